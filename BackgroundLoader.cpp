@@ -0,0 +1,131 @@
+#include "BackgroundLoader.h"
+
+#include <QOpenGLBuffer>
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <new>
+
+#include "ThreadPool.h"
+
+/*! Time the loader thread sleeps while the event queue is full. */
+static const std::chrono::milliseconds LOADER_QUEUE_FULL_WAIT(2);
+
+
+BackgroundLoader::~BackgroundLoader() {
+    cancel();
+}
+
+
+void BackgroundLoader::start(LoadFunction loadFunction) {
+    cancel();
+    m_state = Running;
+    m_stage = "";
+    m_progress = 0;
+    m_thread = std::thread([this, loadFunction]() {
+        ThreadPool pool(m_threadCount);
+        m_pool = &pool;
+        try {
+            loadFunction(*this);
+        }
+        catch (const char * msg) {
+            postFailed(msg);
+        }
+        catch (const std::bad_alloc &) {
+            // e.g. resizing the vertex or index arrays for a huge or corrupt file
+            postFailed("ERROR::LOADER::OUT_OF_MEMORY");
+        }
+        catch (const std::exception & e) {
+            // what() does not survive the handler, the message is kept until the next start()
+            m_errorMessage = std::string("ERROR::LOADER::") + e.what();
+            postFailed(m_errorMessage.c_str());
+        }
+        catch (...) {
+            postFailed("ERROR::LOADER::UNKNOWN_EXCEPTION");
+        }
+        m_pool = nullptr;
+    });
+}
+
+
+void BackgroundLoader::cancel() {
+    if (m_thread.joinable()) {
+        m_cancel = true;
+        m_thread.join();
+    }
+    m_cancel = false;
+    m_events.clear();
+    if (m_state == Running)
+        m_state = Idle;
+}
+
+
+bool BackgroundLoader::takeEvent(LoadEvent & e) {
+    if (!m_events.pop(e))
+        return false;
+    m_stage = e.m_stage;
+    m_progress = e.m_progress;
+    if (e.m_type == LoadEvent::Finished)
+        m_state = Finished;
+    else if (e.m_type == LoadEvent::Failed)
+        m_state = Failed;
+    return true;
+}
+
+
+QString BackgroundLoader::statusText() const {
+    switch (m_state) {
+        case Idle		: return QString();
+        case Running	:
+            if (m_progress > 0)
+                return QString("Loading: %1 (%2 %)").arg(m_stage).arg(int(m_progress*100));
+            return QString("Loading: %1").arg(m_stage);
+        case Finished	: return QString("Loading finished");
+        case Failed		: return QString("Loading failed: %1").arg(m_stage);
+    }
+    return QString();
+}
+
+
+bool BackgroundLoader::post(const LoadEvent & e) {
+    while (!m_events.push(e)) {
+        // the GUI thread does not take events yet (e.g. window not shown), progress is simply dropped
+        if (e.m_type == LoadEvent::Progress)
+            return !cancelRequested();
+        if (cancelRequested())
+            return false;
+        std::this_thread::sleep_for(LOADER_QUEUE_FULL_WAIT);
+    }
+    if (m_notify)
+        m_notify();
+    return !cancelRequested();
+}
+
+
+void BackgroundLoader::postFailed(const char * msg) {
+    LoadEvent e;
+    e.m_type = LoadEvent::Failed;
+    e.m_stage = msg;
+    post(e);
+}
+
+
+bool BackgroundLoader::postProgress(const char * stage, float progress) {
+    LoadEvent e;
+    e.m_stage = stage;
+    e.m_progress = progress;
+    return post(e);
+}
+
+
+void uploadBufferRange(QOpenGLBuffer & buffer, const void * data, std::size_t itemSize, std::size_t & uploaded,
+                       std::size_t ready, std::size_t & budgetBytes)
+{
+    if (ready <= uploaded || budgetBytes < itemSize)
+        return;
+    const std::size_t count = std::min(ready - uploaded, budgetBytes/itemSize);
+    buffer.write(int(uploaded*itemSize), static_cast<const char *>(data) + uploaded*itemSize, int(count*itemSize));
+    uploaded += count;
+    budgetBytes -= count*itemSize;
+}
@@ -0,0 +1,143 @@
+#ifndef BACKGROUNDLOADER_H
+#define BACKGROUNDLOADER_H
+
+#include <QString>
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include "SpscQueue.h"
+
+QT_BEGIN_NAMESPACE
+class QOpenGLBuffer;
+QT_END_NAMESPACE
+
+class ThreadPool;
+
+/*! A message from the loader thread to the GUI thread. */
+struct LoadEvent {
+    enum Type {
+        /*! The data sizes are known (m_vertexCount, m_elementCount), the GPU buffers can be allocated. */
+        Allocate,
+        /*! Vertexes [0, m_vertexCount) are complete and can be uploaded. */
+        Vertexes,
+        /*! Elements [0, m_elementCount) are complete and can be uploaded. */
+        Elements,
+        /*! Only m_stage or m_progress changed. */
+        Progress,
+        /*! All data and the search structures are complete, must be the last event. */
+        Finished,
+        /*! Loading failed, m_stage holds the error message. */
+        Failed
+    };
+
+    Type			m_type = Progress;
+    std::size_t		m_vertexCount = 0;
+    std::size_t		m_elementCount = 0;
+    /*! Description of the current stage, or error message (string literal, or kept by the BackgroundLoader until
+        the next start()).
+    */
+    const char		*m_stage = "";
+    /*! Progress of the current stage, 0..1. */
+    float			m_progress = 0;
+};
+
+
+/*! Runs a load function (parsing a file, building search structures) on a background thread, so that the GUI
+    stays responsive and can show the data as it arrives.
+
+    The load function reports progress and finished parts of the data with post(), the events are passed to the
+    GUI thread through a lock-free queue (SpscQueue) and taken with takeEvent(), e.g. in paintGL(). The data
+    itself is not copied: the load function writes into pre-sized arrays of the object being loaded, an event
+    tells the GUI thread which part of these arrays is complete and must not be changed anymore. After each event,
+    m_notify is called from the loader thread, e.g. to schedule a repaint of the view.
+
+    Exceptions of type const char * (as thrown by the loaders), std::exception (e.g. std::bad_alloc for a huge
+    or corrupt file) and any other exception are caught and reported with a Failed event.
+    Cancellation is cooperative: cancel() sets a flag that post() and cancelRequested() report, the load function
+    should return as soon as possible then.
+
+    The load function runs its parallel work (parsing, building search structures) on pool(), a thread pool of
+    its own: runs of the global thread pool are serialized, a long load there would block the picks of the GUI
+    thread.
+*/
+class BackgroundLoader {
+public:
+    /*! State of the load, as seen by the GUI thread (updated by takeEvent()). */
+    enum State {
+        Idle,
+        Running,
+        Finished,
+        Failed
+    };
+
+    typedef std::function<void(BackgroundLoader & loader)> LoadFunction;
+
+    /*! Cancels a running load. */
+    ~BackgroundLoader();
+
+    /*! GUI thread: starts loadFunction on the loader thread, a running load is cancelled first. */
+    void start(LoadFunction loadFunction);
+    /*! GUI thread: cancels a running load, waits for the loader thread and discards all events not yet taken. */
+    void cancel();
+
+    /*! GUI thread: takes the next event from the queue, returns false if there is none. Updates state(),
+        stage() and progress().
+    */
+    bool takeEvent(LoadEvent & e);
+
+    State state() const { return m_state; }
+    /*! Stage and progress of the last event taken. */
+    const char * stage() const { return m_stage; }
+    float progress() const { return m_progress; }
+    /*! Text describing state, current stage and progress (or the error message), e.g. for a status label. */
+    QString statusText() const;
+
+    /*! Loader thread: posts an event to the GUI thread and calls m_notify. Waits while the queue is full
+        (progress events are dropped instead). Returns false if the load was cancelled.
+    */
+    bool post(const LoadEvent & e);
+    /*! Loader thread: posts a Progress event. */
+    bool postProgress(const char * stage, float progress);
+    /*! Loader thread: true if cancel() was called. */
+    bool cancelRequested() const { return m_cancel.load(std::memory_order_relaxed); }
+    /*! Loader thread: the thread pool of the running load (created by start(), deleted when the load returns). */
+    ThreadPool & pool() const { return *m_pool; }
+
+    /*! Called from the loader thread after each posted event, must be thread-save (e.g. queue a repaint). */
+    std::function<void()>				m_notify;
+    /*! Max. number of bytes uploaded to the GPU per frame, so that rendering stays interactive while a large
+        file arrives (see uploadBufferRange()).
+    */
+    std::size_t							m_uploadBytesPerFrame = 32 << 20;
+    /*! Number of threads of pool() (including the loader thread), 0 = number of hardware threads. */
+    unsigned int						m_threadCount = 0;
+
+private:
+    /*! Loader thread: posts a Failed event with the error message msg. */
+    void postFailed(const char * msg);
+
+    std::thread							m_thread;
+    ThreadPool							*m_pool = nullptr;
+    std::atomic<bool>					m_cancel{false};
+    SpscQueue<LoadEvent, 256>			m_events;
+    /*! Message of a std::exception thrown by the load function, referenced by the Failed event. */
+    std::string							m_errorMessage;
+
+    State								m_state = Idle;
+    const char							*m_stage = "";
+    float								m_progress = 0;
+};
+
+
+/*! Uploads the items [uploaded, ready) of data (itemSize bytes each) into buffer (which must be bound and
+    large enough), but at most budgetBytes bytes. Updates uploaded and budgetBytes, used for the incremental
+    upload of data arriving from a BackgroundLoader.
+*/
+void uploadBufferRange(QOpenGLBuffer & buffer, const void * data, std::size_t itemSize, std::size_t & uploaded,
+                       std::size_t ready, std::size_t & budgetBytes);
+
+#endif // BACKGROUNDLOADER_H
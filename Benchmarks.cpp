@@ -0,0 +1,729 @@
+#include "Benchmarks.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QString>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "BoxMesh.h"
+#include "BoxSet.h"
+#include "MeshBVH.h"
+#include "ObjParser.h"
+#include "PickObject.h"
+#include "PointGrid.h"
+#include "PointKDTree.h"
+#include "RayPacketKernels.h"
+#include "RayTriangleKernels.h"
+#include "SimdSupport.h"
+#include "ThreadPool.h"
+#include "Transform3d.h"
+
+/*! Number of repetitions per measurement, the fastest run is reported. */
+static const int BENCHMARK_REPEATS = 3;
+
+
+/*! Runs prepare() and run() repeats times and returns the time of the fastest run() in ms. prepare() (e.g. resetting
+    the results) is not timed.
+*/
+template <typename Prepare, typename Run>
+static double bestOf(int repeats, Prepare prepare, Run run) {
+    double bestMs = 0;
+    for (int rep=0; rep<repeats; ++rep) {
+        prepare();
+        QElapsedTimer timer;
+        timer.start();
+        run();
+        double ms = timer.nsecsElapsed()*1e-6;
+        if (rep == 0 || ms < bestMs)
+            bestMs = ms;
+    }
+    return bestMs;
+}
+
+/*! Returns the time of the fastest of repeats runs of run() in ms. */
+template <typename Run>
+static double bestOf(int repeats, Run run) {
+    return bestOf(repeats, [] {}, run);
+}
+
+
+/*! Runs measure(threads) (returns the time in ms, see bestOf()) with 1, 2, 4, ... up to maxThreads threads and reports
+    time and speedup over 1 thread per thread count, followed by details(ms) (e.g. the throughput). Then matches()
+    compares the results of the last run with the reference result, a mismatch is reported as well.
+*/
+template <typename Measure, typename Matches, typename Details>
+static void sweepThreads(const QString & label, unsigned int maxThreads, Measure measure, Matches matches,
+                         Details details, const char * reference)
+{
+    double serialMs = 0;
+    for (unsigned int threads = 1; ; threads *= 2) {
+        if (threads > maxThreads)
+            threads = maxThreads;
+        const double ms = measure(threads);
+        if (threads == 1)
+            serialMs = ms;
+        const bool identical = matches();
+        qDebug().nospace().noquote() << "  " << label << threads << " thread(s): " << ms << " ms, speedup = "
+                                     << serialMs/ms << details(ms)
+                                     << (identical ? "" : "  MISMATCH with ") << (identical ? "" : reference);
+        if (threads == maxThreads)
+            break;
+    }
+}
+
+
+void benchmarkObjParsing(const char * filename) {
+    QFile in_file(filename);
+    if (!in_file.open(QIODevice::ReadOnly) || in_file.size() == 0) {
+        qWarning() << "Cannot open OBJ file" << filename;
+        return;
+    }
+    uchar * mappedData = in_file.map(0, in_file.size());
+    if (mappedData == nullptr) {
+        qWarning() << "Cannot map OBJ file" << filename;
+        return;
+    }
+    const char * begin = reinterpret_cast<const char *>(mappedData);
+    const char * end = begin + in_file.size();
+
+    ThreadPool & pool = ThreadPool::globalInstance();
+
+    // serial reference result
+    std::vector<glm::vec3> refPositions;
+    std::vector<int> refIndices;
+    if (!parseObjText(begin, end, pool, 1, refPositions, refIndices)) {
+        qWarning() << "Malformed OBJ file" << filename;
+        in_file.unmap(mappedData);
+        return;
+    }
+    qDebug().nospace() << "OBJ parse benchmark: " << filename << " (" << in_file.size()/(1024.0*1024.0) << " MByte, "
+                       << refPositions.size() << " vertexes, " << refIndices.size()/3 << " triangles)";
+
+    const double megabytes = in_file.size()/(1024.0*1024.0);
+    std::vector<glm::vec3> positions;
+    std::vector<int> indices;
+    sweepThreads("", pool.threadCount(),
+        [&](unsigned int threads) {
+            // the output arrays are allocated by each parse
+            return bestOf(BENCHMARK_REPEATS, [&] { positions = std::vector<glm::vec3>(); indices = std::vector<int>(); },
+                          [&] { parseObjText(begin, end, pool, threads, positions, indices); });
+        },
+        [&] {
+            return positions.size() == refPositions.size() && indices.size() == refIndices.size() &&
+                std::memcmp(positions.data(), refPositions.data(), positions.size()*sizeof(glm::vec3)) == 0 &&
+                std::memcmp(indices.data(), refIndices.data(), indices.size()*sizeof(int)) == 0;
+        },
+        [&](double ms) { return ", " + QString::number(megabytes/(ms*1e-3)) + " MByte/s"; },
+        "serial result!");
+    in_file.unmap(mappedData);
+}
+
+
+void benchmarkBoxBufferGeneration(std::size_t boxCount) {
+    ThreadPool & pool = ThreadPool::globalInstance();
+
+    // random box centers, fixed seed for reproducible results
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> coord(-1000.f, 1000.f);
+    std::vector<glm::vec3> positions(boxCount);
+    for (glm::vec3 & p : positions)
+        p = glm::vec3(coord(rng), coord(rng), coord(rng));
+
+    BoxSet boxes;
+    boxes.resize(boxCount);
+    for (std::size_t i=0; i<boxCount; ++i)
+        boxes.setBox((unsigned int)i, positions[i], glm::vec3(0.5f, 0.5f, 0.5f));
+
+    // serial reference result
+    std::vector<Vertex> refVertexes(boxCount*BoxMesh::VertexCount);
+    std::vector<GLuint> refElements(boxCount*BoxMesh::IndexCount);
+    boxes.copy2Buffer(refVertexes.data(), refElements.data(), pool, 1);
+    qDebug().nospace() << "Box buffer generation benchmark: " << boxCount << " boxes, "
+                       << (refVertexes.size()*sizeof(Vertex) + refElements.size()*sizeof(GLuint))/(1024.0*1024.0) << " MByte";
+
+    // buffers are allocated (and touched) once, only generation is timed
+    std::vector<Vertex> vertexes(refVertexes.size());
+    std::vector<GLuint> elements(refElements.size());
+    sweepThreads("", pool.threadCount(),
+        [&](unsigned int threads) {
+            return bestOf(BENCHMARK_REPEATS, [&] { boxes.copy2Buffer(vertexes.data(), elements.data(), pool, threads); });
+        },
+        [&] {
+            return std::memcmp(vertexes.data(), refVertexes.data(), vertexes.size()*sizeof(Vertex)) == 0 &&
+                std::memcmp(elements.data(), refElements.data(), elements.size()*sizeof(GLuint)) == 0;
+        },
+        [&](double ms) { return ", " + QString::number(boxCount/(ms*1e-3)*1e-6) + " MBoxes/s"; },
+        "serial result!");
+}
+
+
+void benchmarkBoxPicking(std::size_t boxCount) {
+    const unsigned int RAY_COUNT = 64;
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> coord(-1000.f, 1000.f);
+    BoxSet boxes;
+    boxes.resize(boxCount);
+    for (std::size_t i=0; i<boxCount; ++i)
+        boxes.setBox((unsigned int)i, glm::vec3(coord(rng), coord(rng), coord(rng)), glm::vec3(5.f, 5.f, 5.f));
+
+    // rays from outside the box cloud through random points inside
+    std::vector<QVector3D> rayStart(RAY_COUNT), rayDir(RAY_COUNT);
+    for (unsigned int r=0; r<RAY_COUNT; ++r) {
+        rayStart[r] = QVector3D(coord(rng), coord(rng), -3000.f);
+        rayDir[r] = 2.f*(QVector3D(coord(rng)*0.1f, coord(rng)*0.1f, coord(rng)*0.1f) - rayStart[r]);
+    }
+    qDebug().nospace() << "Box picking benchmark: " << boxCount << " boxes, " << RAY_COUNT << " rays";
+
+    // reference: BoxMesh with six rectangle tests per box
+    std::size_t meshCount = std::min<std::size_t>(boxCount, 100000);
+    std::vector<BoxMesh> meshes;
+    meshes.reserve(meshCount);
+    std::vector<Vertex> vertexBuffer(BoxMesh::VertexCount);
+    std::vector<GLuint> elementBuffer(BoxMesh::IndexCount);
+    for (std::size_t i=0; i<meshCount; ++i) {
+        BoxMesh b(10, 10, 10);
+        Transform3D trans;
+        trans.setTranslation(boxes.m_centerX[i], boxes.m_centerY[i], boxes.m_centerZ[i]);
+        b.transform(trans.toMatrix());
+        Vertex * vb = vertexBuffer.data();
+        GLuint * eb = elementBuffer.data();
+        unsigned int startIndex = 0;
+        b.copy2Buffer(vb, eb, startIndex); // also computes plane info
+        meshes.push_back(b);
+    }
+    QElapsedTimer timer;
+    timer.start();
+    for (unsigned int r=0; r<RAY_COUNT; ++r) {
+        PickObject po(2.f, std::numeric_limits<unsigned int>::max());
+        for (std::size_t i=0; i<meshCount; ++i)
+            for (unsigned int j=0; j<6; ++j) {
+                float dist;
+                if (meshes[i].intersects(j, rayStart[r], rayDir[r], dist) && dist < po.m_dist) {
+                    po.m_dist = dist;
+                    po.m_objectId = (unsigned int)i;
+                    po.m_faceId = j;
+                }
+            }
+    }
+    const double meshNsPerBox = timer.nsecsElapsed()/double(RAY_COUNT*meshCount);
+    qDebug().nospace() << "  BoxMesh::intersects(): " << meshNsPerBox << " ns/box";
+
+    // slab test kernels
+    const SimdLevel previousLevel = simdLevel();
+    std::vector<PickObject> reference, results;
+    auto resetResults = [&] { results.assign(RAY_COUNT, PickObject(2.f, std::numeric_limits<unsigned int>::max())); };
+    auto matchesReference = [&] {
+        bool identical = true;
+        for (unsigned int r=0; r<RAY_COUNT; ++r)
+            identical = identical && results[r].m_objectId == reference[r].m_objectId &&
+                    results[r].m_faceId == reference[r].m_faceId && results[r].m_dist == reference[r].m_dist;
+        return identical;
+    };
+    for (int level = SIMD_SCALAR; level <= cpuSimdLevel(); ++level) {
+        setSimdLevel(SimdLevel(level));
+        const double bestMs = bestOf(BENCHMARK_REPEATS, resetResults, [&] {
+            for (unsigned int r=0; r<RAY_COUNT; ++r)
+                boxes.pick(rayStart[r], rayDir[r], results[r]);
+        });
+        if (level == SIMD_SCALAR)
+            reference = results;
+        const bool identical = matchesReference();
+        const double nsPerBox = bestMs*1e6/double(RAY_COUNT*boxCount);
+        qDebug().nospace() << "  " << simdLevelName(SimdLevel(level)) << " slab test: " << nsPerBox << " ns/box, speedup = "
+                           << meshNsPerBox/nsPerBox << (identical ? "" : "  MISMATCH with scalar result!");
+    }
+    setSimdLevel(previousLevel);
+
+    // parallel pick with the current SIMD level, the box range is split into one block per thread
+    ThreadPool & pool = ThreadPool::globalInstance();
+    sweepThreads("parallel pick, ", pool.threadCount(),
+        [&](unsigned int threads) {
+            return bestOf(BENCHMARK_REPEATS, resetResults, [&] {
+                for (unsigned int r=0; r<RAY_COUNT; ++r)
+                    boxes.pick(rayStart[r], rayDir[r], results[r], pool, threads);
+            });
+        },
+        matchesReference,
+        [&](double ms) { return ", " + QString::number(ms*1e3/RAY_COUNT) + " us/pick"; },
+        "scalar result!");
+}
+
+
+/*! Reads positions and triangles (0-based indexes) of an OBJ file, returns false and reports the error if this fails. */
+static bool readObjTriangles(const char * filename, ThreadPool & pool, std::vector<glm::vec3> & positions,
+                             std::vector<unsigned int> & indices)
+{
+    QFile in_file(filename);
+    if (!in_file.open(QIODevice::ReadOnly) || in_file.size() == 0) {
+        qWarning() << "Cannot open OBJ file" << filename;
+        return false;
+    }
+    uchar * mappedData = in_file.map(0, in_file.size());
+    if (mappedData == nullptr) {
+        qWarning() << "Cannot map OBJ file" << filename;
+        return false;
+    }
+    const char * begin = reinterpret_cast<const char *>(mappedData);
+    std::vector<int> objIndices;
+    bool success = parseObjText(begin, begin + in_file.size(), pool, 0, positions, objIndices);
+    in_file.unmap(mappedData);
+    if (!success) {
+        qWarning() << "Malformed OBJ file" << filename;
+        return false;
+    }
+    indices.resize(objIndices.size());
+    for (std::size_t i=0; i<objIndices.size(); ++i) {
+        if (objIndices[i] < 1 || std::size_t(objIndices[i]) > positions.size()) {
+            qWarning() << "Face index out of range in OBJ file" << filename;
+            return false;
+        }
+        indices[i] = (unsigned int)objIndices[i] - 1;
+    }
+    return true;
+}
+
+
+void benchmarkBvhPicking(const char * filename) {
+    const unsigned int RAY_COUNT = 10000;
+    const unsigned int BRUTE_FORCE_RAY_COUNT = 100;
+
+    ThreadPool & pool = ThreadPool::globalInstance();
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned int> indices;
+    if (!readObjTriangles(filename, pool, positions, indices))
+        return;
+    const std::size_t triangleCount = indices.size()/3;
+    qDebug().nospace() << "BVH picking benchmark: " << filename << " (" << triangleCount << " triangles, "
+                       << RAY_COUNT << " rays)";
+
+    MeshBVH bvh;
+    double bestMs = bestOf(BENCHMARK_REPEATS, [&] {
+        bvh.build(positions.data(), indices.data(), sizeof(unsigned int), triangleCount, pool);
+    });
+    qDebug().nospace() << "  build with " << pool.threadCount() << " thread(s): " << bestMs << " ms, "
+                       << bvh.m_nodes.size() << " nodes";
+    if (bvh.empty())
+        return;
+
+    // rays from random points on a sphere around the mesh through random points inside the bounding box
+    const MeshBVH::Node & root = bvh.m_nodes[0];
+    const glm::vec3 boxMin(root.m_min[0], root.m_min[1], root.m_min[2]);
+    const glm::vec3 boxMax(root.m_max[0], root.m_max[1], root.m_max[2]);
+    const glm::vec3 center = (boxMin + boxMax)*0.5f;
+    const float radius = glm::length(boxMax - boxMin);
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    std::normal_distribution<float> normal;
+    std::vector<glm::vec3> rayStart(RAY_COUNT), rayDir(RAY_COUNT);
+    for (unsigned int r=0; r<RAY_COUNT; ++r) {
+        glm::vec3 s(normal(rng), normal(rng), normal(rng));
+        rayStart[r] = center + glm::normalize(s)*radius;
+        glm::vec3 target = boxMin + glm::vec3(unit(rng), unit(rng), unit(rng))*(boxMax - boxMin);
+        rayDir[r] = 2.f*(target - rayStart[r]);
+    }
+
+    // brute force: all triangles per ray, with the triangle kernels of all SIMD levels
+    const unsigned int bruteForceRays = std::min(RAY_COUNT, BRUTE_FORCE_RAY_COUNT);
+    const SimdLevel previousLevel = simdLevel();
+    std::vector<RayTriangleHit> bruteForceHits;
+    double scalarNsPerTriangle = 0;
+    for (int level = SIMD_SCALAR; level <= cpuSimdLevel(); ++level) {
+        std::vector<RayTriangleHit> results;
+        bestMs = bestOf(BENCHMARK_REPEATS, [&] { results.assign(bruteForceRays, RayTriangleHit(1.f)); }, [&] {
+            for (unsigned int r=0; r<bruteForceRays; ++r)
+                nearestRayTriangleHit(bvh.m_triangles, 0, triangleCount, rayStart[r], rayDir[r], results[r], SimdLevel(level));
+        });
+        if (level == SIMD_SCALAR)
+            bruteForceHits = results;
+        bool identical = true;
+        for (unsigned int r=0; r<bruteForceRays; ++r)
+            identical = identical && results[r].m_triangle == bruteForceHits[r].m_triangle &&
+                    results[r].m_dist == bruteForceHits[r].m_dist && results[r].m_u == bruteForceHits[r].m_u &&
+                    results[r].m_v == bruteForceHits[r].m_v;
+        const double nsPerTriangle = bestMs*1e6/(double(bruteForceRays)*triangleCount);
+        if (level == SIMD_SCALAR)
+            scalarNsPerTriangle = nsPerTriangle;
+        qDebug().nospace() << "  brute force, " << simdLevelName(SimdLevel(level)) << " triangle test: " << nsPerTriangle
+                           << " ns/triangle, speedup = " << scalarNsPerTriangle/nsPerTriangle
+                           << (identical ? "" : "  MISMATCH with scalar result!");
+    }
+    const double bruteForceNsPerRay = scalarNsPerTriangle*triangleCount;
+
+    // BVH traversal, leaves tested with the triangle kernels of all SIMD levels
+    for (int level = SIMD_SCALAR; level <= cpuSimdLevel(); ++level) {
+        setSimdLevel(SimdLevel(level));
+        std::vector<MeshBVH::Hit> hits;
+        bestMs = bestOf(BENCHMARK_REPEATS, [&] { hits.assign(RAY_COUNT, MeshBVH::Hit(1.f)); }, [&] {
+            for (unsigned int r=0; r<RAY_COUNT; ++r)
+                bvh.nearestHit(rayStart[r], rayDir[r], hits[r]);
+        });
+        const double bvhNsPerRay = bestMs*1e6/RAY_COUNT;
+        unsigned int hitCount = 0;
+        for (const MeshBVH::Hit & h : hits)
+            if (h.m_triangle != ~0u)
+                ++hitCount;
+        // several triangles may be hit at the same distance (shared edges), so only distances are compared
+        unsigned int mismatches = 0;
+        for (unsigned int r=0; r<bruteForceRays; ++r)
+            if (hits[r].m_dist != bruteForceHits[r].m_dist)
+                ++mismatches;
+        qDebug().nospace() << "  BVH, " << simdLevelName(SimdLevel(level)) << " leaves: " << bvhNsPerRay
+                           << " ns/ray, speedup = " << bruteForceNsPerRay/bvhNsPerRay << " (vs. scalar brute force), "
+                           << hitCount << " of " << RAY_COUNT << " rays hit"
+                           << (mismatches == 0 ? "" : "  MISMATCH with brute force result!");
+    }
+    setSimdLevel(previousLevel);
+}
+
+
+void benchmarkBatchPicking(const char * filename) {
+    const unsigned int IMAGE_WIDTH = 1024;
+    const unsigned int IMAGE_HEIGHT = 768;
+    // pixel tile traced as one packet
+    const unsigned int TILE_WIDTH = 4;
+    const unsigned int TILE_HEIGHT = RAY_PACKET_SIZE/TILE_WIDTH;
+
+    ThreadPool & pool = ThreadPool::globalInstance();
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned int> indices;
+    if (!readObjTriangles(filename, pool, positions, indices))
+        return;
+    const std::size_t triangleCount = indices.size()/3;
+    MeshBVH bvh;
+    bvh.build(positions.data(), indices.data(), sizeof(unsigned int), triangleCount, pool);
+    if (bvh.empty())
+        return;
+
+    // one ray per pixel of a camera in front of the mesh, looking at its center, rays ordered by pixel tiles
+    const MeshBVH::Node & root = bvh.m_nodes[0];
+    const glm::vec3 boxMin(root.m_min[0], root.m_min[1], root.m_min[2]);
+    const glm::vec3 boxMax(root.m_max[0], root.m_max[1], root.m_max[2]);
+    const glm::vec3 center = (boxMin + boxMax)*0.5f;
+    const float radius = 0.5f*glm::length(boxMax - boxMin);
+    const glm::vec3 eye = center + glm::vec3(0.f, 0.5f, 2.f)*radius;
+    const glm::vec3 forward = glm::normalize(center - eye);
+    const glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.f, 1.f, 0.f)));
+    const glm::vec3 up = glm::cross(right, forward);
+    const float halfHeight = std::tan(glm::radians(30.f)); // 60 degrees vertical angle
+    const float halfWidth = halfHeight*IMAGE_WIDTH/IMAGE_HEIGHT;
+    std::vector<MeshBVH::Ray> rays;
+    rays.reserve(IMAGE_WIDTH*IMAGE_HEIGHT);
+    for (unsigned int ty=0; ty<IMAGE_HEIGHT; ty += TILE_HEIGHT)
+        for (unsigned int tx=0; tx<IMAGE_WIDTH; tx += TILE_WIDTH)
+            for (unsigned int y=ty; y<ty + TILE_HEIGHT; ++y)
+                for (unsigned int x=tx; x<tx + TILE_WIDTH; ++x) {
+                    const float px = (2.f*(x + 0.5f)/IMAGE_WIDTH - 1)*halfWidth;
+                    const float py = (1 - 2.f*(y + 0.5f)/IMAGE_HEIGHT)*halfHeight;
+                    MeshBVH::Ray ray;
+                    ray.m_origin = eye;
+                    ray.m_dir = (forward + px*right + py*up)*(4.f*radius);
+                    rays.push_back(ray);
+                }
+    const std::size_t rayCount = rays.size();
+    qDebug().nospace() << "Batch picking benchmark: " << filename << " (" << triangleCount << " triangles, "
+                       << IMAGE_WIDTH << "x" << IMAGE_HEIGHT << " rays in " << TILE_WIDTH << "x" << TILE_HEIGHT
+                       << " tiles)";
+
+    // reference: one ray after the other
+    std::vector<MeshBVH::Hit> refHits;
+    const double singleMs = bestOf(BENCHMARK_REPEATS, [&] { refHits.assign(rayCount, MeshBVH::Hit(1.f)); }, [&] {
+        for (std::size_t r=0; r<rayCount; ++r)
+            bvh.nearestHit(rays[r].m_origin, rays[r].m_dir, refHits[r]);
+    });
+    const double singleMraysPerSec = rayCount*1e-3/singleMs;
+    unsigned int hitCount = 0;
+    for (const MeshBVH::Hit & h : refHits)
+        if (h.m_triangle != ~0u)
+            ++hitCount;
+    qDebug().nospace() << "  single rays, " << simdLevelName(simdLevel()) << " leaves, 1 thread: "
+                       << singleMraysPerSec << " Mrays/s, " << hitCount << " of " << rayCount << " rays hit";
+
+    // several triangles may be hit at the same distance (shared edges), so only distances are compared
+    std::vector<MeshBVH::Hit> hits;
+    auto resetHits = [&] { hits.assign(rayCount, MeshBVH::Hit(1.f)); };
+    auto matchesSingleRays = [&] {
+        for (std::size_t r=0; r<rayCount; ++r)
+            if (hits[r].m_dist != refHits[r].m_dist)
+                return false;
+        return true;
+    };
+
+    // packets with the kernels of all SIMD levels, single thread
+    const SimdLevel previousLevel = simdLevel();
+    for (int level = SIMD_SCALAR; level <= cpuSimdLevel(); ++level) {
+        setSimdLevel(SimdLevel(level));
+        const double bestMs = bestOf(BENCHMARK_REPEATS, resetHits, [&] {
+            bvh.nearestHits(rays.data(), rayCount, hits.data(), pool, 1);
+        });
+        const double mraysPerSec = rayCount*1e-3/bestMs;
+        qDebug().nospace() << "  packets, " << simdLevelName(SimdLevel(level)) << ", 1 thread: " << mraysPerSec
+                           << " Mrays/s, speedup = " << mraysPerSec/singleMraysPerSec << " (vs. single rays)"
+                           << (matchesSingleRays() ? "" : "  MISMATCH with single ray result!");
+    }
+    setSimdLevel(previousLevel);
+
+    // packets distributed on the threads
+    sweepThreads(QString("packets, ") + simdLevelName(simdLevel()) + ", ", pool.threadCount(),
+        [&](unsigned int threads) {
+            return bestOf(BENCHMARK_REPEATS, resetHits, [&] {
+                // several blocks per thread for load balancing, as with the default block count
+                bvh.nearestHits(rays.data(), rayCount, hits.data(), pool, threads == 1 ? 1 : 8*threads);
+            });
+        },
+        matchesSingleRays,
+        [&](double ms) { return ", " + QString::number(rayCount*1e-3/ms) + " Mrays/s"; },
+        "single ray result!");
+}
+
+
+void benchmarkBvhRefit(const char * filename) {
+    const unsigned int RAY_COUNT = 10000;
+
+    ThreadPool & pool = ThreadPool::globalInstance();
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned int> indices;
+    if (!readObjTriangles(filename, pool, positions, indices))
+        return;
+    const std::size_t triangleCount = indices.size()/3;
+    qDebug().nospace() << "BVH refit benchmark: " << filename << " (" << triangleCount << " triangles, "
+                       << positions.size() << " vertexes)";
+
+    MeshBVH bvh;
+    bvh.build(positions.data(), indices.data(), sizeof(unsigned int), triangleCount, pool);
+    if (bvh.empty())
+        return;
+    const MeshBVH::Node & root = bvh.m_nodes[0];
+    const glm::vec3 boxMin(root.m_min[0], root.m_min[1], root.m_min[2]);
+    const glm::vec3 boxMax(root.m_max[0], root.m_max[1], root.m_max[2]);
+    const float diagonal = glm::length(boxMax - boxMin);
+
+    // triangles using each vertex
+    std::vector<std::vector<unsigned int> > vertexTriangles(positions.size());
+    for (std::size_t i=0; i<indices.size(); ++i)
+        vertexTriangles[indices[i]].push_back((unsigned int)(i/3));
+
+    // rays from random points on a sphere around the mesh through random points inside the bounding box
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    std::normal_distribution<float> normal;
+    std::vector<glm::vec3> rayStart(RAY_COUNT), rayDir(RAY_COUNT);
+    for (unsigned int r=0; r<RAY_COUNT; ++r) {
+        glm::vec3 s(normal(rng), normal(rng), normal(rng));
+        rayStart[r] = (boxMin + boxMax)*0.5f + glm::normalize(s)*diagonal;
+        glm::vec3 target = boxMin + glm::vec3(unit(rng), unit(rng), unit(rng))*(boxMax - boxMin);
+        rayDir[r] = 2.f*(target - rayStart[r]);
+    }
+    auto pickAll = [&](const MeshBVH & tree, std::vector<MeshBVH::Hit> & hits) {
+        hits.assign(RAY_COUNT, MeshBVH::Hit(1.f));
+        QElapsedTimer timer;
+        timer.start();
+        for (unsigned int r=0; r<RAY_COUNT; ++r)
+            tree.nearestHit(rayStart[r], rayDir[r], hits[r]);
+        return timer.nsecsElapsed()*1e-3/RAY_COUNT;
+    };
+
+    // move a growing share of the vertexes by up to 1% of the mesh size, refit and compare with a rebuilt tree
+    std::uniform_int_distribution<std::size_t> vertexIndex(0, positions.size() - 1);
+    std::uniform_real_distribution<float> offset(-0.01f*diagonal, 0.01f*diagonal);
+    for (double share : {0.0001, 0.001, 0.01, 0.1, 0.5}) {
+        const std::size_t moveCount = std::max<std::size_t>(1, std::size_t(share*positions.size()));
+        std::vector<unsigned int> triangles;
+        for (std::size_t i=0; i<moveCount; ++i) {
+            const std::size_t v = vertexIndex(rng);
+            positions[v] += glm::vec3(offset(rng), offset(rng), offset(rng));
+            triangles.insert(triangles.end(), vertexTriangles[v].begin(), vertexTriangles[v].end());
+        }
+        std::sort(triangles.begin(), triangles.end());
+        triangles.erase(std::unique(triangles.begin(), triangles.end()), triangles.end());
+
+        QElapsedTimer timer;
+        timer.start();
+        bvh.refit(positions.data(), indices.data(), sizeof(unsigned int), triangles.data(), triangles.size(), pool);
+        const double refitMs = timer.nsecsElapsed()*1e-6;
+        MeshBVH rebuilt;
+        timer.start();
+        rebuilt.build(positions.data(), indices.data(), sizeof(unsigned int), triangleCount, pool);
+        const double buildMs = timer.nsecsElapsed()*1e-6;
+
+        std::vector<MeshBVH::Hit> refitHits, rebuiltHits;
+        const double refitUsPerRay = pickAll(bvh, refitHits);
+        const double rebuiltUsPerRay = pickAll(rebuilt, rebuiltHits);
+        // several triangles may be hit at the same distance (shared edges), so only distances are compared
+        unsigned int mismatches = 0;
+        for (unsigned int r=0; r<RAY_COUNT; ++r)
+            if (refitHits[r].m_dist != rebuiltHits[r].m_dist)
+                ++mismatches;
+        qDebug().nospace() << "  " << moveCount << " vertexes moved (" << triangles.size() << " triangles): refit "
+                           << refitMs << " ms, rebuild " << buildMs << " ms, cost ratio " << bvh.costRatio()
+                           << " (rebuilt " << rebuilt.cost()/bvh.cost()*bvh.costRatio() << "), pick "
+                           << refitUsPerRay << " us/ray (rebuilt " << rebuiltUsPerRay << " us/ray)"
+                           << (mismatches == 0 ? "" : "  MISMATCH with rebuilt tree!");
+    }
+}
+
+
+void benchmarkPointPicking(std::size_t pointCount) {
+    const unsigned int RAY_COUNT = 1000;
+    const unsigned int BRUTE_FORCE_RAY_COUNT = 20;
+    const float RADIUS = 10;
+
+    // points on a sphere (a closed surface like a scanned object), rays from outside through random points inside
+    std::mt19937 rng(42);
+    std::normal_distribution<float> normal;
+    std::uniform_real_distribution<float> coord(-RADIUS, RADIUS);
+    std::vector<glm::vec3> positions(pointCount);
+    for (glm::vec3 & p : positions)
+        p = glm::normalize(glm::vec3(normal(rng), normal(rng), normal(rng)))*RADIUS;
+    std::vector<glm::vec3> rayStart(RAY_COUNT), rayDir(RAY_COUNT);
+    for (unsigned int r=0; r<RAY_COUNT; ++r) {
+        rayStart[r] = glm::vec3(coord(rng), coord(rng), 3*RADIUS);
+        rayDir[r] = 2.f*(glm::vec3(coord(rng), coord(rng), coord(rng))*0.5f - rayStart[r]);
+    }
+    // tolerance of a 5 pixel cone, similar to a pick in a 1000 pixel high viewport with 60 degrees vertical angle
+    const float nearTolerance = 0.0003f;
+    const float farTolerance = 0.005f*glm::length(rayDir[0]);
+    qDebug().nospace() << "Point picking benchmark: " << pointCount << " points, " << RAY_COUNT << " rays";
+
+    ThreadPool & pool = ThreadPool::globalInstance();
+    PointGrid grid;
+    double bestMs = bestOf(BENCHMARK_REPEATS, [&] { grid.build(positions.data(), positions.size(), pool); });
+    qDebug().nospace() << "  build with " << pool.threadCount() << " thread(s): " << bestMs << " ms, "
+                       << grid.m_dims[0] << "x" << grid.m_dims[1] << "x" << grid.m_dims[2] << " cells";
+
+    std::vector<PointGrid::Hit> hits;
+    bestMs = bestOf(BENCHMARK_REPEATS, [&] { hits.assign(RAY_COUNT, PointGrid::Hit(2.f)); }, [&] {
+        for (unsigned int r=0; r<RAY_COUNT; ++r)
+            grid.nearestPoint(rayStart[r], rayDir[r], nearTolerance, farTolerance, hits[r]);
+    });
+    const double gridUsPerPick = bestMs*1e3/RAY_COUNT;
+    unsigned int hitCount = 0;
+    for (const PointGrid::Hit & h : hits)
+        if (h.m_pointId != ~0u)
+            ++hitCount;
+
+    // brute force: all points per ray
+    const unsigned int bruteForceRays = std::min(RAY_COUNT, BRUTE_FORCE_RAY_COUNT);
+    unsigned int mismatches = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for (unsigned int r=0; r<bruteForceRays; ++r) {
+        const glm::vec3 & d = rayDir[r];
+        const float dirLength2 = glm::dot(d, d);
+        float bestT = 2.f;
+        for (const glm::vec3 & pos : positions) {
+            const glm::vec3 p = pos - rayStart[r];
+            const float t = glm::dot(p, d)/dirLength2;
+            if (t < 0 || t > 1 || t >= bestT)
+                continue;
+            const glm::vec3 offset = p - t*d;
+            const float tol = nearTolerance + t*(farTolerance - nearTolerance);
+            if (glm::dot(offset, offset) <= tol*tol)
+                bestT = t;
+        }
+        if (bestT != hits[r].m_dist)
+            ++mismatches;
+    }
+    const double bruteForceUsPerPick = timer.nsecsElapsed()*1e-3/bruteForceRays;
+
+    qDebug().nospace() << "  brute force: " << bruteForceUsPerPick << " us/pick";
+    qDebug().nospace() << "  grid: " << gridUsPerPick << " us/pick, speedup = " << bruteForceUsPerPick/gridUsPerPick
+                       << ", " << hitCount << " of " << RAY_COUNT << " picks hit a point"
+                       << (mismatches == 0 ? "" : "  MISMATCH with brute force result!");
+}
+
+
+void benchmarkNearestNeighbors(std::size_t pointCount) {
+    const unsigned int QUERY_COUNT = 100000;
+    const unsigned int BRUTE_FORCE_QUERY_COUNT = 20;
+    const unsigned int K = 8;
+    const float RADIUS = 10;
+
+    // points on a sphere (a closed surface like a scanned object), queries near the surface
+    std::mt19937 rng(42);
+    std::normal_distribution<float> normal;
+    std::uniform_real_distribution<float> scale(0.999f, 1.001f);
+    std::vector<glm::vec3> positions(pointCount);
+    for (glm::vec3 & p : positions)
+        p = glm::normalize(glm::vec3(normal(rng), normal(rng), normal(rng)))*RADIUS;
+    std::vector<glm::vec3> queries(QUERY_COUNT);
+    for (glm::vec3 & q : queries)
+        q = glm::normalize(glm::vec3(normal(rng), normal(rng), normal(rng)))*(RADIUS*scale(rng));
+    // radius holding about 2*K points on average
+    const float searchRadius = RADIUS*std::sqrt(8.f*K/std::max<std::size_t>(pointCount, 1));
+    qDebug().nospace() << "Nearest neighbor benchmark: " << pointCount << " points, " << QUERY_COUNT << " queries";
+
+    ThreadPool & pool = ThreadPool::globalInstance();
+    PointKDTree tree;
+    auto noReference = [] { return true; };
+    auto noDetails = [](double) { return QString(); };
+    sweepThreads("build with ", pool.threadCount(),
+        [&](unsigned int threads) {
+            // the build uses all threads of its pool
+            ThreadPool buildPool(threads);
+            return bestOf(BENCHMARK_REPEATS, [&] { tree.build(positions.data(), positions.size(), buildPool); });
+        },
+        noReference, noDetails, "");
+
+    // single queries
+    std::vector<PointKDTree::Neighbor> neighbors;
+    for (unsigned int k : {1u, K}) {
+        const double bestMs = bestOf(BENCHMARK_REPEATS, [&] {
+            for (unsigned int q=0; q<QUERY_COUNT; ++q)
+                tree.nearestNeighbors(queries[q], k, neighbors);
+        });
+        qDebug().nospace() << "  " << k << " nearest, 1 thread: " << bestMs*1e3/QUERY_COUNT << " us/query";
+    }
+    std::size_t radiusCount = 0;
+    const double bestMs = bestOf(BENCHMARK_REPEATS, [&] { radiusCount = 0; }, [&] {
+        for (unsigned int q=0; q<QUERY_COUNT; ++q) {
+            tree.radiusSearch(queries[q], searchRadius, neighbors);
+            radiusCount += neighbors.size();
+        }
+    });
+    qDebug().nospace() << "  radius search, 1 thread: " << bestMs*1e3/QUERY_COUNT << " us/query, "
+                       << double(radiusCount)/QUERY_COUNT << " points/query";
+
+    // batch queries distributed on the threads
+    std::vector<PointKDTree::Neighbor> batch(std::size_t(QUERY_COUNT)*K);
+    sweepThreads(QString::number(K) + " nearest, batch with ", pool.threadCount(),
+        [&](unsigned int threads) {
+            return bestOf(BENCHMARK_REPEATS, [&] {
+                // several blocks per thread for load balancing, as with the default block count
+                tree.nearestNeighbors(queries.data(), QUERY_COUNT, K, batch.data(), pool, threads == 1 ? 1 : 8*threads);
+            });
+        },
+        noReference,
+        [&](double ms) { return ", " + QString::number(ms*1e3/QUERY_COUNT) + " us/query"; },
+        "");
+
+    // brute force: all points per query
+    const unsigned int bruteForceQueries = std::min(QUERY_COUNT, BRUTE_FORCE_QUERY_COUNT);
+    unsigned int mismatches = 0;
+    QElapsedTimer timer;
+    timer.start();
+    std::vector<PointKDTree::Neighbor> all(pointCount);
+    for (unsigned int q=0; q<bruteForceQueries; ++q) {
+        for (std::size_t i=0; i<pointCount; ++i) {
+            glm::vec3 d = positions[i] - queries[q];
+            all[i] = PointKDTree::Neighbor(d.x*d.x + d.y*d.y + d.z*d.z, (unsigned int)i);
+        }
+        const std::size_t k = std::min<std::size_t>(K, pointCount);
+        std::partial_sort(all.begin(), all.begin() + k, all.end());
+        // several points may be at the same distance, so only distances are compared
+        for (std::size_t j=0; j<k; ++j)
+            if (batch[q*K + j].m_dist2 != all[j].m_dist2) {
+                ++mismatches;
+                break;
+            }
+    }
+    qDebug().nospace() << "  brute force: " << timer.nsecsElapsed()*1e-3/std::max(bruteForceQueries, 1u)
+                       << " us/query" << (mismatches == 0 ? "" : "  MISMATCH with brute force result!");
+}
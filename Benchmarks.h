@@ -0,0 +1,64 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <cstddef>
+
+/*! Performance benchmarks for the data processing parts of the application (no OpenGL required).
+    They are run from the command line, see main(), and report their results via qDebug().
+*/
+
+/*! Parses the OBJ file with 1, 2, 4, ... up to the number of pool threads and reports
+    parse time and speedup for each thread count. Also verifies that the results are bit-identical
+    to the serial parse.
+*/
+void benchmarkObjParsing(const char * filename);
+
+/*! Generates vertex and element buffers for boxCount randomly placed boxes (as in ObjModel::boxobj()) with 1, 2, 4, ...
+    up to the number of pool threads and reports generation time and speedup. Also verifies that the buffers are
+    identical to the serially generated buffers.
+*/
+void benchmarkBoxBufferGeneration(std::size_t boxCount);
+
+/*! Picks boxCount randomly placed boxes with a number of random rays, using the slab test kernels of all
+    SIMD levels supported by the CPU, and reports the time per box test. For comparison, the per-face test of
+    BoxMesh::intersects() is timed on (up to) the first 100000 boxes. Then the parallel BoxSet::pick() is timed
+    with 1, 2, 4, ... up to the number of pool threads. Results of all kernels and thread counts are verified
+    against the scalar kernel.
+*/
+void benchmarkBoxPicking(std::size_t boxCount);
+
+/*! Builds the triangle BVH (see MeshBVH) for the mesh of the OBJ file and reports the build time, then picks
+    the mesh with random rays through its bounding box and reports the time per ray for all SIMD levels of the
+    triangle kernel (see nearestRayTriangleHit()), compared to testing all triangles. The brute force search is
+    timed per SIMD level as well. Results are verified against the scalar brute force search.
+*/
+void benchmarkBvhPicking(const char * filename);
+
+/*! Builds the triangle BVH for the mesh of the OBJ file and picks it with one ray per pixel of a 1024x768 image
+    (rays ordered by pixel tiles of the packet size) and reports the throughput in Mrays/s: single rays
+    (MeshBVH::nearestHit()), ray packets (MeshBVH::nearestHits()) for all SIMD levels, and ray packets with
+    1, 2, 4, ... up to the number of pool threads. Results are verified against the single ray results.
+*/
+void benchmarkBatchPicking(const char * filename);
+
+/*! Builds the triangle BVH for the mesh of the OBJ file, then moves a growing share of the vertexes (0.01% up to 50%)
+    by random offsets and reports the time of MeshBVH::refit() compared to a rebuild, the cost ratio of the refit
+    tree (see MeshBVH::costRatio()) and the pick time per random ray of both trees. Picks of the refit tree are
+    verified against the rebuilt tree.
+*/
+void benchmarkBvhRefit(const char * filename);
+
+/*! Builds the point grid (see PointGrid) for pointCount random points on a sphere surface and reports the build
+    time, then picks points with random rays and a pick tolerance and reports the time per pick, compared to
+    testing all points. Results are verified against the brute force search.
+*/
+void benchmarkPointPicking(std::size_t pointCount);
+
+/*! Builds the KD-tree (see PointKDTree) for pointCount random points on a sphere surface with 1, 2, 4, ... up to the
+    number of pool threads and reports the build time, then runs nearest neighbor and radius queries near the surface
+    and reports the time per query, single and as batch with 1, 2, 4, ... threads. Results are verified against the
+    brute force search.
+*/
+void benchmarkNearestNeighbors(std::size_t pointCount);
+
+#endif // BENCHMARKS_H
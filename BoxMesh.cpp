@@ -39,66 +39,62 @@ bool BoxMesh::intersects(unsigned int planeIdx, const QVector3D & p1, const QVec
 
 
 void BoxMesh::copy2Buffer(Vertex *& vertexBuffer, GLuint *& elementBuffer, unsigned int & elementStartIndex) const {
-    std::vector<QColor> cols;
     Q_ASSERT(!m_colors.empty());
-    // three ways to store vertex colors
-    if (m_colors.size() == 1) {
-        cols = std::vector<QColor>(6, m_colors[0]);
-    }
-    else {
-        Q_ASSERT(m_colors.size() == 6);
-        cols = m_colors;
-    }
+    // uniform color or face colors, referenced without copying
+    Q_ASSERT(m_colors.size() == 1 || m_colors.size() == 6);
+    const QColor * cols[6];
+    for (unsigned int i=0; i<6; ++i)
+        cols[i] = &m_colors[m_colors.size() == 1 ? 0 : i];
 
     // now we populate the vertex buffer for all planes
 
     // front plane: a, b, c, d, vertexes (0, 1, 2, 3)
     copyPlane2Buffer(vertexBuffer, elementBuffer, elementStartIndex,
-            Vertex(m_vertices[0], cols[0]),
-            Vertex(m_vertices[1], cols[0]),
-            Vertex(m_vertices[2], cols[0]),
-            Vertex(m_vertices[3], cols[0])
+            Vertex(m_vertices[0], *cols[0]),
+            Vertex(m_vertices[1], *cols[0]),
+            Vertex(m_vertices[2], *cols[0]),
+            Vertex(m_vertices[3], *cols[0])
         );
 
     // right plane: b=1, f=5, g=6, c=2, vertexes
     // Mind: colors are numbered up
     copyPlane2Buffer(vertexBuffer, elementBuffer, elementStartIndex,
-            Vertex(m_vertices[1], cols[1]),
-            Vertex(m_vertices[5], cols[1]),
-            Vertex(m_vertices[6], cols[1]),
-            Vertex(m_vertices[2], cols[1])
+            Vertex(m_vertices[1], *cols[1]),
+            Vertex(m_vertices[5], *cols[1]),
+            Vertex(m_vertices[6], *cols[1]),
+            Vertex(m_vertices[2], *cols[1])
         );
 
     // back plane: g=5, e=4, h=7, g=6
     copyPlane2Buffer(vertexBuffer, elementBuffer, elementStartIndex,
-            Vertex(m_vertices[5], cols[2]),
-            Vertex(m_vertices[4], cols[2]),
-            Vertex(m_vertices[7], cols[2]),
-            Vertex(m_vertices[6], cols[2])
+            Vertex(m_vertices[5], *cols[2]),
+            Vertex(m_vertices[4], *cols[2]),
+            Vertex(m_vertices[7], *cols[2]),
+            Vertex(m_vertices[6], *cols[2])
         );
 
     // left plane: 4,0,3,7
     copyPlane2Buffer(vertexBuffer, elementBuffer, elementStartIndex,
-            Vertex(m_vertices[4], cols[3]),
-            Vertex(m_vertices[0], cols[3]),
-            Vertex(m_vertices[3], cols[3]),
-            Vertex(m_vertices[7], cols[3])
+            Vertex(m_vertices[4], *cols[3]),
+            Vertex(m_vertices[0], *cols[3]),
+            Vertex(m_vertices[3], *cols[3]),
+            Vertex(m_vertices[7], *cols[3])
         );
 
     // bottom plane: 4,5,1,0
     copyPlane2Buffer(vertexBuffer, elementBuffer, elementStartIndex,
-            Vertex(m_vertices[4], cols[4]),
-            Vertex(m_vertices[5], cols[4]),
-            Vertex(m_vertices[1], cols[4]),
-            Vertex(m_vertices[0], cols[4])
+            Vertex(m_vertices[4], *cols[4]),
+            Vertex(m_vertices[5], *cols[4]),
+            Vertex(m_vertices[1], *cols[4]),
+            Vertex(m_vertices[0], *cols[4])
         );
 
     // top plane: 3,2,6,7
     copyPlane2Buffer(vertexBuffer, elementBuffer, elementStartIndex,
-            Vertex(m_vertices[3], cols[5]),
-            Vertex(m_vertices[2], cols[5]),
-            Vertex(m_vertices[6], cols[5]),
-            Vertex(m_vertices[7], cols[5])
+            Vertex(m_vertices[3], *cols[5]),
+            Vertex(m_vertices[2], *cols[5]),
+            Vertex(m_vertices[6], *cols[5]),
+            Vertex(m_vertices[7], *cols[5])
         );
 
     // compute all face normals
@@ -1,22 +1,22 @@
 #include "BoxObject.h"
 
 #include <QVector3D>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
 #include <QOpenGLShaderProgram>
 #include <QElapsedTimer>
+#include <QFile>
 
-#include <iostream>
-#include <istream>
-#include <fstream>
-#include <sstream>
+#include <functional>
 
-//pcl
-#include <pcl/io/ply_io.h>
-#include <pcl/io/boost.h>
-#include <pcl/point_types.h>
+#include "PlyReader.h"
+#include "ThreadPool.h"
 
 BoxObject::BoxObject() :
     m_vbo(QOpenGLBuffer::VertexBuffer), // actually the default, so default constructor would have been enough
-    m_ebo(QOpenGLBuffer::IndexBuffer) // make this an Index Buffer
+    m_ebo(QOpenGLBuffer::IndexBuffer), // make this an Index Buffer
+    m_lodEbo(QOpenGLBuffer::IndexBuffer),
+    m_selectionEbo(QOpenGLBuffer::IndexBuffer)
 {
     //create first box
    // BoxMesh b(4,2,3);
@@ -64,178 +64,208 @@ BoxObject::BoxObject() :
    //     b.copy2Buffer(vertexBuffer, elementBuffer, vertexCount);
 }
 
-void BoxObject::loadObj(const char *filename)
+BoxObject::~BoxObject() {
+    m_loader.cancel();
+}
+
+
+/*! Reads the vertex positions of the PLY file into positions, see BoxObject::loadObj().
+    If loader is given, the number of points is posted before decoding (LoadEvent::Allocate), and the number of
+    decoded points after each block (LoadEvent::Vertexes).
+*/
+static void readPlyPositions(const char *filename, std::vector<glm::vec3> & positions, BackgroundLoader * loader)
 {
-    //Vertex portions
-    
-        //std::vector<Vertex> vertex_texcoords;
-        //std::vector<Vertex> vertex_normals;
-
-        //Face vectors
-        
-        //std::vector<GLint> vertex_texcoord_indicies;
-        //std::vector<int> vertex_normal_indicies;
-
-        std::stringstream ss;
-        std::ifstream in_file(filename);
-        std::string line = "";
-        std::string prefix = "";
-        glm::vec3 temp_vec3;
-        int temp_glint[3];
-
-        pcl::PointCloud<pcl::PointXYZ>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZ>);
-        ////pcl::PLYReader Reader;
-        ////Reader.read("C:/Users/firo1/Downloads/frame1.ply", *cloud);
-        if (pcl::io::loadPLYFile<pcl::PointXYZ>(filename, *cloud) == -1)
-        {
-        	PCL_ERROR("Couldn't read file test_pcd.pcd \n");
-        }
+    QElapsedTimer loadTimer;
+    loadTimer.start();
 
-        std::cout << "Loaded " << cloud->width * cloud->height << " data points from test_pcd.pcd with the following fields: " << std::endl;
-        for (const auto& point : *cloud)
-        {
-            temp_vec3.x = point.x;
-            temp_vec3.y = point.y;
-            temp_vec3.z = point.z;
+    QFile in_file(filename);
 
-            vertex_positions.push_back(temp_vec3);
-        }        
+    //File open error check
+    if (!in_file.open(QIODevice::ReadOnly) || in_file.size() == 0)
+    {
+        throw "ERROR::PLYLOADER::Could not open file.";
+    }
 
-        //File open error check
-        if (!in_file.is_open())
-        {
-            throw "ERROR::OBJLOADER::Could not open file.";
+    // map the file, header and vertex data are decoded directly from the mapped memory
+    uchar * mappedData = in_file.map(0, in_file.size());
+    if (mappedData == nullptr)
+        throw "ERROR::PLYLOADER::Could not map file.";
+    const char * begin = reinterpret_cast<const char *>(mappedData);
+    const char * end = begin + in_file.size();
+
+    PlyHeader header;
+    std::string errorMsg;
+    bool success = parsePlyHeader(begin, end, header, errorMsg);
+    int vertexElementIdx = header.elementIndex("vertex");
+    if (success && vertexElementIdx == -1) {
+        errorMsg = "PLY file has no vertex element.";
+        success = false;
+    }
+    if (success) {
+        // decode only x, y, z straight into the tightly packed float3 array
+        static_assert(sizeof(glm::vec3) == 3*sizeof(float), "glm::vec3 must be tightly packed");
+        const std::size_t count = header.m_elements[vertexElementIdx].m_count;
+        positions.resize(count);
+        std::function<bool(std::size_t)> progress;
+        if (loader != nullptr) {
+            LoadEvent e;
+            e.m_type = LoadEvent::Allocate;
+            e.m_vertexCount = count;
+            e.m_stage = "Reading points";
+            loader->post(e);
+            // every decoded block is drawn right away
+            progress = [loader, count](std::size_t decoded) {
+                LoadEvent e;
+                e.m_type = LoadEvent::Vertexes;
+                e.m_vertexCount = decoded;
+                e.m_stage = "Reading points";
+                e.m_progress = float(decoded)/count;
+                return loader->post(e);
+            };
         }
+        success = readPlyElementProperties(begin, end, header, vertexElementIdx, {"x", "y", "z"},
+                                           loader != nullptr ? loader->pool() : ThreadPool::globalInstance(),
+                                           reinterpret_cast<float *>(positions.data()), errorMsg, progress);
+    }
+    in_file.unmap(mappedData);
+    if (!success) {
+        // during a background load, the GUI thread may still upload from positions, it clears them on the
+        // Failed event
+        if (loader == nullptr)
+            positions.clear();
+        qWarning() << "Error reading" << filename << ":" << QString::fromStdString(errorMsg);
+        throw "ERROR::PLYLOADER::Could not read vertex data.";
+    }
 
-        //Read one line at a time
-        //while (std::getline(in_file, line))
-        {
-            //Get the prefix of the line
-            //ss.clear();
-            //ss.str(line);
-            //ss >> prefix;
-
-            //if (prefix == "#")
-            //{
-
-            //}
-            //else if (prefix == "o")
-            //{
-
-            //}
-            //else if (prefix == "s")
-            //{
-
-            //}
-            //else if (prefix == "use_mtl")
-            //{
-
-            //}
-
-            //if (prefix == "v") //Vertex position
-            //{
-            //    ss >> temp_vec3.x >> temp_vec3.y >> temp_vec3.z;
-            //    vertex_positions.push_back(temp_vec3);
-            //}
-           //else if (prefix == "vt")
-           //{
-           //    ss >> temp_vec2.x >> temp_vec2.y;
-           //    vertex_texcoords.push_back(temp_vec2);
-           //}
-           //else if (prefix == "vn")-
-           //{
-           //    ss >> temp_vec3.x >> temp_vec3.y >> temp_vec3.z;
-           //    vertex_normals.push_back(temp_vec3);
-           //}
-            //else if (prefix == "f")
-            //{
-            //    int counter = 0;
-            //    while (ss >> temp_glint[0] >> temp_glint[1] >> temp_glint[2])
-            //    {
-            //        //Pushing indices into correct arrays
-            //        if (counter == 0){
-            //            indices.push_back(temp_glint[0]);
-            //            indices.push_back(temp_glint[1]);
-            //            indices.push_back(temp_glint[2]);
-            //        }
-            //        //else if (counter == 1)
-            //        //    vertex_texcoord_indicies.push_back(temp_glint);
-            //        //else if (counter == 2)
-            //        //    vertex_normal_indicies.push_back(temp_glint);
-            //
-            //        //Handling characters
-            //        if (ss.peek() == '/')
-            //        {
-            //            ++counter;
-            //            ss.ignore(1, '/');
-            //        }
-            //        else if (ss.peek() == ' ')
-            //        {
-            //            ++counter;
-            //            ss.ignore(1, ' ');
-            //        }
-            //
-            //        //Reset the counter
-            //        if (counter > 2)
-            //            counter = 0;
-            //    }
-            //}
-            //else
-            //{
-            //
-            //}
-        }
+    //DEBUG
+    qDebug() << "Size of vertices: " << positions.size() << "\n";
+
+    //Loaded success
+    qDebug() << "PLY file loaded in" << loadTimer.elapsed() << "ms" << "\n";
+}
 
-        
 
-        //Build final vertex array (mesh)
-       //vertices.resize(indices.size(), Model_Vertex());
+/*! Sorts the points into grid. */
+static void buildPointGrid(const std::vector<glm::vec3> & positions, ThreadPool & pool, PointGrid & grid) {
+    QElapsedTimer gridTimer;
+    gridTimer.start();
+    grid.build(positions.data(), positions.size(), pool);
+    qDebug() << "Point grid with" << grid.m_dims[0] << "x" << grid.m_dims[1] << "x" << grid.m_dims[2]
+             << "cells built in" << gridTimer.elapsed() << "ms" << "\n";
+}
 
-        //Load in all indices
-        //for (GLint i = 0; i < vertices.size(); i++)
-        //{
-            //vertices[i].positions = vertex_positions[indices[i] - 1];
 
-            //vertices[i] = vertex_texcoords[vertex_texcoord_indicies[i] - 1];
+/*! Builds the level-of-detail octree. */
+static void buildPointOctree(const std::vector<glm::vec3> & positions, ThreadPool & pool, PointOctree & octree) {
+    QElapsedTimer octreeTimer;
+    octreeTimer.start();
+    octree.build(positions.data(), positions.size(), pool);
+    qDebug() << "LOD octree with" << octree.m_nodes.size() << "nodes and" << octree.m_lodIndexes.size()
+             << "point indexes built in" << octreeTimer.elapsed() << "ms" << "\n";
+}
 
-            //vertices[i] = vertex_normals[vertex_normal_indicies[i] - 1];
 
-            //vertices[i].r = 1.0f;
-            //vertices[i].g = 1.0f;
-            //vertices[i].b = 1.0f;
-        //}
+void BoxObject::loadObj(const char *filename)
+{
+    readPlyPositions(filename, vertex_positions, nullptr);
+    buildPointGrid(vertex_positions, ThreadPool::globalInstance(), m_pointGrid);
+    buildPointOctree(vertex_positions, ThreadPool::globalInstance(), m_octree);
+}
 
-        //DEBUG
-        qDebug() << "Size of vertices: " << vertex_positions.size() << "\n";
-        //qDebug() << "Size of indices: " << indices.size() << "\n";
 
-        //Loaded success
-        qDebug() << "PLY file loaded!" << "\n";
+void BoxObject::loadObjInBackground(const std::string & filename) {
+    m_loader.cancel();
+    m_pointGrid.clear();
+    m_octree.clear();
+    m_lodNodes.clear();
+    m_readyVertexCount = m_uploadedVertexCount = m_uploadedLodIndexCount = 0;
+    m_loader.start([this, filename](BackgroundLoader & loader) {
+        readPlyPositions(filename.c_str(), vertex_positions, &loader);
+        if (!loader.postProgress("Building point grid", 0))
+            return;
+        buildPointGrid(vertex_positions, loader.pool(), m_loadedGrid);
+        if (!loader.postProgress("Building LOD octree", 0))
+            return;
+        buildPointOctree(vertex_positions, loader.pool(), m_loadedOctree);
+        LoadEvent e;
+        e.m_type = LoadEvent::Finished;
+        loader.post(e);
+    });
 }
 
-void BoxObject::boxobj()
-{
-    int boxCount = vertex_positions.size();
-    BoxMesh b(2, 2, 2);
-    Transform3D trans;
-    for (int i = 0; i < boxCount; i++) {
-        trans.setTranslation(vertex_positions[i].x, vertex_positions[i].y, vertex_positions[i].z);
-        b.transform(trans.toMatrix());
-        m_boxes.push_back(b);
+
+bool BoxObject::processLoadEvents() {
+    LoadEvent e;
+    while (m_loader.takeEvent(e)) {
+        switch (e.m_type) {
+            case LoadEvent::Allocate :
+                m_vbo.bind();
+                m_vbo.allocate(int(e.m_vertexCount*sizeof(glm::vec3)));
+                m_vbo.release();
+                break;
+            case LoadEvent::Vertexes :
+                m_readyVertexCount = e.m_vertexCount;
+                break;
+            case LoadEvent::Finished :
+                std::swap(m_pointGrid, m_loadedGrid);
+                m_loadedGrid.clear();
+                std::swap(m_octree, m_loadedOctree);
+                m_loadedOctree.clear();
+                // mind: the element buffer binding is part of the VAO state
+                m_vao.bind();
+                m_lodEbo.bind();
+                m_lodEbo.allocate(int(m_octree.m_lodIndexes.size()*sizeof(GLuint)));
+                m_vao.release();
+                break;
+            case LoadEvent::Failed :
+                qWarning() << "Loading PLY file failed:" << e.m_stage;
+                m_readyVertexCount = m_uploadedVertexCount = 0;
+                vertex_positions.clear();
+                break;
+            default : break;
+        }
+    }
+    std::size_t budget = m_loader.m_uploadBytesPerFrame;
+    if (m_uploadedVertexCount < m_readyVertexCount) {
+        m_vbo.bind();
+        uploadBufferRange(m_vbo, vertex_positions.data(), sizeof(glm::vec3), m_uploadedVertexCount, m_readyVertexCount,
+                          budget);
+        m_vbo.release();
+    }
+    if (m_uploadedLodIndexCount < m_octree.m_lodIndexes.size()) {
+        m_vao.bind();
+        m_lodEbo.bind();
+        uploadBufferRange(m_lodEbo, m_octree.m_lodIndexes.data(), sizeof(GLuint), m_uploadedLodIndexCount,
+                          m_octree.m_lodIndexes.size(), budget);
+        m_vao.release();
     }
+    return m_uploadedVertexCount < m_readyVertexCount || m_uploadedLodIndexCount < m_octree.m_lodIndexes.size();
+}
+
 
-    unsigned int NBoxes = m_boxes.size();
+bool BoxObject::loading() const {
+    return m_loader.state() == BackgroundLoader::Running || m_uploadedVertexCount < m_readyVertexCount ||
+            m_uploadedLodIndexCount < m_octree.m_lodIndexes.size();
+}
+
+void BoxObject::boxobj()
+{
+    const glm::vec3 * positions = vertex_positions.data();
+    unsigned int boxCount = vertex_positions.size();
+    ThreadPool & pool = ThreadPool::globalInstance();
+    m_boxes.clear();
+    m_boxes.resize(boxCount);
+    pool.parallelFor(boxCount, 0, [&](size_t first, size_t last, unsigned int) {
+        for (size_t i = first; i < last; i++)
+            m_boxes.setBox(i, positions[i], glm::vec3(1, 1, 1));
+    });
 
     // resize storage arrays
-    m_vertexBufferData.resize(NBoxes * BoxMesh::VertexCount);
-    m_elementBufferData.resize(NBoxes * BoxMesh::IndexCount);
-
-    // update the buffers
-    Vertex* vertexBuffer = m_vertexBufferData.data();
-    unsigned int vertexCount = 0;
-    GLuint* elementBuffer = m_elementBufferData.data();
-    for (const BoxMesh& b : m_boxes)
-        b.copy2Buffer(vertexBuffer, elementBuffer, vertexCount);
+    m_vertexBufferData.resize(boxCount * BoxMesh::VertexCount);
+    m_elementBufferData.resize(boxCount * BoxMesh::IndexCount);
+
+    // update the buffers, boxes are written in parallel
+    m_boxes.copy2Buffer(m_vertexBufferData.data(), m_elementBufferData.data(), pool);
 }
 
 
@@ -248,10 +278,14 @@ void BoxObject::create(QOpenGLShaderProgram * shaderProgramm) {
     m_vbo.create();
     m_vbo.bind();
     m_vbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
-    int vertexMemSize = vertex_positions.size()*sizeof(Model_Vertex);
-    qDebug() << "size: " << vertex_positions.size();
-    qDebug() << "BoxObject - VertexBuffer size =" << vertexMemSize/1024.0 << "kByte";
-    m_vbo.allocate(vertex_positions.data(), vertexMemSize);
+    // during a background load, the buffer is allocated and filled by processLoadEvents()
+    if (!loading()) {
+        int vertexMemSize = vertex_positions.size()*sizeof(glm::vec3);
+        qDebug() << "size: " << vertex_positions.size();
+        qDebug() << "BoxObject - VertexBuffer size =" << vertexMemSize/1024.0 << "kByte";
+        m_vbo.allocate(vertex_positions.data(), vertexMemSize);
+        m_readyVertexCount = m_uploadedVertexCount = vertex_positions.size();
+    }
 
     // create and bind element buffer
     m_ebo.create();
@@ -261,12 +295,25 @@ void BoxObject::create(QOpenGLShaderProgram * shaderProgramm) {
     qDebug() << "BoxObject - ElementBuffer size =" << elementMemSize/1024.0 << "kByte";
     m_ebo.allocate(indices.data(), elementMemSize);
 
+    // point indexes of the octree nodes, during a background load filled by processLoadEvents()
+    m_lodEbo.create();
+    m_lodEbo.bind();
+    m_lodEbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+    if (!loading()) {
+        m_lodEbo.allocate(m_octree.m_lodIndexes.data(), int(m_octree.m_lodIndexes.size()*sizeof(GLuint)));
+        m_uploadedLodIndexCount = m_octree.m_lodIndexes.size();
+    }
+
+    // selected points, filled by setSelection()
+    m_selectionEbo.create();
+    m_selectionEbo.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+
     // set shader attributes
     // tell shader program we have two data arrays to be used as input to the shaders
 
     // index 0 = position
     shaderProgramm->enableAttributeArray(0); // array with index/id 0
-    shaderProgramm->setAttributeBuffer(0, GL_FLOAT, 0, 3, sizeof(Vertex));
+    shaderProgramm->setAttributeBuffer(0, GL_FLOAT, 0, 3, sizeof(glm::vec3)); // tightly packed positions
     // index 1 = color
     //shaderProgramm->enableAttributeArray(1); // array with index/id 1
     //shaderProgramm->setAttributeBuffer(1, GL_FLOAT, offsetof(Vertex, r), 3, sizeof(Vertex));
@@ -282,6 +329,17 @@ void BoxObject::destroy() {
     m_vao.destroy();
     m_vbo.destroy();
     m_ebo.destroy();
+    m_lodEbo.destroy();
+    m_selectionEbo.destroy();
+}
+
+
+std::size_t BoxObject::updateLod(const float worldToView[16], float focalLength) {
+    if (m_octree.empty() || m_uploadedLodIndexCount < m_octree.m_lodIndexes.size()) {
+        m_lodNodes.clear();
+        return m_uploadedVertexCount;
+    }
+    return m_octree.selectNodes(worldToView, focalLength, m_lodMaxScreenError, m_lodMaxPoints, m_lodNodes);
 }
 
 
@@ -292,47 +350,67 @@ void BoxObject::render() {
     // now draw the cube by drawing individual triangles
     // - GL_TRIANGLES - draw individual triangles via elements
     //glDrawElements(GL_POINTS, vertex_positions.size(), GL_UNSIGNED_INT, nullptr);
-    glDrawArrays(GL_POINTS, vertex_positions[0].x, vertex_positions.size());
+    if (!m_lodNodes.empty()) {
+        // the octree nodes selected for the view, the indexes refer to m_vbo, so the point ids stay the same
+        m_lodEbo.bind();
+        for (unsigned int n : m_lodNodes) {
+            const PointOctree::Node & node = m_octree.m_nodes[n];
+            glDrawElements(GL_POINTS, GLsizei(node.m_count), GL_UNSIGNED_INT,
+                           reinterpret_cast<const void *>(node.m_first*sizeof(GLuint)));
+        }
+    }
+    else if (m_octree.empty() || m_uploadedLodIndexCount < m_octree.m_lodIndexes.size()) {
+        // during a background load only the points uploaded so far, all points until the octree is on the GPU
+        glDrawArrays(GL_POINTS, 0, GLsizei(m_uploadedVertexCount));
+    }
+
+    // selected points are drawn again on top, the color attribute array is disabled,
+    // so the constant value of attribute 1 is used as color for all of them
+    if (m_selectionCount != 0) {
+        QOpenGLFunctions * f = QOpenGLContext::currentContext()->functions();
+        m_selectionEbo.bind(); // mind: the VAO keeps this binding, m_ebo is not used for drawing
+        f->glVertexAttrib3f(1, 1.f, 1.f, 0.f);
+        glDrawElements(GL_POINTS, m_selectionCount, GL_UNSIGNED_INT, nullptr);
+        f->glVertexAttrib3f(1, 0.f, 0.f, 0.f);
+    }
 
     // release vertices again
     m_vao.release();
 }
 
 
+void BoxObject::setSelection(const std::vector<unsigned int> & pointIds) {
+    m_selectionCount = GLsizei(pointIds.size());
+    m_selectionEbo.bind();
+    m_selectionEbo.allocate(pointIds.data(), int(pointIds.size()*sizeof(GLuint)));
+    m_selectionEbo.release();
+}
+
+
 void BoxObject::pick(const QVector3D& p1, const QVector3D& d, PickObject & po) const {
     // now process all box objects
-    for (unsigned int i=0; i<m_boxes.size(); i++) {
-        const BoxMesh& bm = m_boxes[i];
-        for (unsigned int j=0; j<6; ++j) {
-            float dist;
-            // is intersection point closes to viewer than previous intersection points?
-            if (bm.intersects(j, p1, d, dist)) {
-                qDebug() << QString("Point %1 intersects line at normalized distance = %2").arg(i).arg(dist);
-                // keep objects that is closer to near plane
-                if (dist < po.m_dist) {
-                    po.m_dist = dist;
-                    po.m_objectId = i;
-                    po.m_faceId = j;
-                }
-            }
-        } 
-    }   
+    m_boxes.pick(p1, d, po);
 }
 
-void BoxObject::pickPoint(const glm::vec3& n, const glm::vec3& f) const
+bool BoxObject::pickPoint(const glm::vec3& n, const glm::vec3& f, float nearTolerance, float farTolerance,
+                          PickObject & po) const
 {
+    PointGrid::Hit hit(po.m_dist);
+    if (!m_pointGrid.nearestPoint(n, f - n, nearTolerance, farTolerance, hit))
+        return false;
+    po.m_dist = hit.m_dist;
+    po.m_objectId = hit.m_pointId;
+    po.m_faceId = 0;
+    return true;
+}
 
-    for (int i = 0; i < vertex_positions.size() - 2; i++) {
-        auto dir = f - n;
-        auto t = glm::length(dir);
-        if (rayTriangleIntersect(n, dir, vertex_positions[i], vertex_positions[i + 1], vertex_positions[i + 2], t))
-        {
-            std::cout << "Ray intersects mesh at index: " << i << std::endl;
-            break;
-        }
-    }
+void BoxObject::gpuPickPoint(GpuPicker & picker, const glm::vec3& n, const glm::vec3& f, float nearTolerance,
+                             float farTolerance) const
+{
+    picker.pickPoints(m_vbo.bufferId(), (unsigned int)m_uploadedVertexCount, n, f - n, nearTolerance, farTolerance, 2.f);
 }
 
+
 void BoxObject::highlight(unsigned int boxId, unsigned int faceId) {
     // we change the color of all vertexes of the selected box to lightgray
     // and the vertex colors of the selected plane/face to light blue
@@ -344,14 +422,10 @@ void BoxObject::highlight(unsigned int boxId, unsigned int faceId) {
         else
             faceCols[i] = QColor("#f3f3f3");
     }
-    m_boxes[boxId].setFaceColors(faceCols);
+    m_boxes.setColorScheme(boxId, m_boxes.colorSchemeIndex(faceCols));
 
-    // advance the pointers and vertex numbers to the respected box position/numbering
-    Vertex * vertexBuffer = m_vertexBufferData.data() + boxId*6*4; // 6 planes, with 4 vertexes each
-    unsigned int vertexCount = boxId*6*4;
-    GLuint * elementBuffer = m_elementBufferData.data() + boxId*6*6; // 6 planes, with 2 triangles with 3 indexes each
     // then we update the respective portion of the vertexbuffer memory
-    m_boxes[boxId].copy2Buffer(vertexBuffer, elementBuffer, vertexCount);
+    m_boxes.copy2Buffer(boxId, m_vertexBufferData.data(), m_elementBufferData.data());
 
     QElapsedTimer t;
     t.start();
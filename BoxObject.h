@@ -7,6 +7,8 @@
 #include "Vertex.h"
 #include <glm.hpp>
 
+#include "BackgroundLoader.h"
+#include "GpuPicker.h"
 #include "PickObject.h"
 
 QT_BEGIN_NAMESPACE
@@ -14,6 +16,9 @@ class QOpenGLShaderProgram;
 QT_END_NAMESPACE
 
 #include "BoxMesh.h"
+#include "BoxSet.h"
+#include "PointGrid.h"
+#include "PointOctree.h"
 
 /*! A container for all the boxes.
     Basically creates the geometry of the individual boxes and populates the buffers.
@@ -21,28 +26,80 @@ QT_END_NAMESPACE
 class BoxObject {
 public:
     BoxObject();
+    /*! Cancels a running background load. */
+    ~BoxObject();
+    /*! Reads the vertex positions of a PLY file (ascii, binary little or big endian) into vertex_positions.
+        The file is memory mapped and only the x, y, z properties of the vertex element are decoded.
+        Afterwards, the points are sorted into m_pointGrid for picking and into m_octree for rendering.
+    */
     void loadObj(const char *filename);
 
+    /*! Reads the PLY file like loadObj(), but on the thread of m_loader, so that the GUI remains responsive.
+        The points are decoded in blocks, each finished block is uploaded by
+        processLoadEvents() and drawn right away. m_pointGrid and m_octree are built in the background afterwards,
+        until then picks have to use gpuPickPoint() and all points are drawn. A running background load is
+        cancelled first.
+    */
+    void loadObjInBackground(const std::string & filename);
+
+    /*! Processes the events of a background load (GUI thread, OpenGL context current, e.g. in paintGL()):
+        allocates m_vbo, uploads newly decoded points (at most m_loader.m_uploadBytesPerFrame per call) and
+        takes over the point grid and the octree when the load has finished (the octree is uploaded with the same
+        budget). Returns true if data is left to upload, call it again with the next frame then.
+    */
+    bool processLoadEvents();
+
+    /*! True while a background load is running or its points or octree are not uploaded completely. */
+    bool loading() const;
+
+    /*! Creates one box per vertex in m_boxes and expands all boxes into m_vertexBufferData/m_elementBufferData.
+        Mind: this needs 720 bytes per box, for drawing only use InstancedBoxObject instead.
+    */
     void boxobj();
 
     /*! The function is called during OpenGL initialization, where the OpenGL context is current. */
     void create(QOpenGLShaderProgram * shaderProgramm);
     void destroy();
 
+    /*! Selects the octree nodes drawn by render() for the view, see PointOctree::selectNodes() (m_lodMaxScreenError,
+        m_lodMaxPoints). worldToView is row-major (QMatrix4x4::copyDataTo()), focalLength the projection scale in
+        pixels. Returns the number of points that will be drawn.
+    */
+    std::size_t updateLod(const float worldToView[16], float focalLength);
+
+    /*! Draws the octree nodes selected in updateLod() (all points while the octree is not available), and the
+        selected points (see setSelection()) highlighted on top.
+    */
     void render();
 
+    /*! Uploads the indexes of the selected points, which are highlighted by render().
+        OpenGL context must be current.
+    */
+    void setSelection(const std::vector<unsigned int> & pointIds);
+
     /*! Thread-save pick function.
         Checks if any of the box object surfaces is hit by the ray defined by "p1 + d [0..1]" and
         stores data in po (pick object).
     */
     void pick(const QVector3D& p1, const QVector3D& d, PickObject & po) const;
 
-    void pickPoint(const glm::vec3& n, const glm::vec3& f) const;
+    /*! Thread-save pick function for the point cloud.
+        Finds the front-most point within the tolerance of the ray "n + t*(f - n)" with 0 <= t <= 1 (and t < po.m_dist),
+        the tolerance grows linearly from nearTolerance at n to farTolerance at f (see PointGrid::nearestPoint()).
+        On success, returns true and stores the point index (m_objectId) and its depth t (m_dist) in po.
+    */
+    bool pickPoint(const glm::vec3& n, const glm::vec3& f, float nearTolerance, float farTolerance, PickObject & po) const;
+
+    /*! Starts a brute-force pick of the point cloud on the GPU, testing all points in m_vbo with the tolerances of
+        pickPoint() (see GpuPicker), e.g. while m_pointGrid is not built yet. The OpenGL context must be current,
+        the result is polled with picker.pollResult() (GpuPickResult::m_primitiveId is the point index).
+    */
+    void gpuPickPoint(GpuPicker & picker, const glm::vec3& n, const glm::vec3& f, float nearTolerance, float farTolerance) const;
 
     /*! Changes color of box and face to show that the box was clicked on. */
     void highlight(unsigned int boxId, unsigned int faceId);
 
-    std::vector<BoxMesh>		m_boxes;
+    BoxSet						m_boxes;
 
     std::vector<Vertex>			m_vertexBufferData;
     std::vector<GLuint>			m_elementBufferData;
@@ -51,6 +108,14 @@ public:
     std::vector<GLint>           indices;
     std::vector<glm::vec3>      vertex_positions;
     std::vector<int>           vertex_position_indicies;
+
+    /*! Grid over vertex_positions, used by pickPoint(). */
+    PointGrid					m_pointGrid;
+    /*! Level-of-detail octree over vertex_positions, used by render(). */
+    PointOctree					m_octree;
+    /*! Max. screen-space error (pixels) and max. number of points drawn per frame, see updateLod(). */
+    float						m_lodMaxScreenError = 1.5f;
+    std::size_t					m_lodMaxPoints = 4000000;
     
 
     /*! Wraps an OpenGL VertexArrayObject, that references the vertex coordinates and color buffers. */
@@ -60,6 +125,11 @@ public:
     QOpenGLBuffer				m_vbo;
     /*! Holds elements. */
     QOpenGLBuffer				m_ebo;
+    /*! Holds the point indexes of the octree nodes (PointOctree::m_lodIndexes). */
+    QOpenGLBuffer				m_lodEbo;
+    /*! Holds the indexes of the selected points. */
+    QOpenGLBuffer				m_selectionEbo;
+    GLsizei						m_selectionCount = 0;
 
     struct vertex
     {
@@ -72,6 +142,23 @@ public:
 
     std::vector<vertex> vertexes;
     std::vector<face> faces;
+
+    /*! Reads the PLY file in the background, see loadObjInBackground(). */
+    BackgroundLoader			m_loader;
+
+private:
+    /*! Points [0, m_readyVertexCount) are decoded, points [0, m_uploadedVertexCount) are in m_vbo and drawn. */
+    std::size_t					m_readyVertexCount = 0;
+    std::size_t					m_uploadedVertexCount = 0;
+    /*! Point grid and octree built by the background load, moved into m_pointGrid/m_octree when the load has
+        finished.
+    */
+    PointGrid					m_loadedGrid;
+    PointOctree					m_loadedOctree;
+    /*! Indexes [0, m_uploadedLodIndexCount) of m_octree are in m_lodEbo, the octree is used when all are. */
+    std::size_t					m_uploadedLodIndexCount = 0;
+    /*! Octree nodes selected by updateLod(). */
+    std::vector<unsigned int>	m_lodNodes;
 };
 
 #endif // BOXOBJECT_H
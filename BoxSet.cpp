@@ -0,0 +1,305 @@
+#include "BoxSet.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "BoxMesh.h"
+#include "PickObject.h"
+#include "RayBoxKernels.h"
+#include "ThreadPool.h"
+
+/*! Corners of the faces front, right, back, left, bottom, top (counter-clockwise, as in BoxMesh). */
+static const unsigned int FACE_CORNERS[6][4] = {
+    {0, 1, 2, 3}, {1, 5, 6, 2}, {5, 4, 7, 6}, {4, 0, 3, 7}, {4, 5, 1, 0}, {3, 2, 6, 7}
+};
+
+/*! Minimum number of boxes per block in the parallel pick(), smaller sets are searched serially since the
+    slab test kernel needs only a few ns per box.
+*/
+static const std::size_t PARALLEL_PICK_MIN_BOXES = 16384;
+
+
+BoxSet::BoxSet(const QColor & boxColor) {
+    m_orientations.push_back(QQuaternion());
+    colorSchemeIndex(std::vector<QColor>(1, boxColor));
+}
+
+
+void BoxSet::clear() {
+    m_centerX.clear();
+    m_centerY.clear();
+    m_centerZ.clear();
+    m_halfExtentX.clear();
+    m_halfExtentY.clear();
+    m_halfExtentZ.clear();
+    m_orientation.clear();
+    m_colorScheme.clear();
+}
+
+
+void BoxSet::reserve(std::size_t count) {
+    m_centerX.reserve(count);
+    m_centerY.reserve(count);
+    m_centerZ.reserve(count);
+    m_halfExtentX.reserve(count);
+    m_halfExtentY.reserve(count);
+    m_halfExtentZ.reserve(count);
+    m_orientation.reserve(count);
+    m_colorScheme.reserve(count);
+}
+
+
+void BoxSet::resize(std::size_t count) {
+    m_centerX.resize(count, 0.f);
+    m_centerY.resize(count, 0.f);
+    m_centerZ.resize(count, 0.f);
+    m_halfExtentX.resize(count, 0.f);
+    m_halfExtentY.resize(count, 0.f);
+    m_halfExtentZ.resize(count, 0.f);
+    m_orientation.resize(count, 0);
+    m_colorScheme.resize(count, 0);
+}
+
+
+void BoxSet::setBox(unsigned int boxId, const glm::vec3 & center, const glm::vec3 & halfExtent,
+                    unsigned int orientationIdx, unsigned int colorSchemeIdx)
+{
+    Q_ASSERT(boxId < size());
+    Q_ASSERT(orientationIdx < m_orientations.size());
+    Q_ASSERT(colorSchemeIdx < m_colorSchemes.size());
+    m_centerX[boxId] = center.x;
+    m_centerY[boxId] = center.y;
+    m_centerZ[boxId] = center.z;
+    m_halfExtentX[boxId] = halfExtent.x;
+    m_halfExtentY[boxId] = halfExtent.y;
+    m_halfExtentZ[boxId] = halfExtent.z;
+    m_orientation[boxId] = (unsigned short)orientationIdx;
+    m_colorScheme[boxId] = (unsigned short)colorSchemeIdx;
+}
+
+
+unsigned int BoxSet::addBox(const glm::vec3 & center, const glm::vec3 & halfExtent,
+                            unsigned int orientationIdx, unsigned int colorSchemeIdx)
+{
+    Q_ASSERT(orientationIdx < m_orientations.size());
+    Q_ASSERT(colorSchemeIdx < m_colorSchemes.size());
+    m_centerX.push_back(center.x);
+    m_centerY.push_back(center.y);
+    m_centerZ.push_back(center.z);
+    m_halfExtentX.push_back(halfExtent.x);
+    m_halfExtentY.push_back(halfExtent.y);
+    m_halfExtentZ.push_back(halfExtent.z);
+    m_orientation.push_back((unsigned short)orientationIdx);
+    m_colorScheme.push_back((unsigned short)colorSchemeIdx);
+    return (unsigned int)(m_centerX.size() - 1);
+}
+
+
+unsigned int BoxSet::orientationIndex(const QQuaternion & rotation) {
+    for (unsigned int i=0; i<m_orientations.size(); ++i)
+        if (m_orientations[i] == rotation)
+            return i;
+    Q_ASSERT(m_orientations.size() < 0x10000);
+    m_orientations.push_back(rotation);
+    return (unsigned int)(m_orientations.size() - 1);
+}
+
+
+unsigned int BoxSet::colorSchemeIndex(const std::vector<QColor> & faceColors) {
+    Q_ASSERT(faceColors.size() == 1 || faceColors.size() == 6);
+    ColorScheme scheme;
+    for (unsigned int i=0; i<6; ++i) {
+        const QColor & c = faceColors[faceColors.size() == 1 ? 0 : i];
+        scheme.m_rgb[i][0] = float(c.redF());
+        scheme.m_rgb[i][1] = float(c.greenF());
+        scheme.m_rgb[i][2] = float(c.blueF());
+    }
+    for (unsigned int i=0; i<m_colorSchemes.size(); ++i)
+        if (std::memcmp(&m_colorSchemes[i], &scheme, sizeof(ColorScheme)) == 0)
+            return i;
+    Q_ASSERT(m_colorSchemes.size() < 0x10000);
+    m_colorSchemes.push_back(scheme);
+    return (unsigned int)(m_colorSchemes.size() - 1);
+}
+
+
+void BoxSet::corners(unsigned int boxId, QVector3D c[8]) const {
+    const float hx = m_halfExtentX[boxId];
+    const float hy = m_halfExtentY[boxId];
+    const float hz = m_halfExtentZ[boxId];
+    c[0] = QVector3D(-hx, -hy,  hz); // a
+    c[1] = QVector3D( hx, -hy,  hz); // b
+    c[2] = QVector3D( hx,  hy,  hz); // c
+    c[3] = QVector3D(-hx,  hy,  hz); // d
+    c[4] = QVector3D(-hx, -hy, -hz); // e
+    c[5] = QVector3D( hx, -hy, -hz); // f
+    c[6] = QVector3D( hx,  hy, -hz); // g
+    c[7] = QVector3D(-hx,  hy, -hz); // h
+    const QVector3D center(m_centerX[boxId], m_centerY[boxId], m_centerZ[boxId]);
+    const unsigned int orientationIdx = m_orientation[boxId];
+    for (unsigned int i=0; i<8; ++i) {
+        if (orientationIdx != 0)
+            c[i] = m_orientations[orientationIdx].rotatedVector(c[i]);
+        c[i] += center;
+    }
+}
+
+
+bool BoxSet::intersects(unsigned int boxId, unsigned int faceIdx, const QVector3D & p1, const QVector3D & d, float & dist) const {
+    Q_ASSERT(faceIdx < 6);
+    QVector3D c[8];
+    corners(boxId, c);
+    // face plane is spanned by the edges a->b and a->d, same as BoxMesh::Rect
+    const QVector3D & a = c[FACE_CORNERS[faceIdx][0]];
+    QVector3D ab = c[FACE_CORNERS[faceIdx][1]] - a;
+    QVector3D ad = c[FACE_CORNERS[faceIdx][3]] - a;
+    QVector3D normal = QVector3D::crossProduct(ab, ad).normalized();
+    return intersectsRect(ab, ad, normal, a, p1, d, dist);
+}
+
+
+/*! Slab test of line "p + t*d" against the box [-h, h], returns entry distance t and the face that is entered. */
+static inline bool slabTest(float px, float py, float pz, float invDx, float invDy, float invDz,
+                            float hx, float hy, float hz, float & tEnter, unsigned int & axis)
+{
+    const float tx1 = (-hx - px)*invDx, tx2 = (hx - px)*invDx;
+    const float ty1 = (-hy - py)*invDy, ty2 = (hy - py)*invDy;
+    const float tz1 = (-hz - pz)*invDz, tz2 = (hz - pz)*invDz;
+    const float txMin = std::min(tx1, tx2), txMax = std::max(tx1, tx2);
+    const float tyMin = std::min(ty1, ty2), tyMax = std::max(ty1, ty2);
+    const float tzMin = std::min(tz1, tz2), tzMax = std::max(tz1, tz2);
+    tEnter = std::max(txMin, std::max(tyMin, tzMin));
+    const float tExit = std::min(txMax, std::min(tyMax, tzMax));
+    axis = tEnter == txMin ? 0 : (tEnter == tyMin ? 1 : 2);
+    // only hits from outside and within [0..1] count, like in intersectsRect()
+    return tEnter <= tExit && tEnter >= 0 && tEnter <= 1;
+}
+
+
+/*! Face that is entered when crossing the slab of the given axis in direction d. */
+static inline unsigned int entryFace(unsigned int axis, const QVector3D & d) {
+    switch (axis) {
+        case 0  : return d.x() < 0 ? 1 : 3; // right : left
+        case 1  : return d.y() < 0 ? 5 : 4; // top : bottom
+        default : return d.z() < 0 ? 0 : 2; // front : back
+    }
+}
+
+
+bool BoxSet::intersectsLocal(unsigned int boxId, const QVector3D & p1, const QVector3D & d,
+                             float & dist, unsigned int & faceIdx) const
+{
+    unsigned int axis;
+    if (!slabTest(p1.x(), p1.y(), p1.z(), 1.f/d.x(), 1.f/d.y(), 1.f/d.z(),
+                  m_halfExtentX[boxId], m_halfExtentY[boxId], m_halfExtentZ[boxId], dist, axis))
+        return false;
+    faceIdx = entryFace(axis, d);
+    return true;
+}
+
+
+bool BoxSet::pick(const QVector3D & p1, const QVector3D & d, PickObject & po) const {
+    return pickRange(0, size(), p1, d, po);
+}
+
+
+bool BoxSet::pick(const QVector3D & p1, const QVector3D & d, PickObject & po, ThreadPool & pool, unsigned int blockCount) const {
+    if (blockCount == 0)
+        blockCount = (unsigned int)std::min<std::size_t>(pool.threadCount(), size()/PARALLEL_PICK_MIN_BOXES);
+    if (blockCount <= 1)
+        return pickRange(0, size(), p1, d, po);
+
+    // each block searches with its own pick object, blocks write to separate slots only
+    std::vector<PickObject> blockHits(blockCount, po);
+    std::vector<char> blockFound(blockCount, false);
+    pool.parallelFor(size(), blockCount, [&](std::size_t first, std::size_t last, unsigned int block) {
+        blockFound[block] = pickRange(first, last, p1, d, blockHits[block]);
+    });
+
+    // blocks are in box order, so taking only closer hits keeps the lowest box index for equal distances
+    bool found = false;
+    for (unsigned int b=0; b<blockCount; ++b) {
+        if (blockFound[b] && (!found || blockHits[b].m_dist < po.m_dist)) {
+            po = blockHits[b];
+            found = true;
+        }
+    }
+    return found;
+}
+
+
+bool BoxSet::pickRange(std::size_t first, std::size_t last, const QVector3D & p1, const QVector3D & d, PickObject & po) const {
+    // axis-aligned boxes are tested with the SIMD slab test kernel
+    RayBoxHit hit(po.m_dist);
+    nearestRayBoxHit(*this, first, last, RayBoxRay(p1.x(), p1.y(), p1.z(), d.x(), d.y(), d.z()), hit, simdLevel());
+    unsigned int faceIdx = entryFace(hit.m_axis, d);
+
+    // rotated boxes (if any), transform line into box coordinates (distances are not changed by rotation)
+    if (m_orientations.size() > 1) {
+        for (std::size_t i=first; i<last; ++i) {
+            if (m_orientation[i] == 0)
+                continue;
+            const QQuaternion inverse = m_orientations[m_orientation[i]].conjugated();
+            const QVector3D center(m_centerX[i], m_centerY[i], m_centerZ[i]);
+            float t;
+            unsigned int f;
+            if (!intersectsLocal((unsigned int)i, inverse.rotatedVector(p1 - center), inverse.rotatedVector(d), t, f))
+                continue;
+            if (t < hit.m_dist || (t == hit.m_dist && i < hit.m_boxId)) {
+                hit.m_dist = t;
+                hit.m_boxId = (unsigned int)i;
+                faceIdx = f;
+            }
+        }
+    }
+    if (hit.m_boxId == ~0u)
+        return false;
+
+    // keep objects that is closer to near plane
+    po.m_dist = hit.m_dist;
+    po.m_objectId = hit.m_boxId;
+    po.m_faceId = faceIdx;
+    return true;
+}
+
+
+void BoxSet::copy2Buffer(unsigned int boxId, Vertex * vertexBuffer, GLuint * elementBuffer) const {
+    QVector3D c[8];
+    corners(boxId, c);
+    const ColorScheme & colors = m_colorSchemes[m_colorScheme[boxId]];
+
+    vertexBuffer += std::size_t(boxId)*BoxMesh::VertexCount;
+    elementBuffer += std::size_t(boxId)*BoxMesh::IndexCount;
+    GLuint elementStartIndex = boxId*BoxMesh::VertexCount;
+    for (unsigned int f=0; f<6; ++f, vertexBuffer += 4, elementBuffer += 6, elementStartIndex += 4) {
+        // tweak the colors of the bottom left and bottom right nodes
+        const float shade = c[FACE_CORNERS[f][0]].y() < c[FACE_CORNERS[f][2]].y() ? 0.5f : 1.f;
+        for (unsigned int i=0; i<4; ++i) {
+            const QVector3D & p = c[FACE_CORNERS[f][i]];
+            const float s = i < 2 ? shade : 1.f;
+            Vertex & v = vertexBuffer[i];
+            v.x = p.x();
+            v.y = p.y();
+            v.z = p.z();
+            v.r = s*colors.m_rgb[f][0];
+            v.g = s*colors.m_rgb[f][1];
+            v.b = s*colors.m_rgb[f][2];
+        }
+        // two triangles: a, b, d  and b, c, d
+        elementBuffer[0] = elementStartIndex;
+        elementBuffer[1] = elementStartIndex+1;
+        elementBuffer[2] = elementStartIndex+3;
+        elementBuffer[3] = elementStartIndex+1;
+        elementBuffer[4] = elementStartIndex+2;
+        elementBuffer[5] = elementStartIndex+3;
+    }
+}
+
+
+void BoxSet::copy2Buffer(Vertex * vertexBuffer, GLuint * elementBuffer, ThreadPool & pool, unsigned int blockCount) const {
+    // each box writes its own, fixed slice of the buffers, so blocks need no synchronization
+    pool.parallelFor(size(), blockCount, [&](std::size_t first, std::size_t last, unsigned int) {
+        for (std::size_t i=first; i<last; ++i)
+            copy2Buffer((unsigned int)i, vertexBuffer, elementBuffer);
+    });
+}
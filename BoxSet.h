@@ -0,0 +1,121 @@
+#ifndef BOXSET_H
+#define BOXSET_H
+
+#include <QtGui/QOpenGLFunctions>
+
+#include <QColor>
+#include <QQuaternion>
+#include <QVector3D>
+
+#include <vector>
+
+#include <glm.hpp>
+
+#include "Vertex.h"
+
+struct PickObject;
+class ThreadPool;
+
+/*! A set of boxes (quaders), stored as structure of arrays.
+
+    Each box is defined by its center, its half extents in local x, y and z direction, an orientation and a
+    color scheme. Orientations and color schemes are stored once in small tables and boxes only keep the
+    index into these tables (index 0 = no rotation and the default color). Hence, a box needs 28 bytes and all
+    data of one kind is contiguous in memory, which is what the pick loop and buffer generation iterate over.
+
+    Corner coordinates and face planes are not stored, but derived when needed. Face numbering and the
+    generated vertex/element data are the same as in BoxMesh: front, right, back, left, bottom, top.
+*/
+class BoxSet {
+public:
+    /*! Creates an empty set, boxes use boxColor unless a different color scheme is assigned. */
+    explicit BoxSet(const QColor & boxColor = Qt::blue);
+
+    /*! Number of boxes. */
+    std::size_t size() const { return m_centerX.size(); }
+    bool empty() const { return m_centerX.empty(); }
+
+    /*! Removes all boxes, keeps orientation and color scheme tables. */
+    void clear();
+    void reserve(std::size_t count);
+    /*! Changes number of boxes, new boxes are empty (zero center and extents), use setBox() to define them. */
+    void resize(std::size_t count);
+
+    /*! Appends a box and returns its index. */
+    unsigned int addBox(const glm::vec3 & center, const glm::vec3 & halfExtent,
+                        unsigned int orientationIdx = 0, unsigned int colorSchemeIdx = 0);
+
+    /*! Defines box boxId, may be called in parallel for different boxes. */
+    void setBox(unsigned int boxId, const glm::vec3 & center, const glm::vec3 & halfExtent,
+                unsigned int orientationIdx = 0, unsigned int colorSchemeIdx = 0);
+
+    /*! Returns index of orientation in the orientations table, the orientation is added if needed. */
+    unsigned int orientationIndex(const QQuaternion & rotation);
+    /*! Returns index of color scheme with given face colors (size 1 = uniform color, size 6 = face colors),
+        the color scheme is added if needed.
+    */
+    unsigned int colorSchemeIndex(const std::vector<QColor> & faceColors);
+
+    void setColorScheme(unsigned int boxId, unsigned int colorSchemeIdx) { m_colorScheme[boxId] = (unsigned short)colorSchemeIdx; }
+
+    /*! Computes the 8 corners a..h of a box (numbered as in BoxMesh). */
+    void corners(unsigned int boxId, QVector3D c[8]) const;
+
+    /*! Tests if line in space, defined through starting point p1 and distance/direction d intersects the face
+        with index faceIdx of box boxId.
+    */
+    bool intersects(unsigned int boxId, unsigned int faceIdx, const QVector3D & p1, const QVector3D & d, float & dist) const;
+
+    /*! Finds the box face closest to p1 that is hit from outside by line "p1 + d [0..1]" and stores it in po,
+        if it is closer than po.m_dist. Returns true if a closer hit was found.
+        Axis-aligned boxes are tested with the slab test kernel of the current simdLevel() (see nearestRayBoxHit()).
+    */
+    bool pick(const QVector3D & p1, const QVector3D & d, PickObject & po) const;
+
+    /*! Parallel version of pick(): the box range is split into blockCount blocks (0 = one block per thread, small sets
+        are searched serially) which are searched in parallel on the thread pool, each with
+        its own nearest hit. The block results are reduced afterwards, so the result is identical to pick().
+        Must not be called from a task running on the same pool.
+    */
+    bool pick(const QVector3D & p1, const QVector3D & d, PickObject & po, ThreadPool & pool, unsigned int blockCount = 0) const;
+
+    /*! Fills in vertex and element data of box boxId, which are stored at offset boxId*BoxMesh::VertexCount and
+        boxId*BoxMesh::IndexCount in the given buffers (same layout as BoxMesh::copy2Buffer()).
+        Boxes can therefore be written independently and in any order.
+    */
+    void copy2Buffer(unsigned int boxId, Vertex * vertexBuffer, GLuint * elementBuffer) const;
+
+    /*! Fills in vertex and element data of all boxes, buffers must hold size()*BoxMesh::VertexCount vertexes and
+        size()*BoxMesh::IndexCount indexes. The box range is split into blockCount blocks (0 = one block per thread)
+        that are written in parallel on the thread pool.
+    */
+    void copy2Buffer(Vertex * vertexBuffer, GLuint * elementBuffer, ThreadPool & pool, unsigned int blockCount = 0) const;
+
+    /*! Colors of the faces front, right, back, left, bottom, top. */
+    struct ColorScheme {
+        float m_rgb[6][3];
+    };
+
+    // box data, one entry per box
+    std::vector<float>			m_centerX;
+    std::vector<float>			m_centerY;
+    std::vector<float>			m_centerZ;
+    std::vector<float>			m_halfExtentX;
+    std::vector<float>			m_halfExtentY;
+    std::vector<float>			m_halfExtentZ;
+    std::vector<unsigned short>	m_orientation;	// index into m_orientations
+    std::vector<unsigned short>	m_colorScheme;	// index into m_colorSchemes
+
+    /*! Rotations of boxes around their centers, index 0 = no rotation. */
+    std::vector<QQuaternion>	m_orientations;
+    std::vector<ColorScheme>	m_colorSchemes;
+
+private:
+    /*! Searches the boxes [first, last) as described in pick(). */
+    bool pickRange(std::size_t first, std::size_t last, const QVector3D & p1, const QVector3D & d, PickObject & po) const;
+
+    /*! Axis-aligned box test (slab test) in box coordinates (origin = box center, without rotation). */
+    bool intersectsLocal(unsigned int boxId, const QVector3D & p1, const QVector3D & d, float & dist, unsigned int & faceIdx) const;
+};
+
+#endif // BOXSET_H
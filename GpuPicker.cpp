@@ -0,0 +1,189 @@
+#include "GpuPicker.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QDebug>
+
+#include <algorithm>
+#include <cstring>
+
+#include "OpenGLException.h"
+
+/*! Invocations per work group, local_size_x in shaders/pick.comp. */
+static const unsigned int GPUPICK_GROUP_SIZE = 64;
+/*! Max. number of work groups in x direction (minimum guaranteed by OpenGL), larger dispatches use rows in y. */
+static const unsigned int GPUPICK_MAX_GROUPS_X = 65535;
+/*! No hit, for the distance bits and the primitive index. */
+static const GLuint GPUPICK_NO_HIT = 0xffffffffu;
+
+/*! Content of the result buffer (std430 layout, see shaders/pick.comp). */
+struct GpuPickBuffer {
+    GLuint	m_distBits;
+    GLuint	m_primitiveId;
+    GLuint	m_vertexId;
+    float	m_u;
+    float	m_v;
+};
+
+
+GpuPicker::GpuPicker() {
+}
+
+
+GpuPicker::GpuPicker(const QString & computeShaderFilePath) :
+    m_computeShaderFilePath(computeShaderFilePath)
+{
+}
+
+
+void GpuPicker::create() {
+    FUNCID(GpuPicker::create);
+    Q_ASSERT(m_program == nullptr);
+
+    m_program = new QOpenGLShaderProgram();
+    if (!m_program->addShaderFromSourceFile(QOpenGLShader::Compute, m_computeShaderFilePath))
+        throw OpenGLException(QString("Error compiling compute shader %1:\n%2").arg(m_computeShaderFilePath).arg(m_program->log()), FUNC_ID);
+    if (!m_program->link())
+        throw OpenGLException(QString("Shader linker error:\n%2").arg(m_program->log()), FUNC_ID);
+
+    QOpenGLExtraFunctions * f = QOpenGLContext::currentContext()->extraFunctions();
+    f->glGenBuffers(1, &m_resultBuffer);
+    f->glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_resultBuffer);
+    f->glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GpuPickBuffer), nullptr, GL_DYNAMIC_COPY);
+    f->glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    f->glGenBuffers(1, &m_readbackBuffer);
+    f->glBindBuffer(GL_COPY_WRITE_BUFFER, m_readbackBuffer);
+    f->glBufferData(GL_COPY_WRITE_BUFFER, sizeof(GpuPickBuffer), nullptr, GL_STREAM_READ);
+    f->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+
+void GpuPicker::destroy() {
+    QOpenGLContext * ctx = QOpenGLContext::currentContext();
+    if (ctx == nullptr || m_program == nullptr)
+        return;
+    QOpenGLExtraFunctions * f = ctx->extraFunctions();
+    if (m_fence != nullptr)
+        f->glDeleteSync(m_fence);
+    m_fence = nullptr;
+    f->glDeleteBuffers(1, &m_readbackBuffer);
+    f->glDeleteBuffers(1, &m_resultBuffer);
+    m_resultBuffer = m_readbackBuffer = 0;
+    delete m_program;
+    m_program = nullptr;
+}
+
+
+void GpuPicker::pickTriangles(GLuint positionBuffer, GLuint indexBuffer, GLenum indexType, unsigned int triangleCount,
+                              const glm::vec3 & origin, const glm::vec3 & dir, float maxDist)
+{
+    runPick(positionBuffer, indexBuffer, indexType == GL_UNSIGNED_SHORT, false, triangleCount, origin, dir, 0, 0, maxDist);
+}
+
+
+void GpuPicker::pickPoints(GLuint positionBuffer, unsigned int pointCount, const glm::vec3 & origin, const glm::vec3 & dir,
+                           float nearTolerance, float farTolerance, float maxDist)
+{
+    // the index buffer is not read, positions are bound in its place
+    runPick(positionBuffer, positionBuffer, false, true, pointCount, origin, dir, nearTolerance, farTolerance, maxDist);
+}
+
+
+void GpuPicker::runPick(GLuint positionBuffer, GLuint indexBuffer, bool shortIndexes, bool points, unsigned int count,
+                        const glm::vec3 & origin, const glm::vec3 & dir, float nearTolerance, float farTolerance,
+                        float maxDist)
+{
+    Q_ASSERT(m_program != nullptr);
+    QOpenGLExtraFunctions * f = QOpenGLContext::currentContext()->extraFunctions();
+    m_pickTimer.start();
+
+    // a new pick replaces a pending one
+    if (m_fence != nullptr) {
+        f->glDeleteSync(m_fence);
+        m_fence = nullptr;
+    }
+    m_pointPick = points;
+
+    static const GpuPickBuffer noHit = { GPUPICK_NO_HIT, GPUPICK_NO_HIT, GPUPICK_NO_HIT, 0.f, 0.f };
+    f->glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_resultBuffer);
+    f->glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GpuPickBuffer), &noHit);
+    f->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, positionBuffer);
+    f->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, indexBuffer);
+    f->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_resultBuffer);
+
+    m_program->bind();
+    m_program->setUniformValue("primitiveCount", GLuint(count));
+    m_program->setUniformValue("points", GLint(points));
+    m_program->setUniformValue("shortIndexes", GLint(shortIndexes));
+    m_program->setUniformValue("origin", QVector3D(origin.x, origin.y, origin.z));
+    m_program->setUniformValue("dir", QVector3D(dir.x, dir.y, dir.z));
+    m_program->setUniformValue("maxDist", maxDist);
+    m_program->setUniformValue("nearTolerance", nearTolerance);
+    m_program->setUniformValue("farTolerance", farTolerance);
+
+    if (count > 0) {
+        const unsigned int groups = (count + GPUPICK_GROUP_SIZE - 1)/GPUPICK_GROUP_SIZE;
+        const unsigned int groupsX = std::min(groups, GPUPICK_MAX_GROUPS_X);
+        const unsigned int groupsY = (groups + groupsX - 1)/groupsX;
+        // pass 0: nearest t, pass 1: lowest primitive index with that t
+        for (GLuint pass=0; pass<2; ++pass) {
+            m_program->setUniformValue("pass", pass);
+            f->glDispatchCompute(groupsX, groupsY, 1);
+            f->glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        }
+        // pass 2: barycentric coordinates and nearest vertex of the hit triangle
+        if (!points) {
+            m_program->setUniformValue("pass", GLuint(2));
+            f->glDispatchCompute(1, 1, 1);
+        }
+    }
+    m_program->release();
+    for (GLuint b=0; b<3; ++b)
+        f->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, b, 0); // also unbinds the generic binding point
+
+    // start the readback into the readback buffer, returns immediately
+    f->glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    f->glBindBuffer(GL_COPY_READ_BUFFER, m_resultBuffer);
+    f->glBindBuffer(GL_COPY_WRITE_BUFFER, m_readbackBuffer);
+    f->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(GpuPickBuffer));
+    f->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    f->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    m_fence = f->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    f->glFlush(); // make sure the fence reaches the GPU, otherwise polling might never see it signaled
+}
+
+
+bool GpuPicker::pollResult(GpuPickResult & result) {
+    if (m_fence == nullptr)
+        return false;
+    QOpenGLExtraFunctions * f = QOpenGLContext::currentContext()->extraFunctions();
+    GLenum state = f->glClientWaitSync(m_fence, 0, 0); // timeout 0: only query the state
+    if (state == GL_TIMEOUT_EXPIRED)
+        return false;
+    f->glDeleteSync(m_fence);
+    m_fence = nullptr;
+    result = GpuPickResult();
+    if (state == GL_WAIT_FAILED) {
+        qWarning() << "Waiting for compute shader pick failed.";
+        return true;
+    }
+
+    f->glBindBuffer(GL_COPY_READ_BUFFER, m_readbackBuffer);
+    const GpuPickBuffer * hit = static_cast<const GpuPickBuffer *>(f->glMapBufferRange(GL_COPY_READ_BUFFER, 0,
+        sizeof(GpuPickBuffer), GL_MAP_READ_BIT));
+    if (hit != nullptr) {
+        if (hit->m_primitiveId != GPUPICK_NO_HIT) {
+            result.m_primitiveId = hit->m_primitiveId;
+            result.m_vertexId = m_pointPick ? hit->m_primitiveId : hit->m_vertexId;
+            const GLuint distBits = hit->m_distBits;
+            std::memcpy(&result.m_dist, &distBits, sizeof(float));
+            result.m_u = hit->m_u;
+            result.m_v = hit->m_v;
+        }
+        f->glUnmapBuffer(GL_COPY_READ_BUFFER);
+    }
+    f->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    m_lastPickMs = m_pickTimer.nsecsElapsed()*1e-6;
+    return true;
+}
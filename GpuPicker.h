@@ -0,0 +1,116 @@
+#ifndef GPUPICKER_H
+#define GPUPICKER_H
+
+#include <QtGui/QOpenGLFunctions>
+#include <QElapsedTimer>
+#include <QString>
+
+#include <glm.hpp>
+
+QT_BEGIN_NAMESPACE
+class QOpenGLShaderProgram;
+QT_END_NAMESPACE
+
+/*! Result of a pick with GpuPicker. */
+struct GpuPickResult {
+    /*! Index of the triangle or point picked, ~0u if nothing was hit. */
+    unsigned int	m_primitiveId = ~0u;
+    /*! Triangles: vertex index (as in the element buffer) of the triangle's vertex nearest to the hit point,
+        points: the point index.
+    */
+    unsigned int	m_vertexId = ~0u;
+    /*! Ray parameter t of the hit (triangles) or of the point projected onto the ray (points). */
+    float			m_dist = 0;
+    /*! Barycentric coordinates of the hit point (triangles only), weights of vertex 1 and 2. */
+    float			m_u = 0;
+    float			m_v = 0;
+};
+
+
+/*! Brute-force picking with a compute shader (shaders/pick.comp, needs OpenGL 4.3), for data that has no
+    CPU-side search structure (yet), e.g. while the BVH of a mesh is still being built.
+
+    The shader tests the pick ray against every triangle (or point) in the vertex and element buffers that are
+    used for drawing, which are bound as shader storage buffers, so no copy of the data is needed. Positions
+    must be tightly packed vec3 floats, indexes 16 or 32 bit (16 bit element buffers must be padded to a
+    multiple of 4 bytes).
+    The tests and the hit definition match the CPU picks (MeshBVH::nearestHit() and PointGrid::nearestPoint()),
+    results may differ in the last bits of t due to the GPU arithmetic.
+
+    The nearest hit is reduced with atomics into a small result buffer: the first dispatch finds the smallest
+    t (atomicMin() on the float bits, which order like unsigned ints for t >= 0), the second one the lowest
+    primitive index with that t. For triangles, a third single invocation computes the barycentric coordinates
+    and the nearest vertex of the winner. Within a work group, the minimum is first taken in shared memory, so
+    there is only one global atomic per group.
+
+    The result is read back asynchronously as in IdPickBuffer: it is copied into a readback buffer followed by a
+    fence, pollResult() only checks the fence and maps the buffer once the GPU has finished.
+
+    Usage (OpenGL context must be current):
+    \code
+    m_gpuPicker.pickTriangles(m_objModel.m_vbo.bufferId(), m_objModel.m_ebo.bufferId(), m_objModel.m_indexType,
+                              triangleCount, nearPoint, farPoint - nearPoint, 1.f);
+    ...
+    // in following frames
+    GpuPickResult res;
+    if (m_gpuPicker.pickPending() && m_gpuPicker.pollResult(res)) { ... }
+    \endcode
+*/
+class GpuPicker {
+public:
+    GpuPicker();
+    explicit GpuPicker(const QString & computeShaderFilePath);
+
+    /*! The function is called during OpenGL initialization, where the OpenGL context is current.
+        Compiles the compute shader, throws an OpenGLException on error.
+    */
+    void create();
+    void destroy();
+
+    /*! Starts a pick of the nearest triangle hit by the ray "origin + t*dir" with 0 <= t < maxDist (both sides of a
+        triangle count). positionBuffer holds the vertex positions, indexBuffer the triangle indexes (3 per
+        triangle) of type indexType (GL_UNSIGNED_SHORT or GL_UNSIGNED_INT). A pending pick is replaced.
+    */
+    void pickTriangles(GLuint positionBuffer, GLuint indexBuffer, GLenum indexType, unsigned int triangleCount,
+                       const glm::vec3 & origin, const glm::vec3 & dir, float maxDist);
+
+    /*! Starts a pick of the front-most of pointCount points (positionBuffer) near the segment "origin + t*dir" with
+        0 <= t <= 1 and t < maxDist, with a tolerance growing linearly from nearTolerance (t = 0) to farTolerance (t = 1),
+        as in PointGrid::nearestPoint(). A pending pick is replaced.
+    */
+    void pickPoints(GLuint positionBuffer, unsigned int pointCount, const glm::vec3 & origin, const glm::vec3 & dir,
+                    float nearTolerance, float farTolerance, float maxDist);
+
+    /*! True while a pick is in progress (between the pick call and the pollResult() that returns true). */
+    bool pickPending() const { return m_fence != nullptr; }
+
+    /*! Checks (without waiting) if the pick has finished. If so, returns true and the hit in result
+        (m_primitiveId = ~0u if nothing was hit).
+    */
+    bool pollResult(GpuPickResult & result);
+
+    /*! Path to the compute shader, used in create(). */
+    QString					m_computeShaderFilePath;
+
+    /*! Time from the pick call until pollResult() returned the result, in ms. */
+    double					m_lastPickMs = 0;
+
+private:
+    /*! Binds the buffers, runs the dispatches and starts the readback. */
+    void runPick(GLuint positionBuffer, GLuint indexBuffer, bool shortIndexes, bool points, unsigned int count,
+                 const glm::vec3 & origin, const glm::vec3 & dir, float nearTolerance, float farTolerance, float maxDist);
+
+    QOpenGLShaderProgram	*m_program = nullptr;
+    /*! Shader storage buffer, receives the reduced hit. */
+    GLuint					m_resultBuffer = 0;
+    /*! Copy of the result buffer, mapped by pollResult(). */
+    GLuint					m_readbackBuffer = 0;
+    /*! Fence inserted after the readback, nullptr if no pick is pending. */
+    GLsync					m_fence = nullptr;
+    /*! True if the pending pick is a point pick. */
+    bool					m_pointPick = false;
+
+    QElapsedTimer			m_pickTimer;
+};
+
+#endif // GPUPICKER_H
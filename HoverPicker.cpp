@@ -0,0 +1,96 @@
+#include "HoverPicker.h"
+
+#include "PickObject.h"
+
+HoverPicker::HoverPicker(PickFunction pickFunction, QObject * parent) :
+    QObject(parent),
+    m_pickFunction(pickFunction)
+{
+    qRegisterMetaType<HoverPickResult>();
+    m_clock.start();
+}
+
+
+HoverPicker::~HoverPicker() {
+    stop();
+}
+
+
+quint64 HoverPicker::postRay(const glm::vec3 & nearPoint, const glm::vec3 & farPoint) {
+    quint64 serial;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stop)
+            return 0;
+        m_nearPoint = nearPoint;
+        m_farPoint = farPoint;
+        m_postTime = m_clock.nsecsElapsed();
+        m_rayPending = true;
+        serial = ++m_serial;
+        if (!m_worker.joinable())
+            m_worker = std::thread(&HoverPicker::workerLoop, this);
+    }
+    m_wakeCondition.notify_one();
+    return serial;
+}
+
+
+void HoverPicker::cancel() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_rayPending = false;
+    ++m_serial; // a running pick is outdated now
+}
+
+
+void HoverPicker::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+        m_rayPending = false;
+        ++m_serial;
+    }
+    m_wakeCondition.notify_one();
+    if (m_worker.joinable())
+        m_worker.join();
+}
+
+
+void HoverPicker::workerLoop() {
+    for (;;) {
+        HoverPickResult result;
+        glm::vec3 nearPoint, farPoint;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeCondition.wait(lock, [this]() { return m_stop || m_rayPending; });
+            if (m_stop)
+                return;
+            m_rayPending = false;
+            nearPoint = m_nearPoint;
+            farPoint = m_farPoint;
+            result.m_serial = m_serial;
+            result.m_postTime = m_postTime;
+        }
+
+        QElapsedTimer pickTimer;
+        pickTimer.start();
+        // distance is a value between 0 and 1, so initialize with 2 (very far back)
+        PickObject po(2.f, ~0u);
+        result.m_hit = m_pickFunction(nearPoint, farPoint, po);
+        result.m_pickMs = pickTimer.nsecsElapsed()*1e-6;
+        if (result.m_hit) {
+            result.m_objectId = po.m_objectId;
+            result.m_faceId = po.m_faceId;
+            result.m_dist = po.m_dist;
+        }
+
+        // superseded while picking? then the result is of no interest anymore
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_stop)
+                return;
+            if (result.m_serial != m_serial)
+                continue;
+        }
+        emit picked(result);
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef HOVERPICKER_H
+#define HOVERPICKER_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QMetaType>
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include <glm.hpp>
+
+struct PickObject;
+
+/*! Result of a hover pick, delivered with HoverPicker::picked(). */
+struct HoverPickResult {
+    /*! Serial number of the ray (as returned by HoverPicker::postRay()). */
+    quint64			m_serial = 0;
+    /*! Time at which the ray was posted, in ns of HoverPicker::elapsedNs(). */
+    qint64			m_postTime = 0;
+    /*! Time spent in the pick function, in ms. */
+    double			m_pickMs = 0;
+    /*! True if the pick function reported a hit, the other members are then taken from its pick object. */
+    bool			m_hit = false;
+    unsigned int	m_objectId = 0;
+    unsigned int	m_faceId = 0;
+    float			m_dist = 0;
+};
+
+Q_DECLARE_METATYPE(HoverPickResult)
+
+
+/*! Runs hover picks (pick on mouse move) on a background thread, so that the GUI thread never waits for a pick.
+
+    postRay() only stores the ray and wakes the worker thread. Only the latest ray is kept: a ray that has not
+    been picked yet when a newer ray is posted is dropped, and the result of a pick that was superseded while it
+    was running is discarded. A running pick itself is not interrupted (a BVH pick takes microseconds).
+
+    Results are emitted with the signal picked() from the worker thread, connect with Qt::QueuedConnection (or
+    AutoConnection to a receiver living in the GUI thread) to receive them in the event loop.
+
+    Mind: the pick function is called from the worker thread, so all data it reads must stay valid and unchanged
+    while the picker runs. Destroy the picker (or call stop()) before that data is modified or destroyed.
+*/
+class HoverPicker : public QObject {
+    Q_OBJECT
+public:
+    /*! Picks along the line from nearPoint to farPoint and stores the nearest hit in po, returns true on a hit. */
+    typedef std::function<bool(const glm::vec3 & nearPoint, const glm::vec3 & farPoint, PickObject & po)> PickFunction;
+
+    /*! The worker thread is started when the first ray is posted. */
+    explicit HoverPicker(PickFunction pickFunction, QObject * parent = nullptr);
+    ~HoverPicker() override;
+
+    /*! Posts the ray for the next pick and returns its serial number, replaces a ray not yet picked. */
+    quint64 postRay(const glm::vec3 & nearPoint, const glm::vec3 & farPoint);
+
+    /*! Drops a pending ray and discards the result of a running pick (e.g. when the mouse leaves the view). */
+    void cancel();
+
+    /*! Stops and joins the worker thread, pending and running picks are discarded. */
+    void stop();
+
+    /*! Monotonic time in ns, used for HoverPickResult::m_postTime. */
+    qint64 elapsedNs() const { return m_clock.nsecsElapsed(); }
+
+signals:
+    /*! Emitted (from the worker thread) with the result of each pick that was not superseded. */
+    void picked(HoverPickResult result);
+
+private:
+    void workerLoop();
+
+    PickFunction			m_pickFunction;
+    QElapsedTimer			m_clock;
+
+    std::thread				m_worker;
+    /*! Protects the request state below. */
+    std::mutex				m_mutex;
+    std::condition_variable	m_wakeCondition;
+
+    bool					m_stop = false;
+    /*! True if a ray has been posted, but not yet taken by the worker. */
+    bool					m_rayPending = false;
+    glm::vec3				m_nearPoint;
+    glm::vec3				m_farPoint;
+    qint64					m_postTime = 0;
+    /*! Serial number of the latest ray, results of older rays are discarded. */
+    quint64					m_serial = 0;
+};
+
+#endif // HOVERPICKER_H
@@ -0,0 +1,161 @@
+#include "IdPickBuffer.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QDebug>
+
+#include <algorithm>
+#include <climits>
+
+/*! Number of unsigned ints per pixel (GL_RGBA32UI). */
+static const int ID_COMPONENTS = 4;
+
+void IdPickBuffer::create() {
+    QOpenGLExtraFunctions * f = QOpenGLContext::currentContext()->extraFunctions();
+    f->glGenFramebuffers(1, &m_fbo);
+    f->glGenRenderbuffers(1, &m_idRenderbuffer);
+    f->glGenRenderbuffers(1, &m_depthRenderbuffer);
+    f->glGenBuffers(1, &m_pbo);
+    m_width = m_height = 0; // storage is allocated in the first beginPick()
+}
+
+
+void IdPickBuffer::destroy() {
+    QOpenGLContext * ctx = QOpenGLContext::currentContext();
+    if (ctx == nullptr || m_fbo == 0)
+        return;
+    QOpenGLExtraFunctions * f = ctx->extraFunctions();
+    if (m_fence != nullptr)
+        f->glDeleteSync(m_fence);
+    m_fence = nullptr;
+    f->glDeleteBuffers(1, &m_pbo);
+    f->glDeleteRenderbuffers(1, &m_depthRenderbuffer);
+    f->glDeleteRenderbuffers(1, &m_idRenderbuffer);
+    f->glDeleteFramebuffers(1, &m_fbo);
+    m_fbo = m_idRenderbuffer = m_depthRenderbuffer = m_pbo = 0;
+}
+
+
+bool IdPickBuffer::beginPick(int width, int height, int x, int y, int radius) {
+    Q_ASSERT(m_fbo != 0);
+    QOpenGLExtraFunctions * f = QOpenGLContext::currentContext()->extraFunctions();
+    m_pickTimer.start();
+
+    // a new pick replaces a pending one
+    if (m_fence != nullptr) {
+        f->glDeleteSync(m_fence);
+        m_fence = nullptr;
+    }
+    m_windowWidth = m_windowHeight = 0;
+    m_depthTestEnabled = f->glIsEnabled(GL_DEPTH_TEST);
+    m_scissorTestEnabled = f->glIsEnabled(GL_SCISSOR_TEST);
+
+    f->glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+    if (width != m_width || height != m_height) {
+        f->glBindRenderbuffer(GL_RENDERBUFFER, m_idRenderbuffer);
+        f->glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA32UI, width, height);
+        f->glBindRenderbuffer(GL_RENDERBUFFER, m_depthRenderbuffer);
+        f->glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        f->glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        f->glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_idRenderbuffer);
+        f->glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depthRenderbuffer);
+        m_width = width;
+        m_height = height;
+    }
+    if (f->glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        qWarning() << "ID pick framebuffer incomplete, pick skipped.";
+        m_width = m_height = 0;
+        return false;
+    }
+
+    // pick window, clipped to the framebuffer
+    m_pickX = x;
+    m_pickY = y;
+    m_windowX = std::max(x - radius, 0);
+    m_windowY = std::max(y - radius, 0);
+    m_windowWidth = std::min(x + radius + 1, width) - m_windowX;
+    m_windowHeight = std::min(y + radius + 1, height) - m_windowY;
+    if (m_windowWidth <= 0 || m_windowHeight <= 0) {
+        m_windowWidth = m_windowHeight = 0;
+        return false;
+    }
+
+    f->glViewport(0, 0, width, height);
+    f->glEnable(GL_SCISSOR_TEST);
+    f->glScissor(m_windowX, m_windowY, m_windowWidth, m_windowHeight);
+    f->glEnable(GL_DEPTH_TEST);
+    f->glDepthMask(GL_TRUE);
+    static const GLuint noId[ID_COMPONENTS] = {0, 0, 0, 0};
+    f->glClearBufferuiv(GL_COLOR, 0, noId);
+    static const GLfloat farDepth = 1.f;
+    f->glClearBufferfv(GL_DEPTH, 0, &farDepth);
+    return true;
+}
+
+
+void IdPickBuffer::endPick(GLuint defaultFbo) {
+    QOpenGLExtraFunctions * f = QOpenGLContext::currentContext()->extraFunctions();
+
+    if (m_windowWidth > 0) {
+        // start readback into the pixel buffer object, glReadPixels() returns immediately
+        f->glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbo);
+        f->glBufferData(GL_PIXEL_PACK_BUFFER, m_windowWidth*m_windowHeight*ID_COMPONENTS*sizeof(GLuint), nullptr, GL_STREAM_READ);
+        f->glReadBuffer(GL_COLOR_ATTACHMENT0);
+        f->glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        f->glReadPixels(m_windowX, m_windowY, m_windowWidth, m_windowHeight, GL_RGBA_INTEGER, GL_UNSIGNED_INT, nullptr);
+        f->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        m_fence = f->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        f->glFlush(); // make sure the fence reaches the GPU, otherwise polling might never see it signaled
+    }
+
+    if (!m_scissorTestEnabled)
+        f->glDisable(GL_SCISSOR_TEST);
+    if (!m_depthTestEnabled)
+        f->glDisable(GL_DEPTH_TEST);
+    f->glBindFramebuffer(GL_FRAMEBUFFER, defaultFbo);
+}
+
+
+bool IdPickBuffer::pollResult(IdPickResult & result) {
+    if (m_fence == nullptr)
+        return false;
+    QOpenGLExtraFunctions * f = QOpenGLContext::currentContext()->extraFunctions();
+    GLenum state = f->glClientWaitSync(m_fence, 0, 0); // timeout 0: only query the state
+    if (state == GL_TIMEOUT_EXPIRED)
+        return false;
+    f->glDeleteSync(m_fence);
+    m_fence = nullptr;
+    result = IdPickResult();
+    if (state == GL_WAIT_FAILED) {
+        qWarning() << "Waiting for ID pick readback failed.";
+        return true;
+    }
+
+    f->glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbo);
+    const GLuint * ids = static_cast<const GLuint *>(f->glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+        m_windowWidth*m_windowHeight*ID_COMPONENTS*sizeof(GLuint), GL_MAP_READ_BIT));
+    if (ids != nullptr) {
+        // the ID nearest to the pick pixel wins, rows are stored bottom up
+        int bestDist2 = INT_MAX;
+        for (int j=0; j<m_windowHeight; ++j)
+            for (int i=0; i<m_windowWidth; ++i) {
+                const GLuint * id = ids + (j*m_windowWidth + i)*ID_COMPONENTS;
+                if (id[0] == 0)
+                    continue;
+                int dx = m_windowX + i - m_pickX;
+                int dy = m_windowY + j - m_pickY;
+                if (dx*dx + dy*dy < bestDist2) {
+                    bestDist2 = dx*dx + dy*dy;
+                    result.m_objectId = id[0];
+                    result.m_primitiveId = id[1];
+                    result.m_vertexId = id[2];
+                    result.m_x = m_windowX + i;
+                    result.m_y = m_windowY + j;
+                }
+            }
+        f->glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    f->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    m_lastPickMs = m_pickTimer.nsecsElapsed()*1e-6;
+    return true;
+}
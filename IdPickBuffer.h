@@ -0,0 +1,102 @@
+#ifndef IDPICKBUFFER_H
+#define IDPICKBUFFER_H
+
+#include <QtGui/QOpenGLFunctions>
+#include <QElapsedTimer>
+
+/*! Result of a pick with IdPickBuffer. */
+struct IdPickResult {
+    /*! Object ID as set in the ID shader (uniform objectId), 0 if nothing was found in the pick window. */
+    unsigned int	m_objectId = 0;
+    /*! Primitive (triangle or point) index within the draw call. */
+    unsigned int	m_primitiveId = 0;
+    /*! Vertex index (as in the element buffer) of the primitive's vertex nearest to the picked pixel. */
+    unsigned int	m_vertexId = 0;
+    /*! Pixel (OpenGL window coordinates, origin at bottom left) at which the ID was found. */
+    int				m_x = 0;
+    int				m_y = 0;
+};
+
+
+/*! Picking by rendering IDs into an offscreen integer framebuffer (GPU ID buffer).
+
+    A pick renders all pickable objects with an ID shader program (shaders/id.frag, which writes
+    uvec4(objectId, primitiveId, vertexId, 0) into a GL_RGBA32UI color buffer) into a framebuffer of the size
+    of the viewport. Only a small window around the cursor is cleared and rasterized (scissor test), so the
+    GPU cost hardly depends on the scene size.
+
+    The window is read back asynchronously: endPick() starts glReadPixels() into a pixel buffer object and
+    inserts a fence, pollResult() only checks the fence (without waiting) and maps the buffer once the GPU
+    has finished. So the GUI thread never stalls on the readback, the caller simply polls again in the next frame.
+
+    Usage (OpenGL context must be current):
+    \code
+    if (m_idPickBuffer.beginPick(width, height, x, y, radius)) {
+        // bind ID shader program, set uniforms worldToView and objectId, render objects
+    }
+    m_idPickBuffer.endPick(m_context->defaultFramebufferObject());
+    ...
+    // in following frames
+    IdPickResult res;
+    if (m_idPickBuffer.pickPending() && m_idPickBuffer.pollResult(res)) { ... }
+    \endcode
+*/
+class IdPickBuffer {
+public:
+    /*! The function is called during OpenGL initialization, where the OpenGL context is current. */
+    void create();
+    void destroy();
+
+    /*! Binds the ID framebuffer (resized to width x height if needed) and prepares rendering of the
+        pick window with radius pixels around the pixel x, y (OpenGL window coordinates): clears IDs and depth
+        within the window, enables scissor and depth test.
+        Returns false if the framebuffer cannot be used or the window is outside, nothing needs to be rendered then.
+        endPick() must be called in any case.
+    */
+    bool beginPick(int width, int height, int x, int y, int radius);
+
+    /*! Starts the asynchronous readback of the pick window, restores the OpenGL state changed in beginPick()
+        and binds the framebuffer defaultFbo again.
+    */
+    void endPick(GLuint defaultFbo);
+
+    /*! True while a readback is in progress (between endPick() and the pollResult() that returns true). */
+    bool pickPending() const { return m_fence != nullptr; }
+
+    /*! Checks (without waiting) if the readback has finished. If so, returns true and the ID nearest to the
+        pick pixel in result (m_objectId = 0 if the pick window contains no IDs).
+    */
+    bool pollResult(IdPickResult & result);
+
+    /*! Time from beginPick() until pollResult() returned the result, in ms. */
+    double m_lastPickMs = 0;
+
+private:
+    GLuint			m_fbo = 0;
+    GLuint			m_idRenderbuffer = 0;
+    GLuint			m_depthRenderbuffer = 0;
+    /*! Pixel buffer object, receives the IDs of the pick window. */
+    GLuint			m_pbo = 0;
+    /*! Fence inserted after the readback, nullptr if no pick is pending. */
+    GLsync			m_fence = nullptr;
+
+    /*! Current size of the framebuffer. */
+    int				m_width = 0;
+    int				m_height = 0;
+
+    /*! Pick pixel and pick window (clipped to the framebuffer). */
+    int				m_pickX = 0;
+    int				m_pickY = 0;
+    int				m_windowX = 0;
+    int				m_windowY = 0;
+    int				m_windowWidth = 0;
+    int				m_windowHeight = 0;
+
+    /*! State to restore in endPick(). */
+    bool			m_depthTestEnabled = false;
+    bool			m_scissorTestEnabled = false;
+
+    QElapsedTimer	m_pickTimer;
+};
+
+#endif // IDPICKBUFFER_H
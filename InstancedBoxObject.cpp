@@ -0,0 +1,203 @@
+#include "InstancedBoxObject.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QDebug>
+
+#include <algorithm>
+
+/*! Vertex of the unit cube. */
+struct CubeVertex {
+    float x, y, z;
+    float shade;	// brightness factor
+};
+
+static const unsigned int CUBE_VERTEX_COUNT = 6*4;  // 6 faces, 4 vertexes each (faces are shaded individually)
+static const unsigned int CUBE_INDEX_COUNT = 6*2*3; // 6 faces, 2 triangles each, 3 indexes per triangle
+
+
+/*! Creates the unit cube with the same corner numbering and face order as BoxMesh. */
+static void createUnitCube(std::vector<CubeVertex> & vertexes, std::vector<GLushort> & elements) {
+    static const float corners[8][3] = {
+        {-1, -1,  1}, { 1, -1,  1}, { 1,  1,  1}, {-1,  1,  1}, // a, b, c, d
+        {-1, -1, -1}, { 1, -1, -1}, { 1,  1, -1}, {-1,  1, -1}  // e, f, g, h
+    };
+    // front, right, back, left, bottom, top; vertexes in counter-clockwise order
+    static const unsigned int faces[6][4] = {
+        {0, 1, 2, 3}, {1, 5, 6, 2}, {5, 4, 7, 6}, {4, 0, 3, 7}, {4, 5, 1, 0}, {3, 2, 6, 7}
+    };
+    vertexes.resize(CUBE_VERTEX_COUNT);
+    elements.resize(CUBE_INDEX_COUNT);
+    for (unsigned int f=0; f<6; ++f) {
+        const float * a = corners[faces[f][0]];
+        const float * c = corners[faces[f][2]];
+        for (unsigned int i=0; i<4; ++i) {
+            const float * p = corners[faces[f][i]];
+            CubeVertex & v = vertexes[f*4 + i];
+            v.x = p[0];
+            v.y = p[1];
+            v.z = p[2];
+            // darken the bottom left and bottom right nodes of side faces, same as BoxMesh
+            v.shade = (i < 2 && a[1] < c[1]) ? 0.5f : 1.f;
+        }
+        // two triangles: a, b, d  and b, c, d
+        GLushort * e = elements.data() + f*6;
+        e[0] = GLushort(f*4);
+        e[1] = GLushort(f*4 + 1);
+        e[2] = GLushort(f*4 + 3);
+        e[3] = GLushort(f*4 + 1);
+        e[4] = GLushort(f*4 + 2);
+        e[5] = GLushort(f*4 + 3);
+    }
+}
+
+
+static InstancedBoxObject::BoxAttributes boxAttributes(float halfExtent, const QColor & color) {
+    InstancedBoxObject::BoxAttributes attribs;
+    attribs.m_halfExtent = halfExtent;
+    attribs.m_color[0] = (unsigned char)color.red();
+    attribs.m_color[1] = (unsigned char)color.green();
+    attribs.m_color[2] = (unsigned char)color.blue();
+    attribs.m_color[3] = (unsigned char)color.alpha();
+    return attribs;
+}
+
+
+InstancedBoxObject::InstancedBoxObject() :
+    m_cubeVbo(QOpenGLBuffer::VertexBuffer),
+    m_cubeEbo(QOpenGLBuffer::IndexBuffer),
+    m_centerVbo(QOpenGLBuffer::VertexBuffer),
+    m_attributeVbo(QOpenGLBuffer::VertexBuffer)
+{
+}
+
+
+void InstancedBoxObject::setBoxes(const glm::vec3 * centers, std::size_t count, float halfExtent, const QColor & color) {
+    // centers are copied as they are, no per-box geometry is generated
+    m_centers.assign(centers, centers + count);
+    m_attributes.assign(count, boxAttributes(halfExtent, color));
+
+    if (m_centerVbo.isCreated()) {
+        m_centerVbo.bind();
+        m_centerVbo.allocate(m_centers.data(), int(m_centers.size()*sizeof(glm::vec3)));
+        m_centerVbo.release();
+        m_attributeVbo.bind();
+        m_attributeVbo.allocate(m_attributes.data(), int(m_attributes.size()*sizeof(BoxAttributes)));
+        m_attributeVbo.release();
+    }
+}
+
+
+void InstancedBoxObject::setBoxColor(unsigned int boxId, const QColor & color) {
+    Q_ASSERT(boxId < m_attributes.size());
+    m_attributes[boxId] = boxAttributes(m_attributes[boxId].m_halfExtent, color);
+    if (m_attributeVbo.isCreated()) {
+        m_attributeVbo.bind();
+        m_attributeVbo.write(int(boxId*sizeof(BoxAttributes)), &m_attributes[boxId], sizeof(BoxAttributes));
+        m_attributeVbo.release();
+    }
+}
+
+
+void InstancedBoxObject::setBoxColors(const std::vector<unsigned int> & boxIds, const QColor & color) {
+    if (boxIds.empty())
+        return;
+    unsigned int firstId = boxIds[0], lastId = boxIds[0];
+    for (unsigned int boxId : boxIds) {
+        Q_ASSERT(boxId < m_attributes.size());
+        m_attributes[boxId] = boxAttributes(m_attributes[boxId].m_halfExtent, color);
+        firstId = std::min(firstId, boxId);
+        lastId = std::max(lastId, boxId);
+    }
+    if (m_attributeVbo.isCreated()) {
+        m_attributeVbo.bind();
+        m_attributeVbo.write(int(firstId*sizeof(BoxAttributes)), &m_attributes[firstId],
+                             int((lastId - firstId + 1)*sizeof(BoxAttributes)));
+        m_attributeVbo.release();
+    }
+}
+
+
+void InstancedBoxObject::create(QOpenGLShaderProgram * shaderProgramm) {
+    std::vector<CubeVertex> cubeVertexes;
+    std::vector<GLushort> cubeElements;
+    createUnitCube(cubeVertexes, cubeElements);
+
+    QOpenGLExtraFunctions * f = QOpenGLContext::currentContext()->extraFunctions();
+
+    // create and bind Vertex Array Object
+    m_vao.create();
+    m_vao.bind();
+
+    // unit cube, shared by all instances
+    m_cubeVbo.create();
+    m_cubeVbo.bind();
+    m_cubeVbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+    m_cubeVbo.allocate(cubeVertexes.data(), int(cubeVertexes.size()*sizeof(CubeVertex)));
+    // index 0 = corner position
+    shaderProgramm->enableAttributeArray(0);
+    shaderProgramm->setAttributeBuffer(0, GL_FLOAT, offsetof(CubeVertex, x), 3, sizeof(CubeVertex));
+    // index 1 = brightness
+    shaderProgramm->enableAttributeArray(1);
+    shaderProgramm->setAttributeBuffer(1, GL_FLOAT, offsetof(CubeVertex, shade), 1, sizeof(CubeVertex));
+
+    m_cubeEbo.create();
+    m_cubeEbo.bind();
+    m_cubeEbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+    m_cubeEbo.allocate(cubeElements.data(), int(cubeElements.size()*sizeof(GLushort)));
+
+    // per instance: box centers
+    m_centerVbo.create();
+    m_centerVbo.bind();
+    m_centerVbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+    int centerMemSize = int(m_centers.size()*sizeof(glm::vec3));
+    qDebug() << "InstancedBoxObject - CenterBuffer size =" << centerMemSize/1024.0 << "kByte";
+    m_centerVbo.allocate(m_centers.data(), centerMemSize);
+    // index 2 = center, advanced once per instance
+    shaderProgramm->enableAttributeArray(2);
+    shaderProgramm->setAttributeBuffer(2, GL_FLOAT, 0, 3, sizeof(glm::vec3));
+    f->glVertexAttribDivisor(2, 1);
+
+    // per instance: half extent and color
+    m_attributeVbo.create();
+    m_attributeVbo.bind();
+    m_attributeVbo.setUsagePattern(QOpenGLBuffer::DynamicDraw); // colors change when highlighting
+    int attributeMemSize = int(m_attributes.size()*sizeof(BoxAttributes));
+    qDebug() << "InstancedBoxObject - AttributeBuffer size =" << attributeMemSize/1024.0 << "kByte";
+    m_attributeVbo.allocate(m_attributes.data(), attributeMemSize);
+    // index 3 = half extent
+    shaderProgramm->enableAttributeArray(3);
+    shaderProgramm->setAttributeBuffer(3, GL_FLOAT, offsetof(BoxAttributes, m_halfExtent), 1, sizeof(BoxAttributes));
+    f->glVertexAttribDivisor(3, 1);
+    // index 4 = color, unsigned bytes normalized to 0..1 by setAttributeBuffer()
+    shaderProgramm->enableAttributeArray(4);
+    shaderProgramm->setAttributeBuffer(4, GL_UNSIGNED_BYTE, offsetof(BoxAttributes, m_color), 4, sizeof(BoxAttributes));
+    f->glVertexAttribDivisor(4, 1);
+
+    // Release (unbind) all
+    m_vao.release();
+    m_attributeVbo.release();
+    m_cubeEbo.release();
+}
+
+
+void InstancedBoxObject::destroy() {
+    m_vao.destroy();
+    m_cubeVbo.destroy();
+    m_cubeEbo.destroy();
+    m_centerVbo.destroy();
+    m_attributeVbo.destroy();
+}
+
+
+void InstancedBoxObject::render() {
+    if (m_centers.empty())
+        return;
+
+    m_vao.bind();
+    // one unit cube per box, positioned, scaled and colored in the vertex shader
+    QOpenGLContext::currentContext()->extraFunctions()->glDrawElementsInstanced(
+                GL_TRIANGLES, CUBE_INDEX_COUNT, GL_UNSIGNED_SHORT, nullptr, GLsizei(m_centers.size()));
+    m_vao.release();
+}
@@ -0,0 +1,80 @@
+#ifndef INSTANCEDBOXOBJECT_H
+#define INSTANCEDBOXOBJECT_H
+
+#include <QOpenGLBuffer>
+#include <QOpenGLVertexArrayObject>
+#include <QColor>
+
+#include <vector>
+
+#include <glm.hpp>
+
+QT_BEGIN_NAMESPACE
+class QOpenGLShaderProgram;
+QT_END_NAMESPACE
+
+/*! Draws many axis-aligned, cube-shaped boxes (e.g. one box per point of a point cloud) with a single
+    instanced draw call.
+
+    Only one unit cube (24 vertexes, 36 indexes) is stored. Each box is an instance, defined by its center
+    (12 bytes, copied 1:1 from the point array) and its attributes (half extent and packed RGBA color, 8 bytes).
+    In contrast to BoxMesh, which expands each box into 24 Vertex and 36 indexes (720 bytes), a box needs
+    only 20 bytes of CPU and GPU memory.
+
+    The boxes are drawn with the shader program shaders/boxInstances.vert/simple.frag, which is passed to
+    create(). Attribute locations:
+    - 0 = vec3 corner of unit cube (-1..1)
+    - 1 = float brightness factor of corner
+    - 2 = vec3 box center (per instance)
+    - 3 = float half extent (per instance)
+    - 4 = vec4 color (per instance, stored as normalized unsigned bytes)
+*/
+class InstancedBoxObject {
+public:
+    InstancedBoxObject();
+
+    /*! Sets all boxes at once, one box per center point, all with the same size and color.
+        Can be called before create(), otherwise the buffers are updated, OpenGL context must be current then.
+    */
+    void setBoxes(const glm::vec3 * centers, std::size_t count, float halfExtent, const QColor & color);
+
+    /*! Changes color of a single box (e.g. to highlight it), only the changed bytes are transferred.
+        OpenGL context must be current if called after create().
+    */
+    void setBoxColor(unsigned int boxId, const QColor & color);
+
+    /*! Changes color of several boxes (e.g. a selection), the changed range of the attribute buffer is
+        transferred at once. OpenGL context must be current if called after create().
+    */
+    void setBoxColors(const std::vector<unsigned int> & boxIds, const QColor & color);
+
+    std::size_t boxCount() const { return m_centers.size(); }
+
+    /*! The function is called during OpenGL initialization, where the OpenGL context is current. */
+    void create(QOpenGLShaderProgram * shaderProgramm);
+    void destroy();
+
+    void render();
+
+    /*! Per-instance attributes besides the center. */
+    struct BoxAttributes {
+        float			m_halfExtent;
+        unsigned char	m_color[4]; // r, g, b, a
+    };
+
+    std::vector<glm::vec3>		m_centers;
+    std::vector<BoxAttributes>	m_attributes;
+
+    /*! Wraps an OpenGL VertexArrayObject, that references the cube and instance buffers. */
+    QOpenGLVertexArrayObject	m_vao;
+    /*! Holds the unit cube (corner coordinates and brightness factor). */
+    QOpenGLBuffer				m_cubeVbo;
+    /*! Holds unit cube elements. */
+    QOpenGLBuffer				m_cubeEbo;
+    /*! Holds box centers. */
+    QOpenGLBuffer				m_centerVbo;
+    /*! Holds box attributes. */
+    QOpenGLBuffer				m_attributeVbo;
+};
+
+#endif // INSTANCEDBOXOBJECT_H
@@ -0,0 +1,725 @@
+#include "MeshBVH.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <queue>
+#include <utility>
+
+#include <QtGlobal>
+
+#include "SimdSupport.h"
+#include "ThreadPool.h"
+
+/*! Number of bins per axis used to evaluate the SAH. */
+static const unsigned int BVH_BIN_COUNT = 16;
+/*! Cost of traversing a node, relative to the cost of a triangle test. */
+static const float BVH_TRAVERSAL_COST = 1.0f;
+/*! Leaves with more triangles are always split, even if the SAH suggests otherwise. */
+static const unsigned int BVH_MAX_LEAF_SIZE = 16;
+/*! Nodes with fewer triangles are never split. */
+static const unsigned int BVH_MIN_SPLIT_SIZE = 3;
+/*! Below this depth, nodes are split at the median to limit the tree depth (degenerated meshes only). */
+static const unsigned int BVH_MAX_SAH_DEPTH = 64;
+/*! Number of blocks per thread when tracing ray packets, for load balancing (packets differ in cost). */
+static const unsigned int BVH_PACKET_BLOCKS_PER_THREAD = 8;
+/*! refit() updates all nodes if at least this fraction of the triangles changed. */
+static const float BVH_FULL_REFIT_FRACTION = 0.25f;
+/*! Max. depth of the traversal stack, BVH_MAX_SAH_DEPTH plus the depth of median splits of 2^32 triangles. */
+static const unsigned int BVH_STACK_SIZE = BVH_MAX_SAH_DEPTH + 64;
+
+/*! Axis-aligned bounding box used during the build. */
+struct BVHBounds {
+    BVHBounds() : m_min(FLT_MAX), m_max(-FLT_MAX) {}
+
+    void grow(const glm::vec3 & p) {
+        m_min = glm::vec3(std::min(m_min.x, p.x), std::min(m_min.y, p.y), std::min(m_min.z, p.z));
+        m_max = glm::vec3(std::max(m_max.x, p.x), std::max(m_max.y, p.y), std::max(m_max.z, p.z));
+    }
+    void grow(const BVHBounds & b) {
+        grow(b.m_min);
+        grow(b.m_max);
+    }
+    /*! Half of surface area (sufficient for SAH ratios), 0 for empty boxes. */
+    float area() const {
+        if (m_min.x > m_max.x)
+            return 0.f;
+        glm::vec3 e = m_max - m_min;
+        return e.x*e.y + e.y*e.z + e.z*e.x;
+    }
+
+    glm::vec3 m_min;
+    glm::vec3 m_max;
+};
+
+/*! Triangle and centroid bounds and the SAH bins of a triangle range, per axis. */
+struct BVHBins {
+    void add(const BVHBins & other) {
+        m_bounds.grow(other.m_bounds);
+        m_centroidBounds.grow(other.m_centroidBounds);
+        for (unsigned int a=0; a<3; ++a)
+            for (unsigned int b=0; b<BVH_BIN_COUNT; ++b) {
+                m_binBounds[a][b].grow(other.m_binBounds[a][b]);
+                m_binCounts[a][b] += other.m_binCounts[a][b];
+            }
+    }
+
+    BVHBounds		m_bounds;
+    BVHBounds		m_centroidBounds;
+    BVHBounds		m_binBounds[3][BVH_BIN_COUNT];
+    unsigned int	m_binCounts[3][BVH_BIN_COUNT] = {};
+};
+
+
+/*! Triangle reference used during the build. */
+struct BVHTriangle {
+    glm::vec3 centroid() const { return (m_bounds.m_min + m_bounds.m_max)*0.5f; }
+
+    BVHBounds		m_bounds;
+    /*! Original triangle index. */
+    unsigned int	m_id;
+};
+
+
+/*! Build state shared by all build tasks. */
+struct BVHBuilder {
+    /*! Triangles, partitioned in place so that each node references a contiguous range. The bounds are
+        moved along with the triangle index, so that binning reads memory sequentially.
+    */
+    std::vector<BVHTriangle>	m_triangles;
+    std::vector<MeshBVH::Node> *m_nodes;
+    std::atomic<unsigned int>	m_nodeCount;
+
+    /*! Computes node bounds and centroid bounds for the range. */
+    void computeBounds(unsigned int first, unsigned int count, BVHBins & bins) const {
+        for (unsigned int i=first; i<first + count; ++i) {
+            bins.m_bounds.grow(m_triangles[i].m_bounds);
+            bins.m_centroidBounds.grow(m_triangles[i].centroid());
+        }
+    }
+
+    /*! Sorts the triangles of the range into bins, based on the centroid bounds. */
+    void fillBins(unsigned int first, unsigned int count, const BVHBounds & centroidBounds, BVHBins & bins) const {
+        for (unsigned int i=first; i<first + count; ++i) {
+            const glm::vec3 c = m_triangles[i].centroid();
+            for (unsigned int a=0; a<3; ++a) {
+                unsigned int b = binIndex(c[a], centroidBounds, a);
+                bins.m_binBounds[a][b].grow(m_triangles[i].m_bounds);
+                ++bins.m_binCounts[a][b];
+            }
+        }
+    }
+
+    static unsigned int binIndex(float c, const BVHBounds & centroidBounds, unsigned int axis) {
+        float extent = centroidBounds.m_max[axis] - centroidBounds.m_min[axis];
+        if (extent <= 0.f)
+            return 0;
+        int b = int((c - centroidBounds.m_min[axis])*(BVH_BIN_COUNT/extent));
+        return (unsigned int)std::min(std::max(b, 0), int(BVH_BIN_COUNT) - 1);
+    }
+
+    /*! Splits the node (given as leaf with triangle range) into two children, if worthwhile.
+        If pool is given, the triangles are binned in parallel.
+        Returns false if the node remains a leaf.
+    */
+    bool splitNode(unsigned int nodeIdx, unsigned int depth, ThreadPool * pool);
+
+    /*! Builds the entire subtree below the node at the given depth. */
+    void buildSubtree(unsigned int nodeIdx, unsigned int depth) {
+        std::vector<std::pair<unsigned int, unsigned int> > stack(1, std::make_pair(nodeIdx, depth));
+        while (!stack.empty()) {
+            std::pair<unsigned int, unsigned int> n = stack.back();
+            stack.pop_back();
+            if (splitNode(n.first, n.second, nullptr)) {
+                unsigned int left = (*m_nodes)[n.first].m_leftOrFirst;
+                stack.push_back(std::make_pair(left, n.second + 1));
+                stack.push_back(std::make_pair(left + 1, n.second + 1));
+            }
+        }
+    }
+};
+
+
+bool BVHBuilder::splitNode(unsigned int nodeIdx, unsigned int depth, ThreadPool * pool) {
+    MeshBVH::Node & node = (*m_nodes)[nodeIdx];
+    const unsigned int first = node.m_leftOrFirst;
+    const unsigned int count = node.m_count;
+
+    // *** node bounds and centroid bounds
+    BVHBins bins;
+    if (pool != nullptr) {
+        std::vector<BVHBins> blockBins(pool->threadCount());
+        pool->parallelFor(count, (unsigned int)blockBins.size(), [&](std::size_t b, std::size_t e, unsigned int block) {
+            computeBounds(first + (unsigned int)b, (unsigned int)(e - b), blockBins[block]);
+        });
+        for (const BVHBins & b : blockBins)
+            bins.add(b);
+    }
+    else {
+        computeBounds(first, count, bins);
+    }
+    for (unsigned int a=0; a<3; ++a) {
+        node.m_min[a] = bins.m_bounds.m_min[a];
+        node.m_max[a] = bins.m_bounds.m_max[a];
+    }
+    if (count < BVH_MIN_SPLIT_SIZE)
+        return false;
+
+    // *** binning
+    const BVHBounds centroidBounds = bins.m_centroidBounds;
+    if (pool != nullptr) {
+        std::vector<BVHBins> blockBins(pool->threadCount());
+        pool->parallelFor(count, (unsigned int)blockBins.size(), [&](std::size_t b, std::size_t e, unsigned int block) {
+            fillBins(first + (unsigned int)b, (unsigned int)(e - b), centroidBounds, blockBins[block]);
+        });
+        for (const BVHBins & b : blockBins)
+            bins.add(b);
+    }
+    else {
+        fillBins(first, count, centroidBounds, bins);
+    }
+
+    // *** evaluate SAH for all split positions between bins, on all axes
+    float bestCost = FLT_MAX;
+    unsigned int bestAxis = 0;
+    unsigned int bestSplit = 0; // bins [0, bestSplit) go to the left
+    for (unsigned int a=0; a<3; ++a) {
+        if (centroidBounds.m_max[a] <= centroidBounds.m_min[a])
+            continue; // all centroids in one plane, no split possible along this axis
+        float rightArea[BVH_BIN_COUNT];
+        unsigned int rightCount[BVH_BIN_COUNT];
+        BVHBounds box;
+        unsigned int n = 0;
+        for (unsigned int b=BVH_BIN_COUNT - 1; b>0; --b) {
+            box.grow(bins.m_binBounds[a][b]);
+            n += bins.m_binCounts[a][b];
+            rightArea[b] = box.area();
+            rightCount[b] = n;
+        }
+        box = BVHBounds();
+        n = 0;
+        for (unsigned int b=1; b<BVH_BIN_COUNT; ++b) {
+            box.grow(bins.m_binBounds[a][b - 1]);
+            n += bins.m_binCounts[a][b - 1];
+            if (n == 0 || rightCount[b] == 0)
+                continue;
+            float cost = box.area()*n + rightArea[b]*rightCount[b];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = a;
+                bestSplit = b;
+            }
+        }
+    }
+    const float parentArea = bins.m_bounds.area();
+    const float splitCost = parentArea > 0.f ? BVH_TRAVERSAL_COST + bestCost/parentArea : FLT_MAX;
+
+    unsigned int leftCount;
+    if (bestSplit != 0 && splitCost < count && depth < BVH_MAX_SAH_DEPTH) {
+        BVHTriangle * triangles = m_triangles.data();
+        BVHTriangle * mid = std::partition(triangles + first, triangles + first + count, [&](const BVHTriangle & t) {
+            return binIndex(t.centroid()[bestAxis], centroidBounds, bestAxis) < bestSplit;
+        });
+        leftCount = (unsigned int)(mid - (triangles + first));
+    }
+    else if (count > BVH_MAX_LEAF_SIZE) {
+        // SAH gives no useful split (e.g. identical centroids), but the leaf would be too large, or the
+        // tree gets too deep: median split
+        BVHTriangle * triangles = m_triangles.data();
+        unsigned int axis = 0;
+        glm::vec3 extent = centroidBounds.m_max - centroidBounds.m_min;
+        if (extent.y > extent.x)
+            axis = 1;
+        if (extent.z > extent[axis])
+            axis = 2;
+        leftCount = count/2;
+        std::nth_element(triangles + first, triangles + first + leftCount, triangles + first + count,
+                         [axis](const BVHTriangle & a, const BVHTriangle & b) {
+            return a.centroid()[axis] < b.centroid()[axis];
+        });
+    }
+    else {
+        return false;
+    }
+
+    // *** create children, they are allocated in pairs
+    unsigned int left = m_nodeCount.fetch_add(2);
+    MeshBVH::Node & leftNode = (*m_nodes)[left];
+    MeshBVH::Node & rightNode = (*m_nodes)[left + 1];
+    leftNode.m_leftOrFirst = first;
+    leftNode.m_count = leftCount;
+    rightNode.m_leftOrFirst = first + leftCount;
+    rightNode.m_count = count - leftCount;
+    node.m_leftOrFirst = left;
+    node.m_count = 0;
+    return true;
+}
+
+
+void MeshBVH::build(const glm::vec3 * positions, const void * indexes, unsigned int indexSize, std::size_t triangleCount,
+                    ThreadPool & pool)
+{
+    clear();
+    if (triangleCount == 0)
+        return;
+    Q_ASSERT(indexSize == 2 || indexSize == 4);
+
+    // vertex indexes of all triangles as unsigned int
+    std::vector<unsigned int> vertexes(3*triangleCount);
+    pool.parallelFor(3*triangleCount, 0, [&](std::size_t first, std::size_t last, unsigned int) {
+        for (std::size_t i=first; i<last; ++i)
+            vertexes[i] = indexSize == 2 ? static_cast<const unsigned short *>(indexes)[i]
+                                         : static_cast<const unsigned int *>(indexes)[i];
+    });
+
+    BVHBuilder builder;
+    builder.m_triangles.resize(triangleCount);
+    pool.parallelFor(triangleCount, 0, [&](std::size_t first, std::size_t last, unsigned int) {
+        for (std::size_t i=first; i<last; ++i) {
+            BVHTriangle & t = builder.m_triangles[i];
+            t.m_bounds.grow(positions[vertexes[3*i]]);
+            t.m_bounds.grow(positions[vertexes[3*i + 1]]);
+            t.m_bounds.grow(positions[vertexes[3*i + 2]]);
+            t.m_id = (unsigned int)i;
+        }
+    });
+
+    // a binary tree with n leaves has 2n-1 nodes, so the storage is never reallocated during the build
+    m_nodes.resize(2*triangleCount);
+    builder.m_nodes = &m_nodes;
+    builder.m_nodeCount = 1;
+    m_nodes[0].m_leftOrFirst = 0;
+    m_nodes[0].m_count = (unsigned int)triangleCount;
+
+    // *** top levels: large nodes are split one after another, each with parallel binning
+    const std::size_t parallelSplitSize = std::max<std::size_t>(triangleCount/(4*pool.threadCount()), 100000);
+    std::vector<unsigned int> frontier(1, 0);
+    std::vector<std::pair<unsigned int, unsigned int> > subtrees; // node, depth
+    unsigned int depth = 0;
+    for (; !frontier.empty(); ++depth) {
+        std::vector<unsigned int> next;
+        for (unsigned int n : frontier) {
+            if (m_nodes[n].m_count < parallelSplitSize)
+                subtrees.push_back(std::make_pair(n, depth));
+            else if (builder.splitNode(n, depth, &pool)) {
+                next.push_back(m_nodes[n].m_leftOrFirst);
+                next.push_back(m_nodes[n].m_leftOrFirst + 1);
+            }
+        }
+        frontier.swap(next);
+    }
+
+    // *** remaining subtrees are built in parallel, largest first for better load balancing
+    std::sort(subtrees.begin(), subtrees.end(), [this](const std::pair<unsigned int, unsigned int> & a,
+                                                       const std::pair<unsigned int, unsigned int> & b) {
+        return m_nodes[a.first].m_count > m_nodes[b.first].m_count;
+    });
+    pool.run((unsigned int)subtrees.size(), [&](unsigned int i) {
+        builder.buildSubtree(subtrees[i].first, subtrees[i].second);
+    });
+    m_nodes.resize(builder.m_nodeCount);
+    m_nodes.shrink_to_fit();
+
+    // *** triangle data in leaf order
+    m_triangles.resize(triangleCount);
+    m_triangleIds.resize(triangleCount);
+    m_triangleOrder.resize(triangleCount);
+    pool.parallelFor(triangleCount, 0, [&](std::size_t first, std::size_t last, unsigned int) {
+        for (std::size_t i=first; i<last; ++i) {
+            unsigned int id = builder.m_triangles[i].m_id;
+            m_triangleIds[i] = id;
+            m_triangles.set(i, positions[vertexes[3*id]], positions[vertexes[3*id + 1]], positions[vertexes[3*id + 2]]);
+            m_triangleOrder[id] = (unsigned int)i;
+        }
+    });
+
+    initRefitData(pool);
+}
+
+
+/*! Returns vertex index i of an index array with indexSize 2 (unsigned short) or 4 (unsigned int) bytes. */
+static inline unsigned int vertexIndex(const void * indexes, unsigned int indexSize, std::size_t i) {
+    return indexSize == 2 ? static_cast<const unsigned short *>(indexes)[i] : static_cast<const unsigned int *>(indexes)[i];
+}
+
+
+/*! Half of the surface area of the node bounds, see BVHBounds::area(). */
+static inline float nodeArea(const MeshBVH::Node & node) {
+    if (node.m_min[0] > node.m_max[0])
+        return 0.f;
+    float ex = node.m_max[0] - node.m_min[0], ey = node.m_max[1] - node.m_min[1], ez = node.m_max[2] - node.m_min[2];
+    return ex*ey + ey*ez + ez*ex;
+}
+
+
+/*! Cost of a ray visiting the node, relative to a triangle test. */
+static inline float nodeWeight(const MeshBVH::Node & node) {
+    return node.m_count == 0 ? BVH_TRAVERSAL_COST : float(node.m_count);
+}
+
+
+/*! Stores the bounds in the node, returns true if they changed. */
+static inline bool setNodeBounds(MeshBVH::Node & node, const BVHBounds & bounds) {
+    bool changed = false;
+    for (unsigned int a=0; a<3; ++a) {
+        changed = changed || node.m_min[a] != bounds.m_min[a] || node.m_max[a] != bounds.m_max[a];
+        node.m_min[a] = bounds.m_min[a];
+        node.m_max[a] = bounds.m_max[a];
+    }
+    return changed;
+}
+
+
+void MeshBVH::initRefitData(ThreadPool & pool) {
+    m_parents.resize(m_nodes.size());
+    m_triangleLeaves.resize(m_triangleIds.size());
+    m_parents[0] = ~0u;
+    pool.parallelFor(m_nodes.size(), 0, [&](std::size_t first, std::size_t last, unsigned int) {
+        for (std::size_t n=first; n<last; ++n) {
+            const Node & node = m_nodes[n];
+            if (node.m_count == 0) {
+                m_parents[node.m_leftOrFirst] = (unsigned int)n;
+                m_parents[node.m_leftOrFirst + 1] = (unsigned int)n;
+            }
+            else {
+                for (unsigned int i=node.m_leftOrFirst; i<node.m_leftOrFirst + node.m_count; ++i)
+                    m_triangleLeaves[i] = (unsigned int)n;
+            }
+        }
+    });
+    m_weightedArea = 0;
+    for (const Node & node : m_nodes)
+        m_weightedArea += double(nodeWeight(node))*nodeArea(node);
+    m_buildCost = cost();
+}
+
+
+/*! Bounds of the triangles of a leaf, computed from the vertex positions as in the build. */
+static BVHBounds leafBounds(const MeshBVH & bvh, const MeshBVH::Node & leaf, const glm::vec3 * positions,
+                            const void * indexes, unsigned int indexSize)
+{
+    BVHBounds bounds;
+    for (unsigned int i=leaf.m_leftOrFirst; i<leaf.m_leftOrFirst + leaf.m_count; ++i) {
+        const std::size_t id = bvh.m_triangleIds[i];
+        for (unsigned int k=0; k<3; ++k)
+            bounds.grow(positions[vertexIndex(indexes, indexSize, 3*id + k)]);
+    }
+    return bounds;
+}
+
+
+bool MeshBVH::refitLeaf(unsigned int nodeIdx, const glm::vec3 * positions, const void * indexes, unsigned int indexSize) {
+    Node & node = m_nodes[nodeIdx];
+    const float oldArea = nodeArea(node);
+    if (!setNodeBounds(node, leafBounds(*this, node, positions, indexes, indexSize)))
+        return false;
+    m_weightedArea += double(nodeWeight(node))*(nodeArea(node) - oldArea);
+    return true;
+}
+
+
+bool MeshBVH::refitInnerNode(unsigned int nodeIdx) {
+    Node & node = m_nodes[nodeIdx];
+    BVHBounds bounds;
+    for (unsigned int c=node.m_leftOrFirst; c<node.m_leftOrFirst + 2; ++c) {
+        bounds.grow(glm::vec3(m_nodes[c].m_min[0], m_nodes[c].m_min[1], m_nodes[c].m_min[2]));
+        bounds.grow(glm::vec3(m_nodes[c].m_max[0], m_nodes[c].m_max[1], m_nodes[c].m_max[2]));
+    }
+    const float oldArea = nodeArea(node);
+    if (!setNodeBounds(node, bounds))
+        return false;
+    m_weightedArea += double(BVH_TRAVERSAL_COST)*(nodeArea(node) - oldArea);
+    return true;
+}
+
+
+void MeshBVH::refit(const glm::vec3 * positions, const void * indexes, unsigned int indexSize,
+                    const unsigned int * triangles, std::size_t count, ThreadPool & pool)
+{
+    if (empty() || count == 0)
+        return;
+    Q_ASSERT(indexSize == 2 || indexSize == 4);
+    const std::size_t triangleCount = m_triangleIds.size();
+
+    if (count >= BVH_FULL_REFIT_FRACTION*triangleCount) {
+        // *** large change: copy all triangles and refit all leaves in parallel, then the inner nodes bottom-up
+        pool.parallelFor(triangleCount, 0, [&](std::size_t first, std::size_t last, unsigned int) {
+            for (std::size_t i=first; i<last; ++i) {
+                const std::size_t id = m_triangleIds[i];
+                m_triangles.set(i, positions[vertexIndex(indexes, indexSize, 3*id)],
+                                positions[vertexIndex(indexes, indexSize, 3*id + 1)],
+                                positions[vertexIndex(indexes, indexSize, 3*id + 2)]);
+            }
+        });
+        pool.parallelFor(m_nodes.size(), 0, [&](std::size_t first, std::size_t last, unsigned int) {
+            for (std::size_t n=first; n<last; ++n)
+                if (m_nodes[n].m_count != 0)
+                    setNodeBounds(m_nodes[n], leafBounds(*this, m_nodes[n], positions, indexes, indexSize));
+        });
+        // children are stored after their parent, m_weightedArea is recomputed below
+        for (std::size_t n=m_nodes.size(); n-- > 0;)
+            if (m_nodes[n].m_count == 0)
+                refitInnerNode((unsigned int)n);
+        m_weightedArea = 0;
+        for (const Node & node : m_nodes)
+            m_weightedArea += double(nodeWeight(node))*nodeArea(node);
+        return;
+    }
+
+    // *** small change: copy the changed triangles and refit their leaves
+    std::vector<unsigned int> leaves;
+    leaves.reserve(count);
+    for (std::size_t i=0; i<count; ++i) {
+        const std::size_t id = triangles[i];
+        const unsigned int pos = m_triangleOrder[id];
+        m_triangles.set(pos, positions[vertexIndex(indexes, indexSize, 3*id)],
+                        positions[vertexIndex(indexes, indexSize, 3*id + 1)],
+                        positions[vertexIndex(indexes, indexSize, 3*id + 2)]);
+        leaves.push_back(m_triangleLeaves[pos]);
+    }
+    std::sort(leaves.begin(), leaves.end());
+    leaves.erase(std::unique(leaves.begin(), leaves.end()), leaves.end());
+
+    // *** then the ancestors whose bounds may have changed, highest index first: children are stored after their
+    //     parent, so all children of a node are updated before the node itself
+    std::priority_queue<unsigned int> dirty;
+    for (unsigned int leaf : leaves)
+        if (refitLeaf(leaf, positions, indexes, indexSize) && leaf != 0)
+            dirty.push(m_parents[leaf]);
+    unsigned int previous = ~0u;
+    while (!dirty.empty()) {
+        const unsigned int n = dirty.top();
+        dirty.pop();
+        if (n == previous)
+            continue; // both children changed
+        previous = n;
+        if (refitInnerNode(n) && n != 0)
+            dirty.push(m_parents[n]);
+    }
+}
+
+
+void MeshBVH::clear() {
+    m_nodes.clear();
+    m_triangles.clear();
+    m_triangleIds.clear();
+    m_triangleOrder.clear();
+    m_parents.clear();
+    m_triangleLeaves.clear();
+    m_weightedArea = 0;
+    m_buildCost = 0;
+}
+
+
+float MeshBVH::cost() const {
+    if (empty())
+        return 0.f;
+    const float rootArea = nodeArea(m_nodes[0]);
+    return rootArea > 0.f ? float(m_weightedArea/rootArea) : 0.f;
+}
+
+
+float MeshBVH::costRatio() const {
+    return m_buildCost > 0.f ? cost()/m_buildCost : 1.f;
+}
+
+
+/*! Slab test of ray against node bounds, returns entry distance or FLT_MAX if missed (or farther than tMax). */
+static inline float intersectNode(const MeshBVH::Node & node, const glm::vec3 & origin, const glm::vec3 & invDir, float tMax) {
+    float t1 = (node.m_min[0] - origin.x)*invDir.x, t2 = (node.m_max[0] - origin.x)*invDir.x;
+    float tEnter = std::min(t1, t2), tExit = std::max(t1, t2);
+    t1 = (node.m_min[1] - origin.y)*invDir.y;
+    t2 = (node.m_max[1] - origin.y)*invDir.y;
+    tEnter = std::max(tEnter, std::min(t1, t2));
+    tExit = std::min(tExit, std::max(t1, t2));
+    t1 = (node.m_min[2] - origin.z)*invDir.z;
+    t2 = (node.m_max[2] - origin.z)*invDir.z;
+    tEnter = std::max(tEnter, std::min(t1, t2));
+    tExit = std::min(tExit, std::max(t1, t2));
+    if (tExit >= tEnter && tExit >= 0.f && tEnter < tMax)
+        return tEnter;
+    return FLT_MAX;
+}
+
+
+bool MeshBVH::nearestHit(const glm::vec3 & origin, const glm::vec3 & dir, Hit & hit) const {
+    if (m_nodes.empty())
+        return false;
+    const glm::vec3 invDir(1.f/dir.x, 1.f/dir.y, 1.f/dir.z);
+    const SimdLevel level = simdLevel();
+    if (intersectNode(m_nodes[0], origin, invDir, hit.m_dist) == FLT_MAX)
+        return false;
+
+    bool found = false;
+    unsigned int stack[BVH_STACK_SIZE];
+    unsigned int stackSize = 0;
+    unsigned int n = 0;
+    for (;;) {
+        const Node & node = m_nodes[n];
+        if (node.m_count != 0) {
+            // leaf: test all triangles
+            RayTriangleHit leafHit(hit.m_dist);
+            nearestRayTriangleHit(m_triangles, node.m_leftOrFirst, node.m_leftOrFirst + node.m_count, origin, dir,
+                                  leafHit, level);
+            if (leafHit.m_triangle != ~0u) {
+                hit.m_dist = leafHit.m_dist;
+                hit.m_triangle = m_triangleIds[leafHit.m_triangle];
+                hit.m_u = leafHit.m_u;
+                hit.m_v = leafHit.m_v;
+                found = true;
+            }
+        }
+        else {
+            // inner node: continue with the nearer child, remember the other one
+            unsigned int nearChild = node.m_leftOrFirst;
+            unsigned int farChild = nearChild + 1;
+            float tNear = intersectNode(m_nodes[nearChild], origin, invDir, hit.m_dist);
+            float tFar = intersectNode(m_nodes[farChild], origin, invDir, hit.m_dist);
+            if (tFar < tNear) {
+                std::swap(nearChild, farChild);
+                std::swap(tNear, tFar);
+            }
+            if (tNear != FLT_MAX) {
+                if (tFar != FLT_MAX) {
+                    Q_ASSERT(stackSize < BVH_STACK_SIZE);
+                    stack[stackSize++] = farChild;
+                }
+                n = nearChild;
+                continue;
+            }
+        }
+        // next node from stack, skip nodes that are farther away than the current hit
+        bool next = false;
+        while (stackSize > 0) {
+            n = stack[--stackSize];
+            if (intersectNode(m_nodes[n], origin, invDir, hit.m_dist) != FLT_MAX) {
+                next = true;
+                break;
+            }
+        }
+        if (!next)
+            break;
+    }
+    return found;
+}
+
+
+void MeshBVH::nearestHitPacket(RayPacket & packet, unsigned int laneMask, SimdLevel level) const {
+    laneMask = packetIntersectBox(packet, m_nodes[0].m_min, m_nodes[0].m_max, laneMask, nullptr, level);
+    if (laneMask == 0)
+        return;
+
+    // each stack entry remembers the rays that hit the node
+    struct StackEntry {
+        unsigned int	m_node;
+        unsigned int	m_laneMask;
+    };
+    StackEntry stack[BVH_STACK_SIZE];
+    unsigned int stackSize = 0;
+    unsigned int n = 0;
+    for (;;) {
+        const Node & node = m_nodes[n];
+        if (node.m_count != 0) {
+            // leaf: test all triangles against the rays that reached it
+            const unsigned int first = node.m_leftOrFirst;
+            if ((laneMask & (laneMask - 1)) == 0) {
+                // a single ray (diverged packet): vectorize over the triangles instead
+                unsigned int l = 0;
+                while ((laneMask & (1u << l)) == 0)
+                    ++l;
+                RayTriangleHit leafHit(packet.m_dist[l]);
+                nearestRayTriangleHit(m_triangles, first, first + node.m_count,
+                                      glm::vec3(packet.m_ox[l], packet.m_oy[l], packet.m_oz[l]),
+                                      glm::vec3(packet.m_dx[l], packet.m_dy[l], packet.m_dz[l]), leafHit, level);
+                if (leafHit.m_triangle != ~0u) {
+                    packet.m_dist[l] = leafHit.m_dist;
+                    packet.m_triangle[l] = int(leafHit.m_triangle);
+                    packet.m_u[l] = leafHit.m_u;
+                    packet.m_v[l] = leafHit.m_v;
+                }
+            }
+            else
+                packetRayTriangleHits(m_triangles, first, first + node.m_count, packet, laneMask, level);
+        }
+        else {
+            // inner node: continue with the child that is nearer for the first ray, remember the other one
+            unsigned int nearChild = node.m_leftOrFirst;
+            unsigned int farChild = nearChild + 1;
+            float nearEnter[RAY_PACKET_SIZE], farEnter[RAY_PACKET_SIZE];
+            unsigned int nearMask = packetIntersectBox(packet, m_nodes[nearChild].m_min, m_nodes[nearChild].m_max,
+                                                       laneMask, nearEnter, level);
+            unsigned int farMask = packetIntersectBox(packet, m_nodes[farChild].m_min, m_nodes[farChild].m_max,
+                                                      laneMask, farEnter, level);
+            if ((nearMask | farMask) != 0) {
+                unsigned int lead = 0;
+                while (((nearMask | farMask) & (1u << lead)) == 0)
+                    ++lead;
+                if (farEnter[lead] < nearEnter[lead]) {
+                    std::swap(nearChild, farChild);
+                    std::swap(nearMask, farMask);
+                }
+                if (nearMask == 0) {
+                    n = farChild;
+                    laneMask = farMask;
+                    continue;
+                }
+                if (farMask != 0) {
+                    Q_ASSERT(stackSize < BVH_STACK_SIZE);
+                    stack[stackSize].m_node = farChild;
+                    stack[stackSize].m_laneMask = farMask;
+                    ++stackSize;
+                }
+                n = nearChild;
+                laneMask = nearMask;
+                continue;
+            }
+        }
+        // next node from stack, rays whose hit is nearer than the node meanwhile are dropped
+        bool next = false;
+        while (stackSize > 0) {
+            const StackEntry & entry = stack[--stackSize];
+            n = entry.m_node;
+            laneMask = packetIntersectBox(packet, m_nodes[n].m_min, m_nodes[n].m_max, entry.m_laneMask, nullptr, level);
+            if (laneMask != 0) {
+                next = true;
+                break;
+            }
+        }
+        if (!next)
+            break;
+    }
+}
+
+
+void MeshBVH::nearestHits(const Ray * rays, std::size_t count, Hit * hits, ThreadPool & pool,
+                          unsigned int blockCount) const
+{
+    if (m_nodes.empty())
+        return;
+    const SimdLevel level = simdLevel();
+    const std::size_t packetCount = (count + RAY_PACKET_SIZE - 1)/RAY_PACKET_SIZE;
+    if (blockCount == 0)
+        blockCount = BVH_PACKET_BLOCKS_PER_THREAD*pool.threadCount();
+    pool.parallelFor(packetCount, blockCount, [&](std::size_t first, std::size_t last, unsigned int) {
+        RayPacket packet;
+        for (std::size_t p=first; p<last; ++p) {
+            const std::size_t firstRay = p*RAY_PACKET_SIZE;
+            const unsigned int rayCount = (unsigned int)std::min<std::size_t>(RAY_PACKET_SIZE, count - firstRay);
+            // unused lanes of the last packet repeat the first ray, they are masked out
+            for (unsigned int l=0; l<RAY_PACKET_SIZE; ++l) {
+                const std::size_t r = firstRay + (l < rayCount ? l : 0);
+                packet.setRay(l, rays[r].m_origin, rays[r].m_dir, hits[r].m_dist);
+            }
+            nearestHitPacket(packet, (1u << rayCount) - 1, level);
+            for (unsigned int l=0; l<rayCount; ++l) {
+                if (packet.m_triangle[l] == -1)
+                    continue;
+                Hit & hit = hits[firstRay + l];
+                hit.m_dist = packet.m_dist[l];
+                hit.m_triangle = m_triangleIds[(unsigned int)packet.m_triangle[l]];
+                hit.m_u = packet.m_u[l];
+                hit.m_v = packet.m_v[l];
+            }
+        }
+    });
+}
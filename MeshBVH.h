@@ -0,0 +1,136 @@
+#ifndef MESHBVH_H
+#define MESHBVH_H
+
+#include <cstddef>
+#include <vector>
+
+#include <glm.hpp>
+
+#include "RayPacketKernels.h"
+#include "RayTriangleKernels.h"
+
+class ThreadPool;
+
+/*! Bounding volume hierarchy over the triangles of an indexed mesh, used for picking.
+
+    The tree is built with binned SAH (surface area heuristic). Large nodes near the root are split one after
+    another with the binning done in parallel, the remaining subtrees are then built in parallel, one subtree
+    per task.
+
+    Nodes are stored in a flat array, the two children of an inner node are stored next to each other.
+    Leaves reference a range of triangles in leaf order. The triangle coordinates are copied in leaf order into
+    a structure of arrays (m_triangles), so that the triangles of a leaf are tested with the SIMD kernel
+    nearestRayTriangleHit().
+
+    Many rays at once (e.g. one per pixel) are traced with nearestHits() in packets of RAY_PACKET_SIZE rays,
+    one ray per SIMD lane: a node is visited once for all rays of the packet that hit it, and each triangle is
+    tested against all of these rays at once.
+
+    When vertexes move, refit() updates the bounds of the affected leaves and their ancestors instead of
+    rebuilding the tree. The topology is kept, so the tree gets slower (not wrong) as the bounds grow and
+    overlap; costRatio() tells when a rebuild pays off.
+*/
+class MeshBVH {
+public:
+    struct Node {
+        float			m_min[3];
+        /*! Inner node: index of left child (right child is next), leaf: index of first triangle. */
+        unsigned int	m_leftOrFirst;
+        float			m_max[3];
+        /*! Number of triangles in leaf, 0 for inner nodes. */
+        unsigned int	m_count;
+    };
+
+    /*! Nearest hit of a ray. */
+    struct Hit {
+        Hit(float dist) : m_dist(dist), m_triangle(~0u), m_u(0), m_v(0) {}
+
+        /*! Distance in units of the ray direction, only hits closer than the initial value are accepted. */
+        float			m_dist;
+        /*! Index of the triangle hit, ~0u if there was no hit. */
+        unsigned int	m_triangle;
+        /*! Barycentric coordinates of the hit point, weights of vertex 1 and 2 (vertex 0 has 1 - u - v). */
+        float			m_u;
+        float			m_v;
+    };
+
+    /*! A ray "m_origin + t*m_dir". */
+    struct Ray {
+        glm::vec3		m_origin;
+        glm::vec3		m_dir;
+    };
+
+    /*! Builds the tree for triangleCount triangles, indexes are 0-based vertex indexes, 3 per triangle,
+        with indexSize 2 (unsigned short) or 4 (unsigned int) bytes.
+    */
+    void build(const glm::vec3 * positions, const void * indexes, unsigned int indexSize, std::size_t triangleCount,
+               ThreadPool & pool);
+
+    /*! Updates the tree after the vertex positions of count triangles (original indexes) changed, with positions
+        and indexes as for build() (the indexes themselves must be unchanged). The coordinates of the triangles
+        are copied and the bounds of their leaves and of all ancestors are recomputed bottom-up. If a large part
+        of the mesh changed, all nodes are refit (leaves in parallel on the thread pool).
+    */
+    void refit(const glm::vec3 * positions, const void * indexes, unsigned int indexSize,
+               const unsigned int * triangles, std::size_t count, ThreadPool & pool);
+
+    void clear();
+    bool empty() const { return m_nodes.empty(); }
+
+    /*! SAH cost of the tree: the expected cost of a ray through the root bounds, in units of triangle tests. */
+    float cost() const;
+    /*! cost() relative to the cost right after build(), 1 for a new tree. Grows as refit() enlarges the bounds,
+        a tree with a high ratio should be rebuilt.
+    */
+    float costRatio() const;
+
+    /*! Finds the nearest triangle hit by the ray "origin + t*dir" with 0 <= t < hit.m_dist (both sides of a
+        triangle count). Returns true and updates hit if a triangle was hit.
+    */
+    bool nearestHit(const glm::vec3 & origin, const glm::vec3 & dir, Hit & hit) const;
+
+    /*! Finds the nearest hits of count rays, as nearestHit() for each ray and hit (with exactly the same
+        distances and barycentric coordinates). Consecutive rays are traced together as a packet, so rays should
+        be ordered coherently (e.g. by tiles of neighboring pixels), incoherent packets are traced correctly,
+        but slower. Packets are distributed on the thread pool in blockCount blocks (0 = several blocks per
+        thread), the function must not be called from a task running on that pool.
+    */
+    void nearestHits(const Ray * rays, std::size_t count, Hit * hits, ThreadPool & pool, unsigned int blockCount = 0) const;
+
+    /*! Traces the rays in laneMask through the tree and stores the nearest hits (leaf-order triangles) in packet. */
+    void nearestHitPacket(RayPacket & packet, unsigned int laneMask, SimdLevel level) const;
+
+    std::vector<Node>			m_nodes;
+    /*! Vertex and edge coordinates of triangles in leaf order. */
+    TriangleSoA					m_triangles;
+    /*! Original triangle index of triangles in leaf order. */
+    std::vector<unsigned int>	m_triangleIds;
+    /*! Position of leaf-order triangle for each original triangle index. */
+    std::vector<unsigned int>	m_triangleOrder;
+    /*! Parent of each node, ~0u for the root. Children are always stored after their parent. */
+    std::vector<unsigned int>	m_parents;
+    /*! Leaf node of each triangle in leaf order. */
+    std::vector<unsigned int>	m_triangleLeaves;
+
+private:
+    /*! Computes m_parents, m_triangleLeaves and the SAH cost after the build. */
+    void initRefitData(ThreadPool & pool);
+
+    /*! Recomputes the bounds of the leaf from the vertex positions and updates m_weightedArea.
+        Returns true if the bounds changed.
+    */
+    bool refitLeaf(unsigned int nodeIdx, const glm::vec3 * positions, const void * indexes, unsigned int indexSize);
+    /*! Recomputes the bounds of the inner node from its children and updates m_weightedArea.
+        Returns true if the bounds changed.
+    */
+    bool refitInnerNode(unsigned int nodeIdx);
+
+    /*! Sum of node areas weighted with the node costs (traversal cost for inner nodes, triangle count for leaves),
+        cost() is this sum divided by the area of the root.
+    */
+    double						m_weightedArea = 0;
+    /*! cost() after build(). */
+    float						m_buildCost = 0;
+};
+
+#endif // MESHBVH_H
@@ -0,0 +1,225 @@
+#include "MeshCache.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QFileInfo>
+#include <QSaveFile>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+static const char MESHCACHE_MAGIC[8] = { 'V', 'P', 'M', 'E', 'S', 'H', '\0', '\0' };
+/*! Increase whenever the layout of the header or the content of the data sections changes. */
+static const std::uint32_t MESHCACHE_VERSION = 3;
+
+/*! Size of sampled blocks at start/end of source file. */
+static const qint64 CONTENT_HASH_EDGE_SIZE = 64*1024;
+/*! Number and size of sampled blocks in between. */
+static const qint64 CONTENT_HASH_SAMPLE_COUNT = 64;
+static const qint64 CONTENT_HASH_SAMPLE_SIZE = 4*1024;
+
+/*! Rounds up to the next multiple of 16. */
+static inline std::uint64_t align16(std::uint64_t offset) {
+    return (offset + 15) & ~std::uint64_t(15);
+}
+
+
+/*! True if count items of itemSize bytes at offset fit into a file of fileSize bytes, without overflow for corrupt
+    header values.
+*/
+static inline bool sectionInFile(std::uint64_t offset, std::uint64_t count, std::uint64_t itemSize, std::uint64_t fileSize) {
+    return offset <= fileSize && (itemSize == 0 || count <= (fileSize - offset)/itemSize);
+}
+
+
+/*! Returns true if all count indexes of type T are less than vertexCount. */
+template <typename T>
+static bool indexesInRange(const uchar * data, std::uint64_t count, std::uint64_t vertexCount) {
+    const T * indexes = reinterpret_cast<const T *>(data);
+    T maxIndex = 0;
+    for (std::uint64_t i=0; i<count; ++i)
+        maxIndex = std::max(maxIndex, indexes[i]);
+    return count == 0 || maxIndex < vertexCount;
+}
+
+
+QString MeshCache::cacheFilePath(const QString & sourceFilePath) {
+    return sourceFilePath + ".vpmesh";
+}
+
+
+bool MeshCache::computeKey(const QString & sourceFilePath, Key & key) {
+    std::memset(&key, 0, sizeof(Key));
+    QFileInfo info(sourceFilePath);
+    if (!info.exists())
+        return false;
+
+    QByteArray absPath = info.absoluteFilePath().toUtf8();
+    QByteArray pathHash = QCryptographicHash::hash(absPath, QCryptographicHash::Md5);
+    std::memcpy(key.m_pathHash, pathHash.constData(), sizeof(key.m_pathHash));
+    key.m_sourceSize = std::uint64_t(info.size());
+    key.m_sourceModified = info.lastModified().toMSecsSinceEpoch();
+
+    // content fingerprint from sampled blocks, mapping the file only touches the sampled pages
+    QFile source(sourceFilePath);
+    if (!source.open(QIODevice::ReadOnly))
+        return false;
+    const qint64 size = source.size();
+    QCryptographicHash contentHash(QCryptographicHash::Md5);
+    if (size > 0) {
+        uchar * data = source.map(0, size);
+        if (data == nullptr)
+            return false;
+        const char * text = reinterpret_cast<const char *>(data);
+        if (size <= 2*CONTENT_HASH_EDGE_SIZE + CONTENT_HASH_SAMPLE_COUNT*CONTENT_HASH_SAMPLE_SIZE) {
+            contentHash.addData(text, size);
+        }
+        else {
+            contentHash.addData(text, CONTENT_HASH_EDGE_SIZE);
+            const qint64 innerSize = size - 2*CONTENT_HASH_EDGE_SIZE - CONTENT_HASH_SAMPLE_SIZE;
+            for (qint64 i=0; i<CONTENT_HASH_SAMPLE_COUNT; ++i) {
+                qint64 offset = CONTENT_HASH_EDGE_SIZE + innerSize*i/CONTENT_HASH_SAMPLE_COUNT;
+                contentHash.addData(text + offset, CONTENT_HASH_SAMPLE_SIZE);
+            }
+            contentHash.addData(text + size - CONTENT_HASH_EDGE_SIZE, CONTENT_HASH_EDGE_SIZE);
+        }
+        source.unmap(data);
+    }
+    QByteArray contentHashResult = contentHash.result();
+    std::memcpy(key.m_contentHash, contentHashResult.constData(), sizeof(key.m_contentHash));
+    return true;
+}
+
+
+bool MeshCache::write(const QString & sourceFilePath, float weldTolerance,
+                      const void * vertexData, std::size_t vertexCount, unsigned int vertexSize,
+                      const void * indexData, std::size_t indexCount, unsigned int indexSize)
+{
+    Header header;
+    std::memset(&header, 0, sizeof(Header));
+    if (!computeKey(sourceFilePath, header.m_key))
+        return false;
+    std::memcpy(header.m_magic, MESHCACHE_MAGIC, sizeof(MESHCACHE_MAGIC));
+    header.m_version = MESHCACHE_VERSION;
+    header.m_headerSize = sizeof(Header);
+    header.m_vertexCount = vertexCount;
+    header.m_vertexSize = vertexSize;
+    header.m_vertexOffset = align16(sizeof(Header));
+    header.m_indexCount = indexCount;
+    header.m_indexSize = indexSize;
+    header.m_indexOffset = align16(header.m_vertexOffset + std::uint64_t(vertexCount)*vertexSize);
+    header.m_weldTolerance = weldTolerance;
+
+    QSaveFile cacheFile(cacheFilePath(sourceFilePath));
+    if (!cacheFile.open(QIODevice::WriteOnly))
+        return false;
+
+    static const char padding[16] = {};
+    qint64 pos = cacheFile.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+    pos += cacheFile.write(padding, qint64(header.m_vertexOffset) - pos);
+    pos += cacheFile.write(static_cast<const char *>(vertexData), qint64(vertexCount)*vertexSize);
+    pos += cacheFile.write(padding, qint64(header.m_indexOffset) - pos);
+    pos += cacheFile.write(static_cast<const char *>(indexData), qint64(indexCount)*indexSize);
+    if (pos != qint64(header.m_indexOffset + std::uint64_t(indexCount)*indexSize)) {
+        cacheFile.cancelWriting();
+        return false;
+    }
+    return cacheFile.commit();
+}
+
+
+bool MeshCache::open(const QString & sourceFilePath, float weldTolerance) {
+    close();
+
+    m_file->setFileName(cacheFilePath(sourceFilePath));
+    if (!m_file->exists() || !m_file->open(QIODevice::ReadOnly))
+        return false;
+
+    const qint64 fileSize = m_file->size();
+    if (fileSize < qint64(sizeof(Header))) {
+        m_file->close();
+        return false;
+    }
+    m_data = m_file->map(0, fileSize);
+    if (m_data == nullptr) {
+        m_file->close();
+        return false;
+    }
+
+    const Header * header = reinterpret_cast<const Header *>(m_data);
+    Key key;
+    bool valid = std::memcmp(header->m_magic, MESHCACHE_MAGIC, sizeof(MESHCACHE_MAGIC)) == 0 &&
+            header->m_version == MESHCACHE_VERSION &&
+            header->m_headerSize == sizeof(Header) &&
+            header->m_weldTolerance == weldTolerance &&
+            sectionInFile(header->m_vertexOffset, header->m_vertexCount, header->m_vertexSize, std::uint64_t(fileSize)) &&
+            sectionInFile(header->m_indexOffset, header->m_indexCount, header->m_indexSize, std::uint64_t(fileSize)) &&
+            computeKey(sourceFilePath, key) &&
+            std::memcmp(&header->m_key, &key, sizeof(Key)) == 0;
+    // a truncated or corrupt index section must not reach the BVH build or glDrawElements()
+    if (valid) {
+        const uchar * indexData = m_data + header->m_indexOffset;
+        if (header->m_indexSize == sizeof(std::uint16_t))
+            valid = indexesInRange<std::uint16_t>(indexData, header->m_indexCount, header->m_vertexCount);
+        else if (header->m_indexSize == sizeof(std::uint32_t))
+            valid = indexesInRange<std::uint32_t>(indexData, header->m_indexCount, header->m_vertexCount);
+        else
+            valid = false;
+    }
+    if (!valid) {
+        qDebug() << "Mesh cache" << m_file->fileName() << "is outdated or invalid.";
+        close();
+        return false;
+    }
+    m_header = header;
+    return true;
+}
+
+
+void MeshCache::close() {
+    if (m_data != nullptr)
+        m_file->unmap(m_data);
+    m_data = nullptr;
+    m_header = nullptr;
+    m_file->close();
+}
+
+
+void MeshCache::swap(MeshCache & other) {
+    std::swap(m_file, other.m_file);
+    std::swap(m_data, other.m_data);
+    std::swap(m_header, other.m_header);
+}
+
+
+const void * MeshCache::vertexData() const {
+    Q_ASSERT(isOpen());
+    return m_data + m_header->m_vertexOffset;
+}
+
+std::size_t MeshCache::vertexCount() const {
+    Q_ASSERT(isOpen());
+    return std::size_t(m_header->m_vertexCount);
+}
+
+unsigned int MeshCache::vertexSize() const {
+    Q_ASSERT(isOpen());
+    return m_header->m_vertexSize;
+}
+
+const void * MeshCache::indexData() const {
+    Q_ASSERT(isOpen());
+    return m_data + m_header->m_indexOffset;
+}
+
+std::size_t MeshCache::indexCount() const {
+    Q_ASSERT(isOpen());
+    return std::size_t(m_header->m_indexCount);
+}
+
+unsigned int MeshCache::indexSize() const {
+    Q_ASSERT(isOpen());
+    return m_header->m_indexSize;
+}
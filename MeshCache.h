@@ -0,0 +1,117 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <QFile>
+#include <QString>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/*! A binary sidecar cache (file extension .vpmesh) for parsed meshes, stored next to the source file.
+
+    The cache holds the GPU-ready vertex and element buffer data exactly as uploaded to the
+    vertex/element buffer objects, so that a cache hit needs no parsing at all: the cache file is memory mapped
+    and the mapped pointers are handed directly to QOpenGLBuffer::allocate().
+
+    The cache is keyed by the source file path, size, modification time and a content fingerprint
+    (MD5 over the first and last 64 kByte plus 64 evenly spaced 4 kByte samples of the source). A full
+    content hash would need to read the entire source file and defeat the purpose of the cache. The weld
+    tolerance the vertexes were welded with is stored as well, a cache written with another tolerance is rejected.
+
+    File layout (native byte order, all sections 16-byte aligned):
+    \code
+    Header | vertex data (vertexCount*vertexSize bytes) | element data (indexCount*indexSize bytes)
+    \endcode
+
+    Usage:
+    \code
+    MeshCache cache;
+    if (cache.open(sourceFile, weldTolerance)) {
+        // use cache.vertexData(), cache.indexData() ... while the cache is open
+    }
+    else {
+        // parse source file ... then
+        MeshCache::write(sourceFile, weldTolerance, vertexData, vertexCount, vertexSize, indexData, indexCount, indexSize);
+    }
+    \endcode
+*/
+class MeshCache {
+public:
+    MeshCache() : m_file(new QFile) {}
+    ~MeshCache() { close(); }
+
+    MeshCache(const MeshCache &) = delete;
+    MeshCache & operator=(const MeshCache &) = delete;
+
+    /*! Returns path of the sidecar cache file for a source file (source path + ".vpmesh"). */
+    static QString cacheFilePath(const QString & sourceFilePath);
+
+    /*! Writes the cache file for the given source file, whose vertexes were welded with weldTolerance. The file
+        is written atomically, so that an interrupted write never leaves a valid-looking cache behind.
+        Returns false, if the cache could not be written (e.g. read-only directory).
+    */
+    static bool write(const QString & sourceFilePath, float weldTolerance,
+                      const void * vertexData, std::size_t vertexCount, unsigned int vertexSize,
+                      const void * indexData, std::size_t indexCount, unsigned int indexSize);
+
+    /*! Opens and memory maps the cache file for the given source file.
+        Returns false, if there is no cache file, or if it does not match the current source file (key mismatch)
+        or weldTolerance, or if its format is not compatible, or if an index is out of range of the vertexes
+        (corrupt file, all indexes are checked once here).
+    */
+    bool open(const QString & sourceFilePath, float weldTolerance);
+
+    /*! Unmaps and closes the cache file, all data pointers become invalid. */
+    void close();
+
+    bool isOpen() const { return m_header != nullptr; }
+
+    /*! Exchanges the (open or closed) caches, the data pointers remain valid. E.g. to hand a cache opened on
+        a loader thread over to the GUI thread.
+    */
+    void swap(MeshCache & other);
+
+    /*! Identifies the source file the cache was generated from (also used by PointTileFile). */
+    struct Key {
+        unsigned char	m_pathHash[16];		// MD5 of absolute source file path
+        unsigned char	m_contentHash[16];	// MD5 of sampled source file content
+        std::uint64_t	m_sourceSize;
+        std::int64_t	m_sourceModified;	// ms since epoch
+    };
+
+    /*! Computes the key of the source file, returns false if source file cannot be read. */
+    static bool computeKey(const QString & sourceFilePath, Key & key);
+
+    const void * vertexData() const;
+    std::size_t vertexCount() const;
+    unsigned int vertexSize() const;
+
+    const void * indexData() const;
+    std::size_t indexCount() const;
+    unsigned int indexSize() const;
+
+private:
+    /*! Header at the start of the cache file. */
+    struct Header {
+        char			m_magic[8];
+        std::uint32_t	m_version;
+        std::uint32_t	m_headerSize;
+        Key				m_key;
+        std::uint64_t	m_vertexCount;
+        std::uint64_t	m_vertexOffset;
+        std::uint64_t	m_indexCount;
+        std::uint64_t	m_indexOffset;
+        std::uint32_t	m_vertexSize;
+        std::uint32_t	m_indexSize;
+        float			m_weldTolerance;
+        std::uint32_t	m_reserved;
+    };
+
+    /*! Held by pointer, so that swap() keeps the mapping with the file it belongs to. */
+    std::unique_ptr<QFile>	m_file;
+    uchar			*m_data = nullptr;
+    const Header	*m_header = nullptr;
+};
+
+#endif // MESHCACHE_H
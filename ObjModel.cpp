@@ -2,11 +2,24 @@
 
 #include <QOpenGLShaderProgram>
 #include <QElapsedTimer>
+#include <QFile>
 
-#include <iostream>
-#include <istream>
-#include <fstream>
-#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+
+#include "ObjParser.h"
+#include "ThreadPool.h"
+#include "VertexWelder.h"
+
+/*! updatePositions() starts a BVH rebuild when the SAH cost of the refit tree exceeds that of the built tree
+    by this factor.
+*/
+static const float BVH_REBUILD_COST_RATIO = 1.5f;
+/*! updatePositions() starts a rebuild when more vertexes have moved since the vertex tree was built,
+    as the vertex queries test these vertexes one by one.
+*/
+static const std::size_t VERTEX_TREE_MAX_MOVED = 4096;
 
 ObjModel::ObjModel() :
    m_vbo(QOpenGLBuffer::VertexBuffer), // actually the default, so default constructor would have been enough
@@ -58,6 +71,12 @@ ObjModel::ObjModel() :
   //      b.copy2Buffer(vertexBuffer, elementBuffer, vertexCount);
 }
 
+
+ObjModel::~ObjModel() {
+    m_loader.cancel();
+    waitForRebuild();
+}
+
 static QVector3D vec3toqvec3(glm::vec3 v)
 {
     QVector3D q;
@@ -67,164 +86,444 @@ static QVector3D vec3toqvec3(glm::vec3 v)
     return q;
 }
 
-void ObjModel::loadObj(const char *filename)
+void ObjModel::loadObj(const char *filename, unsigned int chunkCount)
 {
-        //Vertex portions
-        
-        //std::vector<Vertex> vertex_texcoords;
-        //std::vector<glm::fvec3> vertex_normals;
+    m_loader.cancel();
+    waitForRebuild();
+    m_vertexTriangleStart.clear();
+    m_vertexTriangles.clear();
+    MeshData mesh;
+    readMeshData(filename, chunkCount, nullptr, mesh);
+    takeMeshData(mesh);
+    buildSearchTrees();
+}
+
+
+void ObjModel::loadObjInBackground(const std::string & filename, unsigned int chunkCount) {
+    m_loader.cancel();
+    waitForRebuild();
+    {
+        // picks fall back to gpuPick() until the new trees are taken over in processLoadEvents()
+        std::unique_lock<std::shared_mutex> lock(m_searchMutex);
+        m_bvh = MeshBVH();
+        m_vertexTree = PointKDTree();
+        m_movedVertexes.clear();
+        m_vertexMoved.clear();
+    }
+    m_vertexTriangleStart.clear();
+    m_vertexTriangles.clear();
+    m_readyVertexCount = m_uploadedVertexCount = 0;
+    m_readyElementCount = m_uploadedElementCount = 0;
+    m_loadedMesh.clear();
+
+    m_loader.start([this, filename, chunkCount](BackgroundLoader & loader) {
+        readMeshData(filename.c_str(), chunkCount, &loader, m_loadedMesh);
+
+        // the indexes refer to the welded vertexes, so the mesh is passed to the GUI thread as a whole, which takes
+        // m_loadedMesh over with the Allocate event, the data itself stays in place and is only read from then on
+        const glm::vec3 * positions = m_loadedMesh.positionData();
+        const std::size_t positionCount = m_loadedMesh.positionCount();
+        const void * elements = m_loadedMesh.elementData();
+        const std::size_t elementCount = m_loadedMesh.elementCount();
+        const unsigned int elementSize = m_loadedMesh.elementSize();
+        LoadEvent e;
+        e.m_type = LoadEvent::Allocate;
+        e.m_vertexCount = positionCount;
+        e.m_elementCount = elementCount;
+        e.m_stage = "Building BVH";
+        loader.post(e);
+        e.m_type = LoadEvent::Vertexes;
+        loader.post(e);
+        e.m_type = LoadEvent::Elements;
+        if (!loader.post(e))
+            return;
+
+        // meanwhile, the mesh is uploaded and drawn, picks use the GPU
+        QElapsedTimer buildTimer;
+        buildTimer.start();
+        m_loadedBvh.build(positions, elements, elementSize, elementCount/3, loader.pool());
+        qDebug() << "BVH with" << m_loadedBvh.m_nodes.size() << "nodes built in background in" << buildTimer.elapsed() << "ms" << "\n";
+        if (!loader.postProgress("Building vertex KD-tree", 0))
+            return;
+        buildTimer.start();
+        m_loadedVertexTree.build(positions, positionCount, loader.pool());
+        qDebug() << "Vertex KD-tree built in background in" << buildTimer.elapsed() << "ms" << "\n";
+
+        e.m_type = LoadEvent::Finished;
+        e.m_stage = "";
+        loader.post(e);
+    });
+}
 
-        //Face vectors
-        std::vector<GLint> vertex_position_indicies;
-        //std::vector<GLint> vertex_texcoord_indicies;
-        //std::vector<int> vertex_normal_indicies;
 
+bool ObjModel::processLoadEvents() {
+    LoadEvent e;
+    while (m_loader.takeEvent(e)) {
+        switch (e.m_type) {
+            case LoadEvent::Allocate :
+                takeMeshData(m_loadedMesh);
+                m_loadedMesh.clear();
+                m_vbo.bind();
+                m_vbo.allocate(int(e.m_vertexCount*sizeof(glm::vec3)));
+                m_vbo.release();
+                // the element buffer binding is part of the VAO state, releasing m_ebo would remove it
+                m_vao.bind();
+                m_ebo.bind();
+                // padded to whole 32 bit words, see create()
+                m_ebo.allocate(int((e.m_elementCount*elementSize() + 3) & ~std::size_t(3)));
+                m_vao.release();
+                break;
+            case LoadEvent::Vertexes :
+                m_readyVertexCount = e.m_vertexCount;
+                break;
+            case LoadEvent::Elements :
+                m_readyElementCount = e.m_elementCount;
+                break;
+            case LoadEvent::Finished : {
+                std::unique_lock<std::shared_mutex> lock(m_searchMutex);
+                std::swap(m_bvh, m_loadedBvh);
+                std::swap(m_vertexTree, m_loadedVertexTree);
+                m_loadedBvh = MeshBVH();
+                m_loadedVertexTree = PointKDTree();
+            } break;
+            case LoadEvent::Failed :
+                qWarning() << "Loading OBJ file failed:" << e.m_stage;
+                m_readyVertexCount = m_uploadedVertexCount = 0;
+                m_readyElementCount = m_uploadedElementCount = 0;
+                break;
+            default : break;
+        }
+    }
 
+    // all vertexes first, so that every uploaded triangle can be drawn
+    std::size_t budget = m_loader.m_uploadBytesPerFrame;
+    if (m_uploadedVertexCount < m_readyVertexCount) {
+        m_vbo.bind();
+        uploadBufferRange(m_vbo, positionData(), sizeof(glm::vec3), m_uploadedVertexCount, m_readyVertexCount, budget);
+        m_vbo.release();
+    }
+    if (m_uploadedVertexCount == m_readyVertexCount && m_uploadedElementCount < m_readyElementCount) {
+        m_vao.bind();
+        m_ebo.bind();
+        uploadBufferRange(m_ebo, elementData(), elementSize(), m_uploadedElementCount, m_readyElementCount, budget);
+        m_vao.release();
+    }
+    return m_uploadedVertexCount < m_readyVertexCount || m_uploadedElementCount < m_readyElementCount;
+}
 
-        std::stringstream ss;
-        std::ifstream in_file(filename);
-        std::string line = "";
-        std::string prefix = "";
-        glm::vec3 temp_vec3;
-        //glm::vec2 temp_vec2;
-        int temp_glint[3];
 
-        //File open error check
-        if (!in_file.is_open())
+bool ObjModel::loading() const {
+    return m_loader.state() == BackgroundLoader::Running || m_uploadedVertexCount < m_readyVertexCount ||
+           m_uploadedElementCount < m_readyElementCount;
+}
+
+
+void ObjModel::readMeshData(const char *filename, unsigned int chunkCount, BackgroundLoader * loader,
+                            MeshData & mesh) const
+{
+    QElapsedTimer loadTimer;
+    loadTimer.start();
+
+    // reports the next stage of a background load, stops a cancelled load
+    auto beginStage = [loader](const char * stage) {
+        if (loader != nullptr && !loader->postProgress(stage, 0))
+            throw "ERROR::OBJLOADER::Loading cancelled.";
+    };
+
+    // a valid binary cache of a previous parse is simply mapped, buffer data is read directly from the mapping
+    if (mesh.m_meshCache.open(filename, m_weldTolerance)) {
+        if (mesh.m_meshCache.vertexSize() == sizeof(glm::vec3) &&
+            (mesh.m_meshCache.indexSize() == sizeof(GLushort) || mesh.m_meshCache.indexSize() == sizeof(GLuint)))
         {
-            throw "ERROR::OBJLOADER::Could not open file.";
+            mesh.m_positions.clear();
+            mesh.m_indices.clear();
+            mesh.m_shortIndices.clear();
+            mesh.m_indexType = mesh.m_meshCache.indexSize() == sizeof(GLushort) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+            qDebug() << "OBJ file loaded from cache" << MeshCache::cacheFilePath(filename) << "in" << loadTimer.elapsed() << "ms" << "\n";
+            return;
         }
+        mesh.m_meshCache.close();
+    }
 
-        //Read one line at a time
-        while (std::getline(in_file, line))
-        {
-            //Get the prefix of the line
-            ss.clear();
-            ss.str(line);
-            ss >> prefix;
-
-            //if (prefix == "#")
-            //{
-
-            //}
-            //else if (prefix == "o")
-            //{
-
-            //}
-            //else if (prefix == "s")
-            //{
-
-            //}
-            //else if (prefix == "use_mtl")
-            //{
-
-            //}
-            if (prefix == "v") //Vertex position
-            {
-                ss >> temp_vec3.x >> temp_vec3.y >> temp_vec3.z;
-                vertex_positions.push_back(temp_vec3);
-            }
-            //else if (prefix == "vt")
-            //{
-            //    ss >> temp_vec2.x >> temp_vec2.y;
-            //    vertex_texcoords.push_back(temp_vec2);
-            //}
-             //else if (prefix == "vn")
-             //{
-             //    ss >> temp_vec3.x >> temp_vec3.y >> temp_vec3.z;
-             //    vertex_normals.push_back(temp_vec3);
-             //}
-            else if (prefix == "f")
-            {
-                int counter = 0;
-                while (ss >> temp_glint[0] >> temp_glint[1] >> temp_glint[2])
-                {
-                    //Pushing indices into correct arrays
-                    if (counter == 0) {
-                        indices.push_back(temp_glint[0]);
-                        indices.push_back(temp_glint[1]);
-                        indices.push_back(temp_glint[2]);
-                    }
-                    //else if (counter == 1)
-                    //    vertex_texcoord_indicies.push_back(temp_glint);
-                    //else if (counter == 2)
-                    //    vertex_normal_indicies.push_back(temp_glint);
-
-                    //Handling characters
-                    if (ss.peek() == '/')
-                    {
-                        ++counter;
-                        ss.ignore(1, '/');
-                    }
-                    else if (ss.peek() == '//')
-                    {
-                        ++counter;
-                        ss.ignore(1, '//');
-                    }
-                    else if (ss.peek() == ' ')
-                    {
-                        ++counter;
-                        ss.ignore(1, ' ');
-                    }
-
-                    //Reset the counter
-                    if (counter > 2)
-                        counter = 0;
-                }
-            }
-            else
-            {
+    beginStage("Parsing OBJ file");
+    QFile in_file(filename);
 
+    //File open error check
+    if (!in_file.open(QIODevice::ReadOnly))
+    {
+        throw "ERROR::OBJLOADER::Could not open file.";
+    }
+
+    // map the entire file into memory, the parser works directly on the mapped text
+    const qint64 fileSize = in_file.size();
+    const char * begin = nullptr;
+    uchar * mappedData = nullptr;
+    if (fileSize > 0) {
+        mappedData = in_file.map(0, fileSize);
+        if (mappedData == nullptr)
+            throw "ERROR::OBJLOADER::Could not map file.";
+        begin = reinterpret_cast<const char *>(mappedData);
+    }
+    const char * end = begin + fileSize;
+
+    // count and parse records (in parallel chunks unless chunkCount == 1),
+    // the arrays are sized exactly from the counting pass
+    std::vector<glm::vec3> objPositions;
+    std::vector<int> objIndices;
+    // a background load must not hold the global pool, which the picks of the GUI thread use
+    ThreadPool & pool = loader != nullptr ? loader->pool() : ThreadPool::globalInstance();
+    bool success = parseObjText(begin, end, pool, chunkCount, objPositions, objIndices);
+    if (mappedData != nullptr)
+        in_file.unmap(mappedData);
+    if (!success)
+        throw "ERROR::OBJLOADER::Malformed vertex or face record.";
+
+    beginStage("Welding vertexes");
+    // merge duplicate positions, so that each shared vertex is stored and transformed only once
+    std::vector<unsigned int> remap;
+    weldVertices(objPositions.data(), objPositions.size(), m_weldTolerance, pool, mesh.m_positions, remap);
+
+    // translate 1-based OBJ indexes to 0-based indexes of welded vertexes,
+    // 16-bit indexes are sufficient for up to 65536 vertexes
+    mesh.m_indexType = mesh.m_positions.size() <= 0x10000 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    mesh.m_indices.clear();
+    mesh.m_shortIndices.clear();
+    if (mesh.m_indexType == GL_UNSIGNED_SHORT)
+        mesh.m_shortIndices.resize(objIndices.size());
+    else
+        mesh.m_indices.resize(objIndices.size());
+    std::atomic<bool> indexesValid(true);
+    pool.parallelFor(objIndices.size(), 0, [&](size_t first, size_t last, unsigned int) {
+        for (size_t i = first; i < last; i++) {
+            if (objIndices[i] < 1 || size_t(objIndices[i]) > objPositions.size()) {
+                indexesValid = false;
+                return;
             }
+            GLuint idx = remap[objIndices[i] - 1];
+            if (mesh.m_indexType == GL_UNSIGNED_SHORT)
+                mesh.m_shortIndices[i] = GLushort(idx);
+            else
+                mesh.m_indices[i] = idx;
         }
-        //Build final vertex array (mesh)
-        vertices.resize(indices.size(), Model_Vertex());
+    });
+    if (!indexesValid)
+        throw "ERROR::OBJLOADER::Face index out of range.";
+
+    //DEBUG
+    qDebug() << "Size of vertices: " << mesh.m_positions.size() << "(" << objPositions.size() << "before welding)" << "\n";
+    qDebug() << "Size of indices: " << mesh.elementCount() << "\n";
+
+    //Loaded success
+    qDebug() << "OBJ file loaded in" << loadTimer.elapsed() << "ms" << "\n";
+
+    beginStage("Writing mesh cache");
+    // store parsed data for the next time this file is loaded
+    if (!MeshCache::write(filename, m_weldTolerance,
+                          mesh.m_positions.data(), mesh.m_positions.size(), sizeof(glm::vec3),
+                          mesh.elementData(), mesh.elementCount(), mesh.elementSize()))
+    {
+        qWarning() << "Could not write mesh cache" << MeshCache::cacheFilePath(filename);
+    }
+}
 
-        //Load in all indices
-        for (GLint i = 0; i < vertices.size(); i++)
-        {
-            vertices[i].positions = vertex_positions[indices[i] - 1];
 
-            //vertices[i] = vertex_texcoords[vertex_texcoord_indicies[i] - 1];
+void ObjModel::takeMeshData(MeshData & mesh) {
+    vertex_positions.swap(mesh.m_positions);
+    indices.swap(mesh.m_indices);
+    m_shortIndices.swap(mesh.m_shortIndices);
+    std::swap(m_indexType, mesh.m_indexType);
+    m_meshCache.swap(mesh.m_meshCache);
+}
+
+
+void ObjModel::buildSearchTrees() {
+    QElapsedTimer buildTimer;
+    buildTimer.start();
+    m_bvh.build(positionData(), elementData(), elementSize(), elementCount()/3, ThreadPool::globalInstance());
+    qDebug() << "BVH with" << m_bvh.m_nodes.size() << "nodes built in" << buildTimer.elapsed() << "ms" << "\n";
+
+    buildTimer.start();
+    m_vertexTree.build(positionData(), positionCount(), ThreadPool::globalInstance());
+    m_movedVertexes.clear();
+    m_vertexMoved.clear();
+    qDebug() << "Vertex KD-tree built in" << buildTimer.elapsed() << "ms" << "\n";
+}
 
-            //vertices[i].normals = vertex_normals[indices[i] - 1];
 
-            //vertices[i].r = 1.0f;
-            //vertices[i].g = 1.0f;
-            //vertices[i].b = 1.0f;
+void ObjModel::rebuildSearchTrees(std::vector<glm::vec3> positions) {
+    QElapsedTimer buildTimer;
+    buildTimer.start();
+    // built on this thread only, so that the global pool remains available for picks and refits meanwhile
+    ThreadPool pool(1);
+    MeshBVH bvh;
+    bvh.build(positions.data(), elementData(), elementSize(), elementCount()/3, pool);
+    PointKDTree vertexTree;
+    vertexTree.build(positions.data(), positions.size(), pool);
+    std::vector<glm::vec3>().swap(positions);
+
+    std::unique_lock<std::shared_mutex> lock(m_searchMutex);
+    // vertexes moved during the build
+    std::sort(m_changedTriangles.begin(), m_changedTriangles.end());
+    m_changedTriangles.erase(std::unique(m_changedTriangles.begin(), m_changedTriangles.end()), m_changedTriangles.end());
+    bvh.refit(positionData(), elementData(), elementSize(), m_changedTriangles.data(), m_changedTriangles.size(), pool);
+    const std::size_t changedCount = m_changedTriangles.size();
+    std::vector<unsigned int>().swap(m_changedTriangles);
+    std::swap(m_bvh, bvh);
+    // the new vertex tree skips the vertexes moved during the build
+    for (unsigned int v : m_movedVertexes)
+        m_vertexMoved[v] = 0;
+    m_movedVertexes.clear();
+    for (unsigned int v : m_changedVertexes)
+        if (m_vertexMoved[v] == 0) {
+            m_vertexMoved[v] = 1;
+            m_movedVertexes.push_back(v);
         }
+    std::vector<unsigned int>().swap(m_changedVertexes);
+    std::swap(m_vertexTree, vertexTree);
+    m_rebuilding = false;
+    lock.unlock();
+    qDebug() << "BVH rebuilt in background in" << buildTimer.elapsed() << "ms," << changedCount
+             << "triangles refit after the build" << "\n";
+}
 
-        //DEBUG
-        qDebug() << "Size of vertices: " << vertices.size() << "\n";
-        qDebug() << "Size of indices: " << indices.size() << "\n";
 
-        //Loaded success
-        qDebug() << "OBJ file loaded!" << "\n";
+void ObjModel::waitForRebuild() {
+    if (m_rebuildThread.joinable())
+        m_rebuildThread.join();
 }
 
-void ObjModel::boxobj()
-{
-    int boxCount = vertices.size();
-    BoxMesh b(1000, 1000, 1000);
-    Transform3D trans;
-    for (int i = 0; i < boxCount; i++) {
-        trans.setTranslation(vertices[i].positions.x, vertices[i].positions.y, vertices[i].positions.z);
-        b.transform(trans.toMatrix());
-        m_boxes.push_back(b);
+
+void ObjModel::detachMeshCache() {
+    const glm::vec3 * positions = positionData();
+    vertex_positions.assign(positions, positions + positionCount());
+    if (m_indexType == GL_UNSIGNED_SHORT) {
+        const GLushort * elements = static_cast<const GLushort *>(elementData());
+        m_shortIndices.assign(elements, elements + elementCount());
+    }
+    else {
+        const GLuint * elements = static_cast<const GLuint *>(elementData());
+        indices.assign(elements, elements + elementCount());
     }
+    m_meshCache.close();
+}
+
+
+void ObjModel::buildVertexTriangles() {
+    // counting sort of the triangle corners by vertex
+    const size_t cornerCount = elementCount();
+    m_vertexTriangleStart.assign(positionCount() + 1, 0);
+    for (size_t i = 0; i < cornerCount; ++i)
+        ++m_vertexTriangleStart[elementIndex(i) + 1];
+    for (size_t v = 1; v < m_vertexTriangleStart.size(); ++v)
+        m_vertexTriangleStart[v] += m_vertexTriangleStart[v - 1];
+    m_vertexTriangles.resize(cornerCount);
+    std::vector<unsigned int> next(m_vertexTriangleStart.begin(), m_vertexTriangleStart.end() - 1);
+    for (size_t i = 0; i < cornerCount; ++i)
+        m_vertexTriangles[next[elementIndex(i)]++] = (unsigned int)(i/3);
+}
 
-    unsigned int NBoxes = m_boxes.size();
+
+void ObjModel::updatePositions(const unsigned int * ids, const glm::vec3 * newPositions, std::size_t count) {
+    if (count == 0 || m_bvh.empty())
+        return;
+    QElapsedTimer updateTimer;
+    updateTimer.start();
+
+    // ids out of range would corrupt the mesh data and the search trees, they are skipped
+    const std::size_t vertexCount = positionCount();
+    std::vector<unsigned int> validIds;
+    std::vector<glm::vec3> validPositions;
+    if (std::any_of(ids, ids + count, [vertexCount](unsigned int id) { return id >= vertexCount; })) {
+        for (std::size_t i = 0; i < count; ++i)
+            if (ids[i] < vertexCount) {
+                validIds.push_back(ids[i]);
+                validPositions.push_back(newPositions[i]);
+            }
+        qWarning() << "updatePositions(): skipped" << count - validIds.size() << "vertex ids out of range";
+        ids = validIds.data();
+        newPositions = validPositions.data();
+        count = validIds.size();
+        if (count == 0)
+            return;
+    }
+
+    // triangles using the moved vertexes (a triangle may use a vertex more than once)
+    if (m_vertexTriangleStart.empty())
+        buildVertexTriangles();
+    std::vector<unsigned int> triangles;
+    for (std::size_t i = 0; i < count; ++i)
+        triangles.insert(triangles.end(), m_vertexTriangles.begin() + m_vertexTriangleStart[ids[i]],
+                         m_vertexTriangles.begin() + m_vertexTriangleStart[ids[i] + 1]);
+    std::sort(triangles.begin(), triangles.end());
+    triangles.erase(std::unique(triangles.begin(), triangles.end()), triangles.end());
+
+    std::vector<glm::vec3> rebuildPositions;
+    bool rebuild = false;
+    float costRatio;
+    {
+        std::unique_lock<std::shared_mutex> lock(m_searchMutex);
+        if (m_meshCache.isOpen())
+            detachMeshCache();
+        for (std::size_t i = 0; i < count; ++i)
+            vertex_positions[ids[i]] = newPositions[i];
+        m_bvh.refit(vertex_positions.data(), elementData(), elementSize(), triangles.data(), triangles.size(),
+                    ThreadPool::globalInstance());
+        costRatio = m_bvh.costRatio();
+        if (m_vertexMoved.empty())
+            m_vertexMoved.assign(vertex_positions.size(), 0);
+        for (std::size_t i = 0; i < count; ++i)
+            if (m_vertexMoved[ids[i]] == 0) {
+                m_vertexMoved[ids[i]] = 1;
+                m_movedVertexes.push_back(ids[i]);
+            }
+        if (m_rebuilding) {
+            m_changedTriangles.insert(m_changedTriangles.end(), triangles.begin(), triangles.end());
+            m_changedVertexes.insert(m_changedVertexes.end(), ids, ids + count);
+        }
+        else if (costRatio > BVH_REBUILD_COST_RATIO || m_movedVertexes.size() > VERTEX_TREE_MAX_MOVED) {
+            m_rebuilding = true;
+            rebuild = true;
+            rebuildPositions = vertex_positions;
+        }
+    }
+    if (rebuild) {
+        waitForRebuild(); // the previous rebuild has finished already
+        m_rebuildThread = std::thread(&ObjModel::rebuildSearchTrees, this, std::move(rebuildPositions));
+    }
+
+    if (m_vbo.isCreated()) {
+        m_vbo.bind();
+        // many single writes are slower than one upload of the entire buffer
+        if (count > positionCount()/16)
+            m_vbo.write(0, vertex_positions.data(), int(positionCount()*sizeof(glm::vec3)));
+        else
+            for (std::size_t i = 0; i < count; ++i)
+                m_vbo.write(int(ids[i]*sizeof(glm::vec3)), &newPositions[i], sizeof(glm::vec3));
+        m_vbo.release();
+    }
+    qDebug().nospace() << "Moved " << count << " vertexes, BVH refit for " << triangles.size() << " triangles in "
+                       << updateTimer.nsecsElapsed()*1e-6 << " ms, cost ratio " << costRatio
+                       << (rebuild ? ", rebuild started" : "");
+}
+
+void ObjModel::boxobj()
+{
+    const glm::vec3 * positions = positionData();
+    unsigned int boxCount = positionCount();
+    ThreadPool & pool = ThreadPool::globalInstance();
+    m_boxes.clear();
+    m_boxes.resize(boxCount);
+    pool.parallelFor(boxCount, 0, [&](size_t first, size_t last, unsigned int) {
+        for (size_t i = first; i < last; i++)
+            m_boxes.setBox(i, positions[i], glm::vec3(500, 500, 500));
+    });
 
     // resize storage arrays
-    m_vertexBufferData.resize(NBoxes * BoxMesh::VertexCount);
-    m_elementBufferData.resize(NBoxes * BoxMesh::IndexCount);
+    m_vertexBufferData.resize(boxCount * BoxMesh::VertexCount);
+    m_elementBufferData.resize(boxCount * BoxMesh::IndexCount);
 
-    // update the buffers
-    Vertex* vertexBuffer = m_vertexBufferData.data();
-    unsigned int vertexCount = 0;
-    GLuint* elementBuffer = m_elementBufferData.data();
-    for (const BoxMesh& b : m_boxes)
-        b.copy2Buffer(vertexBuffer, elementBuffer, vertexCount);
+    // update the buffers, boxes are written in parallel
+    m_boxes.copy2Buffer(m_vertexBufferData.data(), m_elementBufferData.data(), pool);
 }
 
 void ObjModel::create(QOpenGLShaderProgram * shaderProgramm) {
@@ -236,25 +535,36 @@ void ObjModel::create(QOpenGLShaderProgram * shaderProgramm) {
     m_vbo.create();
     m_vbo.bind();
     m_vbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
-    int vertexMemSize = vertices.size()*sizeof(Model_Vertex);
-    qDebug() << "size: " << vertices.size();
-    qDebug() << "BoxObject - VertexBuffer size =" << vertexMemSize/1024.0 << "kByte";
-    m_vbo.allocate(vertices.data(), vertexMemSize);
+    // during a background load, the buffers are allocated and filled by processLoadEvents()
+    const bool upload = !loading();
+    if (upload) {
+        int vertexMemSize = positionCount()*sizeof(glm::vec3);
+        qDebug() << "size: " << positionCount();
+        qDebug() << "BoxObject - VertexBuffer size =" << vertexMemSize/1024.0 << "kByte";
+        // when loaded from cache, the data is uploaded directly from the mapped file
+        m_vbo.allocate(positionData(), vertexMemSize);
+        m_readyVertexCount = m_uploadedVertexCount = positionCount();
+    }
 
     // create and bind element buffer
     m_ebo.create();
     m_ebo.bind();
     m_ebo.setUsagePattern(QOpenGLBuffer::StaticDraw);
-    int elementMemSize = indices.size()*sizeof(GLuint);
-    qDebug() << "BoxObject - ElementBuffer size =" << elementMemSize/1024.0 << "kByte";
-    m_ebo.allocate(indices.data(), elementMemSize);
+    if (upload) {
+        int elementMemSize = elementCount()*elementSize();
+        qDebug() << "BoxObject - ElementBuffer size =" << elementMemSize/1024.0 << "kByte";
+        // padded to whole 32 bit words, the GPU pick reads 16 bit indexes in pairs
+        m_ebo.allocate((elementMemSize + 3) & ~3);
+        m_ebo.write(0, elementData(), elementMemSize);
+        m_readyElementCount = m_uploadedElementCount = elementCount();
+    }
 
     // set shader attributes
     // tell shader program we have two data arrays to be used as input to the shaders
 
     // index 0 = position
     shaderProgramm->enableAttributeArray(0); // array with index/id 0
-    shaderProgramm->setAttributeBuffer(0, GL_FLOAT, 0, 3, sizeof(Model_Vertex));
+    shaderProgramm->setAttributeBuffer(0, GL_FLOAT, 0, 3, sizeof(glm::vec3));
     // index 1 = color
     //shaderProgramm->enableAttributeArray(1); // array with index/id 1
     //shaderProgramm->setAttributeBuffer(1, GL_FLOAT, offsetof(Vertex, r), 3, sizeof(Vertex));
@@ -277,9 +587,10 @@ void ObjModel::render() {
     //set the geometry ("position" and "color" arrays)
     m_vao.bind();
 
-    // now draw the cube by drawing individual triangles
-    // - GL_TRIANGLES - draw individual triangles via elements
-    glDrawArrays(GL_TRIANGLES, m_elementBufferData[0], m_elementBufferData.size());
+    // now draw the mesh by drawing individual triangles
+    // - GL_TRIANGLES - draw individual triangles via elements (16 or 32 bit indexes)
+    // during a background load only the triangles uploaded so far
+    glDrawElements(GL_TRIANGLES, GLsizei(m_uploadedElementCount/3*3), m_indexType, nullptr);
 
     // release vertices again
     m_vao.release();
@@ -287,39 +598,211 @@ void ObjModel::render() {
 
 void ObjModel::pick(const QVector3D& p1, const QVector3D& d, PickObject & po) const {
     // now process all box objects
-   for (unsigned int i=0; i<m_boxes.size(); ++i) {
-       const BoxMesh bm = m_boxes[i];
-       for (unsigned int j=0; j<6; ++j) {
-           float dist;
-           // is intersection point closes to viewer than previous intersection points?
-           if (bm.intersects(j, p1, d, dist)) {
-               qDebug() << QString("Plane %1 of box %2 intersects line at normalized distance = %3").arg(j).arg(i).arg(dist);
-               // keep objects that is closer to near plane
-               if (dist < po.m_dist) {
-                   po.m_dist = dist;
-                   po.m_objectId = i;
-                   po.m_faceId = j;
-               }
-               std::cout << "index: " << indices[i];
-           }
-       }
-   }
-}
-
-void ObjModel::pickPoint(const glm::vec3 &n, const glm::vec3 &f) const
+    m_boxes.pick(p1, d, po, ThreadPool::globalInstance());
+}
+
+bool ObjModel::pickPoint(const glm::vec3 &n, const glm::vec3 &f, PickObject & po) const
 {
-    for (int i = 0; i < vertices.size() - 2; i++) {
-        auto dir = f - n;
-        auto t = glm::length(dir);
-        if (rayTriangleIntersect(n, dir, vertices[i].positions, vertices[i + 1].positions, vertices[i + 2].positions, t))
-        {
-            std::cout << "Ray intersects mesh at index: " << i << std::endl;
-            break;
+    std::shared_lock<std::shared_mutex> lock(m_searchMutex);
+    MeshBVH::Hit hit(std::min(po.m_dist, 1.f));
+    if (!m_bvh.nearestHit(n, f - n, hit))
+        return false;
+    storeHit(hit, n, f - n, po);
+    return true;
+}
+
+
+bool ObjModel::hasSearchTrees() const {
+    std::shared_lock<std::shared_mutex> lock(m_searchMutex);
+    return !m_bvh.empty();
+}
+
+
+void ObjModel::gpuPick(GpuPicker & picker, const glm::vec3 & n, const glm::vec3 & f, float maxDist) const {
+    picker.pickTriangles(m_vbo.bufferId(), m_ebo.bufferId(), m_indexType, (unsigned int)(m_uploadedElementCount/3),
+                         n, f - n, std::min(maxDist, 1.f));
+}
+
+
+bool ObjModel::storeGpuHit(const GpuPickResult & hit, PickObject & po) const {
+    if (hit.m_primitiveId == ~0u)
+        return false;
+    po.m_dist = hit.m_dist;
+    po.m_faceId = hit.m_primitiveId;
+    po.m_u = hit.m_u;
+    po.m_v = hit.m_v;
+    po.m_objectId = hit.m_vertexId;
+    po.m_nearestVertex = ~0u;
+    return true;
+}
+
+
+std::size_t ObjModel::pickRays(const MeshBVH::Ray * rays, std::size_t count, PickObject * results,
+                               ThreadPool & pool) const
+{
+    std::shared_lock<std::shared_mutex> lock(m_searchMutex);
+    std::vector<MeshBVH::Hit> hits;
+    hits.reserve(count);
+    for (std::size_t i=0; i<count; ++i)
+        hits.push_back(MeshBVH::Hit(std::min(results[i].m_dist, 1.f)));
+    m_bvh.nearestHits(rays, count, hits.data(), pool);
+
+    // the nearest vertex query costs about as much as the ray, so hits are stored in parallel as well
+    std::atomic<std::size_t> hitCount(0);
+    pool.parallelFor(count, 0, [&](std::size_t first, std::size_t last, unsigned int) {
+        std::size_t blockHits = 0;
+        for (std::size_t i=first; i<last; ++i) {
+            if (hits[i].m_triangle == ~0u)
+                continue;
+            storeHit(hits[i], rays[i].m_origin, rays[i].m_dir, results[i]);
+            ++blockHits;
         }
+        hitCount += blockHits;
+    });
+    return hitCount;
+}
+
+
+void ObjModel::nearestVertexes(const glm::vec3 & p, unsigned int k, std::vector<PointKDTree::Neighbor> & neighbors) const {
+    std::shared_lock<std::shared_mutex> lock(m_searchMutex);
+    findNearestVertexes(p, k, neighbors);
+}
+
+
+void ObjModel::vertexesInRadius(const glm::vec3 & p, float radius, std::vector<PointKDTree::Neighbor> & neighbors) const {
+    std::shared_lock<std::shared_mutex> lock(m_searchMutex);
+    m_vertexTree.radiusSearch(p, radius, neighbors, m_movedVertexes.empty() ? nullptr : m_vertexMoved.data());
+    if (m_movedVertexes.empty())
+        return;
+    const glm::vec3 * positions = positionData();
+    for (unsigned int v : m_movedVertexes) {
+        glm::vec3 d = positions[v] - p;
+        float dist2 = d.x*d.x + d.y*d.y + d.z*d.z;
+        if (dist2 <= radius*radius)
+            neighbors.push_back(PointKDTree::Neighbor(dist2, v));
+    }
+    std::sort(neighbors.begin(), neighbors.end());
+}
+
+
+void ObjModel::findNearestVertexes(const glm::vec3 & p, unsigned int k, std::vector<PointKDTree::Neighbor> & neighbors) const {
+    m_vertexTree.nearestNeighbors(p, k, neighbors, FLT_MAX, m_movedVertexes.empty() ? nullptr : m_vertexMoved.data());
+    if (m_movedVertexes.empty())
+        return;
+    const glm::vec3 * positions = positionData();
+    for (unsigned int v : m_movedVertexes) {
+        glm::vec3 d = positions[v] - p;
+        neighbors.push_back(PointKDTree::Neighbor(d.x*d.x + d.y*d.y + d.z*d.z, v));
+    }
+    std::sort(neighbors.begin(), neighbors.end());
+    if (neighbors.size() > k)
+        neighbors.resize(k);
+}
+
+
+unsigned int ObjModel::findNearestVertex(const glm::vec3 & p) const {
+    PointKDTree::Neighbor nearest;
+    m_vertexTree.nearestNeighbor(p, nearest, m_movedVertexes.empty() ? nullptr : m_vertexMoved.data());
+    const glm::vec3 * positions = positionData();
+    for (unsigned int v : m_movedVertexes) {
+        glm::vec3 d = positions[v] - p;
+        PointKDTree::Neighbor n(d.x*d.x + d.y*d.y + d.z*d.z, v);
+        if (n < nearest)
+            nearest = n;
     }
+    return nearest.m_pointId;
 }
 
 
+void ObjModel::storeHit(const MeshBVH::Hit & hit, const glm::vec3 & origin, const glm::vec3 & dir, PickObject & po) const {
+    po.m_dist = hit.m_dist;
+    po.m_faceId = hit.m_triangle;
+    po.m_u = hit.m_u;
+    po.m_v = hit.m_v;
+    // the vertex with the largest barycentric weight is nearest to the hit point
+    unsigned int k = 0;
+    if (hit.m_u > 1 - hit.m_u - hit.m_v && hit.m_u >= hit.m_v)
+        k = 1;
+    else if (hit.m_v > 1 - hit.m_u - hit.m_v && hit.m_v > hit.m_u)
+        k = 2;
+    po.m_objectId = elementIndex(3*size_t(hit.m_triangle) + k);
+    po.m_nearestVertex = findNearestVertex(origin + hit.m_dist*dir);
+}
+
+
+
+const glm::vec3 * ObjModel::positionData() const {
+    if (m_meshCache.isOpen())
+        return static_cast<const glm::vec3 *>(m_meshCache.vertexData());
+    return vertex_positions.data();
+}
+
+
+size_t ObjModel::positionCount() const {
+    if (m_meshCache.isOpen())
+        return m_meshCache.vertexCount();
+    return vertex_positions.size();
+}
+
+
+const void * ObjModel::elementData() const {
+    if (m_meshCache.isOpen())
+        return m_meshCache.indexData();
+    if (m_indexType == GL_UNSIGNED_SHORT)
+        return m_shortIndices.data();
+    return indices.data();
+}
+
+
+size_t ObjModel::elementCount() const {
+    if (m_meshCache.isOpen())
+        return m_meshCache.indexCount();
+    if (m_indexType == GL_UNSIGNED_SHORT)
+        return m_shortIndices.size();
+    return indices.size();
+}
+
+
+void ObjModel::MeshData::clear() {
+    std::vector<glm::vec3>().swap(m_positions);
+    std::vector<GLuint>().swap(m_indices);
+    std::vector<GLushort>().swap(m_shortIndices);
+    m_indexType = GL_UNSIGNED_INT;
+    m_meshCache.close();
+}
+
+
+const glm::vec3 * ObjModel::MeshData::positionData() const {
+    if (m_meshCache.isOpen())
+        return static_cast<const glm::vec3 *>(m_meshCache.vertexData());
+    return m_positions.data();
+}
+
+
+size_t ObjModel::MeshData::positionCount() const {
+    if (m_meshCache.isOpen())
+        return m_meshCache.vertexCount();
+    return m_positions.size();
+}
+
+
+const void * ObjModel::MeshData::elementData() const {
+    if (m_meshCache.isOpen())
+        return m_meshCache.indexData();
+    if (m_indexType == GL_UNSIGNED_SHORT)
+        return m_shortIndices.data();
+    return m_indices.data();
+}
+
+
+size_t ObjModel::MeshData::elementCount() const {
+    if (m_meshCache.isOpen())
+        return m_meshCache.indexCount();
+    if (m_indexType == GL_UNSIGNED_SHORT)
+        return m_shortIndices.size();
+    return m_indices.size();
+}
+
 
 void ObjModel::highlight(unsigned int boxId, unsigned int faceId) {
     // we change the color of all vertexes of the selected box to lightgray
@@ -332,14 +815,10 @@ void ObjModel::highlight(unsigned int boxId, unsigned int faceId) {
         else
             faceCols[i] = QColor("#f3f3f3");
     }
-    m_boxes[boxId].setFaceColors(faceCols);
+    m_boxes.setColorScheme(boxId, m_boxes.colorSchemeIndex(faceCols));
 
-    // advance the pointers and vertex numbers to the respected box position/numbering
-    Vertex * vertexBuffer = m_vertexBufferData.data() + boxId*6*4; // 6 planes, with 4 vertexes each
-    unsigned int vertexCount = boxId*6*4;
-    GLuint * elementBuffer = m_elementBufferData.data() + boxId*6*6; // 6 planes, with 2 triangles with 3 indexes each
     // then we update the respective portion of the vertexbuffer memory
-    m_boxes[boxId].copy2Buffer(vertexBuffer, elementBuffer, vertexCount);
+    m_boxes.copy2Buffer(boxId, m_vertexBufferData.data(), m_elementBufferData.data());
 
     QElapsedTimer t;
     t.start();
@@ -8,12 +8,23 @@
 #include "Vertex.h"
 #include <glm.hpp>
 
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
 QT_BEGIN_NAMESPACE
 class QOpenGLShaderProgram;
 QT_END_NAMESPACE
 
+#include "BackgroundLoader.h"
 #include "BoxMesh.h"
+#include "BoxSet.h"
+#include "GpuPicker.h"
 #include "PickObject.h"
+#include "MeshBVH.h"
+#include "MeshCache.h"
+#include "PointKDTree.h"
 
 
 /*! A container for all the boxes.
@@ -22,8 +33,47 @@ QT_END_NAMESPACE
 class ObjModel {
 public:
     ObjModel();
-    void loadObj(const char *filename);
+    /*! Cancels a running background load and waits for a running background rebuild of the BVH. */
+    ~ObjModel();
+    /*! Reads vertex positions and (fan-triangulated) faces from an OBJ file.
+        The file is memory mapped and parsed in two passes (count, then parse), so that
+        vertex_positions and indices are sized exactly and no memory is allocated per line.
+        The file is split into chunkCount chunks that are parsed in parallel (0 = one chunk per
+        thread of the global thread pool, 1 = serial parsing).
+
+        Duplicate positions are welded (see m_weldTolerance), so that vertex_positions holds unique positions
+        only and the faces are stored as 0-based indexes into vertex_positions: in m_shortIndices for
+        meshes with up to 65536 vertexes, otherwise in indices.
+
+        After a successful parse, the buffer data is written to a binary cache next to the OBJ file (see MeshCache).
+        If a valid cache exists, it is memory mapped instead of parsing the file, and all vectors remain empty.
+
+        Finally, the BVH for picking (m_bvh) and the KD-tree over the vertexes (m_vertexTree) are built.
+        Mind: must not be called while picks are running.
+    */
+    void loadObj(const char *filename, unsigned int chunkCount = 0);
+
+    /*! Loads the OBJ file like loadObj(), but on the thread of m_loader, so that the GUI remains responsive.
+        As the triangle indexes refer to the welded vertexes, the mesh is complete only after welding. It is
+        then uploaded by processLoadEvents() over several frames and drawn, while the BVH and the vertex tree are
+        built in the background. Until they are taken over, pickPoint() finds nothing and picks have to use
+        gpuPick() (see hasSearchTrees()). A running background load is cancelled first.
+    */
+    void loadObjInBackground(const std::string & filename, unsigned int chunkCount = 0);
 
+    /*! Processes the events of a background load (GUI thread, OpenGL context current, e.g. in paintGL()):
+        allocates m_vbo/m_ebo, uploads the vertexes and then the triangles (at most m_loader.m_uploadBytesPerFrame
+        per call) and takes over the search trees when the load has finished.
+        Returns true if data is left to upload, call it again with the next frame then.
+    */
+    bool processLoadEvents();
+
+    /*! True while a background load is running or its data is not uploaded completely. */
+    bool loading() const;
+
+    /*! Creates one box per vertex in m_boxes and expands all boxes into m_vertexBufferData/m_elementBufferData.
+        Mind: this needs 720 bytes per box, for drawing only use InstancedBoxObject instead.
+    */
     void boxobj();
 
     /*! The function is called during OpenGL initialization, where the OpenGL context is current. */
@@ -35,24 +85,117 @@ public:
     /*! Thread-save pick function.
         Checks if any of the box object surfaces is hit by the ray defined by "p1 + d [0..1]" and
         stores data in po (pick object).
+        Large box sets are searched in parallel on the global thread pool, hence the function must not be called
+        from a task running on that pool.
     */
     void pick(const QVector3D& p1, const QVector3D& d, PickObject & po) const;
 
-    void pickPoint(const glm::vec3& n, const glm::vec3& f) const;
+    /*! Thread-save pick function for the mesh, also while updatePositions() changes the mesh.
+        Finds the nearest triangle hit by the ray "n + t*(f - n)" with 0 <= t < 1 (and t < po.m_dist) using m_bvh,
+        the triangles of the BVH leaves are tested with the SIMD kernel selected by simdLevel().
+        On a hit, returns true and stores the distance, the triangle (m_faceId), the barycentric coordinates,
+        the vertex of the triangle nearest to the hit point (m_objectId) and the vertex of the entire mesh
+        nearest to the hit point (m_nearestVertex, see nearestVertexes()) in po.
+    */
+    bool pickPoint(const glm::vec3& n, const glm::vec3& f, PickObject & po) const;
+
+    /*! Thread-save batch pick function for the mesh (also while updatePositions() changes the mesh), e.g. for
+        scripted picks of many screen pixels.
+        Picks all rays "m_origin + t*m_dir" with 0 <= t < 1 (and t < results[i].m_dist) and stores the hits in
+        results as pickPoint() does, results of rays without hit remain unchanged. Returns the number of hits.
+        Consecutive rays are traced together as packets (see MeshBVH::nearestHits()), so rays should be ordered
+        coherently, e.g. by tiles of neighboring pixels. The packets are distributed on the thread pool, hence the
+        function must not be called from a task running on that pool. No OpenGL calls are made.
+    */
+    std::size_t pickRays(const MeshBVH::Ray * rays, std::size_t count, PickObject * results, ThreadPool & pool) const;
+
+    /*! Thread-save: true once m_bvh is built, before pickPoint() and pickRays() find nothing (use gpuPick() then). */
+    bool hasSearchTrees() const;
+
+    /*! Starts a brute-force pick of the ray "n + t*(f - n)" with 0 <= t < maxDist on the GPU, testing all triangles
+        uploaded to m_vbo/m_ebo (see GpuPicker), e.g. while m_bvh is not built yet. The OpenGL context must be current, the
+        result is polled with picker.pollResult() and stored into a PickObject with storeGpuHit().
+    */
+    void gpuPick(GpuPicker & picker, const glm::vec3 & n, const glm::vec3 & f, float maxDist = 1) const;
+    /*! Stores the result of gpuPick() in po as pickPoint() does, except for m_nearestVertex. Returns false if
+        nothing was hit.
+    */
+    bool storeGpuHit(const GpuPickResult & hit, PickObject & po) const;
+
+    /*! Thread-save: finds the k vertexes nearest to p and stores them in neighbors, sorted by distance
+        (see PointKDTree::nearestNeighbors()), also while updatePositions() changes the mesh.
+    */
+    void nearestVertexes(const glm::vec3 & p, unsigned int k, std::vector<PointKDTree::Neighbor> & neighbors) const;
+    /*! Thread-save: finds all vertexes within radius around p and stores them in neighbors, sorted by distance. */
+    void vertexesInRadius(const glm::vec3 & p, float radius, std::vector<PointKDTree::Neighbor> & neighbors) const;
+
+    /*! Moves the vertexes ids[i] to newPositions[i] (i < count). The BVH is refit for the triangles using these
+        vertexes (see MeshBVH::refit()) and the vertex buffer is updated, if it was created (the OpenGL context
+        must be current then). When the mesh was loaded from the cache, the mesh data is copied from the cache first.
+        Ids out of range of the vertexes are skipped.
+
+        Refitting keeps picks exact, but slows them down as the bounds grow. Moved vertexes are skipped in
+        m_vertexTree and tested individually by the vertex queries. When the SAH cost of the tree exceeds that after
+        the last build by more than BVH_REBUILD_COST_RATIO, or more than VERTEX_TREE_MAX_MOVED vertexes have moved,
+        both trees are rebuilt from a copy of the positions on a background thread. Until then queries use the
+        current trees, vertexes moved meanwhile are refit in (or skipped by) the new trees before they replace
+        the current ones.
+    */
+    void updatePositions(const unsigned int * ids, const glm::vec3 * newPositions, std::size_t count);
 
     /*! Changes color of box and face to show that the box was clicked on. */
     void highlight(unsigned int boxId, unsigned int faceId);
 
-    std::vector<BoxMesh>		m_boxes;
+    /*! The unique vertex positions, either from vertex_positions or from the mapped mesh cache. */
+    const glm::vec3 * positionData() const;
+    size_t positionCount() const;
+
+    /*! The triangle indexes (element buffer content, with m_indexType), either from the index vectors
+        or from the mapped mesh cache.
+    */
+    const void * elementData() const;
+    size_t elementCount() const;
+    /*! Size of one index in bytes. */
+    unsigned int elementSize() const { return m_indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint); }
+    /*! Returns the i-th triangle index (0-based vertex index). */
+    unsigned int elementIndex(size_t i) const {
+        if (m_indexType == GL_UNSIGNED_SHORT)
+            return static_cast<const GLushort *>(elementData())[i];
+        return static_cast<const GLuint *>(elementData())[i];
+    }
+
+    BoxSet						m_boxes;
 
     std::vector<Vertex>			m_vertexBufferData;
     std::vector<uint>			m_elementBufferData;
 
-    std::vector<Model_Vertex>    vertices;
-    std::vector<int>             indices;
+    /*! Triangle indexes into vertex_positions, used for meshes with more than 65536 vertexes. */
+    std::vector<GLuint>          indices;
+    /*! Triangle indexes into vertex_positions, used for meshes with up to 65536 vertexes. */
+    std::vector<GLushort>        m_shortIndices;
+    /*! Type of indexes in the element buffer, either GL_UNSIGNED_SHORT or GL_UNSIGNED_INT. */
+    GLenum                       m_indexType = GL_UNSIGNED_INT;
 
+    /*! Unique (welded) vertex positions. */
     std::vector<glm::vec3> vertex_positions;
-    
+
+    /*! Positions closer than this (snapped to a grid with this cell size) are welded into one vertex,
+        0 welds only exact duplicates. The mesh cache stores the tolerance, after changing it the file is
+        parsed again.
+    */
+    float                        m_weldTolerance = 0.f;
+
+    /*! Mapped binary cache of the loaded OBJ file, holds the buffer data when the mesh was loaded from cache. */
+    MeshCache                   m_meshCache;
+
+    /*! Bounding volume hierarchy over the triangles, references the data of positionData(). */
+    MeshBVH                     m_bvh;
+    /*! KD-tree over the vertex positions, for nearest vertex and neighborhood queries. */
+    PointKDTree                 m_vertexTree;
+
+    /*! Reads the OBJ file in the background, see loadObjInBackground(). */
+    BackgroundLoader            m_loader;
+
 
     /*! Wraps an OpenGL VertexArrayObject, that references the vertex coordinates and color buffers. */
     QOpenGLVertexArrayObject	m_vao;
@@ -73,6 +216,90 @@ public:
 
     std::vector<vertex> vertexes;
     std::vector<face> faces;
+
+private:
+    /*! Mesh data read by readMeshData(), before it is taken over into the members by takeMeshData(). */
+    struct MeshData {
+        std::vector<glm::vec3>	m_positions;
+        std::vector<GLuint>		m_indices;
+        std::vector<GLushort>	m_shortIndices;
+        GLenum					m_indexType = GL_UNSIGNED_INT;
+        /*! Holds the data instead of the vectors, if the mesh was loaded from the cache. */
+        MeshCache				m_meshCache;
+
+        /*! Releases the data (the vectors and the cache). */
+        void clear();
+
+        const glm::vec3 * positionData() const;
+        size_t positionCount() const;
+        const void * elementData() const;
+        size_t elementCount() const;
+        unsigned int elementSize() const { return m_indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint); }
+    };
+
+    /*! Reads, welds and indexes the mesh data of the OBJ file (or maps its cache) into mesh, see loadObj(). If
+        loader is given, the stages are posted to it and the reading stops with an exception when it was cancelled.
+        Only reads m_weldTolerance of the object, so that it can run on the loader thread.
+    */
+    void readMeshData(const char *filename, unsigned int chunkCount, BackgroundLoader * loader, MeshData & mesh) const;
+    /*! Replaces the mesh data of the object by mesh (mesh receives the previous data). The data pointers of mesh
+        remain valid.
+    */
+    void takeMeshData(MeshData & mesh);
+    /*! Builds m_bvh and m_vertexTree from the current position and index data. */
+    void buildSearchTrees();
+    /*! Builds a new BVH and vertex tree for the given positions (on the calling thread) and replaces m_bvh and
+        m_vertexTree with them, runs on m_rebuildThread.
+    */
+    void rebuildSearchTrees(std::vector<glm::vec3> positions);
+    /*! Waits for a running background rebuild of the search trees. */
+    void waitForRebuild();
+
+    /*! Copies vertex and index data from the mesh cache into the vectors and closes the cache. */
+    void detachMeshCache();
+    /*! Fills m_vertexTriangleStart and m_vertexTriangles. */
+    void buildVertexTriangles();
+
+    /*! Stores a hit of m_bvh for the ray "origin + t*dir" in po, see pickPoint(). */
+    void storeHit(const MeshBVH::Hit & hit, const glm::vec3 & origin, const glm::vec3 & dir, PickObject & po) const;
+
+    /*! Vertex queries without locking, the moved vertexes are tested individually. */
+    void findNearestVertexes(const glm::vec3 & p, unsigned int k, std::vector<PointKDTree::Neighbor> & neighbors) const;
+    unsigned int findNearestVertex(const glm::vec3 & p) const;
+
+    /*! Protects the search trees and the mesh data while updatePositions() changes them, queries lock it shared. */
+    mutable std::shared_mutex	m_searchMutex;
+    /*! Rebuilds the search trees in the background, see updatePositions(). */
+    std::thread					m_rebuildThread;
+    /*! True while m_rebuildThread builds new trees (protected by m_searchMutex). */
+    bool						m_rebuilding = false;
+    /*! Triangles moved after the running rebuild copied the positions (protected by m_searchMutex). */
+    std::vector<unsigned int>	m_changedTriangles;
+    /*! Vertexes moved after the running rebuild copied the positions (protected by m_searchMutex). */
+    std::vector<unsigned int>	m_changedVertexes;
+    /*! Vertexes moved since m_vertexTree was built (protected by m_searchMutex), marked in m_vertexMoved. */
+    std::vector<unsigned int>	m_movedVertexes;
+    /*! Non-zero for vertexes in m_movedVertexes, empty until a vertex moved. */
+    std::vector<unsigned char>	m_vertexMoved;
+
+    /*! Triangles using vertex v are m_vertexTriangles[m_vertexTriangleStart[v] .. m_vertexTriangleStart[v + 1]),
+        built on the first call of updatePositions().
+    */
+    std::vector<unsigned int>	m_vertexTriangleStart;
+    std::vector<unsigned int>	m_vertexTriangles;
+
+    /*! Vertexes/indexes [0, m_ready...) are loaded, [0, m_uploaded...) are in m_vbo/m_ebo and drawn. */
+    std::size_t					m_readyVertexCount = 0;
+    std::size_t					m_uploadedVertexCount = 0;
+    std::size_t					m_readyElementCount = 0;
+    std::size_t					m_uploadedElementCount = 0;
+    /*! Mesh data read by the background load, only accessed by the loader thread until processLoadEvents() takes
+        it over with the Allocate event. The loader thread keeps reading the (unchanged) data for the search trees.
+    */
+    MeshData					m_loadedMesh;
+    /*! Search trees built by the background load, taken over by processLoadEvents() when the load has finished. */
+    MeshBVH						m_loadedBvh;
+    PointKDTree					m_loadedVertexTree;
 };
 
 #endif // OBJMODEL_H
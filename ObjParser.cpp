@@ -0,0 +1,190 @@
+#include "ObjParser.h"
+
+#include <atomic>
+#include <charconv>
+#include <cstring>
+
+#include "ThreadPool.h"
+
+// Note: all scanning functions work on raw (memory mapped) text and must never read beyond 'end'.
+
+static inline bool isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char * skipBlanks(const char * p, const char * end) {
+    while (p != end && isBlank(*p))
+        ++p;
+    return p;
+}
+
+/*! Returns pointer to the first character of the next line (or end). */
+static inline const char * nextLine(const char * p, const char * end) {
+    const char * eol = static_cast<const char *>(std::memchr(p, '\n', end - p));
+    return eol == nullptr ? end : eol + 1;
+}
+
+/*! Returns true, if the line starting at p begins with the single-character keyword c, followed by a blank. */
+static inline bool isKeyword(const char * p, const char * end, char c) {
+    return p != end && *p == c && (p + 1 == end || isBlank(p[1]));
+}
+
+/*! Returns true, if p points to the start of another token within the current line. */
+static inline bool isTokenStart(const char * p, const char * end) {
+    return p != end && *p != '\n' && *p != '#';
+}
+
+static inline const char * skipToken(const char * p, const char * end) {
+    while (p != end && !isBlank(*p) && *p != '\n')
+        ++p;
+    return p;
+}
+
+static inline const char * parseFloat(const char * p, const char * end, float & value) {
+    p = skipBlanks(p, end);
+    // from_chars does not accept an explicit plus sign
+    if (p != end && *p == '+')
+        ++p;
+    std::from_chars_result res = std::from_chars(p, end, value);
+    if (res.ec != std::errc())
+        return nullptr;
+    return res.ptr;
+}
+
+
+void countObjRecords(const char * begin, const char * end, ObjRecordCount & count) {
+    const char * p = begin;
+    while (p != end) {
+        p = skipBlanks(p, end);
+        if (isKeyword(p, end, 'v')) {
+            ++count.m_vertexCount;
+        }
+        else if (isKeyword(p, end, 'f')) {
+            // count corner references: "f 1 2 3 4" or "f 1/1/1 2/2/2 3/3/3"
+            std::size_t corners = 0;
+            p = skipBlanks(p + 1, end);
+            while (isTokenStart(p, end)) {
+                ++corners;
+                p = skipBlanks(skipToken(p, end), end);
+            }
+            if (corners >= 3)
+                count.m_indexCount += 3*(corners - 2);
+        }
+        if (p != end)
+            p = nextLine(p, end);
+    }
+}
+
+
+bool parseObjRecords(const char * begin, const char * end, std::size_t vertexBase,
+                     glm::vec3 * positions, int * indices)
+{
+    const char * p = begin;
+    std::size_t vertexCount = 0; // vertexes read in this block so far
+    while (p != end) {
+        p = skipBlanks(p, end);
+        if (isKeyword(p, end, 'v')) {
+            glm::vec3 & v = positions[vertexCount++];
+            ++p;
+            if ((p = parseFloat(p, end, v.x)) == nullptr ||
+                (p = parseFloat(p, end, v.y)) == nullptr ||
+                (p = parseFloat(p, end, v.z)) == nullptr)
+            {
+                return false;
+            }
+            // optional w coordinate is ignored
+        }
+        else if (isKeyword(p, end, 'f')) {
+            // polygons are split into a triangle fan: (c0, c1, c2), (c0, c2, c3), ...
+            int first = 0;
+            int prev = 0;
+            unsigned int corners = 0;
+            p = skipBlanks(p + 1, end);
+            while (isTokenStart(p, end)) {
+                int idx;
+                std::from_chars_result res = std::from_chars(p, end, idx);
+                if (res.ec != std::errc() || idx == 0)
+                    return false;
+                // relative index, -1 references the last vertex read before this face
+                if (idx < 0) {
+                    idx = int(vertexBase + vertexCount) + idx + 1;
+                    if (idx < 1)
+                        return false;
+                }
+                // skip texture/normal references
+                p = skipBlanks(skipToken(res.ptr, end), end);
+
+                if (corners == 0)
+                    first = idx;
+                else if (corners >= 2) {
+                    indices[0] = first;
+                    indices[1] = prev;
+                    indices[2] = idx;
+                    indices += 3;
+                }
+                prev = idx;
+                ++corners;
+            }
+        }
+        if (p != end)
+            p = nextLine(p, end);
+    }
+    return true;
+}
+
+
+std::vector<const char *> splitObjText(const char * begin, const char * end, unsigned int chunkCount) {
+    std::vector<const char *> bounds;
+    bounds.push_back(begin);
+    const std::size_t size = end - begin;
+    for (unsigned int i=1; i<chunkCount; ++i) {
+        const char * p = begin + size*i/chunkCount;
+        // move split point to the start of the next line, unless we are already at a line start
+        if (p != begin && p[-1] != '\n')
+            p = nextLine(p, end);
+        // skip empty chunks (long lines or tiny files)
+        if (p > bounds.back() && p < end)
+            bounds.push_back(p);
+    }
+    bounds.push_back(end);
+    return bounds;
+}
+
+
+bool parseObjText(const char * begin, const char * end, ThreadPool & pool, unsigned int chunkCount,
+                  std::vector<glm::vec3> & positions, std::vector<int> & indices)
+{
+    if (chunkCount == 0)
+        chunkCount = pool.threadCount();
+    std::vector<const char *> bounds = splitObjText(begin, end, chunkCount);
+    const unsigned int chunks = (unsigned int)bounds.size() - 1;
+
+    // pass 1: count records in each chunk
+    std::vector<ObjRecordCount> counts(chunks);
+    pool.run(chunks, [&](unsigned int i) {
+        countObjRecords(bounds[i], bounds[i+1], counts[i]);
+    });
+
+    // exclusive prefix sums give output offsets (and vertex base for relative indexes) of each chunk
+    std::vector<ObjRecordCount> offsets(chunks);
+    ObjRecordCount total;
+    for (unsigned int i=0; i<chunks; ++i) {
+        offsets[i] = total;
+        total.m_vertexCount += counts[i].m_vertexCount;
+        total.m_indexCount += counts[i].m_indexCount;
+    }
+    positions.resize(total.m_vertexCount);
+    indices.resize(total.m_indexCount);
+
+    // pass 2: parse each chunk directly into its range of the output arrays
+    std::atomic<bool> success(true);
+    pool.run(chunks, [&](unsigned int i) {
+        if (!parseObjRecords(bounds[i], bounds[i+1], offsets[i].m_vertexCount,
+                             positions.data() + offsets[i].m_vertexCount,
+                             indices.data() + offsets[i].m_indexCount))
+        {
+            success = false;
+        }
+    });
+    return success;
+}
@@ -0,0 +1,54 @@
+#ifndef OBJPARSER_H
+#define OBJPARSER_H
+
+#include <cstddef>
+#include <vector>
+
+#include <glm.hpp>
+
+class ThreadPool;
+
+/*! Number of records found in a block of OBJ text, as determined by the counting pass. */
+struct ObjRecordCount {
+    std::size_t m_vertexCount = 0; // number of "v" records
+    std::size_t m_indexCount = 0;  // number of triangle corners generated by all "f" records
+};
+
+/*! Scans the OBJ text in [begin, end) and counts "v" records and the number of triangle corners
+    the "f" records expand to (polygons are triangulated as fans, so a face with n corners yields 3*(n-2) indexes).
+    No memory is allocated.
+*/
+void countObjRecords(const char * begin, const char * end, ObjRecordCount & count);
+
+/*! Parses the OBJ text in [begin, end) and writes vertex positions and triangle indexes into the
+    caller-provided arrays, which must hold at least the number of entries reported by countObjRecords()
+    for the same text block.
+
+    Indexes are stored 1-based, as in the OBJ file. Relative (negative) indexes are resolved against
+    vertexBase + number of vertices read so far, where vertexBase is the number of "v" records that precede 'begin'
+    in the file. Only the position index of "v/vt/vn" references is used.
+
+    Returns false if a malformed "v" or "f" record was encountered (the output arrays are then only partially filled).
+*/
+bool parseObjRecords(const char * begin, const char * end, std::size_t vertexBase,
+                     glm::vec3 * positions, int * indices);
+
+/*! Splits the text [begin, end) into (at most) chunkCount blocks, each starting at the beginning of a line.
+    Returns the chunk boundaries, i.e. first pointer is begin, last pointer is end.
+*/
+std::vector<const char *> splitObjText(const char * begin, const char * end, unsigned int chunkCount);
+
+/*! Parses an entire OBJ text into positions and (1-based) triangle indexes.
+
+    With chunkCount > 1, the text is split into chunks at line boundaries. All chunks are counted in parallel,
+    exclusive prefix sums over the per-chunk vertex and index counts then give each chunk its output offsets
+    and vertex base (needed for relative indexes), and finally all chunks are parsed in parallel directly into
+    their ranges of the output arrays. The result is identical to the serial path (chunkCount = 1).
+
+    chunkCount = 0 selects one chunk per pool thread.
+    Returns false if a malformed record was encountered.
+*/
+bool parseObjText(const char * begin, const char * end, ThreadPool & pool, unsigned int chunkCount,
+                  std::vector<glm::vec3> & positions, std::vector<int> & indices);
+
+#endif // OBJPARSER_H
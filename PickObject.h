@@ -18,6 +18,9 @@ struct PickObject {
     float m_dist; // the normalized distance of the intersection point from starting point of pick line
     unsigned int m_objectId; // the object clicked on
     unsigned int m_faceId; // the actual triangle/plane clicked on
+    float m_u = 0; // barycentric coordinates of the hit point in triangle m_faceId (weights of its 2nd and 3rd vertex)
+    float m_v = 0;
+    unsigned int m_nearestVertex = ~0u; // vertex of the entire mesh nearest to the hit point (may belong to another triangle)
 };
 
 
@@ -0,0 +1,442 @@
+#include "PlyReader.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+
+#include "ThreadPool.h"
+
+static const char * const PLY_TYPE_NAMES[NUM_PLY_TYPES][2] = {
+    { "char",	"int8"		},
+    { "uchar",	"uint8"		},
+    { "short",	"int16"		},
+    { "ushort",	"uint16"	},
+    { "int",	"int32"		},
+    { "uint",	"uint32"	},
+    { "float",	"float32"	},
+    { "double",	"float64"	}
+};
+
+static const unsigned int PLY_TYPE_SIZES[NUM_PLY_TYPES] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+
+/*! Number of element instances decoded between two calls of the progress function. */
+static const std::size_t PLY_PROGRESS_BLOCK = 1 << 20;
+
+
+static bool plyTypeFromString(const std::string & str, PlyType & type) {
+    for (int i=0; i<NUM_PLY_TYPES; ++i) {
+        if (str == PLY_TYPE_NAMES[i][0] || str == PLY_TYPE_NAMES[i][1]) {
+            type = PlyType(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static inline bool hostIsLittleEndian() {
+    const std::uint16_t probe = 1;
+    return *reinterpret_cast<const unsigned char *>(&probe) == 1;
+}
+
+
+/*! Loads a value of type T from unaligned memory, optionally swapping the byte order. */
+template <typename T>
+static inline T loadValue(const char * p, bool swapBytes) {
+    T value;
+    if (!swapBytes) {
+        std::memcpy(&value, p, sizeof(T));
+    }
+    else {
+        char bytes[sizeof(T)];
+        for (unsigned int i=0; i<sizeof(T); ++i)
+            bytes[i] = p[sizeof(T) - 1 - i];
+        std::memcpy(&value, bytes, sizeof(T));
+    }
+    return value;
+}
+
+
+static inline double decodeValue(const char * p, PlyType type, bool swapBytes) {
+    switch (type) {
+        case PLY_INT8		: return *reinterpret_cast<const std::int8_t *>(p);
+        case PLY_UINT8		: return *reinterpret_cast<const std::uint8_t *>(p);
+        case PLY_INT16		: return loadValue<std::int16_t>(p, swapBytes);
+        case PLY_UINT16		: return loadValue<std::uint16_t>(p, swapBytes);
+        case PLY_INT32		: return loadValue<std::int32_t>(p, swapBytes);
+        case PLY_UINT32		: return loadValue<std::uint32_t>(p, swapBytes);
+        case PLY_FLOAT32	: return loadValue<float>(p, swapBytes);
+        case PLY_FLOAT64	: return loadValue<double>(p, swapBytes);
+        default				: return 0;
+    }
+}
+
+
+/*! Returns the next whitespace-delimited token in the line [p, lineEnd) and advances p. */
+static inline bool nextToken(const char * & p, const char * lineEnd, const char * & tokenBegin, const char * & tokenEnd) {
+    while (p != lineEnd && (*p == ' ' || *p == '\t' || *p == '\r'))
+        ++p;
+    if (p == lineEnd)
+        return false;
+    tokenBegin = p;
+    while (p != lineEnd && *p != ' ' && *p != '\t' && *p != '\r')
+        ++p;
+    tokenEnd = p;
+    return true;
+}
+
+
+static inline const char * findLineEnd(const char * p, const char * end) {
+    const char * eol = static_cast<const char *>(std::memchr(p, '\n', end - p));
+    return eol == nullptr ? end : eol;
+}
+
+
+int PlyHeader::elementIndex(const std::string & name) const {
+    for (unsigned int i=0; i<m_elements.size(); ++i)
+        if (m_elements[i].m_name == name)
+            return (int)i;
+    return -1;
+}
+
+
+/*! Returns the minimum size in bytes of one instance of element e: the binary size with empty lists, or for ASCII
+    one character and one separator per value.
+*/
+static std::size_t minInstanceSize(const PlyElement & e, bool ascii) {
+    std::size_t size = 0;
+    for (const PlyProperty & prop : e.m_properties)
+        size += ascii ? 2 : PLY_TYPE_SIZES[prop.m_isList ? prop.m_countType : prop.m_type];
+    return size;
+}
+
+
+bool parsePlyHeader(const char * begin, const char * end, PlyHeader & header, std::string & errorMsg) {
+    header = PlyHeader();
+    const char * p = begin;
+    bool first = true;
+    bool formatFound = false;
+    while (p != end) {
+        const char * lineEnd = findLineEnd(p, end);
+        const char * lineStart = p;
+        p = (lineEnd == end) ? end : lineEnd + 1;
+
+        std::vector<std::string> tokens;
+        const char * tokenBegin;
+        const char * tokenEnd;
+        const char * t = lineStart;
+        while (nextToken(t, lineEnd, tokenBegin, tokenEnd))
+            tokens.emplace_back(tokenBegin, tokenEnd);
+
+        if (first) {
+            if (tokens.size() != 1 || tokens[0] != "ply") {
+                errorMsg = "Not a PLY file.";
+                return false;
+            }
+            first = false;
+            continue;
+        }
+        if (tokens.empty() || tokens[0] == "comment" || tokens[0] == "obj_info")
+            continue;
+
+        if (tokens[0] == "format") {
+            if (tokens.size() < 2) {
+                errorMsg = "Invalid format line in PLY header.";
+                return false;
+            }
+            if (tokens[1] == "ascii")
+                header.m_format = PlyHeader::Ascii;
+            else if (tokens[1] == "binary_little_endian")
+                header.m_format = PlyHeader::BinaryLittleEndian;
+            else if (tokens[1] == "binary_big_endian")
+                header.m_format = PlyHeader::BinaryBigEndian;
+            else {
+                errorMsg = "Unknown PLY format '" + tokens[1] + "'.";
+                return false;
+            }
+            formatFound = true;
+        }
+        else if (tokens[0] == "element") {
+            PlyElement e;
+            if (tokens.size() != 3 ||
+                std::from_chars(tokens[2].data(), tokens[2].data() + tokens[2].size(), e.m_count).ec != std::errc())
+            {
+                errorMsg = "Invalid element line in PLY header.";
+                return false;
+            }
+            e.m_name = tokens[1];
+            header.m_elements.push_back(e);
+        }
+        else if (tokens[0] == "property") {
+            if (header.m_elements.empty()) {
+                errorMsg = "Property without element in PLY header.";
+                return false;
+            }
+            PlyProperty prop;
+            bool valid;
+            if (tokens.size() == 5 && tokens[1] == "list") {
+                prop.m_isList = true;
+                valid = plyTypeFromString(tokens[2], prop.m_countType) && plyTypeFromString(tokens[3], prop.m_type);
+                prop.m_name = tokens[4];
+            }
+            else {
+                valid = tokens.size() == 3 && plyTypeFromString(tokens[1], prop.m_type);
+                prop.m_name = tokens.back();
+            }
+            if (!valid) {
+                errorMsg = "Invalid property line in PLY header.";
+                return false;
+            }
+            header.m_elements.back().m_properties.push_back(prop);
+        }
+        else if (tokens[0] == "end_header") {
+            if (!formatFound) {
+                errorMsg = "Missing format line in PLY header.";
+                return false;
+            }
+            header.m_dataOffset = std::size_t(p - begin);
+            // the element counts must fit into the data, before arrays are sized by them (corrupt header),
+            // the last ASCII value needs no separator
+            const bool ascii = header.m_format == PlyHeader::Ascii;
+            std::size_t remaining = std::size_t(end - p) + (ascii ? 1 : 0);
+            for (const PlyElement & e : header.m_elements) {
+                const std::size_t instanceSize = minInstanceSize(e, ascii);
+                if (instanceSize == 0)
+                    continue;
+                if (e.m_count > remaining/instanceSize) {
+                    errorMsg = "Truncated PLY file (element '" + e.m_name + "' exceeds the file size).";
+                    return false;
+                }
+                remaining -= e.m_count*instanceSize;
+            }
+            return true;
+        }
+        else {
+            errorMsg = "Unknown keyword '" + tokens[0] + "' in PLY header.";
+            return false;
+        }
+    }
+    errorMsg = "Missing end_header in PLY file.";
+    return false;
+}
+
+
+/*! Returns fixed size in bytes of one element instance, or 0 if the element has list properties. */
+static std::size_t binaryStride(const PlyElement & e) {
+    std::size_t stride = 0;
+    for (const PlyProperty & prop : e.m_properties) {
+        if (prop.m_isList)
+            return 0;
+        stride += PLY_TYPE_SIZES[prop.m_type];
+    }
+    return stride;
+}
+
+
+/*! Skips or decodes one binary element instance with variable size (list properties), returns nullptr if truncated.
+    slots holds the output slot index for each property (-1 if not requested).
+*/
+static const char * readBinaryInstance(const char * p, const char * end, const PlyElement & e, bool swapBytes,
+                                       const std::vector<int> & slots, float * out)
+{
+    for (unsigned int i=0; i<e.m_properties.size(); ++i) {
+        const PlyProperty & prop = e.m_properties[i];
+        if (prop.m_isList) {
+            if (std::size_t(end - p) < PLY_TYPE_SIZES[prop.m_countType])
+                return nullptr;
+            double count = decodeValue(p, prop.m_countType, swapBytes);
+            p += PLY_TYPE_SIZES[prop.m_countType];
+            std::size_t listSize = count < 0 ? 0 : std::size_t(count)*PLY_TYPE_SIZES[prop.m_type];
+            if (std::size_t(end - p) < listSize)
+                return nullptr;
+            p += listSize;
+        }
+        else {
+            if (std::size_t(end - p) < PLY_TYPE_SIZES[prop.m_type])
+                return nullptr;
+            if (!slots.empty() && slots[i] != -1)
+                out[slots[i]] = float(decodeValue(p, prop.m_type, swapBytes));
+            p += PLY_TYPE_SIZES[prop.m_type];
+        }
+    }
+    return p;
+}
+
+
+/*! Skips or decodes one ascii element instance (one line), returns nullptr if malformed. */
+static const char * readAsciiInstance(const char * p, const char * end, const PlyElement & e,
+                                      const std::vector<int> & slots, float * out)
+{
+    const char * lineEnd = findLineEnd(p, end);
+    const char * tokenBegin;
+    const char * tokenEnd;
+    for (unsigned int i=0; i<e.m_properties.size(); ++i) {
+        const PlyProperty & prop = e.m_properties[i];
+        if (!nextToken(p, lineEnd, tokenBegin, tokenEnd))
+            return nullptr;
+        if (prop.m_isList) {
+            std::size_t count;
+            if (std::from_chars(tokenBegin, tokenEnd, count).ec != std::errc())
+                return nullptr;
+            for (std::size_t j=0; j<count; ++j)
+                if (!nextToken(p, lineEnd, tokenBegin, tokenEnd))
+                    return nullptr;
+        }
+        else if (!slots.empty() && slots[i] != -1) {
+            if (*tokenBegin == '+')
+                ++tokenBegin;
+            if (std::from_chars(tokenBegin, tokenEnd, out[slots[i]]).ec != std::errc())
+                return nullptr;
+        }
+    }
+    return lineEnd == end ? end : lineEnd + 1;
+}
+
+
+/*! Decodes the requested properties of element elementIdx in blocks of blockSize instances. For each block,
+    target(first) returns the output for the instances [first, first + blockSize) (tightly packed as described for
+    readPlyElementProperties()), and blockDone(first, count) is called after the block is decoded (if given).
+*/
+static bool readPlyElementInBlocks(const char * begin, const char * end, const PlyHeader & header, int elementIdx,
+                                   const std::vector<std::string> & propertyNames, ThreadPool & pool,
+                                   std::size_t blockSize, const std::function<float*(std::size_t)> & target,
+                                   const std::function<bool(std::size_t, std::size_t)> & blockDone,
+                                   std::string & errorMsg)
+{
+    const bool ascii = header.m_format == PlyHeader::Ascii;
+    const bool swapBytes = !ascii && ((header.m_format == PlyHeader::BinaryLittleEndian) != hostIsLittleEndian());
+    const std::vector<int> noSlots;
+    const char * p = begin + header.m_dataOffset;
+
+    // skip all elements before the requested one
+    for (int i=0; i<elementIdx; ++i) {
+        const PlyElement & e = header.m_elements[i];
+        std::size_t stride = binaryStride(e);
+        if (!ascii && stride != 0) {
+            if (std::size_t(end - p) / stride < e.m_count) {
+                errorMsg = "Truncated PLY file.";
+                return false;
+            }
+            p += e.m_count*stride;
+            continue;
+        }
+        for (std::size_t j=0; j<e.m_count; ++j) {
+            p = ascii ? readAsciiInstance(p, end, e, noSlots, nullptr)
+                      : readBinaryInstance(p, end, e, swapBytes, noSlots, nullptr);
+            if (p == nullptr) {
+                errorMsg = "Malformed or truncated element '" + e.m_name + "' in PLY file.";
+                return false;
+            }
+        }
+    }
+
+    // map requested properties to output slots
+    const PlyElement & e = header.m_elements[elementIdx];
+    const std::size_t n = propertyNames.size();
+    std::vector<int> slots(e.m_properties.size(), -1);
+    for (unsigned int k=0; k<n; ++k) {
+        bool found = false;
+        for (unsigned int i=0; i<e.m_properties.size(); ++i) {
+            if (e.m_properties[i].m_name == propertyNames[k] && !e.m_properties[i].m_isList) {
+                slots[i] = (int)k;
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            errorMsg = "Element '" + e.m_name + "' has no scalar property '" + propertyNames[k] + "'.";
+            return false;
+        }
+    }
+
+    std::size_t stride = binaryStride(e);
+    if (!ascii && stride != 0) {
+        // fast path: fixed stride, decode only the requested properties in parallel
+        if (std::size_t(end - p) / stride < e.m_count) {
+            errorMsg = "Truncated PLY file.";
+            return false;
+        }
+        struct Field {
+            std::size_t	m_offset;
+            PlyType		m_type;
+            int			m_slot;
+        };
+        std::vector<Field> fields;
+        std::size_t offset = 0;
+        for (unsigned int i=0; i<e.m_properties.size(); ++i) {
+            if (slots[i] != -1)
+                fields.push_back(Field{offset, e.m_properties[i].m_type, slots[i]});
+            offset += PLY_TYPE_SIZES[e.m_properties[i].m_type];
+        }
+        for (std::size_t blockStart=0; blockStart<e.m_count; blockStart+=blockSize) {
+            const std::size_t blockEnd = std::min(e.m_count, blockStart + blockSize);
+            float * out = target(blockStart);
+            pool.parallelFor(blockEnd - blockStart, 0, [&](std::size_t first, std::size_t last, unsigned int) {
+                for (std::size_t j=first; j<last; ++j) {
+                    const char * instance = p + (blockStart + j)*stride;
+                    float * values = out + j*n;
+                    for (const Field & f : fields)
+                        values[f.m_slot] = float(decodeValue(instance + f.m_offset, f.m_type, swapBytes));
+                }
+            });
+            if (blockDone && !blockDone(blockStart, blockEnd - blockStart)) {
+                errorMsg = "Reading PLY file cancelled.";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    float * out = nullptr;
+    std::size_t blockStart = 0;
+    for (std::size_t j=0; j<e.m_count; ++j) {
+        if (j % blockSize == 0) {
+            blockStart = j;
+            out = target(j);
+        }
+        float * values = out + (j - blockStart)*n;
+        p = ascii ? readAsciiInstance(p, end, e, slots, values)
+                  : readBinaryInstance(p, end, e, swapBytes, slots, values);
+        if (p == nullptr) {
+            errorMsg = "Malformed or truncated element '" + e.m_name + "' in PLY file.";
+            return false;
+        }
+        if (blockDone && ((j + 1) % blockSize == 0 || j + 1 == e.m_count) && !blockDone(blockStart, j + 1 - blockStart)) {
+            errorMsg = "Reading PLY file cancelled.";
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool readPlyElementProperties(const char * begin, const char * end, const PlyHeader & header, int elementIdx,
+                              const std::vector<std::string> & propertyNames, ThreadPool & pool,
+                              float * out, std::string & errorMsg, const std::function<bool(std::size_t)> & progress)
+{
+    const std::size_t n = propertyNames.size();
+    // without progress function all instances form a single block
+    const std::size_t blockSize = progress ? PLY_PROGRESS_BLOCK
+                                           : std::max<std::size_t>(1, header.m_elements[elementIdx].m_count);
+    std::function<bool(std::size_t, std::size_t)> blockDone;
+    if (progress)
+        blockDone = [&progress](std::size_t first, std::size_t count) { return progress(first + count); };
+    return readPlyElementInBlocks(begin, end, header, elementIdx, propertyNames, pool, blockSize,
+                                  [out, n](std::size_t first) { return out + first*n; }, blockDone, errorMsg);
+}
+
+
+bool readPlyElementBlocks(const char * begin, const char * end, const PlyHeader & header, int elementIdx,
+                          const std::vector<std::string> & propertyNames, ThreadPool & pool, std::size_t blockSize,
+                          const std::function<bool(const float *, std::size_t, std::size_t)> & consumer,
+                          std::string & errorMsg)
+{
+    blockSize = std::max<std::size_t>(1, std::min(blockSize, header.m_elements[elementIdx].m_count));
+    std::vector<float> values(blockSize*propertyNames.size());
+    return readPlyElementInBlocks(begin, end, header, elementIdx, propertyNames, pool, blockSize,
+                                  [&values](std::size_t) { return values.data(); },
+                                  [&values, &consumer](std::size_t first, std::size_t count) {
+                                      return consumer(values.data(), first, count);
+                                  }, errorMsg);
+}
@@ -0,0 +1,96 @@
+#ifndef PLYREADER_H
+#define PLYREADER_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+/*! Data types of PLY properties. */
+enum PlyType {
+    PLY_INT8,
+    PLY_UINT8,
+    PLY_INT16,
+    PLY_UINT16,
+    PLY_INT32,
+    PLY_UINT32,
+    PLY_FLOAT32,
+    PLY_FLOAT64,
+    NUM_PLY_TYPES
+};
+
+/*! A scalar or list property of a PLY element. */
+struct PlyProperty {
+    std::string		m_name;
+    PlyType			m_type;				// value type, for lists the item type
+    bool			m_isList = false;
+    PlyType			m_countType = PLY_UINT8;	// only for lists
+};
+
+/*! An element (e.g. "vertex" or "face") declared in the PLY header. */
+struct PlyElement {
+    std::string					m_name;
+    std::size_t					m_count = 0;
+    std::vector<PlyProperty>	m_properties;
+};
+
+/*! Content of a PLY header. */
+struct PlyHeader {
+    enum Format {
+        Ascii,
+        BinaryLittleEndian,
+        BinaryBigEndian
+    };
+
+    Format						m_format = Ascii;
+    std::vector<PlyElement>		m_elements;
+    /*! Offset of the first byte after the "end_header" line. */
+    std::size_t					m_dataOffset = 0;
+
+    /*! Returns index of element with given name, or -1 if there is no such element. */
+    int elementIndex(const std::string & name) const;
+};
+
+/*! Parses the header of the PLY data in [begin, end).
+    Returns false and an error message if the header is invalid, or if the data is too short for the element
+    counts of the header (checked with the minimum size of the instances, without decoding), so that arrays can be
+    sized by the counts afterwards.
+*/
+bool parsePlyHeader(const char * begin, const char * end, PlyHeader & header, std::string & errorMsg);
+
+/*! Decodes the properties 'propertyNames' of all instances of the element with index elementIdx
+    into the array out, which must hold propertyNames.size() * element count floats. Values are converted to float
+    and stored tightly packed in the order given in propertyNames, i.e. for {"x", "y", "z"} the output is
+    an array of float3. All other properties are skipped without decoding.
+
+    Elements before the requested one are skipped. Binary elements without list properties have a fixed
+    stride and are decoded in parallel on the thread pool.
+
+    If a progress function is given, it is called after each block of instances with the number of instances
+    decoded so far (these are complete in out), e.g. to process the data while the rest is still decoded. If it
+    returns false, decoding is cancelled.
+
+    Returns false and an error message if a requested property does not exist, or the data is truncated/malformed,
+    or decoding was cancelled.
+*/
+bool readPlyElementProperties(const char * begin, const char * end, const PlyHeader & header, int elementIdx,
+                              const std::vector<std::string> & propertyNames, ThreadPool & pool,
+                              float * out, std::string & errorMsg,
+                              const std::function<bool(std::size_t)> & progress = std::function<bool(std::size_t)>());
+
+/*! Decodes the properties 'propertyNames' of the element with index elementIdx like readPlyElementProperties(),
+    but in blocks of blockSize instances into a buffer of the reader, so that files larger than the memory can be
+    processed. After each block, consumer(values, first, count) is called with the values of the instances
+    [first, first + count) (tightly packed, values[0] is the first property of instance first). The values are
+    only valid during the call. If consumer returns false, decoding is cancelled.
+
+    Returns false and an error message like readPlyElementProperties().
+*/
+bool readPlyElementBlocks(const char * begin, const char * end, const PlyHeader & header, int elementIdx,
+                          const std::vector<std::string> & propertyNames, ThreadPool & pool, std::size_t blockSize,
+                          const std::function<bool(const float * values, std::size_t first, std::size_t count)> & consumer,
+                          std::string & errorMsg);
+
+#endif // PLYREADER_H
@@ -0,0 +1,542 @@
+#include "PointCloudSequence.h"
+
+#include <QCollator>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QOpenGLShaderProgram>
+#include <QDebug>
+
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <new>
+
+#include "BackgroundLoader.h"
+#include "PlyReader.h"
+#include "ThreadPool.h"
+
+
+/*! False for points with NaN or infinite coordinates (found in real captures). */
+static inline bool isFinitePoint(const glm::vec3 & p) {
+    return std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z);
+}
+
+
+/*! Reads the vertex positions of a PLY file into positions on pool, returns early if cancel is set.
+    Points with NaN or infinite coordinates are dropped, they would spoil the bounds of the quantization.
+    Throws a const char * error message on failure (like the loaders).
+*/
+static void decodeFrame(const QString & filePath, ThreadPool & pool, std::vector<glm::vec3> & positions,
+                        const std::atomic<bool> & cancel)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly) || file.size() == 0)
+        throw "ERROR::PLYLOADER::Could not open file.";
+    uchar * mappedData = file.map(0, file.size());
+    if (mappedData == nullptr)
+        throw "ERROR::PLYLOADER::Could not map file.";
+    const char * begin = reinterpret_cast<const char *>(mappedData);
+    const char * end = begin + file.size();
+
+    PlyHeader header;
+    std::string errorMsg;
+    bool success = parsePlyHeader(begin, end, header, errorMsg);
+    int vertexElementIdx = header.elementIndex("vertex");
+    if (success && vertexElementIdx == -1) {
+        errorMsg = "PLY file has no vertex element.";
+        success = false;
+    }
+    if (success) {
+        positions.resize(header.m_elements[vertexElementIdx].m_count);
+        success = readPlyElementProperties(begin, end, header, vertexElementIdx, {"x", "y", "z"}, pool,
+                                           reinterpret_cast<float *>(positions.data()), errorMsg,
+                                           [&cancel](std::size_t) { return !cancel.load(std::memory_order_relaxed); });
+    }
+    file.unmap(mappedData);
+    if (!success) {
+        positions.clear();
+        if (cancel)
+            return;
+        qWarning() << "Error reading" << filePath << ":" << QString::fromStdString(errorMsg);
+        throw "ERROR::PLYLOADER::Could not read vertex data.";
+    }
+    positions.erase(std::remove_if(positions.begin(), positions.end(),
+                                   [](const glm::vec3 & p) { return !isFinitePoint(p); }), positions.end());
+}
+
+
+PointCloudSequence::~PointCloudSequence() {
+    stopDecoders();
+}
+
+
+bool PointCloudSequence::open(const QString & pattern) {
+    close();
+
+    // a directory means all PLY files in it, otherwise the file name is the filter
+    QFileInfo info(pattern);
+    QDir dir;
+    QStringList files;
+    if (info.isDir()) {
+        dir = QDir(pattern);
+        files = dir.entryList(QStringList() << "*.ply", QDir::Files);
+    }
+    else {
+        dir = info.absoluteDir();
+        files = dir.entryList(QStringList() << info.fileName(), QDir::Files);
+    }
+    if (files.isEmpty()) {
+        qWarning() << "No PLY files found for sequence" << pattern;
+        return false;
+    }
+    QCollator collator;
+    collator.setNumericMode(true); // frame2.ply before frame10.ply
+    std::sort(files.begin(), files.end(), collator);
+
+    m_frames.resize(std::size_t(files.size()));
+    for (int i=0; i<files.size(); ++i)
+        m_frames[std::size_t(i)].m_path = dir.filePath(files[i]);
+    qDebug() << "Sequence with" << m_frames.size() << "frames:" << files.first() << "..." << files.last();
+
+    m_playing = false;
+    m_startFrame = 0;
+    m_lastDueFrame = -1;
+    m_statistics = Statistics();
+    startDecoders();
+    return true;
+}
+
+
+void PointCloudSequence::close() {
+    stopDecoders();
+    m_frames.clear();
+    m_cacheBytes = 0;
+    for (FrameBuffer & b : m_buffers) {
+        b.m_frameIdx = -1;
+        b.m_pointCount = b.m_uploadedCount = 0;
+    }
+    m_playing = false;
+}
+
+
+void PointCloudSequence::create(QOpenGLShaderProgram * shaderProgramm) {
+    // one vertex array object for both buffers, the position buffer is switched in render()
+    m_vao.create();
+    m_vao.bind();
+    shaderProgramm->enableAttributeArray(0); // tightly packed positions
+    m_vao.release();
+    m_positionOriginUniform = shaderProgramm->uniformLocation("positionOrigin");
+    m_positionScaleUniform = shaderProgramm->uniformLocation("positionScale");
+
+    for (FrameBuffer & b : m_buffers) {
+        b.m_vbo.create();
+        b.m_vbo.setUsagePattern(QOpenGLBuffer::StreamDraw);
+    }
+}
+
+
+void PointCloudSequence::destroy() {
+    close();
+    for (FrameBuffer & b : m_buffers)
+        b.m_vbo.destroy();
+    m_vao.destroy();
+}
+
+
+void PointCloudSequence::play() {
+    if (m_frames.empty())
+        return;
+    m_startFrame = dueFrame();
+    m_playing = true;
+    m_playTimer.start();
+    m_lastDueFrame = -1;
+    m_statistics = Statistics();
+}
+
+
+void PointCloudSequence::pause() {
+    m_startFrame = dueFrame();
+    m_playing = false;
+}
+
+
+void PointCloudSequence::seek(int frameIdx) {
+    m_playing = false;
+    m_startFrame = std::max(0, std::min(frameCount() - 1, frameIdx));
+}
+
+
+void PointCloudSequence::step(int delta) {
+    if (m_frames.empty())
+        return;
+    int frameIdx = nextFrame(dueFrame(), delta);
+    if (frameIdx == -1)
+        frameIdx = delta < 0 ? 0 : frameCount() - 1;
+    seek(frameIdx);
+}
+
+
+int PointCloudSequence::nextFrame(int frameIdx, int delta) const {
+    const int count = frameCount();
+    const int next = frameIdx + delta;
+    if (m_loop)
+        return (next % count + count) % count;
+    return (next < 0 || next >= count) ? -1 : next;
+}
+
+
+int PointCloudSequence::playbackDistance(int fromFrameIdx, int toFrameIdx) const {
+    return m_loop ? (toFrameIdx - fromFrameIdx + frameCount()) % frameCount() : toFrameIdx - fromFrameIdx;
+}
+
+
+int PointCloudSequence::dueFrame() {
+    if (!m_playing)
+        return m_startFrame;
+    const qint64 advance = qint64(m_playTimer.nsecsElapsed()*1e-9*m_fps);
+    if (m_loop)
+        return int((m_startFrame + advance) % frameCount());
+    if (m_startFrame + advance >= frameCount()) {
+        // end of the sequence reached
+        m_playing = false;
+        m_startFrame = frameCount() - 1;
+        return m_startFrame;
+    }
+    return int(m_startFrame + advance);
+}
+
+
+std::size_t PointCloudSequence::frameBytes(const Frame & frame) {
+    return frame.m_points.size()*sizeof(glm::vec3) + frame.m_quantized.size()*sizeof(QuantizedPosition);
+}
+
+
+void PointCloudSequence::beginUpload(int frameIdx) {
+    FrameBuffer & back = m_buffers[1 - m_front];
+    const Frame & frame = m_frames[std::size_t(frameIdx)];
+    back.m_frameIdx = frameIdx;
+    back.m_pointCount = frame.m_points.size();
+    back.m_uploadedCount = 0;
+    back.m_quantization = frame.m_quantization;
+    // allocating orphans the previous storage, which may still be used by draws of earlier frames
+    back.m_vbo.bind();
+    back.m_vbo.allocate(int(back.m_pointCount*(m_quantizePositions ? sizeof(QuantizedPosition) : sizeof(glm::vec3))));
+    back.m_vbo.release();
+}
+
+
+bool PointCloudSequence::update() {
+    if (m_frames.empty())
+        return false;
+    ++m_updateCount;
+
+    // *** take over the decoded frames, requests not yet started are scheduled again below
+    std::deque<DecodedFrame> completed;
+    {
+        std::lock_guard<std::mutex> lock(m_decodeMutex);
+        completed.swap(m_decodeCompleted);
+        for (int frameIdx : m_decodeRequests)
+            m_frames[std::size_t(frameIdx)].m_requested = false;
+        m_decodeRequests.clear();
+    }
+    for (DecodedFrame & decoded : completed) {
+        Frame & frame = m_frames[std::size_t(decoded.m_frameIdx)];
+        frame.m_requested = false;
+        if (decoded.m_success) {
+            frame.m_points.swap(decoded.m_points);
+            frame.m_quantized.swap(decoded.m_quantized);
+            frame.m_quantization = decoded.m_quantization;
+            frame.m_decoded = true;
+            m_cacheBytes += frameBytes(frame);
+        }
+        else
+            frame.m_failed = true; // skipped from now on
+    }
+
+    // *** frames needed: the due frame and the frames following it, and the frames in the buffers
+    const int due = dueFrame();
+    std::vector<int> window;
+    for (unsigned int i=0; i<=m_prefetchFrames; ++i) {
+        const int frameIdx = nextFrame(due, int(i));
+        if (frameIdx == -1 || (!window.empty() && frameIdx == window.front()))
+            break; // end of the sequence, or all frames of a short sequence in the window
+        window.push_back(frameIdx);
+        m_frames[std::size_t(frameIdx)].m_lastUsed = m_updateCount;
+    }
+    for (const FrameBuffer & b : m_buffers)
+        if (b.m_frameIdx != -1)
+            m_frames[std::size_t(b.m_frameIdx)].m_lastUsed = m_updateCount;
+
+    if (m_playing && due != m_lastDueFrame) {
+        if (m_frames[std::size_t(due)].m_decoded)
+            ++m_statistics.m_cacheHits;
+        else
+            ++m_statistics.m_cacheMisses;
+    }
+
+    // *** request the missing frames of the window, in playback order
+    std::deque<int> requests;
+    for (int frameIdx : window) {
+        Frame & frame = m_frames[std::size_t(frameIdx)];
+        if (frame.m_decoded || frame.m_requested || frame.m_failed)
+            continue;
+        frame.m_requested = true;
+        requests.push_back(frameIdx);
+    }
+    if (!requests.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(m_decodeMutex);
+            m_decodeRequests.swap(requests);
+        }
+        m_decodeCondition.notify_all();
+    }
+
+    // *** evict the least recently used frames not needed, while the cache exceeds its budget
+    if (m_cacheBytes > m_cacheBudgetBytes) {
+        std::vector<int> evictable;
+        for (unsigned int i=0; i<m_frames.size(); ++i)
+            if (m_frames[i].m_decoded && m_frames[i].m_lastUsed != m_updateCount)
+                evictable.push_back(int(i));
+        std::sort(evictable.begin(), evictable.end(), [this](int a, int b) {
+            return m_frames[std::size_t(a)].m_lastUsed < m_frames[std::size_t(b)].m_lastUsed;
+        });
+        for (std::size_t i=0; i<evictable.size() && m_cacheBytes > m_cacheBudgetBytes; ++i) {
+            Frame & frame = m_frames[std::size_t(evictable[i])];
+            m_cacheBytes -= frameBytes(frame);
+            std::vector<glm::vec3>().swap(frame.m_points);
+            std::vector<QuantizedPosition>().swap(frame.m_quantized);
+            frame.m_decoded = false;
+        }
+    }
+
+    // *** upload into the back buffer: the due frame, or the frame after it if the due frame is displayed already
+    const int shown = displayedFrame();
+    const int wanted = shown == due ? nextFrame(due, 1) : due;
+    FrameBuffer & back = m_buffers[1 - m_front];
+    // during playback, a frame after the displayed one and not after the due one is finished and shown, even if it
+    // is not due anymore, otherwise uploads slower than the frame rate would be restarted again and again
+    const bool backInTime = m_playing && shown != -1 && back.m_frameIdx != -1 &&
+            playbackDistance(shown, back.m_frameIdx) > 0 &&
+            playbackDistance(shown, back.m_frameIdx) <= playbackDistance(shown, due);
+    if (!backInTime && wanted != -1 && wanted != shown && back.m_frameIdx != wanted &&
+        m_frames[std::size_t(wanted)].m_decoded)
+    {
+        beginUpload(wanted);
+    }
+    if (back.m_frameIdx != -1 && !back.complete()) {
+        std::size_t budget = m_uploadBytesPerFrame;
+        const Frame & frame = m_frames[std::size_t(back.m_frameIdx)];
+        back.m_vbo.bind();
+        if (m_quantizePositions)
+            uploadBufferRange(back.m_vbo, frame.m_quantized.data(), sizeof(QuantizedPosition), back.m_uploadedCount,
+                              back.m_pointCount, budget);
+        else
+            uploadBufferRange(back.m_vbo, frame.m_points.data(), sizeof(glm::vec3), back.m_uploadedCount,
+                              back.m_pointCount, budget);
+        back.m_vbo.release();
+    }
+
+    // *** swap when the frame is complete in the back buffer, count the frames skipped since the last swap
+    if (back.complete() && (back.m_frameIdx == due || backInTime)) {
+        const int skipped = shown == -1 ? 0 : playbackDistance(shown, back.m_frameIdx) - 1;
+        if (m_playing && skipped > 0)
+            m_statistics.m_droppedFrames += (unsigned int)skipped;
+        m_front = 1 - m_front;
+        ++m_statistics.m_shownFrames;
+    }
+    if (m_playing && due != m_lastDueFrame && displayedFrame() != due)
+        ++m_statistics.m_lateFrames;
+    m_lastDueFrame = due;
+
+    const FrameBuffer & pending = m_buffers[1 - m_front];
+    return m_playing || (pending.m_frameIdx != -1 && !pending.complete());
+}
+
+
+void PointCloudSequence::render() {
+    FrameBuffer & front = m_buffers[m_front];
+    if (front.m_frameIdx == -1)
+        return;
+    QOpenGLFunctions * f = QOpenGLContext::currentContext()->functions();
+    m_vao.bind();
+    front.m_vbo.bind();
+    if (m_quantizePositions) {
+        // the shader decodes the integer positions with the box of the frame
+        const PointQuantization & q = front.m_quantization;
+        f->glUniform3f(m_positionOriginUniform, q.m_origin.x, q.m_origin.y, q.m_origin.z);
+        f->glUniform3f(m_positionScaleUniform, q.m_scale.x, q.m_scale.y, q.m_scale.z);
+        f->glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(QuantizedPosition), nullptr);
+    }
+    else
+        f->glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), nullptr);
+    f->glDrawArrays(GL_POINTS, 0, GLsizei(front.m_pointCount));
+    if (m_quantizePositions) {
+        // other objects drawn with the shader program have float positions
+        f->glUniform3f(m_positionOriginUniform, 0.f, 0.f, 0.f);
+        f->glUniform3f(m_positionScaleUniform, 1.f, 1.f, 1.f);
+    }
+    front.m_vbo.release();
+    m_vao.release();
+}
+
+
+bool PointCloudSequence::pickPoint(const glm::vec3& n, const glm::vec3& f, float nearTolerance, float farTolerance,
+                                   PickObject & po) const
+{
+    // the displayed frame is kept in the cache, see update()
+    const int frameIdx = displayedFrame();
+    if (frameIdx == -1)
+        return false;
+    const std::vector<glm::vec3> & points = m_frames[std::size_t(frameIdx)].m_points;
+    const glm::vec3 dir = f - n;
+    const float dirLength2 = glm::dot(dir, dir);
+    if (dirLength2 == 0)
+        return false;
+
+    // test all points in parallel, each block keeps its nearest hit
+    ThreadPool & pool = ThreadPool::globalInstance();
+    struct Hit {
+        float			m_dist;
+        std::size_t		m_pointIdx;
+    };
+    std::vector<Hit> blockHits(pool.threadCount(), Hit{po.m_dist, ~std::size_t(0)});
+    pool.parallelFor(points.size(), (unsigned int)blockHits.size(), [&](std::size_t first, std::size_t last, unsigned int block) {
+        Hit & hit = blockHits[block];
+        for (std::size_t i=first; i<last; ++i) {
+            const glm::vec3 p = points[i] - n;
+            const float t = glm::dot(p, dir)/dirLength2;
+            if (t < 0 || t > 1 || t >= hit.m_dist)
+                continue;
+            const glm::vec3 offset = p - t*dir;
+            const float r = nearTolerance + t*(farTolerance - nearTolerance);
+            if (glm::dot(offset, offset) > r*r)
+                continue;
+            hit.m_dist = t;
+            hit.m_pointIdx = i;
+        }
+    });
+    bool found = false;
+    for (const Hit & hit : blockHits) {
+        if (hit.m_pointIdx == ~std::size_t(0) || hit.m_dist >= po.m_dist)
+            continue;
+        po.m_dist = hit.m_dist;
+        po.m_objectId = (unsigned int)hit.m_pointIdx;
+        po.m_faceId = 0;
+        found = true;
+    }
+    return found;
+}
+
+
+QString PointCloudSequence::statusText() const {
+    if (m_frames.empty())
+        return QString();
+    const int frameIdx = displayedFrame();
+    QString text = QString("Frame %1/%2").arg(frameIdx + 1).arg(m_frames.size());
+    if (frameIdx != -1)
+        text += QString(" (%1)").arg(QFileInfo(framePath(frameIdx)).fileName());
+    if (m_playing) {
+        const double seconds = m_playTimer.elapsed()*1e-3;
+        text += QString(", %1 fps").arg(seconds > 0 ? m_statistics.m_shownFrames/seconds : 0., 0, 'f', 1);
+    }
+    else
+        text += ", paused";
+    text += QString(", %1 dropped, %2 late, %3 MB cached").arg(m_statistics.m_droppedFrames)
+            .arg(m_statistics.m_lateFrames).arg(m_cacheBytes >> 20);
+    return text;
+}
+
+
+void PointCloudSequence::startDecoders() {
+    stopDecoders();
+    m_decodeStop = false;
+    m_decodeCancel = false;
+    for (unsigned int i=0; i<std::max(1u, m_decodeThreadCount); ++i)
+        m_decodeThreads.push_back(std::thread(&PointCloudSequence::decodeLoop, this));
+}
+
+
+void PointCloudSequence::stopDecoders() {
+    if (!m_decodeThreads.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(m_decodeMutex);
+            m_decodeStop = true;
+        }
+        m_decodeCancel = true;
+        m_decodeCondition.notify_all();
+        for (std::thread & t : m_decodeThreads)
+            t.join();
+        m_decodeThreads.clear();
+    }
+    m_decodeRequests.clear();
+    m_decodeCompleted.clear();
+}
+
+
+void PointCloudSequence::decodeLoop() {
+    // each decoder decodes its frames on its own thread only: runs of the global pool are serialized, so the
+    // decoders would wait for each other there, and picks would wait for the decoders
+    ThreadPool pool(1);
+    std::unique_lock<std::mutex> lock(m_decodeMutex);
+    for (;;) {
+        m_decodeCondition.wait(lock, [this]() { return m_decodeStop || !m_decodeRequests.empty(); });
+        if (m_decodeStop)
+            return;
+        DecodedFrame decoded;
+        decoded.m_frameIdx = m_decodeRequests.front();
+        m_decodeRequests.pop_front();
+        // m_frames is not resized while the decoders run, and the path is never changed
+        const QString filePath = m_frames[std::size_t(decoded.m_frameIdx)].m_path;
+
+        lock.unlock();
+        try {
+            decodeFrame(filePath, pool, decoded.m_points, m_decodeCancel);
+            decoded.m_success = !m_decodeCancel;
+            if (decoded.m_success && m_quantizePositions && !decoded.m_points.empty()) {
+                // quantize relative to the bounding box of the frame, picks use the positions as drawn
+                glm::vec3 boxMin = decoded.m_points[0];
+                glm::vec3 boxMax = boxMin;
+                for (const glm::vec3 & p : decoded.m_points) {
+                    boxMin = glm::min(boxMin, p);
+                    boxMax = glm::max(boxMax, p);
+                }
+                decoded.m_quantization = PointQuantization::fromBounds(boxMin, boxMax);
+                decoded.m_quantized.resize(decoded.m_points.size());
+                decoded.m_quantization.quantize(decoded.m_points.data(), decoded.m_points.size(), decoded.m_quantized.data());
+                decoded.m_quantization.snap(decoded.m_points.data(), decoded.m_points.size());
+            }
+        }
+        catch (const char * msg) {
+            qWarning() << "Decoding frame" << filePath << "failed:" << msg;
+            decoded.m_success = false;
+        }
+        catch (const std::bad_alloc &) {
+            // e.g. a corrupt vertex count in the header, an exception must not escape the decoder thread
+            qWarning() << "Decoding frame" << filePath << "failed: out of memory";
+            decoded.m_success = false;
+        }
+        catch (const std::exception & e) {
+            qWarning() << "Decoding frame" << filePath << "failed:" << e.what();
+            decoded.m_success = false;
+        }
+        catch (...) {
+            qWarning() << "Decoding frame" << filePath << "failed: unknown exception";
+            decoded.m_success = false;
+        }
+        if (!decoded.m_success) {
+            std::vector<glm::vec3>().swap(decoded.m_points);
+            std::vector<QuantizedPosition>().swap(decoded.m_quantized);
+        }
+        lock.lock();
+
+        m_decodeCompleted.push_back(std::move(decoded));
+        if (m_notify) {
+            lock.unlock();
+            m_notify();
+            lock.lock();
+        }
+    }
+}
@@ -0,0 +1,222 @@
+#ifndef POINTCLOUDSEQUENCE_H
+#define POINTCLOUDSEQUENCE_H
+
+#include <QOpenGLBuffer>
+#include <QOpenGLVertexArrayObject>
+#include <QElapsedTimer>
+#include <QString>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <glm.hpp>
+
+#include "PickObject.h"
+#include "PointQuantization.h"
+
+QT_BEGIN_NAMESPACE
+class QOpenGLShaderProgram;
+QT_END_NAMESPACE
+
+/*! Plays a sequence of PLY point clouds (e.g. frame1.ply, frame2.ply, ... of a capture) at a target frame rate.
+
+    While frame N is displayed, the frames N+1..N+m_prefetchFrames are decoded on m_decodeThreadCount decoder
+    threads, in playback order. Each decoder thread decodes one frame at a time by itself (not on the global
+    thread pool), so the decoders run in parallel and do not delay picks on the global pool. Decoded frames are
+    kept in a cache of m_cacheBudgetBytes, the least recently displayed frames outside the prefetch window are
+    evicted first, so that scrubbing back and forth (seek(), step()) mostly hits the cache.
+
+    The points are drawn from two alternating vertex buffers: the front buffer holds the displayed frame, the next
+    frame is uploaded into the back buffer (at most m_uploadBytesPerFrame per frame), and the buffers are swapped
+    when playback reaches that frame and its upload is complete. Thus the draw never waits for an upload, and the
+    back buffer is re-allocated (orphaned) before each new frame, so the upload does not wait for draws of the
+    previous frames still using it either.
+
+    If the next frame is not ready in time, the displayed frame stays (counted in Statistics::m_lateFrames), and the
+    frame being uploaded is shown when complete, even if playback has advanced further meanwhile. The frames
+    skipped between two displayed frames are counted in Statistics::m_droppedFrames.
+
+    If m_quantizePositions is set, the decoder threads also quantize each frame relative to its bounding box
+    (see PointQuantization), which halves the upload per frame. The decoded points are replaced by the dequantized
+    positions then, so picks use exactly the points drawn.
+*/
+class PointCloudSequence {
+public:
+    /*! Playback statistics, reset by play(). */
+    struct Statistics {
+        /*! Frames swapped to the front buffer (displayed). */
+        unsigned int	m_shownFrames = 0;
+        /*! Frames skipped, because they were not decoded or uploaded in time. */
+        unsigned int	m_droppedFrames = 0;
+        /*! Frames not displayed when they became due, because they were not ready (an older frame stays). */
+        unsigned int	m_lateFrames = 0;
+        /*! Frames taken from the cache (already decoded) / decoded when they were due. */
+        unsigned int	m_cacheHits = 0;
+        unsigned int	m_cacheMisses = 0;
+    };
+
+    /*! Stops the decoder threads. */
+    ~PointCloudSequence();
+
+    /*! Lists the frames of the sequence and starts the decoder threads. pattern is either a directory (all
+        *.ply files in it) or a file path with wildcards in the file name (e.g. "C:/capture/frame*.ply"). The
+        frames are sorted by name, numbers in the names by value (frame2.ply before frame10.ply).
+        Returns false if there are no matching files. Playback is paused at the first frame.
+    */
+    bool open(const QString & pattern);
+
+    /*! Stops the decoder threads and clears the cache (the vertex buffers are kept, see destroy()). */
+    void close();
+
+    /*! The function is called during OpenGL initialization, where the OpenGL context is current. */
+    void create(QOpenGLShaderProgram * shaderProgramm);
+    /*! Closes the sequence and releases the vertex buffers (OpenGL context must be current). */
+    void destroy();
+
+    /*! Starts/stops playback at the current frame. */
+    void play();
+    void pause();
+    bool playing() const { return m_playing; }
+    /*! Pauses playback and shows frame frameIdx (clamped to the sequence). */
+    void seek(int frameIdx);
+    /*! Pauses playback and moves delta frames forward/backward (wraps around if m_loop is true). */
+    void step(int delta);
+
+    /*! Advances the playback time, takes over the decoded frames, schedules the frames to decode and uploads the
+        next frame (OpenGL context must be current). Returns true if another repaint is needed (playing, or frames
+        being decoded or uploaded).
+    */
+    bool update();
+
+    /*! Draws the displayed frame. */
+    void render();
+
+    /*! Finds the front-most point of the displayed frame within the tolerance of the ray "n + t*(f - n)",
+        with the same parameters and result as BoxObject::pickPoint() (the point id is the index in the frame).
+    */
+    bool pickPoint(const glm::vec3& n, const glm::vec3& f, float nearTolerance, float farTolerance, PickObject & po) const;
+
+    int frameCount() const { return int(m_frames.size()); }
+    /*! Index of the frame in the front buffer, -1 if none is displayed yet. */
+    int displayedFrame() const { return m_buffers[m_front].m_frameIdx; }
+    const QString & framePath(int frameIdx) const { return m_frames[std::size_t(frameIdx)].m_path; }
+    const Statistics & statistics() const { return m_statistics; }
+
+    /*! Text with frame, measured frame rate and statistics, e.g. for a status label. */
+    QString statusText() const;
+
+    /*! Target frame rate of the playback. */
+    float								m_fps = 30;
+    /*! If true, playback continues with the first frame after the last one, otherwise it stops. */
+    bool								m_loop = true;
+    /*! Number of frames decoded ahead of the displayed one. */
+    unsigned int						m_prefetchFrames = 8;
+    /*! Max. memory of the decoded frames (the displayed and the prefetched frames are always kept). */
+    std::size_t							m_cacheBudgetBytes = std::size_t(1) << 30;
+    /*! Max. number of bytes uploaded to the GPU per frame. */
+    std::size_t							m_uploadBytesPerFrame = 32 << 20;
+    /*! Number of decoder threads started by open(), i.e. of frames decoded in parallel. */
+    unsigned int						m_decodeThreadCount = 2;
+    /*! If true, the frames are uploaded as quantized positions (must be set before open()). */
+    bool								m_quantizePositions = false;
+
+    /*! Called from a decoder thread after a frame was decoded, must be thread-save (e.g. queue a repaint). */
+    std::function<void()>				m_notify;
+
+private:
+    /*! A frame of the sequence and its cache state. */
+    struct Frame {
+        QString					m_path;
+        /*! Decoded points, empty if not in the cache. */
+        std::vector<glm::vec3>	m_points;
+        /*! Quantized points and their quantization, if m_quantizePositions is set. */
+        std::vector<QuantizedPosition>	m_quantized;
+        PointQuantization		m_quantization;
+        bool					m_decoded = false;
+        /*! True while the frame is requested from (or being decoded by) a decoder thread. */
+        bool					m_requested = false;
+        /*! True if decoding failed, the frame is skipped then. */
+        bool					m_failed = false;
+        /*! Update in which the frame was last displayed or needed, for LRU eviction. */
+        unsigned long long		m_lastUsed = 0;
+    };
+
+    /*! A frame decoded by a decoder thread. */
+    struct DecodedFrame {
+        int						m_frameIdx;
+        std::vector<glm::vec3>	m_points;
+        std::vector<QuantizedPosition>	m_quantized;
+        PointQuantization		m_quantization;
+        bool					m_success;
+    };
+
+    /*! One of the two alternating vertex buffers. */
+    struct FrameBuffer {
+        QOpenGLBuffer			m_vbo;
+        /*! Frame in the buffer (complete if m_uploadedCount == m_pointCount), -1 if none. */
+        int						m_frameIdx = -1;
+        std::size_t				m_pointCount = 0;
+        std::size_t				m_uploadedCount = 0;
+        /*! Quantization of the frame, if m_quantizePositions is set. */
+        PointQuantization		m_quantization;
+
+        bool complete() const { return m_frameIdx != -1 && m_uploadedCount == m_pointCount; }
+    };
+
+    /*! Frame index delta frames after frameIdx, with wrap around if m_loop is set, -1 past the ends otherwise. */
+    int nextFrame(int frameIdx, int delta) const;
+
+    /*! Number of frames played from fromFrameIdx to toFrameIdx (with wrap around if m_loop is set). */
+    int playbackDistance(int fromFrameIdx, int toFrameIdx) const;
+
+    /*! Frame due at the current playback time (the paused frame if not playing). */
+    int dueFrame();
+
+    /*! Memory of a decoded frame in bytes. */
+    static std::size_t frameBytes(const Frame & frame);
+
+    /*! Starts uploading frame frameIdx into the back buffer, if decoded. */
+    void beginUpload(int frameIdx);
+
+    void startDecoders();
+    void stopDecoders();
+    void decodeLoop();
+
+    std::vector<Frame>					m_frames;
+    std::size_t							m_cacheBytes = 0;
+    unsigned long long					m_updateCount = 0;
+
+    FrameBuffer							m_buffers[2];
+    /*! Index of the front buffer in m_buffers. */
+    unsigned int						m_front = 0;
+    QOpenGLVertexArrayObject			m_vao;
+    /*! Uniforms of the shader program for the decoding of quantized positions. */
+    int									m_positionOriginUniform = -1;
+    int									m_positionScaleUniform = -1;
+
+    /*! Playback state: the frame shown when playback was started or paused, the time since then. */
+    bool								m_playing = false;
+    int									m_startFrame = 0;
+    QElapsedTimer						m_playTimer;
+    /*! Last frame due (to count late frames once per frame). */
+    int									m_lastDueFrame = -1;
+    Statistics							m_statistics;
+
+    std::vector<std::thread>			m_decodeThreads;
+    /*! Protects the request and completion queues below. */
+    std::mutex							m_decodeMutex;
+    std::condition_variable				m_decodeCondition;
+    bool								m_decodeStop = false;
+    /*! Set to cancel the decoding in progress when the sequence is closed. */
+    std::atomic<bool>					m_decodeCancel{false};
+    /*! Frames to decode, most urgent first. */
+    std::deque<int>						m_decodeRequests;
+    std::deque<DecodedFrame>			m_decodeCompleted;
+};
+
+#endif // POINTCLOUDSEQUENCE_H
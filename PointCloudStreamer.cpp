@@ -0,0 +1,461 @@
+#include "PointCloudStreamer.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QDebug>
+
+#include <algorithm>
+#include <cfloat>
+
+#include "ScreenSelection.h"
+#include "ThreadPool.h"
+
+/*! Max. time between two frames for the estimation of the camera velocity, after a longer pause the camera is
+    considered to be at rest.
+*/
+static const float STREAMER_MAX_FRAME_GAP = 0.25f;
+
+
+PointCloudStreamer::PointCloudStreamer() :
+    m_lastCameraPos(0.f),
+    m_cameraVelocity(0.f)
+{
+}
+
+
+PointCloudStreamer::~PointCloudStreamer() {
+    m_loader.cancel();
+    stopIo();
+}
+
+
+void PointCloudStreamer::openInBackground(const std::string & filename) {
+    m_loader.cancel();
+    close();
+    m_loader.start([this, filename](BackgroundLoader & loader) {
+        const QString sourceFilePath = QString::fromStdString(filename);
+        if (!m_tileFile.open(sourceFilePath)) {
+            PointTileFile::build(sourceFilePath, &loader);
+            if (!m_tileFile.open(sourceFilePath))
+                throw "ERROR::PLYLOADER::Could not open tile file.";
+        }
+        LoadEvent e;
+        e.m_type = LoadEvent::Finished;
+        e.m_vertexCount = m_tileFile.pointCount();
+        loader.post(e);
+    });
+}
+
+
+void PointCloudStreamer::processLoadEvents() {
+    LoadEvent e;
+    while (m_loader.takeEvent(e)) {
+        if (e.m_type == LoadEvent::Finished) {
+            m_tiles.assign(m_tileFile.tiles().size(), TileState());
+            startIo();
+            qDebug() << "Streaming" << m_tileFile.pointCount() << "points in" << m_tiles.size() << "tiles";
+        }
+        else if (e.m_type == LoadEvent::Failed)
+            qWarning() << "Opening tiled point cloud failed:" << e.m_stage;
+    }
+}
+
+
+bool PointCloudStreamer::loading() const {
+    return m_loader.state() == BackgroundLoader::Running;
+}
+
+
+void PointCloudStreamer::create(QOpenGLShaderProgram * shaderProgramm) {
+    // one vertex array object for all tiles, the position buffer is switched per tile in render()
+    m_vao.create();
+    m_vao.bind();
+    shaderProgramm->enableAttributeArray(0); // tightly packed positions
+    m_vao.release();
+    m_positionOriginUniform = shaderProgramm->uniformLocation("positionOrigin");
+    m_positionScaleUniform = shaderProgramm->uniformLocation("positionScale");
+}
+
+
+void PointCloudStreamer::destroy() {
+    close();
+    m_vao.destroy();
+}
+
+
+void PointCloudStreamer::close() {
+    stopIo();
+    for (TileState & tile : m_tiles)
+        releaseGpu(tile);
+    m_tiles.clear();
+    m_hostBytes = m_gpuBytes = 0;
+    m_tileFile.close();
+}
+
+
+std::size_t PointCloudStreamer::tileBytes(unsigned int tileIdx) const {
+    return std::size_t(m_tileFile.tiles()[tileIdx].m_pointCount)*sizeof(glm::vec3);
+}
+
+
+std::size_t PointCloudStreamer::gpuTileBytes(unsigned int tileIdx) const {
+    return std::size_t(m_tileFile.tiles()[tileIdx].m_pointCount)*
+            (m_quantizePositions ? sizeof(QuantizedPosition) : sizeof(glm::vec3));
+}
+
+
+PointQuantization PointCloudStreamer::tileQuantization(unsigned int tileIdx) const {
+    const PointTileFile::Tile & t = m_tileFile.tiles()[tileIdx];
+    return PointQuantization::fromBounds(t.m_min, t.m_max);
+}
+
+
+void PointCloudStreamer::releaseGpu(TileState & tile) {
+    if (tile.m_vbo == 0)
+        return;
+    QOpenGLContext::currentContext()->extraFunctions()->glDeleteBuffers(1, &tile.m_vbo);
+    tile.m_vbo = 0;
+}
+
+
+bool PointCloudStreamer::update(const float worldToView[16], const glm::vec3 & cameraPos, float focalLength) {
+    if (m_tiles.empty())
+        return false;
+    ++m_frame;
+
+    // *** camera motion, smoothed over a few frames
+    const float dt = m_frameTimer.isValid() ? m_frameTimer.restart()*1e-3f : 0;
+    if (!m_frameTimer.isValid())
+        m_frameTimer.start();
+    if (dt > 0 && dt < STREAMER_MAX_FRAME_GAP)
+        m_cameraVelocity = 0.5f*m_cameraVelocity + (0.5f/dt)*(cameraPos - m_lastCameraPos);
+    else
+        m_cameraVelocity = glm::vec3(0.f);
+    m_lastCameraPos = cameraPos;
+    // moving the camera by prefetchOffset is the same as moving the tiles by -prefetchOffset
+    const glm::vec3 prefetchOffset = m_prefetchSeconds*m_cameraVelocity;
+    const glm::vec3 predictedCameraPos = cameraPos + prefetchOffset;
+
+    // *** take over the tiles read by the IO thread, requests not yet started are ranked again below
+    std::deque<LoadedTile> completed;
+    {
+        std::lock_guard<std::mutex> lock(m_ioMutex);
+        completed.swap(m_ioCompleted);
+        for (unsigned int tileIdx : m_ioRequests) {
+            m_tiles[tileIdx].m_requested = false;
+            m_hostBytes -= tileBytes(tileIdx);
+        }
+        m_ioRequests.clear();
+    }
+    for (LoadedTile & loaded : completed) {
+        TileState & tile = m_tiles[loaded.m_tileIdx];
+        tile.m_requested = false;
+        if (loaded.m_success)
+            tile.m_points.swap(loaded.m_points);
+        else {
+            qWarning() << "Reading tile" << loaded.m_tileIdx << "failed.";
+            m_hostBytes -= tileBytes(loaded.m_tileIdx);
+        }
+    }
+
+    // *** rank the visible tiles by their screen-space size, and the tiles visible from the predicted position
+    ScreenSelection frustum;
+    frustum.setRectangle(worldToView, -1, -1, 1, 1);
+    struct RankedTile {
+        unsigned int	m_tileIdx;
+        float			m_screenRadius;
+        bool operator<(const RankedTile & other) const { return m_screenRadius > other.m_screenRadius; }
+    };
+    auto screenRadius = [focalLength](const PointTileFile::Tile & t, const glm::vec3 & eye) {
+        const float radius = 0.5f*glm::length(t.m_max - t.m_min);
+        const float dist = glm::length(0.5f*(t.m_min + t.m_max) - eye);
+        return dist <= radius ? FLT_MAX : focalLength*radius/dist;
+    };
+    std::vector<RankedTile> visibleTiles;
+    std::vector<RankedTile> prefetchTiles;
+    const std::vector<PointTileFile::Tile> & tileTable = m_tileFile.tiles();
+    for (unsigned int i=0; i<m_tiles.size(); ++i) {
+        const PointTileFile::Tile & t = tileTable[i];
+        TileState & tile = m_tiles[i];
+        tile.m_visible = frustum.classifyBox(t.m_min, t.m_max) != ScreenSelection::OUTSIDE;
+        if (tile.m_visible) {
+            tile.m_lastUsedFrame = m_frame;
+            const float r = screenRadius(t, cameraPos);
+            if (r >= m_minScreenRadius)
+                visibleTiles.push_back(RankedTile{i, r});
+        }
+        else if (frustum.classifyBox(t.m_min - prefetchOffset, t.m_max - prefetchOffset) != ScreenSelection::OUTSIDE) {
+            const float r = screenRadius(t, predictedCameraPos);
+            if (r >= m_minScreenRadius)
+                prefetchTiles.push_back(RankedTile{i, r});
+        }
+    }
+    std::sort(visibleTiles.begin(), visibleTiles.end());
+    std::sort(prefetchTiles.begin(), prefetchTiles.end());
+
+    // *** tiles needed on the GPU and in host memory, in order of their rank, within the budgets
+    std::vector<char> neededOnGpu(m_tiles.size(), 0);
+    std::vector<char> neededOnHost(m_tiles.size(), 0);
+    std::vector<unsigned int> gpuTiles;
+    std::vector<unsigned int> hostTiles;
+    std::size_t gpuBytes = 0;
+    for (const RankedTile & r : visibleTiles) {
+        gpuBytes += gpuTileBytes(r.m_tileIdx);
+        if (gpuBytes > m_gpuBudgetBytes)
+            break;
+        neededOnGpu[r.m_tileIdx] = 1;
+        gpuTiles.push_back(r.m_tileIdx);
+    }
+    std::size_t hostBytes = 0;
+    for (const std::vector<RankedTile> * ranked : { &visibleTiles, &prefetchTiles }) {
+        for (const RankedTile & r : *ranked) {
+            hostBytes += tileBytes(r.m_tileIdx);
+            if (hostBytes > m_hostBudgetBytes)
+                break;
+            neededOnHost[r.m_tileIdx] = 1;
+            hostTiles.push_back(r.m_tileIdx);
+        }
+    }
+
+    // tiles that may be evicted, least recently visible first
+    auto lruOrder = [this](unsigned int a, unsigned int b) {
+        return m_tiles[a].m_lastUsedFrame < m_tiles[b].m_lastUsedFrame;
+    };
+    std::vector<unsigned int> hostEvictable;
+    std::vector<unsigned int> gpuEvictable;
+    for (unsigned int i=0; i<m_tiles.size(); ++i) {
+        if (!neededOnHost[i] && !m_tiles[i].m_points.empty())
+            hostEvictable.push_back(i);
+        if (!neededOnGpu[i] && m_tiles[i].m_vbo != 0)
+            gpuEvictable.push_back(i);
+    }
+    std::sort(hostEvictable.begin(), hostEvictable.end(), lruOrder);
+    std::sort(gpuEvictable.begin(), gpuEvictable.end(), lruOrder);
+
+    // *** request the missing host tiles, their memory is reserved until they are read (or the request withdrawn)
+    std::size_t nextEvictable = 0;
+    std::deque<unsigned int> requests;
+    for (unsigned int tileIdx : hostTiles) {
+        TileState & tile = m_tiles[tileIdx];
+        if (!tile.m_points.empty() || tile.m_requested)
+            continue;
+        const std::size_t bytes = tileBytes(tileIdx);
+        while (m_hostBytes + bytes > m_hostBudgetBytes && nextEvictable < hostEvictable.size()) {
+            TileState & evicted = m_tiles[hostEvictable[nextEvictable++]];
+            m_hostBytes -= evicted.m_points.size()*sizeof(glm::vec3);
+            std::vector<glm::vec3>().swap(evicted.m_points);
+        }
+        if (m_hostBytes + bytes > m_hostBudgetBytes)
+            break; // tiles still being read that are not needed anymore
+        m_hostBytes += bytes;
+        tile.m_requested = true;
+        requests.push_back(tileIdx);
+    }
+    if (!requests.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(m_ioMutex);
+            m_ioRequests.swap(requests);
+        }
+        m_ioCondition.notify_one();
+    }
+
+    // *** upload the host-resident tiles needed on the GPU, at least one tile per frame
+    QOpenGLExtraFunctions * f = QOpenGLContext::currentContext()->extraFunctions();
+    std::size_t uploadBudget = m_uploadBytesPerFrame;
+    bool uploadPending = false;
+    std::vector<QuantizedPosition> quantized;
+    nextEvictable = 0;
+    for (unsigned int tileIdx : gpuTiles) {
+        TileState & tile = m_tiles[tileIdx];
+        if (tile.m_vbo != 0 || tile.m_points.empty())
+            continue;
+        const std::size_t bytes = gpuTileBytes(tileIdx);
+        if (bytes > uploadBudget && uploadBudget != m_uploadBytesPerFrame) {
+            uploadPending = true;
+            break;
+        }
+        while (m_gpuBytes + bytes > m_gpuBudgetBytes && nextEvictable < gpuEvictable.size()) {
+            m_gpuBytes -= gpuTileBytes(gpuEvictable[nextEvictable]);
+            releaseGpu(m_tiles[gpuEvictable[nextEvictable++]]);
+        }
+        if (m_gpuBytes + bytes > m_gpuBudgetBytes)
+            break;
+        f->glGenBuffers(1, &tile.m_vbo);
+        f->glBindBuffer(GL_ARRAY_BUFFER, tile.m_vbo);
+        if (m_quantizePositions) {
+            quantized.resize(tile.m_points.size());
+            tileQuantization(tileIdx).quantize(tile.m_points.data(), tile.m_points.size(), quantized.data());
+            f->glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(bytes), quantized.data(), GL_STATIC_DRAW);
+        }
+        else
+            f->glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(bytes), tile.m_points.data(), GL_STATIC_DRAW);
+        m_gpuBytes += bytes;
+        uploadBudget -= std::min(uploadBudget, bytes);
+    }
+    f->glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return uploadPending;
+}
+
+
+void PointCloudStreamer::render() {
+    if (m_tiles.empty())
+        return;
+    QOpenGLExtraFunctions * f = QOpenGLContext::currentContext()->extraFunctions();
+    m_vao.bind();
+    const std::vector<PointTileFile::Tile> & tileTable = m_tileFile.tiles();
+    for (unsigned int i=0; i<m_tiles.size(); ++i) {
+        const TileState & tile = m_tiles[i];
+        if (!tile.m_visible || tile.m_vbo == 0)
+            continue;
+        f->glBindBuffer(GL_ARRAY_BUFFER, tile.m_vbo);
+        if (m_quantizePositions) {
+            // the shader decodes the integer positions with the box of the tile
+            const PointQuantization q = tileQuantization(i);
+            f->glUniform3f(m_positionOriginUniform, q.m_origin.x, q.m_origin.y, q.m_origin.z);
+            f->glUniform3f(m_positionScaleUniform, q.m_scale.x, q.m_scale.y, q.m_scale.z);
+            f->glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(QuantizedPosition), nullptr);
+        }
+        else
+            f->glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), nullptr);
+        f->glDrawArrays(GL_POINTS, 0, GLsizei(tileTable[i].m_pointCount));
+    }
+    if (m_quantizePositions) {
+        // other objects drawn with the shader program have float positions
+        f->glUniform3f(m_positionOriginUniform, 0.f, 0.f, 0.f);
+        f->glUniform3f(m_positionScaleUniform, 1.f, 1.f, 1.f);
+    }
+    f->glBindBuffer(GL_ARRAY_BUFFER, 0);
+    m_vao.release();
+}
+
+
+/*! Clips the segment "n + t*d", 0 <= t <= tMax, against the box, returns false if it misses the box. */
+static bool segmentHitsBox(const glm::vec3 & n, const glm::vec3 & d, const glm::vec3 & boxMin, const glm::vec3 & boxMax,
+                           float tMax)
+{
+    float t0 = 0;
+    float t1 = tMax;
+    for (int a=0; a<3; ++a) {
+        if (d[a] == 0) {
+            if (n[a] < boxMin[a] || n[a] > boxMax[a])
+                return false;
+            continue;
+        }
+        float tNear = (boxMin[a] - n[a])/d[a];
+        float tFar = (boxMax[a] - n[a])/d[a];
+        if (tNear > tFar)
+            std::swap(tNear, tFar);
+        t0 = std::max(t0, tNear);
+        t1 = std::min(t1, tFar);
+        if (t0 > t1)
+            return false;
+    }
+    return true;
+}
+
+
+bool PointCloudStreamer::pickPoint(const glm::vec3& n, const glm::vec3& f, float nearTolerance, float farTolerance,
+                                   PickObject & po) const
+{
+    const glm::vec3 dir = f - n;
+    const float dirLength2 = glm::dot(dir, dir);
+    if (dirLength2 == 0)
+        return false;
+
+    // host-resident tiles whose box, grown by the tolerance, is hit by the ray
+    const glm::vec3 tolerance(std::max(nearTolerance, farTolerance));
+    const std::vector<PointTileFile::Tile> & tileTable = m_tileFile.tiles();
+    std::vector<unsigned int> candidates;
+    for (unsigned int i=0; i<m_tiles.size(); ++i)
+        if (!m_tiles[i].m_points.empty() &&
+            segmentHitsBox(n, dir, tileTable[i].m_min - tolerance, tileTable[i].m_max + tolerance, std::min(po.m_dist, 1.f)))
+        {
+            candidates.push_back(i);
+        }
+
+    // test the points of the candidates in parallel, each block keeps its nearest hit
+    ThreadPool & pool = ThreadPool::globalInstance();
+    struct Hit {
+        float			m_dist;
+        std::uint64_t	m_pointId;
+    };
+    std::vector<Hit> blockHits(pool.threadCount(), Hit{po.m_dist, ~std::uint64_t(0)});
+    pool.parallelFor(candidates.size(), (unsigned int)blockHits.size(), [&](std::size_t first, std::size_t last, unsigned int block) {
+        Hit & hit = blockHits[block];
+        for (std::size_t c=first; c<last; ++c) {
+            const std::vector<glm::vec3> & points = m_tiles[candidates[c]].m_points;
+            for (std::size_t i=0; i<points.size(); ++i) {
+                const glm::vec3 p = points[i] - n;
+                const float t = glm::dot(p, dir)/dirLength2;
+                if (t < 0 || t > 1 || t >= hit.m_dist)
+                    continue;
+                const glm::vec3 offset = p - t*dir;
+                const float r = nearTolerance + t*(farTolerance - nearTolerance);
+                if (glm::dot(offset, offset) > r*r)
+                    continue;
+                hit.m_dist = t;
+                hit.m_pointId = tileTable[candidates[c]].m_firstPoint + i;
+            }
+        }
+    });
+    bool found = false;
+    for (const Hit & hit : blockHits) {
+        if (hit.m_pointId == ~std::uint64_t(0) || hit.m_dist >= po.m_dist)
+            continue;
+        po.m_dist = hit.m_dist;
+        po.m_objectId = (unsigned int)hit.m_pointId;
+        po.m_faceId = 0;
+        found = true;
+    }
+    return found;
+}
+
+
+void PointCloudStreamer::startIo() {
+    stopIo();
+    m_ioStop = false;
+    m_ioThread = std::thread(&PointCloudStreamer::ioLoop, this);
+}
+
+
+void PointCloudStreamer::stopIo() {
+    if (m_ioThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_ioMutex);
+            m_ioStop = true;
+        }
+        m_ioCondition.notify_one();
+        m_ioThread.join();
+    }
+    m_ioRequests.clear();
+    m_ioCompleted.clear();
+}
+
+
+void PointCloudStreamer::ioLoop() {
+    std::unique_lock<std::mutex> lock(m_ioMutex);
+    for (;;) {
+        m_ioCondition.wait(lock, [this]() { return m_ioStop || !m_ioRequests.empty(); });
+        if (m_ioStop)
+            return;
+        LoadedTile loaded;
+        loaded.m_tileIdx = m_ioRequests.front();
+        m_ioRequests.pop_front();
+
+        // the tile file is only read by this thread
+        lock.unlock();
+        loaded.m_success = m_tileFile.readTile(loaded.m_tileIdx, loaded.m_points);
+        // picks use the positions as drawn
+        if (loaded.m_success && m_quantizePositions)
+            tileQuantization(loaded.m_tileIdx).snap(loaded.m_points.data(), loaded.m_points.size());
+        lock.lock();
+
+        m_ioCompleted.push_back(std::move(loaded));
+        if (m_notify) {
+            lock.unlock();
+            m_notify();
+            lock.lock();
+        }
+    }
+}
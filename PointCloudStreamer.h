@@ -0,0 +1,173 @@
+#ifndef POINTCLOUDSTREAMER_H
+#define POINTCLOUDSTREAMER_H
+
+#include <QOpenGLVertexArrayObject>
+#include <QElapsedTimer>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <glm.hpp>
+
+#include "BackgroundLoader.h"
+#include "PickObject.h"
+#include "PointQuantization.h"
+#include "PointTileFile.h"
+
+QT_BEGIN_NAMESPACE
+class QOpenGLShaderProgram;
+QT_END_NAMESPACE
+
+/*! Out-of-core rendering of point clouds larger than host and GPU memory.
+
+    The cloud is split into spatial tiles on disk (PointTileFile, built in the background by openInBackground()).
+    Each frame, update() decides which tiles are needed, based on the camera:
+    - tiles inside the view frustum are ranked by their screen-space size (projected radius in pixels), tiles
+      smaller than m_minScreenRadius are skipped,
+    - the highest ranked tiles up to m_gpuBudgetBytes are uploaded into one vertex buffer per tile
+      (at most m_uploadBytesPerFrame per frame),
+    - the host keeps these tiles plus the tiles visible from the position the camera is predicted to reach within
+      m_prefetchSeconds (prefetch along the camera motion), up to m_hostBudgetBytes.
+    Tiles are read from the tile file on an IO thread, in order of their rank (requests not yet started are
+    re-ranked every frame). When a budget is exceeded, the least recently visible tiles that are not needed are
+    evicted (LRU).
+
+    Only tiles resident on the GPU are drawn, and only host-resident tiles can be picked. Point ids are indexes
+    in the tile file (see PointTileFile), not in the PLY file.
+
+    If m_quantizePositions is set, the tiles are stored on the GPU as 16 bit integers relative to their bounding
+    box (see PointQuantization), so twice as many tiles fit into m_gpuBudgetBytes and uploads take half the time.
+    The host-resident points are replaced by the dequantized positions, so picks use exactly the points drawn.
+*/
+class PointCloudStreamer {
+public:
+    PointCloudStreamer();
+    /*! Cancels the tiling and stops the IO thread. */
+    ~PointCloudStreamer();
+
+    /*! Opens the tile file of the PLY file, on the thread of m_loader. If the tile file is missing or outdated,
+        it is built first (see PointTileFile::build()). The IO thread is started in processLoadEvents() when
+        the file is open. A streamer that is already open is closed first (OpenGL context must be current then).
+    */
+    void openInBackground(const std::string & filename);
+
+    /*! Processes the events of m_loader (GUI thread): starts streaming when the tile file is open. */
+    void processLoadEvents();
+
+    /*! True while the tile file is being built or opened. */
+    bool loading() const;
+
+    /*! The function is called during OpenGL initialization, where the OpenGL context is current. */
+    void create(QOpenGLShaderProgram * shaderProgramm);
+    /*! Stops the IO thread and releases all tiles (OpenGL context must be current). */
+    void destroy();
+
+    /*! Updates the residency of the tiles for the camera at cameraPos (world coordinates, for the prediction of
+        the camera motion) and the world to view matrix worldToView (row-major, as returned by
+        QMatrix4x4::copyDataTo()). focalLength is the projection scale in pixels
+        (half viewport height / tan(half vertical field of view)).
+        Takes over the tiles read by the IO thread, evicts tiles, issues new reads and uploads tiles (OpenGL context
+        must be current). Returns true if uploads are left for the next frame.
+    */
+    bool update(const float worldToView[16], const glm::vec3 & cameraPos, float focalLength);
+
+    /*! Draws the tiles that are on the GPU and were inside the view frustum in the last update(). */
+    void render();
+
+    /*! Finds the front-most point of the host-resident tiles within the tolerance of the ray "n + t*(f - n)",
+        with the same parameters and result as BoxObject::pickPoint().
+    */
+    bool pickPoint(const glm::vec3& n, const glm::vec3& f, float nearTolerance, float farTolerance, PickObject & po) const;
+
+    /*! Total number of points and tiles in the tile file. */
+    std::size_t pointCount() const { return m_tileFile.pointCount(); }
+    std::size_t tileCount() const { return m_tiles.size(); }
+
+    /*! Budgets and parameters of the streaming, can be changed at any time. */
+    std::size_t							m_hostBudgetBytes = std::size_t(1) << 30;
+    std::size_t							m_gpuBudgetBytes = std::size_t(512) << 20;
+    std::size_t							m_uploadBytesPerFrame = 32 << 20;
+    float								m_prefetchSeconds = 0.5f;
+    float								m_minScreenRadius = 1;
+    /*! If true, the tiles are uploaded as quantized positions (must be set before openInBackground()). */
+    bool								m_quantizePositions = false;
+
+    /*! Called from the IO thread after a tile was read, must be thread-save (e.g. queue a repaint). */
+    std::function<void()>				m_notify;
+
+    /*! Builds and opens the tile file in the background, see openInBackground(). */
+    BackgroundLoader					m_loader;
+
+private:
+    /*! Residency of a tile. */
+    struct TileState {
+        /*! Points of the tile, empty if not in host memory. */
+        std::vector<glm::vec3>	m_points;
+        /*! Vertex buffer with the points, 0 if not on the GPU. */
+        GLuint					m_vbo = 0;
+        /*! True while the tile is requested from (or being read by) the IO thread. */
+        bool					m_requested = false;
+        /*! True if the tile was inside the view frustum in the last update(). */
+        bool					m_visible = false;
+        /*! Frame of the last update() in which the tile was visible, for LRU eviction. */
+        unsigned long long		m_lastUsedFrame = 0;
+    };
+
+    /*! A tile read by the IO thread. */
+    struct LoadedTile {
+        unsigned int			m_tileIdx;
+        std::vector<glm::vec3>	m_points;
+        bool					m_success;
+    };
+
+    /*! Starts/stops the IO thread. */
+    void startIo();
+    void stopIo();
+    void ioLoop();
+
+    /*! Stops the IO thread, releases all tiles and closes the tile file (OpenGL context must be current if tiles
+        are on the GPU).
+    */
+    void close();
+
+    /*! Size of the points of a tile in bytes, in host and in GPU memory. */
+    std::size_t tileBytes(unsigned int tileIdx) const;
+    std::size_t gpuTileBytes(unsigned int tileIdx) const;
+
+    /*! Quantization of the points of a tile, relative to its bounding box. */
+    PointQuantization tileQuantization(unsigned int tileIdx) const;
+
+    /*! Deletes the vertex buffer of the tile. */
+    void releaseGpu(TileState & tile);
+
+    PointTileFile						m_tileFile;
+    std::vector<TileState>				m_tiles;
+    std::size_t							m_hostBytes = 0;
+    std::size_t							m_gpuBytes = 0;
+
+    QOpenGLVertexArrayObject			m_vao;
+    /*! Uniforms of the shader program for the decoding of quantized positions. */
+    int									m_positionOriginUniform = -1;
+    int									m_positionScaleUniform = -1;
+
+    /*! Frame counter and camera motion, for LRU and prefetch. */
+    unsigned long long					m_frame = 0;
+    QElapsedTimer						m_frameTimer;
+    glm::vec3							m_lastCameraPos;
+    glm::vec3							m_cameraVelocity;
+
+    std::thread							m_ioThread;
+    /*! Protects the request and completion queues below. */
+    std::mutex							m_ioMutex;
+    std::condition_variable				m_ioCondition;
+    bool								m_ioStop = false;
+    /*! Tiles to read, highest ranked first. */
+    std::deque<unsigned int>			m_ioRequests;
+    std::deque<LoadedTile>				m_ioCompleted;
+};
+
+#endif // POINTCLOUDSTREAMER_H
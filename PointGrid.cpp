@@ -0,0 +1,281 @@
+#include "PointGrid.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "ScreenSelection.h"
+#include "ThreadPool.h"
+
+/*! Upper limit of the number of grid cells (4 bytes per cell). */
+static const std::size_t POINTGRID_MAX_CELLS = 1 << 24;
+/*! Edge length (in cells) of the bricks classified first in selectPoints(). */
+static const unsigned int POINTGRID_SELECT_BRICK = 8;
+/*! Number of blocks per thread in selectPoints(), for load balancing. */
+static const unsigned int POINTGRID_SELECT_BLOCKS_PER_THREAD = 4;
+
+/*! False for points with NaN or infinite coordinates (found in real captures), they are not sorted into the grid. */
+static inline bool isFinitePoint(const glm::vec3 & p) {
+    return std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z);
+}
+
+void PointGrid::build(const glm::vec3 * positions, std::size_t count, ThreadPool & pool, float pointsPerCell) {
+    clear();
+    if (count == 0)
+        return;
+
+    // *** bounding box and number of the finite points (all others are skipped)
+    std::vector<glm::vec3> blockMin(pool.threadCount(), glm::vec3(FLT_MAX));
+    std::vector<glm::vec3> blockMax(pool.threadCount(), glm::vec3(-FLT_MAX));
+    std::vector<std::size_t> blockCounts(pool.threadCount(), 0);
+    pool.parallelFor(count, (unsigned int)blockMin.size(), [&](std::size_t first, std::size_t last, unsigned int block) {
+        glm::vec3 & bMin = blockMin[block];
+        glm::vec3 & bMax = blockMax[block];
+        for (std::size_t i=first; i<last; ++i) {
+            if (!isFinitePoint(positions[i]))
+                continue;
+            for (int a=0; a<3; ++a) {
+                bMin[a] = std::min(bMin[a], positions[i][a]);
+                bMax[a] = std::max(bMax[a], positions[i][a]);
+            }
+            ++blockCounts[block];
+        }
+    });
+    glm::vec3 boxMin(FLT_MAX), boxMax(-FLT_MAX);
+    std::size_t pointCount = 0;
+    for (std::size_t b=0; b<blockMin.size(); ++b) {
+        for (int a=0; a<3; ++a) {
+            boxMin[a] = std::min(boxMin[a], blockMin[b][a]);
+            boxMax[a] = std::max(boxMax[a], blockMax[b][a]);
+        }
+        pointCount += blockCounts[b];
+    }
+    if (pointCount == 0)
+        return;
+
+    // *** grid dimensions, cubic cells with about pointsPerCell points per cell
+    glm::vec3 extent = boxMax - boxMin;
+    float maxExtent = std::max(extent.x, std::max(extent.y, extent.z));
+    if (maxExtent <= 0)
+        maxExtent = 1; // all points at the same position
+    // flat clouds (e.g. a single plane) are treated like thin boxes, so that the cell size follows the point density
+    for (int a=0; a<3; ++a)
+        extent[a] = std::max(extent[a], maxExtent*1e-3f);
+    std::size_t targetCells = std::min(std::max<std::size_t>(1, std::size_t(pointCount/pointsPerCell)), POINTGRID_MAX_CELLS);
+    m_cellSize = std::cbrt(extent.x*extent.y*extent.z/targetCells);
+    std::size_t cellCount;
+    for (;;) {
+        cellCount = 1;
+        for (int a=0; a<3; ++a) {
+            m_dims[a] = std::max(1u, (unsigned int)std::ceil(extent[a]/m_cellSize));
+            cellCount *= m_dims[a];
+        }
+        if (cellCount <= POINTGRID_MAX_CELLS)
+            break;
+        m_cellSize *= 1.25f; // rounding up of the dimensions exceeded the limit
+    }
+    m_origin = boxMin;
+
+    // *** cell index of each point, ~0u for the skipped points
+    std::vector<unsigned int> pointCells(count);
+    pool.parallelFor(count, 0, [&](std::size_t first, std::size_t last, unsigned int) {
+        const float invCellSize = 1/m_cellSize;
+        for (std::size_t i=first; i<last; ++i) {
+            if (!isFinitePoint(positions[i])) {
+                pointCells[i] = ~0u;
+                continue;
+            }
+            unsigned int c[3];
+            for (int a=0; a<3; ++a)
+                c[a] = std::min((unsigned int)((positions[i][a] - m_origin[a])*invCellSize), m_dims[a] - 1);
+            pointCells[i] = c[0] + m_dims[0]*(c[1] + m_dims[1]*c[2]);
+        }
+    });
+
+    // *** counting sort of points by cell
+    m_cellStart.assign(cellCount + 1, 0);
+    for (std::size_t i=0; i<count; ++i)
+        if (pointCells[i] != ~0u)
+            ++m_cellStart[pointCells[i] + 1];
+    for (std::size_t c=0; c<cellCount; ++c)
+        m_cellStart[c + 1] += m_cellStart[c];
+    m_points.resize(pointCount);
+    m_pointIds.resize(pointCount);
+    std::vector<unsigned int> insertPos(m_cellStart.begin(), m_cellStart.end() - 1);
+    for (std::size_t i=0; i<count; ++i) {
+        if (pointCells[i] == ~0u)
+            continue;
+        unsigned int pos = insertPos[pointCells[i]]++;
+        m_points[pos] = positions[i];
+        m_pointIds[pos] = (unsigned int)i;
+    }
+}
+
+
+void PointGrid::clear() {
+    m_cellStart.clear();
+    m_points.clear();
+    m_pointIds.clear();
+    m_dims[0] = m_dims[1] = m_dims[2] = 0;
+}
+
+
+/*! Returns the range [first, last] of cells along an axis that overlap the coordinate range [lo, hi],
+    false if there is none.
+*/
+static bool cellRange(float lo, float hi, float origin, float cellSize, unsigned int dim, unsigned int & first, unsigned int & last) {
+    float cLo = std::floor((lo - origin)/cellSize);
+    float cHi = std::floor((hi - origin)/cellSize);
+    if (cHi < 0 || cLo >= dim || !(cLo <= cHi))
+        return false;
+    first = (unsigned int)std::max(cLo, 0.f);
+    last = (unsigned int)std::min(cHi, float(dim - 1));
+    return true;
+}
+
+
+bool PointGrid::nearestPoint(const glm::vec3 & origin, const glm::vec3 & dir, float nearTolerance, float farTolerance,
+                             Hit & hit) const
+{
+    const float dirLength2 = glm::dot(dir, dir);
+    if (m_points.empty() || dirLength2 == 0)
+        return false;
+
+    // layers of cells are walked along the dominant axis of the ray, the two other axes are the layer axes
+    int axis = 0;
+    if (std::fabs(dir.y) > std::fabs(dir[axis]))
+        axis = 1;
+    if (std::fabs(dir.z) > std::fabs(dir[axis]))
+        axis = 2;
+    const int axisU = (axis + 1) % 3;
+    const int axisV = (axis + 2) % 3;
+    const unsigned int cellStride[3] = {1, m_dims[0], m_dims[0]*m_dims[1]};
+
+    // all points that can be accepted are within maxTolerance of the segment
+    const float maxTolerance = std::max(nearTolerance, farTolerance);
+    unsigned int firstLayer, lastLayer;
+    if (!cellRange(std::min(origin[axis], origin[axis] + dir[axis]) - maxTolerance,
+                   std::max(origin[axis], origin[axis] + dir[axis]) + maxTolerance,
+                   m_origin[axis], m_cellSize, m_dims[axis], firstLayer, lastLayer))
+    {
+        return false;
+    }
+
+    bool found = false;
+    const unsigned int layerCount = lastLayer - firstLayer + 1;
+    for (unsigned int l=0; l<layerCount; ++l) {
+        // front to back
+        const unsigned int layer = dir[axis] > 0 ? firstLayer + l : lastLayer - l;
+
+        // ray parameter range in which the segment is within maxTolerance of the layer
+        float layerLo = m_origin[axis] + layer*m_cellSize - maxTolerance;
+        float layerHi = layerLo + m_cellSize + 2*maxTolerance;
+        float t0 = (layerLo - origin[axis])/dir[axis];
+        float t1 = (layerHi - origin[axis])/dir[axis];
+        if (t0 > t1)
+            std::swap(t0, t1);
+        t0 = std::max(t0, 0.f);
+        t1 = std::min(t1, 1.f);
+        if (t0 >= hit.m_dist)
+            break; // this and all following layers are behind the best point
+        if (t0 > t1)
+            continue;
+
+        // cells of the layer within the tolerance of the segment part
+        const float tolerance = std::max(nearTolerance + t0*(farTolerance - nearTolerance),
+                                         nearTolerance + t1*(farTolerance - nearTolerance));
+        unsigned int firstU, lastU, firstV, lastV;
+        if (!cellRange(std::min(origin[axisU] + t0*dir[axisU], origin[axisU] + t1*dir[axisU]) - tolerance,
+                       std::max(origin[axisU] + t0*dir[axisU], origin[axisU] + t1*dir[axisU]) + tolerance,
+                       m_origin[axisU], m_cellSize, m_dims[axisU], firstU, lastU) ||
+            !cellRange(std::min(origin[axisV] + t0*dir[axisV], origin[axisV] + t1*dir[axisV]) - tolerance,
+                       std::max(origin[axisV] + t0*dir[axisV], origin[axisV] + t1*dir[axisV]) + tolerance,
+                       m_origin[axisV], m_cellSize, m_dims[axisV], firstV, lastV))
+        {
+            continue;
+        }
+
+        for (unsigned int v=firstV; v<=lastV; ++v)
+            for (unsigned int u=firstU; u<=lastU; ++u) {
+                const unsigned int cell = layer*cellStride[axis] + u*cellStride[axisU] + v*cellStride[axisV];
+                for (unsigned int i=m_cellStart[cell]; i<m_cellStart[cell + 1]; ++i) {
+                    const glm::vec3 p = m_points[i] - origin;
+                    const float t = glm::dot(p, dir)/dirLength2;
+                    if (t < 0 || t > 1 || t >= hit.m_dist)
+                        continue;
+                    const glm::vec3 offset = p - t*dir;
+                    const float r = nearTolerance + t*(farTolerance - nearTolerance);
+                    if (glm::dot(offset, offset) > r*r)
+                        continue;
+                    hit.m_dist = t;
+                    hit.m_pointId = m_pointIds[i];
+                    found = true;
+                }
+            }
+    }
+    return found;
+}
+
+
+void PointGrid::selectPoints(const ScreenSelection & selection, ThreadPool & pool, std::vector<unsigned int> & ids) const {
+    ids.clear();
+    if (m_points.empty())
+        return;
+    unsigned int bricks[3];
+    for (int a=0; a<3; ++a)
+        bricks[a] = (m_dims[a] + POINTGRID_SELECT_BRICK - 1)/POINTGRID_SELECT_BRICK;
+    const std::size_t brickCount = std::size_t(bricks[0])*bricks[1]*bricks[2];
+    // points are clamped into the outermost cells and positions are rounded, so boxes are slightly enlarged
+    // (a box is then accepted as a whole only if it is safely inside)
+    const glm::vec3 margin(m_cellSize*1e-3f);
+
+    std::vector<std::vector<unsigned int> > blockIds(POINTGRID_SELECT_BLOCKS_PER_THREAD*pool.threadCount());
+    pool.parallelFor(brickCount, (unsigned int)blockIds.size(), [&](std::size_t first, std::size_t last, unsigned int block) {
+        std::vector<unsigned int> & out = blockIds[block];
+        for (std::size_t b=first; b<last; ++b) {
+            // cell range [c0, c1) of the brick
+            unsigned int brick[3] = { unsigned(b % bricks[0]), unsigned(b/bricks[0] % bricks[1]), unsigned(b/bricks[0]/bricks[1]) };
+            unsigned int c0[3], c1[3];
+            for (int a=0; a<3; ++a) {
+                c0[a] = brick[a]*POINTGRID_SELECT_BRICK;
+                c1[a] = std::min(c0[a] + POINTGRID_SELECT_BRICK, m_dims[a]);
+            }
+            const glm::vec3 brickMin = m_origin + glm::vec3(c0[0], c0[1], c0[2])*m_cellSize - margin;
+            const glm::vec3 brickMax = m_origin + glm::vec3(c1[0], c1[1], c1[2])*m_cellSize + margin;
+            ScreenSelection::Overlap brickOverlap = selection.classifyBox(brickMin, brickMax);
+            if (brickOverlap == ScreenSelection::OUTSIDE)
+                continue;
+
+            for (unsigned int z=c0[2]; z<c1[2]; ++z)
+                for (unsigned int y=c0[1]; y<c1[1]; ++y) {
+                    const unsigned int rowCell = m_dims[0]*(y + m_dims[1]*z);
+                    if (brickOverlap == ScreenSelection::INSIDE) {
+                        // the points of a row of cells are contiguous
+                        out.insert(out.end(), m_pointIds.begin() + m_cellStart[rowCell + c0[0]],
+                                   m_pointIds.begin() + m_cellStart[rowCell + c1[0]]);
+                        continue;
+                    }
+                    for (unsigned int x=c0[0]; x<c1[0]; ++x) {
+                        const unsigned int cell = rowCell + x;
+                        const unsigned int pFirst = m_cellStart[cell];
+                        const unsigned int pLast = m_cellStart[cell + 1];
+                        if (pFirst == pLast)
+                            continue;
+                        const glm::vec3 cellMin = m_origin + glm::vec3(x, y, z)*m_cellSize - margin;
+                        const glm::vec3 cellMax = m_origin + glm::vec3(x + 1, y + 1, z + 1)*m_cellSize + margin;
+                        ScreenSelection::Overlap cellOverlap = selection.classifyBox(cellMin, cellMax);
+                        if (cellOverlap == ScreenSelection::OUTSIDE)
+                            continue;
+                        if (cellOverlap == ScreenSelection::INSIDE) {
+                            out.insert(out.end(), m_pointIds.begin() + pFirst, m_pointIds.begin() + pLast);
+                            continue;
+                        }
+                        for (unsigned int i=pFirst; i<pLast; ++i)
+                            if (selection.contains(m_points[i]))
+                                out.push_back(m_pointIds[i]);
+                    }
+                }
+        }
+    });
+    concatenateSelections(blockIds, ids);
+}
@@ -0,0 +1,76 @@
+#ifndef POINTGRID_H
+#define POINTGRID_H
+
+#include <cstddef>
+#include <vector>
+
+#include <glm.hpp>
+
+class ScreenSelection;
+class ThreadPool;
+
+/*! Uniform grid over a point cloud, used for picking points with a tolerance around the pick ray.
+
+    The bounding box of the points is divided into cubic cells, sized so that each cell holds a few points
+    on average. The points are stored sorted by cell (copies of the positions plus their original indexes),
+    m_cellStart holds the offset of the first point of each cell.
+
+    A pick query walks the layers of cells along the dominant axis of the ray, front to back, and only
+    visits the cells in each layer that are within the tolerance of the ray. It stops as soon as the remaining
+    layers cannot contain a point in front of the best point found so far.
+*/
+class PointGrid {
+public:
+    /*! Nearest point found by nearestPoint(). */
+    struct Hit {
+        Hit(float dist) : m_dist(dist), m_pointId(~0u) {}
+
+        /*! Ray parameter t of the point projected onto the ray (the depth), only points with smaller t are accepted. */
+        float			m_dist;
+        /*! Index of the point, ~0u if no point was found. */
+        unsigned int	m_pointId;
+    };
+
+    /*! Sorts the count points into a grid with about pointsPerCell points per cell (on average).
+        The positions are copied, so they may be changed or released afterwards. Points with NaN or infinite
+        coordinates are skipped (never found).
+    */
+    void build(const glm::vec3 * positions, std::size_t count, ThreadPool & pool, float pointsPerCell = 4);
+
+    void clear();
+    bool empty() const { return m_points.empty(); }
+
+    /*! Finds the front-most point near the segment "origin + t*dir" with 0 <= t <= 1.
+        A point is near the segment if its distance to the segment point at its projection parameter t
+        is not larger than the tolerance at t, which grows linearly from nearTolerance (t = 0) to
+        farTolerance (t = 1). For a pick ray between near and far plane, this is a cone of constant
+        screen-space radius.
+        Returns true and updates hit, if a point with t < hit.m_dist was found.
+    */
+    bool nearestPoint(const glm::vec3 & origin, const glm::vec3 & dir, float nearTolerance, float farTolerance,
+                      Hit & hit) const;
+
+    /*! Stores the indexes of all points inside the selection (rectangle or lasso, see ScreenSelection) in ids,
+        grouped by grid cell (not sorted). Bricks of cells are classified first, bricks and cells that are entirely inside or
+        outside are accepted or rejected as a whole, so only points in cells crossing the border of the selection
+        are tested individually. The bricks are processed in parallel on the thread pool.
+    */
+    void selectPoints(const ScreenSelection & selection, ThreadPool & pool, std::vector<unsigned int> & ids) const;
+
+    /*! Lower corner of the grid. */
+    glm::vec3					m_origin;
+    /*! Edge length of the cubic cells. */
+    float						m_cellSize = 1;
+    /*! Number of cells in x, y and z direction. */
+    unsigned int				m_dims[3] = {0, 0, 0};
+    /*! Index of the first point of each cell in m_points (cell index = x + m_dims[0]*(y + m_dims[1]*z)),
+        with an extra entry at the end holding the number of points.
+    */
+    std::vector<unsigned int>	m_cellStart;
+    /*! Point positions, sorted by cell. */
+    std::vector<glm::vec3>		m_points;
+    /*! Original index of each point in m_points. */
+    std::vector<unsigned int>	m_pointIds;
+};
+
+#endif // POINTGRID_H
@@ -0,0 +1,261 @@
+#include "PointKDTree.h"
+
+#include <algorithm>
+
+#include "ThreadPool.h"
+
+/*! Ranges with up to this many points are not split any further. */
+static const std::size_t KDTREE_LEAF_SIZE = 8;
+/*! Max. depth of the search stack, sufficient for median splits of 2^32 points. */
+static const unsigned int KDTREE_STACK_SIZE = 64;
+/*! Number of blocks per thread in batch queries, for load balancing (queries differ in cost). */
+static const unsigned int KDTREE_QUERY_BLOCKS_PER_THREAD = 8;
+
+/*! Point with its original index, moved as one during the build. */
+struct KDTreePoint {
+    glm::vec3		m_pos;
+    unsigned int	m_id;
+};
+
+
+static inline float distance2(const glm::vec3 & a, const glm::vec3 & b) {
+    glm::vec3 d = a - b;
+    return d.x*d.x + d.y*d.y + d.z*d.z;
+}
+
+
+/*! Splits the range [first, last) at its median along the axis of largest extent, stores the axis and returns
+    false if the range is a leaf.
+*/
+static bool splitRange(std::vector<KDTreePoint> & points, std::vector<unsigned char> & axes, std::size_t first,
+                       std::size_t last)
+{
+    if (last - first <= KDTREE_LEAF_SIZE)
+        return false;
+    glm::vec3 boxMin(FLT_MAX), boxMax(-FLT_MAX);
+    for (std::size_t i=first; i<last; ++i)
+        for (int a=0; a<3; ++a) {
+            boxMin[a] = std::min(boxMin[a], points[i].m_pos[a]);
+            boxMax[a] = std::max(boxMax[a], points[i].m_pos[a]);
+        }
+    const glm::vec3 extent = boxMax - boxMin;
+    unsigned char axis = 0;
+    if (extent.y > extent.x)
+        axis = 1;
+    if (extent.z > extent[axis])
+        axis = 2;
+    const std::size_t mid = first + (last - first)/2;
+    std::nth_element(points.begin() + first, points.begin() + mid, points.begin() + last,
+                     [axis](const KDTreePoint & a, const KDTreePoint & b) { return a.m_pos[axis] < b.m_pos[axis]; });
+    axes[mid] = axis;
+    return true;
+}
+
+
+/*! Builds the entire subtree of the range [first, last). */
+static void buildSubtree(std::vector<KDTreePoint> & points, std::vector<unsigned char> & axes, std::size_t first,
+                         std::size_t last)
+{
+    std::vector<std::pair<std::size_t, std::size_t> > stack(1, std::make_pair(first, last));
+    while (!stack.empty()) {
+        std::pair<std::size_t, std::size_t> r = stack.back();
+        stack.pop_back();
+        if (splitRange(points, axes, r.first, r.second)) {
+            const std::size_t mid = r.first + (r.second - r.first)/2;
+            stack.push_back(std::make_pair(r.first, mid));
+            stack.push_back(std::make_pair(mid + 1, r.second));
+        }
+    }
+}
+
+
+void PointKDTree::build(const glm::vec3 * positions, std::size_t count, ThreadPool & pool) {
+    clear();
+    if (count == 0)
+        return;
+
+    std::vector<KDTreePoint> points(count);
+    pool.parallelFor(count, 0, [&](std::size_t first, std::size_t last, unsigned int) {
+        for (std::size_t i=first; i<last; ++i) {
+            points[i].m_pos = positions[i];
+            points[i].m_id = (unsigned int)i;
+        }
+    });
+    m_splitAxes.assign(count, 0);
+
+    // *** top levels: all ranges of a level are split in parallel, until there are enough ranges for all threads
+    std::vector<std::pair<std::size_t, std::size_t> > ranges(1, std::make_pair(std::size_t(0), count));
+    while (ranges.size() < 4*pool.threadCount()) {
+        std::vector<char> split(ranges.size());
+        pool.run((unsigned int)ranges.size(), [&](unsigned int i) {
+            split[i] = splitRange(points, m_splitAxes, ranges[i].first, ranges[i].second);
+        });
+        std::vector<std::pair<std::size_t, std::size_t> > next;
+        for (std::size_t i=0; i<ranges.size(); ++i)
+            if (split[i]) {
+                const std::size_t mid = ranges[i].first + (ranges[i].second - ranges[i].first)/2;
+                next.push_back(std::make_pair(ranges[i].first, mid));
+                next.push_back(std::make_pair(mid + 1, ranges[i].second));
+            }
+        if (next.empty())
+            break;
+        ranges.swap(next);
+    }
+
+    // *** remaining subtrees, all of similar size
+    pool.run((unsigned int)ranges.size(), [&](unsigned int i) {
+        buildSubtree(points, m_splitAxes, ranges[i].first, ranges[i].second);
+    });
+
+    m_points.resize(count);
+    m_pointIds.resize(count);
+    pool.parallelFor(count, 0, [&](std::size_t first, std::size_t last, unsigned int) {
+        for (std::size_t i=first; i<last; ++i) {
+            m_points[i] = points[i].m_pos;
+            m_pointIds[i] = points[i].m_id;
+        }
+    });
+}
+
+
+void PointKDTree::clear() {
+    m_points.clear();
+    m_pointIds.clear();
+    m_splitAxes.clear();
+}
+
+
+template <typename Visitor>
+void PointKDTree::search(const glm::vec3 & p, float & maxDist2, Visitor visit) const {
+    struct StackEntry {
+        std::size_t	m_first;
+        std::size_t	m_last;
+        /*! Distance of p to the range along each axis, as far as known from the split planes above it. */
+        glm::vec3	m_offset;
+        /*! Squared length of m_offset, a lower bound of the squared distance of p to the points in the range. */
+        float		m_dist2;
+    };
+    StackEntry stack[KDTREE_STACK_SIZE];
+    unsigned int stackSize = 0;
+    stack[stackSize++] = StackEntry{0, m_points.size(), glm::vec3(0.f), 0.f};
+    while (stackSize > 0) {
+        const StackEntry e = stack[--stackSize];
+        if (e.m_dist2 > maxDist2)
+            continue;
+        std::size_t first = e.m_first;
+        std::size_t last = e.m_last;
+        // descend to the leaf containing p, the farther children are searched later
+        while (last - first > KDTREE_LEAF_SIZE) {
+            const std::size_t mid = first + (last - first)/2;
+            visit(mid);
+            const unsigned int axis = m_splitAxes[mid];
+            const float diff = p[axis] - m_points[mid][axis];
+            // the farther child is at least |diff| away along the axis, replacing the previous bound on this axis
+            StackEntry far{0, 0, e.m_offset, 0.f};
+            far.m_offset[axis] = diff;
+            far.m_dist2 = far.m_offset.x*far.m_offset.x + far.m_offset.y*far.m_offset.y + far.m_offset.z*far.m_offset.z;
+            if (diff < 0) {
+                far.m_first = mid + 1;
+                far.m_last = last;
+                last = mid;
+            }
+            else {
+                far.m_first = first;
+                far.m_last = mid;
+                first = mid + 1;
+            }
+            if (far.m_dist2 <= maxDist2)
+                stack[stackSize++] = far;
+        }
+        for (std::size_t i=first; i<last; ++i)
+            visit(i);
+    }
+}
+
+
+bool PointKDTree::nearestNeighbor(const glm::vec3 & p, Neighbor & nearest, const unsigned char * excluded) const {
+    if (empty())
+        return false;
+    bool found = false;
+    float maxDist2 = nearest.m_dist2;
+    search(p, maxDist2, [&](std::size_t i) {
+        const unsigned int id = m_pointIds[i];
+        if (excluded != nullptr && excluded[id] != 0)
+            return;
+        const Neighbor n(distance2(p, m_points[i]), id);
+        if (n.m_dist2 < nearest.m_dist2 || (found && n < nearest)) {
+            nearest = n;
+            maxDist2 = n.m_dist2;
+            found = true;
+        }
+    });
+    return found;
+}
+
+
+void PointKDTree::nearestNeighbors(const glm::vec3 & p, unsigned int k, std::vector<Neighbor> & neighbors,
+                                   float maxDist2, const unsigned char * excluded) const
+{
+    neighbors.clear();
+    if (empty() || k == 0)
+        return;
+    // max-heap of the k nearest points so far, the farthest one on top
+    search(p, maxDist2, [&](std::size_t i) {
+        const unsigned int id = m_pointIds[i];
+        if (excluded != nullptr && excluded[id] != 0)
+            return;
+        const Neighbor n(distance2(p, m_points[i]), id);
+        if (neighbors.size() < k) {
+            if (!(n.m_dist2 < maxDist2))
+                return;
+            neighbors.push_back(n);
+        }
+        else {
+            if (!(n < neighbors.front()))
+                return;
+            std::pop_heap(neighbors.begin(), neighbors.end());
+            neighbors.back() = n;
+        }
+        std::push_heap(neighbors.begin(), neighbors.end());
+        if (neighbors.size() == k)
+            maxDist2 = neighbors.front().m_dist2;
+    });
+    std::sort_heap(neighbors.begin(), neighbors.end());
+}
+
+
+void PointKDTree::radiusSearch(const glm::vec3 & p, float radius, std::vector<Neighbor> & neighbors,
+                               const unsigned char * excluded) const
+{
+    neighbors.clear();
+    if (empty())
+        return;
+    float maxDist2 = radius*radius;
+    const float radius2 = maxDist2;
+    search(p, maxDist2, [&](std::size_t i) {
+        const unsigned int id = m_pointIds[i];
+        if (excluded != nullptr && excluded[id] != 0)
+            return;
+        const float d2 = distance2(p, m_points[i]);
+        if (d2 <= radius2)
+            neighbors.push_back(Neighbor(d2, id));
+    });
+    std::sort(neighbors.begin(), neighbors.end());
+}
+
+
+void PointKDTree::nearestNeighbors(const glm::vec3 * points, std::size_t count, unsigned int k, Neighbor * neighbors,
+                                   ThreadPool & pool, unsigned int blockCount) const
+{
+    if (blockCount == 0)
+        blockCount = KDTREE_QUERY_BLOCKS_PER_THREAD*pool.threadCount();
+    pool.parallelFor(count, blockCount, [&](std::size_t first, std::size_t last, unsigned int) {
+        std::vector<Neighbor> result;
+        result.reserve(k);
+        for (std::size_t i=first; i<last; ++i) {
+            nearestNeighbors(points[i], k, result);
+            std::copy(result.begin(), result.end(), neighbors + i*k);
+            std::fill(neighbors + i*k + result.size(), neighbors + (i + 1)*k, Neighbor());
+        }
+    });
+}
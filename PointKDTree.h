@@ -0,0 +1,87 @@
+#ifndef POINTKDTREE_H
+#define POINTKDTREE_H
+
+#include <cfloat>
+#include <cstddef>
+#include <vector>
+
+#include <glm.hpp>
+
+class ThreadPool;
+
+/*! KD-tree over a point cloud (e.g. the vertexes of a mesh) for nearest neighbor and radius queries.
+
+    The tree has an implicit layout: the points are reordered so that every node is a contiguous range
+    [first, last) of m_points, split at its median point mid = first + (last - first)/2. Points in [first, mid)
+    are not above the median along the split axis, points in [mid + 1, last) are not below. Hence, no node or
+    child pointers are stored, only the split axis of each median point. Ranges of up to KDTREE_LEAF_SIZE
+    points are leaves and are scanned linearly. Near the root the ranges are split one level after
+    another, with the nodes of a level split in parallel, the remaining subtrees are then built in parallel.
+
+    Queries are const and can be run from several threads at once. Points can be skipped with an exclusion mask
+    (indexed by original point index, non-zero = skipped), e.g. points that moved since the tree was built.
+*/
+class PointKDTree {
+public:
+    /*! A point found by a query. */
+    struct Neighbor {
+        Neighbor() : m_dist2(FLT_MAX), m_pointId(~0u) {}
+        Neighbor(float dist2, unsigned int pointId) : m_dist2(dist2), m_pointId(pointId) {}
+
+        /*! Orders neighbors by distance, then by point index. */
+        bool operator<(const Neighbor & other) const {
+            return m_dist2 < other.m_dist2 || (m_dist2 == other.m_dist2 && m_pointId < other.m_pointId);
+        }
+
+        /*! Squared distance to the query point. */
+        float			m_dist2;
+        /*! Index of the point, ~0u if no point was found. */
+        unsigned int	m_pointId;
+    };
+
+    /*! Builds the tree for count points. The positions are copied, so they may be changed or released afterwards. */
+    void build(const glm::vec3 * positions, std::size_t count, ThreadPool & pool);
+
+    void clear();
+    bool empty() const { return m_points.empty(); }
+
+    /*! Finds the point nearest to p with a squared distance below nearest.m_dist2.
+        Returns true and updates nearest if a point was found. Of several points at the same distance, the
+        one with the lowest index is taken.
+    */
+    bool nearestNeighbor(const glm::vec3 & p, Neighbor & nearest, const unsigned char * excluded = nullptr) const;
+
+    /*! Finds the k points nearest to p with a squared distance below maxDist2 and stores them in neighbors,
+        sorted by distance (then by index). neighbors holds fewer than k points, if there are not enough.
+    */
+    void nearestNeighbors(const glm::vec3 & p, unsigned int k, std::vector<Neighbor> & neighbors,
+                          float maxDist2 = FLT_MAX, const unsigned char * excluded = nullptr) const;
+
+    /*! Finds all points within radius around p and stores them in neighbors, sorted by distance (then by index). */
+    void radiusSearch(const glm::vec3 & p, float radius, std::vector<Neighbor> & neighbors,
+                      const unsigned char * excluded = nullptr) const;
+
+    /*! Batch query: finds the k nearest points for count query points, as nearestNeighbors() for each point.
+        The neighbors of query point i are stored in neighbors[i*k .. i*k + k), missing ones as Neighbor().
+        The queries are distributed on the thread pool in blockCount blocks (0 = several blocks per thread),
+        the function must not be called from a task running on that pool.
+    */
+    void nearestNeighbors(const glm::vec3 * points, std::size_t count, unsigned int k, Neighbor * neighbors,
+                          ThreadPool & pool, unsigned int blockCount = 0) const;
+
+    /*! Point positions in tree order. */
+    std::vector<glm::vec3>		m_points;
+    /*! Original index of each point in m_points. */
+    std::vector<unsigned int>	m_pointIds;
+    /*! Split axis (0, 1, 2) of each point, used only for the median points of inner nodes. */
+    std::vector<unsigned char>	m_splitAxes;
+
+private:
+    /*! Visits all points that may be closer than maxDist2 (which the visitor may lower while the search runs),
+        nearer subtrees first.
+    */
+    template <typename Visitor>
+    void search(const glm::vec3 & p, float & maxDist2, Visitor visit) const;
+};
+
+#endif // POINTKDTREE_H
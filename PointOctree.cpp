@@ -0,0 +1,263 @@
+#include "PointOctree.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <queue>
+
+#include "ScreenSelection.h"
+#include "ThreadPool.h"
+
+/*! Max. number of points in a leaf, larger nodes are split. */
+static const std::size_t POINTOCTREE_MAX_LEAF_POINTS = 8192;
+/*! Max. number of points stored in each inner node, at most a quarter of the points of the node are taken,
+    so that the inner nodes add little to the size of m_lodIndexes.
+*/
+static const std::size_t POINTOCTREE_NODE_POINTS = 4096;
+/*! Bits of the Morton code per axis, limits the depth of the octree. */
+static const unsigned int POINTOCTREE_MORTON_BITS = 21;
+
+
+/*! Spreads the lower 21 bits of v so that there are two zero bits between each of them. */
+static inline std::uint64_t expandBits(std::uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffull;
+    v = (v | v << 16) & 0x1f0000ff0000ffull;
+    v = (v | v << 8) & 0x100f00f00f00f00full;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+    v = (v | v << 2) & 0x1249249249249249ull;
+    return v;
+}
+
+
+/*! A point index with the Morton code of the point (x in bit 0, y in bit 1, z in bit 2 of each octal digit). */
+struct MortonPoint {
+    std::uint64_t	m_code;
+    unsigned int	m_index;
+
+    bool operator<(const MortonPoint & other) const {
+        return m_code < other.m_code || (m_code == other.m_code && m_index < other.m_index);
+    }
+};
+
+
+/*! Sorts the points: blocks are sorted in parallel and then merged pairwise, also in parallel. */
+static void parallelSort(std::vector<MortonPoint> & points, ThreadPool & pool) {
+    const std::size_t count = points.size();
+    const unsigned int blockCount = (unsigned int)std::max<std::size_t>(1, std::min<std::size_t>(pool.threadCount(), count));
+    auto blockStart = [count, blockCount](unsigned int block) {
+        return count*std::min(block, blockCount)/blockCount;
+    };
+    pool.parallelFor(blockCount, blockCount, [&](std::size_t first, std::size_t last, unsigned int) {
+        for (std::size_t b=first; b<last; ++b)
+            std::sort(points.begin() + blockStart((unsigned int)b), points.begin() + blockStart((unsigned int)b + 1));
+    });
+    std::vector<MortonPoint> merged(count);
+    for (unsigned int width=1; width<blockCount; width*=2) {
+        const unsigned int pairCount = (blockCount + 2*width - 1)/(2*width);
+        pool.parallelFor(pairCount, pairCount, [&](std::size_t first, std::size_t last, unsigned int) {
+            for (std::size_t p=first; p<last; ++p) {
+                const unsigned int b = (unsigned int)p*2*width;
+                std::merge(points.begin() + blockStart(b), points.begin() + blockStart(b + width),
+                           points.begin() + blockStart(b + width), points.begin() + blockStart(b + 2*width),
+                           merged.begin() + blockStart(b));
+            }
+        });
+        points.swap(merged);
+    }
+}
+
+
+/*! False for points with NaN or infinite coordinates (found in real captures), they are not part of the octree. */
+static inline bool isFinitePoint(const glm::vec3 & p) {
+    return std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z);
+}
+
+void PointOctree::build(const glm::vec3 * positions, std::size_t count, ThreadPool & pool) {
+    clear();
+    if (count == 0)
+        return;
+
+    // *** bounding cube and number of the finite points (all others are skipped)
+    std::vector<glm::vec3> blockMin(pool.threadCount(), glm::vec3(FLT_MAX));
+    std::vector<glm::vec3> blockMax(pool.threadCount(), glm::vec3(-FLT_MAX));
+    std::vector<std::size_t> blockCounts(pool.threadCount(), 0);
+    pool.parallelFor(count, (unsigned int)blockMin.size(), [&](std::size_t first, std::size_t last, unsigned int block) {
+        for (std::size_t i=first; i<last; ++i) {
+            if (!isFinitePoint(positions[i]))
+                continue;
+            blockMin[block] = glm::min(blockMin[block], positions[i]);
+            blockMax[block] = glm::max(blockMax[block], positions[i]);
+            ++blockCounts[block];
+        }
+    });
+    glm::vec3 boxMin(FLT_MAX), boxMax(-FLT_MAX);
+    std::size_t pointCount = 0;
+    for (std::size_t b=0; b<blockMin.size(); ++b) {
+        boxMin = glm::min(boxMin, blockMin[b]);
+        boxMax = glm::max(boxMax, blockMax[b]);
+        pointCount += blockCounts[b];
+    }
+    if (pointCount == 0)
+        return;
+    const glm::vec3 extent = boxMax - boxMin;
+    float size = std::max(extent.x, std::max(extent.y, extent.z));
+    if (size <= 0)
+        size = 1; // all points at the same position
+
+    // *** sort the points along the Morton curve, the skipped points (with the largest code) are removed after
+    // sorting, the codes of the others have 3*POINTOCTREE_MORTON_BITS < 64 bits
+    const float scale = float(1u << POINTOCTREE_MORTON_BITS)/size;
+    const std::uint64_t maxCoord = (1u << POINTOCTREE_MORTON_BITS) - 1;
+    std::vector<MortonPoint> sorted(count);
+    pool.parallelFor(count, 0, [&](std::size_t first, std::size_t last, unsigned int) {
+        for (std::size_t i=first; i<last; ++i) {
+            sorted[i].m_index = (unsigned int)i;
+            if (!isFinitePoint(positions[i])) {
+                sorted[i].m_code = ~std::uint64_t(0);
+                continue;
+            }
+            std::uint64_t code = 0;
+            for (int a=0; a<3; ++a) {
+                const std::uint64_t c = std::min(maxCoord, std::uint64_t(std::max(0.f, (positions[i][a] - boxMin[a])*scale)));
+                code |= expandBits(c) << a;
+            }
+            sorted[i].m_code = code;
+        }
+    });
+    parallelSort(sorted, pool);
+    sorted.resize(pointCount);
+
+    // *** split nodes breadth first, the children of a node are the ranges of its 8 octants (if not empty)
+    struct Range {
+        std::size_t		m_begin;
+        std::size_t		m_end;
+        unsigned int	m_depth;
+    };
+    std::vector<Range> ranges;
+    Node root;
+    root.m_min = boxMin;
+    root.m_max = boxMin + glm::vec3(size);
+    m_nodes.push_back(root);
+    ranges.push_back(Range{0, pointCount, 0});
+    for (std::size_t i=0; i<m_nodes.size(); ++i) {
+        const Range r = ranges[i];
+        if (r.m_end - r.m_begin <= POINTOCTREE_MAX_LEAF_POINTS || r.m_depth == POINTOCTREE_MORTON_BITS)
+            continue;
+        const unsigned int shift = 3*(POINTOCTREE_MORTON_BITS - 1 - r.m_depth);
+        const glm::vec3 nodeMin = m_nodes[i].m_min;
+        const float childSize = 0.5f*(m_nodes[i].m_max.x - nodeMin.x);
+        m_nodes[i].m_firstChild = (unsigned int)m_nodes.size();
+        std::size_t begin = r.m_begin;
+        for (unsigned int octant=0; octant<8 && begin<r.m_end; ++octant) {
+            const std::size_t end = std::size_t(std::partition_point(sorted.begin() + begin, sorted.begin() + r.m_end,
+                                                [shift, octant](const MortonPoint & p) {
+                                                    return ((p.m_code >> shift) & 7) <= octant;
+                                                }) - sorted.begin());
+            if (end == begin)
+                continue;
+            Node child;
+            child.m_min = nodeMin + childSize*glm::vec3(float(octant & 1), float((octant >> 1) & 1), float(octant >> 2));
+            child.m_max = child.m_min + glm::vec3(childSize);
+            m_nodes.push_back(child);
+            ranges.push_back(Range{begin, end, r.m_depth + 1});
+            ++m_nodes[i].m_childCount;
+            begin = end;
+        }
+    }
+
+    // *** node contents: all points of leaves, every k-th point of inner nodes
+    std::size_t lodCount = 0;
+    for (std::size_t i=0; i<m_nodes.size(); ++i) {
+        Node & node = m_nodes[i];
+        const std::size_t n = ranges[i].m_end - ranges[i].m_begin;
+        node.m_first = (unsigned int)lodCount;
+        node.m_count = (unsigned int)(node.m_childCount == 0 ? n : std::min(n/4, POINTOCTREE_NODE_POINTS));
+        node.m_spacing = (node.m_max.x - node.m_min.x)/std::sqrt(float(node.m_count));
+        lodCount += node.m_count;
+    }
+    m_lodIndexes.resize(lodCount);
+    pool.parallelFor(m_nodes.size(), 0, [&](std::size_t first, std::size_t last, unsigned int) {
+        for (std::size_t i=first; i<last; ++i) {
+            const Node & node = m_nodes[i];
+            const std::size_t n = ranges[i].m_end - ranges[i].m_begin;
+            unsigned int * out = m_lodIndexes.data() + node.m_first;
+            for (std::size_t k=0; k<node.m_count; ++k)
+                out[k] = sorted[ranges[i].m_begin + k*n/node.m_count].m_index;
+        }
+    });
+}
+
+
+void PointOctree::clear() {
+    m_nodes.clear();
+    m_lodIndexes.clear();
+}
+
+
+std::size_t PointOctree::selectNodes(const float worldToView[16], float focalLength, float maxScreenError,
+                                     std::size_t maxPoints, std::vector<unsigned int> & nodes) const
+{
+    nodes.clear();
+    if (m_nodes.empty())
+        return 0;
+
+    ScreenSelection frustum;
+    frustum.setRectangle(worldToView, -1, -1, 1, 1);
+    auto visible = [&frustum](const Node & node) {
+        return frustum.classifyBox(node.m_min, node.m_max) != ScreenSelection::OUTSIDE;
+    };
+    // distance between the points of the node in pixels, at the point of the node nearest to the camera
+    // (w of the clip coordinates is the depth in front of the camera)
+    const float * w = worldToView + 12;
+    auto screenError = [w, focalLength](const Node & node) {
+        const glm::vec3 center = 0.5f*(node.m_min + node.m_max);
+        const float depth = w[0]*center.x + w[1]*center.y + w[2]*center.z + w[3] - 0.5f*glm::length(node.m_max - node.m_min);
+        return depth <= 0 ? FLT_MAX : node.m_spacing*focalLength/depth;
+    };
+
+    if (!visible(m_nodes[0]))
+        return 0;
+    std::vector<char> selected(m_nodes.size(), 0);
+    selected[0] = 1;
+    std::size_t pointCount = m_nodes[0].m_count;
+
+    // refine the node with the largest error first
+    typedef std::pair<float, unsigned int> RefinableNode;
+    std::priority_queue<RefinableNode> refinable;
+    if (m_nodes[0].m_childCount != 0)
+        refinable.push(RefinableNode(screenError(m_nodes[0]), 0));
+    while (!refinable.empty()) {
+        const RefinableNode top = refinable.top();
+        refinable.pop();
+        if (top.first <= maxScreenError)
+            break;
+        const Node & node = m_nodes[top.second];
+        unsigned int visibleChildren[8];
+        unsigned int visibleChildCount = 0;
+        std::size_t childPoints = 0;
+        for (unsigned int c=node.m_firstChild; c<node.m_firstChild + node.m_childCount; ++c) {
+            if (visible(m_nodes[c])) {
+                visibleChildren[visibleChildCount++] = c;
+                childPoints += m_nodes[c].m_count;
+            }
+        }
+        // a refinement that exceeds the budget is skipped, smaller ones may still fit
+        if (pointCount - node.m_count + childPoints > maxPoints)
+            continue;
+        pointCount = pointCount - node.m_count + childPoints;
+        selected[top.second] = 0;
+        for (unsigned int i=0; i<visibleChildCount; ++i) {
+            const unsigned int c = visibleChildren[i];
+            selected[c] = 1;
+            if (m_nodes[c].m_childCount != 0)
+                refinable.push(RefinableNode(screenError(m_nodes[c]), c));
+        }
+    }
+
+    for (unsigned int i=0; i<m_nodes.size(); ++i)
+        if (selected[i])
+            nodes.push_back(i);
+    return pointCount;
+}
@@ -0,0 +1,66 @@
+#ifndef POINTOCTREE_H
+#define POINTOCTREE_H
+
+#include <cstddef>
+#include <vector>
+
+#include <glm.hpp>
+
+class ThreadPool;
+
+/*! Level-of-detail octree over a point cloud, so that rendering draws only about as many points as the screen can
+    show, independent of the size of the cloud.
+
+    The points are sorted along a Morton (z-order) curve, so that every octree node covers a contiguous range of
+    the sorted points. Nodes with more than POINTOCTREE_MAX_LEAF_POINTS points are split. Each inner node stores a
+    representative subset of its points (every k-th point along the curve, which is spread evenly over the space of
+    the node), each leaf stores all of its points. The node contents are stored as point indexes in m_lodIndexes,
+    one contiguous range per node, so that a node is drawn with a single glDrawElements() call on the vertex buffer
+    holding the points in their original order (and the point ids stay the same).
+
+    selectNodes() finds the nodes to draw for a view: starting with the root, the visible node with the largest
+    screen-space error (distance between its points projected to pixels) is replaced by its visible children, until
+    the error is below the threshold everywhere or the next refinement would exceed the point budget.
+*/
+class PointOctree {
+public:
+    /*! A node of the octree. */
+    struct Node {
+        /*! Bounding cube of the node. */
+        glm::vec3		m_min;
+        glm::vec3		m_max;
+        /*! Index of the first child in m_nodes (the children of a node are stored contiguously), 0 for leaves. */
+        unsigned int	m_firstChild = 0;
+        unsigned int	m_childCount = 0;
+        /*! Range of the points of the node in m_lodIndexes. */
+        unsigned int	m_first = 0;
+        unsigned int	m_count = 0;
+        /*! Average distance between the points of the node (assuming they sample a surface). */
+        float			m_spacing = 0;
+    };
+
+    /*! Builds the octree over the count points in parallel on the thread pool.
+        The positions are not copied and not needed afterwards. Points with NaN or infinite coordinates are
+        skipped (never drawn).
+    */
+    void build(const glm::vec3 * positions, std::size_t count, ThreadPool & pool);
+
+    void clear();
+    bool empty() const { return m_nodes.empty(); }
+
+    /*! Selects the nodes to draw for the world to view matrix worldToView (row-major, as returned by
+        QMatrix4x4::copyDataTo()). focalLength is the projection scale in pixels (half viewport height /
+        tan(half vertical field of view)). Nodes are refined while their screen-space error is larger than
+        maxScreenError pixels and the total number of points stays below maxPoints. Stores the indexes of the
+        selected nodes in nodes and returns their total number of points.
+    */
+    std::size_t selectNodes(const float worldToView[16], float focalLength, float maxScreenError, std::size_t maxPoints,
+                            std::vector<unsigned int> & nodes) const;
+
+    /*! All nodes, the root is m_nodes[0]. */
+    std::vector<Node>			m_nodes;
+    /*! Point indexes of all nodes, see Node::m_first. */
+    std::vector<unsigned int>	m_lodIndexes;
+};
+
+#endif // POINTOCTREE_H
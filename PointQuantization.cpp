@@ -0,0 +1,39 @@
+#include "PointQuantization.h"
+
+#include <algorithm>
+#include <cmath>
+
+/*! Largest quantized coordinate. */
+static const float QUANTIZATION_MAX = 65535.f;
+
+
+PointQuantization PointQuantization::fromBounds(const glm::vec3 & boxMin, const glm::vec3 & boxMax) {
+    PointQuantization q;
+    q.m_origin = boxMin;
+    for (int a=0; a<3; ++a) {
+        const float extent = boxMax[a] - boxMin[a];
+        q.m_scale[a] = extent > 0 ? extent/QUANTIZATION_MAX : 1.f; // flat box: all points at q = 0
+    }
+    return q;
+}
+
+
+QuantizedPosition PointQuantization::quantize(const glm::vec3 & p) const {
+    const glm::vec3 c = (p - m_origin)/m_scale;
+    auto toUint16 = [](float f) {
+        return std::uint16_t(std::min(QUANTIZATION_MAX, std::max(0.f, std::round(f))));
+    };
+    return QuantizedPosition{ toUint16(c.x), toUint16(c.y), toUint16(c.z) };
+}
+
+
+void PointQuantization::quantize(const glm::vec3 * points, std::size_t count, QuantizedPosition * out) const {
+    for (std::size_t i=0; i<count; ++i)
+        out[i] = quantize(points[i]);
+}
+
+
+void PointQuantization::snap(glm::vec3 * points, std::size_t count) const {
+    for (std::size_t i=0; i<count; ++i)
+        points[i] = dequantize(quantize(points[i]));
+}
@@ -0,0 +1,347 @@
+#include "PointTileFile.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#include "BackgroundLoader.h"
+#include "PlyReader.h"
+#include "ThreadPool.h"
+
+static const char POINTTILES_MAGIC[8] = { 'V', 'P', 'T', 'I', 'L', 'E', 'S', '\0' };
+/*! Increase whenever the layout of the header or the content of the data sections changes. */
+static const std::uint32_t POINTTILES_VERSION = 1;
+
+/*! Max. number of grid cells (including empty ones), limits the size of the counters while building. */
+static const std::size_t POINTTILES_MAX_CELLS = 1 << 20;
+/*! Number of points decoded from the source file per block while building. */
+static const std::size_t POINTTILES_READ_BLOCK = 1 << 20;
+
+static_assert(sizeof(glm::vec3) == 3*sizeof(float), "glm::vec3 must be tightly packed");
+static_assert(sizeof(PointTileFile::Tile) == 40, "PointTileFile::Tile is stored in the file and must not change");
+
+/*! Rounds up to the next multiple of 16. */
+static inline std::uint64_t align16(std::uint64_t offset) {
+    return (offset + 15) & ~std::uint64_t(15);
+}
+
+
+/*! True if count items of itemSize bytes at offset fit into a file of fileSize bytes, without overflow for corrupt
+    header values.
+*/
+static inline bool sectionInFile(std::uint64_t offset, std::uint64_t count, std::uint64_t itemSize, std::uint64_t fileSize) {
+    return offset <= fileSize && (itemSize == 0 || count <= (fileSize - offset)/itemSize);
+}
+
+
+/*! False for points with NaN or infinite coordinates (found in real captures), they are not tiled. */
+static inline bool isFinitePoint(const glm::vec3 & p) {
+    return std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z);
+}
+
+
+/*! The uniform grid the points are sorted into. */
+struct TileGrid {
+    glm::vec3		m_origin;
+    float			m_cellSize;
+    unsigned int	m_dims[3];
+
+    unsigned int cellIndex(const glm::vec3 & p) const {
+        unsigned int c[3];
+        for (int a=0; a<3; ++a) {
+            const float f = (p[a] - m_origin[a])/m_cellSize;
+            c[a] = f <= 0 ? 0u : std::min(m_dims[a] - 1, (unsigned int)f);
+        }
+        return (c[2]*m_dims[1] + c[1])*m_dims[0] + c[0];
+    }
+};
+
+
+/*! Memory maps a PLY file and parses its header, throws on error. */
+class MappedPlyFile {
+public:
+    explicit MappedPlyFile(const QString & filePath) : m_file(filePath) {
+        if (!m_file.open(QIODevice::ReadOnly) || m_file.size() == 0)
+            throw "ERROR::PLYLOADER::Could not open file.";
+        m_data = m_file.map(0, m_file.size());
+        if (m_data == nullptr)
+            throw "ERROR::PLYLOADER::Could not map file.";
+        std::string errorMsg;
+        if (!parsePlyHeader(begin(), end(), m_header, errorMsg)) {
+            qWarning() << "Error reading" << filePath << ":" << QString::fromStdString(errorMsg);
+            throw "ERROR::PLYLOADER::Invalid PLY header.";
+        }
+        m_vertexElementIdx = m_header.elementIndex("vertex");
+        if (m_vertexElementIdx == -1)
+            throw "ERROR::PLYLOADER::PLY file has no vertex element.";
+    }
+    ~MappedPlyFile() {
+        m_file.unmap(m_data);
+    }
+
+    const char * begin() const { return reinterpret_cast<const char *>(m_data); }
+    const char * end() const { return begin() + m_file.size(); }
+    std::size_t vertexCount() const { return m_header.m_elements[m_vertexElementIdx].m_count; }
+
+    /*! Decodes x, y, z of all vertexes in blocks on pool, see readPlyElementBlocks(). Throws on error or
+        cancellation.
+    */
+    void readPositions(ThreadPool & pool, const std::function<bool(const glm::vec3 *, std::size_t, std::size_t)> & consumer) const {
+        std::string errorMsg;
+        bool success = readPlyElementBlocks(begin(), end(), m_header, m_vertexElementIdx, {"x", "y", "z"},
+                                            pool, POINTTILES_READ_BLOCK,
+                                            [&consumer](const float * values, std::size_t first, std::size_t count) {
+                                                return consumer(reinterpret_cast<const glm::vec3 *>(values), first, count);
+                                            }, errorMsg);
+        if (!success) {
+            qWarning() << "Error reading" << m_file.fileName() << ":" << QString::fromStdString(errorMsg);
+            throw "ERROR::PLYLOADER::Could not read vertex data.";
+        }
+    }
+
+private:
+    QFile		m_file;
+    uchar		*m_data = nullptr;
+    PlyHeader	m_header;
+    int			m_vertexElementIdx = -1;
+};
+
+
+QString PointTileFile::tileFilePath(const QString & sourceFilePath) {
+    return sourceFilePath + ".vptiles";
+}
+
+
+void PointTileFile::build(const QString & sourceFilePath, BackgroundLoader * loader, float pointsPerTile) {
+    QElapsedTimer buildTimer;
+    buildTimer.start();
+
+    Header header;
+    std::memset(&header, 0, sizeof(Header));
+    if (!MeshCache::computeKey(sourceFilePath, header.m_key))
+        throw "ERROR::PLYLOADER::Could not open file.";
+
+    MappedPlyFile source(sourceFilePath);
+    const std::size_t count = source.vertexCount();
+    // a background build must not hold the global pool, which the picks of the GUI thread use
+    ThreadPool & pool = loader != nullptr ? loader->pool() : ThreadPool::globalInstance();
+    auto progress = [loader, count](const char * stage, std::size_t done) {
+        return loader == nullptr || loader->postProgress(stage, float(done)/std::max<std::size_t>(1, count));
+    };
+
+    // *** pass 1: bounding box and number of the finite points (all others are skipped)
+    std::vector<glm::vec3> blockMin(pool.threadCount());
+    std::vector<glm::vec3> blockMax(pool.threadCount());
+    std::vector<std::size_t> blockCounts(pool.threadCount());
+    glm::vec3 boxMin(FLT_MAX), boxMax(-FLT_MAX);
+    std::size_t pointCount = 0;
+    source.readPositions(pool, [&](const glm::vec3 * points, std::size_t first, std::size_t n) {
+        std::fill(blockMin.begin(), blockMin.end(), glm::vec3(FLT_MAX));
+        std::fill(blockMax.begin(), blockMax.end(), glm::vec3(-FLT_MAX));
+        std::fill(blockCounts.begin(), blockCounts.end(), 0);
+        pool.parallelFor(n, (unsigned int)blockMin.size(), [&](std::size_t begin, std::size_t end, unsigned int block) {
+            for (std::size_t i=begin; i<end; ++i) {
+                if (!isFinitePoint(points[i]))
+                    continue;
+                blockMin[block] = glm::min(blockMin[block], points[i]);
+                blockMax[block] = glm::max(blockMax[block], points[i]);
+                ++blockCounts[block];
+            }
+        });
+        for (std::size_t b=0; b<blockMin.size(); ++b) {
+            boxMin = glm::min(boxMin, blockMin[b]);
+            boxMax = glm::max(boxMax, blockMax[b]);
+            pointCount += blockCounts[b];
+        }
+        return progress("Tiling points: bounding box", first + n);
+    });
+    if (pointCount == 0)
+        boxMin = boxMax = glm::vec3(0);
+    if (pointCount < count)
+        qWarning() << "Skipped" << count - pointCount << "points with non-finite coordinates in" << sourceFilePath;
+
+    // *** grid dimensions, cubic cells with about pointsPerTile points per cell (see PointGrid::build())
+    TileGrid grid;
+    glm::vec3 extent = boxMax - boxMin;
+    float maxExtent = std::max(extent.x, std::max(extent.y, extent.z));
+    if (maxExtent <= 0)
+        maxExtent = 1; // all points at the same position
+    for (int a=0; a<3; ++a)
+        extent[a] = std::max(extent[a], maxExtent*1e-3f);
+    std::size_t targetCells = std::min(std::max<std::size_t>(1, std::size_t(pointCount/pointsPerTile)), POINTTILES_MAX_CELLS);
+    grid.m_cellSize = std::cbrt(extent.x*extent.y*extent.z/targetCells);
+    std::size_t cellCount;
+    for (;;) {
+        cellCount = 1;
+        for (int a=0; a<3; ++a) {
+            grid.m_dims[a] = std::max(1u, (unsigned int)std::ceil(extent[a]/grid.m_cellSize));
+            cellCount *= grid.m_dims[a];
+        }
+        if (cellCount <= POINTTILES_MAX_CELLS)
+            break;
+        grid.m_cellSize *= 1.25f; // rounding up of the dimensions exceeded the limit
+    }
+    grid.m_origin = boxMin;
+
+    // *** pass 2: points per cell, counted per thread
+    std::vector<std::vector<std::uint64_t> > threadCounts(pool.threadCount(), std::vector<std::uint64_t>(cellCount, 0));
+    source.readPositions(pool, [&](const glm::vec3 * points, std::size_t first, std::size_t n) {
+        pool.parallelFor(n, (unsigned int)threadCounts.size(), [&](std::size_t begin, std::size_t end, unsigned int block) {
+            std::vector<std::uint64_t> & counts = threadCounts[block];
+            for (std::size_t i=begin; i<end; ++i)
+                if (isFinitePoint(points[i]))
+                    ++counts[grid.cellIndex(points[i])];
+        });
+        return progress("Tiling points: counting", first + n);
+    });
+
+    // non-empty cells become the tiles, with their points in cell order
+    std::vector<unsigned int> cellTiles(cellCount, ~0u);
+    std::vector<Tile> tiles;
+    std::uint64_t pointIdx = 0;
+    for (std::size_t c=0; c<cellCount; ++c) {
+        std::uint64_t n = 0;
+        for (const std::vector<std::uint64_t> & counts : threadCounts)
+            n += counts[c];
+        if (n == 0)
+            continue;
+        cellTiles[c] = (unsigned int)tiles.size();
+        Tile t;
+        t.m_min = glm::vec3(FLT_MAX);
+        t.m_max = glm::vec3(-FLT_MAX);
+        t.m_firstPoint = pointIdx;
+        t.m_pointCount = n;
+        tiles.push_back(t);
+        pointIdx += n;
+    }
+    threadCounts.clear();
+
+    std::memcpy(header.m_magic, POINTTILES_MAGIC, sizeof(POINTTILES_MAGIC));
+    header.m_version = POINTTILES_VERSION;
+    header.m_headerSize = sizeof(Header);
+    header.m_pointCount = pointCount;
+    header.m_tileCount = tiles.size();
+    header.m_tableOffset = align16(sizeof(Header));
+    header.m_pointOffset = align16(header.m_tableOffset + tiles.size()*sizeof(Tile));
+    for (int a=0; a<3; ++a) {
+        header.m_boundsMin[a] = boxMin[a];
+        header.m_boundsMax[a] = boxMax[a];
+        header.m_dims[a] = grid.m_dims[a];
+    }
+    const std::uint64_t fileSize = header.m_pointOffset + std::uint64_t(pointCount)*sizeof(glm::vec3);
+
+    // *** pass 3: scatter the points into the mapped (temporary) tile file, the OS writes back the dirty pages
+    const QString filePath = tileFilePath(sourceFilePath);
+    QFile out(filePath + ".tmp");
+    if (!out.open(QIODevice::ReadWrite | QIODevice::Truncate) || !out.resize(qint64(fileSize)))
+        throw "ERROR::PLYLOADER::Could not write tile file.";
+    uchar * outData = out.map(0, qint64(fileSize));
+    if (outData == nullptr) {
+        out.remove();
+        throw "ERROR::PLYLOADER::Could not map tile file.";
+    }
+    glm::vec3 * outPoints = reinterpret_cast<glm::vec3 *>(outData + header.m_pointOffset);
+    std::vector<std::uint64_t> cursors(tiles.size());
+    for (std::size_t t=0; t<tiles.size(); ++t)
+        cursors[t] = tiles[t].m_firstPoint;
+    std::vector<unsigned int> pointTiles;
+    try {
+        source.readPositions(pool, [&](const glm::vec3 * points, std::size_t first, std::size_t n) {
+            pointTiles.resize(n);
+            pool.parallelFor(n, 0, [&](std::size_t begin, std::size_t end, unsigned int) {
+                for (std::size_t i=begin; i<end; ++i)
+                    pointTiles[i] = isFinitePoint(points[i]) ? cellTiles[grid.cellIndex(points[i])] : ~0u;
+            });
+            for (std::size_t i=0; i<n; ++i) {
+                if (pointTiles[i] == ~0u)
+                    continue;
+                Tile & t = tiles[pointTiles[i]];
+                t.m_min = glm::min(t.m_min, points[i]);
+                t.m_max = glm::max(t.m_max, points[i]);
+                outPoints[cursors[pointTiles[i]]++] = points[i];
+            }
+            return progress("Tiling points: sorting", first + n);
+        });
+    }
+    catch (...) {
+        out.unmap(outData);
+        out.remove();
+        throw;
+    }
+    std::memcpy(outData, &header, sizeof(Header));
+    std::memcpy(outData + header.m_tableOffset, tiles.data(), tiles.size()*sizeof(Tile));
+    out.unmap(outData);
+    out.close();
+
+    // replace an outdated tile file
+    QFile::remove(filePath);
+    if (!out.rename(filePath)) {
+        out.remove();
+        throw "ERROR::PLYLOADER::Could not write tile file.";
+    }
+
+    qDebug() << "Tile file with" << tiles.size() << "tiles (" << grid.m_dims[0] << "x" << grid.m_dims[1] << "x"
+             << grid.m_dims[2] << "cells) for" << pointCount << "points built in" << buildTimer.elapsed() << "ms";
+}
+
+
+bool PointTileFile::open(const QString & sourceFilePath) {
+    close();
+
+    m_file.setFileName(tileFilePath(sourceFilePath));
+    if (!m_file.exists() || !m_file.open(QIODevice::ReadOnly))
+        return false;
+
+    Header header;
+    MeshCache::Key key;
+    const qint64 fileSize = m_file.size();
+    bool valid = m_file.read(reinterpret_cast<char *>(&header), sizeof(Header)) == qint64(sizeof(Header)) &&
+            std::memcmp(header.m_magic, POINTTILES_MAGIC, sizeof(POINTTILES_MAGIC)) == 0 &&
+            header.m_version == POINTTILES_VERSION &&
+            header.m_headerSize == sizeof(Header) &&
+            sectionInFile(header.m_tableOffset, header.m_tileCount, sizeof(Tile), std::uint64_t(fileSize)) &&
+            sectionInFile(header.m_pointOffset, header.m_pointCount, sizeof(glm::vec3), std::uint64_t(fileSize)) &&
+            MeshCache::computeKey(sourceFilePath, key) &&
+            std::memcmp(&header.m_key, &key, sizeof(MeshCache::Key)) == 0;
+    if (valid) {
+        m_tiles.resize(std::size_t(header.m_tileCount));
+        const qint64 tableSize = qint64(m_tiles.size()*sizeof(Tile));
+        valid = m_file.seek(qint64(header.m_tableOffset)) &&
+                m_file.read(reinterpret_cast<char *>(m_tiles.data()), tableSize) == tableSize;
+        // the points of each tile must be within the points of the file
+        for (const Tile & t : m_tiles)
+            valid = valid && t.m_firstPoint <= header.m_pointCount && t.m_pointCount <= header.m_pointCount - t.m_firstPoint;
+    }
+    if (!valid) {
+        qDebug() << "Tile file" << m_file.fileName() << "is outdated or invalid.";
+        close();
+        return false;
+    }
+    m_pointOffset = header.m_pointOffset;
+    m_pointCount = std::size_t(header.m_pointCount);
+    m_boundsMin = glm::vec3(header.m_boundsMin[0], header.m_boundsMin[1], header.m_boundsMin[2]);
+    m_boundsMax = glm::vec3(header.m_boundsMax[0], header.m_boundsMax[1], header.m_boundsMax[2]);
+    return true;
+}
+
+
+void PointTileFile::close() {
+    m_file.close();
+    m_tiles.clear();
+    m_pointOffset = 0;
+    m_pointCount = 0;
+}
+
+
+bool PointTileFile::readTile(unsigned int tileIdx, std::vector<glm::vec3> & points) {
+    Q_ASSERT(isOpen() && tileIdx < m_tiles.size());
+    const Tile & t = m_tiles[tileIdx];
+    points.resize(std::size_t(t.m_pointCount));
+    const qint64 size = qint64(points.size()*sizeof(glm::vec3));
+    return m_file.seek(qint64(m_pointOffset + t.m_firstPoint*sizeof(glm::vec3))) &&
+            m_file.read(reinterpret_cast<char *>(points.data()), size) == size;
+}
@@ -0,0 +1,109 @@
+#ifndef POINTTILEFILE_H
+#define POINTTILEFILE_H
+
+#include <QFile>
+#include <QString>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm.hpp>
+
+#include "MeshCache.h"
+
+class BackgroundLoader;
+
+/*! A binary sidecar file (file extension .vptiles) holding the points of a PLY file sorted into spatial tiles,
+    for out-of-core rendering of point clouds that do not fit into memory (see PointCloudStreamer).
+
+    The tiles are the non-empty cells of a uniform grid over the bounding box of the cloud, with about
+    pointsPerTile points per cell (the same sizing as PointGrid). The points of each tile are stored contiguously,
+    so that a tile is read with a single read() and uploaded with a single buffer upload. A point is identified by
+    its index in the tile file (Tile::m_firstPoint + index in tile), i.e. in tile order, not in PLY order.
+
+    The file is keyed like MeshCache (path, size, modification time and sampled content of the source file), an
+    outdated tile file is rebuilt by build().
+
+    File layout (native byte order, all sections 16-byte aligned):
+    \code
+    Header | tile table (tileCount*Tile) | points (pointCount*float3, grouped by tile)
+    \endcode
+*/
+class PointTileFile {
+public:
+    /*! Entry of the tile table. */
+    struct Tile {
+        /*! Bounding box of the points in the tile. */
+        glm::vec3		m_min;
+        glm::vec3		m_max;
+        /*! Index of the first point of the tile in the file, the points of a tile are contiguous. */
+        std::uint64_t	m_firstPoint;
+        std::uint64_t	m_pointCount;
+    };
+
+    PointTileFile() {}
+    ~PointTileFile() { close(); }
+
+    PointTileFile(const PointTileFile &) = delete;
+    PointTileFile & operator=(const PointTileFile &) = delete;
+
+    /*! Returns path of the tile file for a source file (source path + ".vptiles"). */
+    static QString tileFilePath(const QString & sourceFilePath);
+
+    /*! Sorts the vertex positions of the PLY file into tiles and writes the tile file. The source file is read in
+        blocks (three passes: bounds, points per tile, points), so that neither the source nor the tiled points
+        have to fit into memory. The file is written under a temporary name and renamed when complete.
+        Points with NaN or infinite coordinates are skipped.
+        If loader is given, progress is posted to it and the build returns early when it is cancelled.
+        Throws a const char * error message on failure (like the loaders).
+    */
+    static void build(const QString & sourceFilePath, BackgroundLoader * loader, float pointsPerTile = 65536);
+
+    /*! Opens the tile file of the source file and reads the tile table.
+        Returns false, if there is no tile file, or if it does not match the current source file (key mismatch),
+        or if its format is not compatible.
+    */
+    bool open(const QString & sourceFilePath);
+
+    /*! Closes the tile file, the tile table is cleared. */
+    void close();
+
+    bool isOpen() const { return m_file.isOpen(); }
+
+    /*! Reads the points of tile tileIdx into points (resized accordingly), returns false on a read error.
+        Mind: not thread-save, only one thread may read tiles at a time.
+    */
+    bool readTile(unsigned int tileIdx, std::vector<glm::vec3> & points);
+
+    const std::vector<Tile> & tiles() const { return m_tiles; }
+    std::size_t pointCount() const { return m_pointCount; }
+    const glm::vec3 & boundsMin() const { return m_boundsMin; }
+    const glm::vec3 & boundsMax() const { return m_boundsMax; }
+
+private:
+    /*! Header at the start of the tile file. */
+    struct Header {
+        char			m_magic[8];
+        std::uint32_t	m_version;
+        std::uint32_t	m_headerSize;
+        MeshCache::Key	m_key;
+        std::uint64_t	m_pointCount;
+        std::uint64_t	m_tileCount;
+        std::uint64_t	m_tableOffset;
+        std::uint64_t	m_pointOffset;
+        float			m_boundsMin[3];
+        float			m_boundsMax[3];
+        std::uint32_t	m_dims[3];
+        std::uint32_t	m_padding;
+    };
+
+    QFile				m_file;
+    std::vector<Tile>	m_tiles;
+    std::uint64_t		m_pointOffset = 0;
+    std::size_t			m_pointCount = 0;
+    glm::vec3			m_boundsMin;
+    glm::vec3			m_boundsMax;
+};
+
+#endif // POINTTILEFILE_H
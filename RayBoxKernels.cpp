@@ -0,0 +1,270 @@
+#include "RayBoxKernels.h"
+
+#include <algorithm>
+
+#if defined(SIMD_X86)
+    #include <immintrin.h>
+#endif
+
+#include "BoxSet.h"
+
+// Mind: min/max operands are ordered as in std::min(a, b) = b < a ? b : a and std::max(a, b) = a < b ? b : a,
+// i.e. _mm_min_ps(b, a) and _mm_max_ps(b, a), so that all kernels also treat NaN (0*inf) identically.
+
+RayBoxRay::RayBoxRay(float px, float py, float pz, float dx, float dy, float dz) {
+    m_origin[0] = px;
+    m_origin[1] = py;
+    m_origin[2] = pz;
+    // division by zero yields +-inf, which is handled correctly by the slab test
+    m_invDir[0] = 1.f/dx;
+    m_invDir[1] = 1.f/dy;
+    m_invDir[2] = 1.f/dz;
+}
+
+
+static void nearestRayBoxHitScalar(const BoxSet & boxes, std::size_t first, std::size_t last,
+                                   const RayBoxRay & ray, RayBoxHit & hit)
+{
+    const float * cx = boxes.m_centerX.data();
+    const float * cy = boxes.m_centerY.data();
+    const float * cz = boxes.m_centerZ.data();
+    const float * hx = boxes.m_halfExtentX.data();
+    const float * hy = boxes.m_halfExtentY.data();
+    const float * hz = boxes.m_halfExtentZ.data();
+    const unsigned short * orientation = boxes.m_orientation.data();
+    for (std::size_t i=first; i<last; ++i) {
+        if (orientation[i] != 0)
+            continue;
+        // line origin in box coordinates
+        const float px = ray.m_origin[0] - cx[i];
+        const float py = ray.m_origin[1] - cy[i];
+        const float pz = ray.m_origin[2] - cz[i];
+        const float tx1 = (-hx[i] - px)*ray.m_invDir[0], tx2 = (hx[i] - px)*ray.m_invDir[0];
+        const float ty1 = (-hy[i] - py)*ray.m_invDir[1], ty2 = (hy[i] - py)*ray.m_invDir[1];
+        const float tz1 = (-hz[i] - pz)*ray.m_invDir[2], tz2 = (hz[i] - pz)*ray.m_invDir[2];
+        const float txMin = std::min(tx1, tx2), txMax = std::max(tx1, tx2);
+        const float tyMin = std::min(ty1, ty2), tyMax = std::max(ty1, ty2);
+        const float tzMin = std::min(tz1, tz2), tzMax = std::max(tz1, tz2);
+        const float tEnter = std::max(txMin, std::max(tyMin, tzMin));
+        const float tExit = std::min(txMax, std::min(tyMax, tzMax));
+        // only hits from outside and within [0..1] count, like in intersectsRect()
+        if (tEnter <= tExit && tEnter >= 0 && tEnter <= 1 && tEnter < hit.m_dist) {
+            hit.m_dist = tEnter;
+            hit.m_boxId = (unsigned int)i;
+            hit.m_axis = tEnter == txMin ? 0 : (tEnter == tyMin ? 1 : 2);
+        }
+    }
+}
+
+
+/*! Merges the per-lane hits of a SIMD kernel into hit (lowest box index wins for equal distances). */
+static void reduceLanes(const float * dist, const int * boxId, const int * axis, unsigned int laneCount, RayBoxHit & hit) {
+    for (unsigned int l=0; l<laneCount; ++l) {
+        if (boxId[l] == -1)
+            continue;
+        if (dist[l] < hit.m_dist || (dist[l] == hit.m_dist && (unsigned int)boxId[l] < hit.m_boxId)) {
+            hit.m_dist = dist[l];
+            hit.m_boxId = (unsigned int)boxId[l];
+            hit.m_axis = (unsigned int)axis[l];
+        }
+    }
+}
+
+
+#if defined(SIMD_X86)
+
+/*! SSE2 kernel, 4 boxes per iteration. */
+static void nearestRayBoxHitSSE(const BoxSet & boxes, std::size_t first, std::size_t last,
+                                const RayBoxRay & ray, RayBoxHit & hit)
+{
+    const float * cx = boxes.m_centerX.data();
+    const float * cy = boxes.m_centerY.data();
+    const float * cz = boxes.m_centerZ.data();
+    const float * hx = boxes.m_halfExtentX.data();
+    const float * hy = boxes.m_halfExtentY.data();
+    const float * hz = boxes.m_halfExtentZ.data();
+    const unsigned short * orientation = boxes.m_orientation.data();
+
+    const __m128 ox = _mm_set1_ps(ray.m_origin[0]);
+    const __m128 oy = _mm_set1_ps(ray.m_origin[1]);
+    const __m128 oz = _mm_set1_ps(ray.m_origin[2]);
+    const __m128 invDx = _mm_set1_ps(ray.m_invDir[0]);
+    const __m128 invDy = _mm_set1_ps(ray.m_invDir[1]);
+    const __m128 invDz = _mm_set1_ps(ray.m_invDir[2]);
+    const __m128 signMask = _mm_set1_ps(-0.f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128i axisX = _mm_setzero_si128();
+    const __m128i axisY = _mm_set1_epi32(1);
+    const __m128i axisZ = _mm_set1_epi32(2);
+    const __m128i four = _mm_set1_epi32(4);
+
+    __m128 bestDist = _mm_set1_ps(hit.m_dist);
+    __m128i bestBox = _mm_set1_epi32(-1);
+    __m128i bestAxis = _mm_setzero_si128();
+    __m128i boxId = _mm_setr_epi32(int(first), int(first + 1), int(first + 2), int(first + 3));
+
+    std::size_t i = first;
+    for (; i + 4 <= last; i += 4, boxId = _mm_add_epi32(boxId, four)) {
+        // only axis-aligned boxes (orientation index 0)
+        __m128i orient = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(orientation + i)),
+                                            _mm_setzero_si128());
+        __m128 aligned = _mm_castsi128_ps(_mm_cmpeq_epi32(orient, _mm_setzero_si128()));
+
+        __m128 px = _mm_sub_ps(ox, _mm_loadu_ps(cx + i));
+        __m128 py = _mm_sub_ps(oy, _mm_loadu_ps(cy + i));
+        __m128 pz = _mm_sub_ps(oz, _mm_loadu_ps(cz + i));
+        __m128 ex = _mm_loadu_ps(hx + i);
+        __m128 ey = _mm_loadu_ps(hy + i);
+        __m128 ez = _mm_loadu_ps(hz + i);
+        __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_xor_ps(ex, signMask), px), invDx);
+        __m128 tx2 = _mm_mul_ps(_mm_sub_ps(ex, px), invDx);
+        __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_xor_ps(ey, signMask), py), invDy);
+        __m128 ty2 = _mm_mul_ps(_mm_sub_ps(ey, py), invDy);
+        __m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_xor_ps(ez, signMask), pz), invDz);
+        __m128 tz2 = _mm_mul_ps(_mm_sub_ps(ez, pz), invDz);
+        __m128 txMin = _mm_min_ps(tx2, tx1), txMax = _mm_max_ps(tx2, tx1);
+        __m128 tyMin = _mm_min_ps(ty2, ty1), tyMax = _mm_max_ps(ty2, ty1);
+        __m128 tzMin = _mm_min_ps(tz2, tz1), tzMax = _mm_max_ps(tz2, tz1);
+        __m128 tEnter = _mm_max_ps(_mm_max_ps(tzMin, tyMin), txMin);
+        __m128 tExit = _mm_min_ps(_mm_min_ps(tzMax, tyMax), txMax);
+
+        __m128 mask = _mm_and_ps(aligned, _mm_cmple_ps(tEnter, tExit));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(tEnter, zero));
+        mask = _mm_and_ps(mask, _mm_cmple_ps(tEnter, one));
+        mask = _mm_and_ps(mask, _mm_cmplt_ps(tEnter, bestDist));
+        if (_mm_movemask_ps(mask) == 0)
+            continue;
+
+        // axis = tEnter == txMin ? 0 : (tEnter == tyMin ? 1 : 2)
+        __m128i isX = _mm_castps_si128(_mm_cmpeq_ps(tEnter, txMin));
+        __m128i isY = _mm_castps_si128(_mm_cmpeq_ps(tEnter, tyMin));
+        __m128i axis = _mm_or_si128(_mm_and_si128(isY, axisY), _mm_andnot_si128(isY, axisZ));
+        axis = _mm_or_si128(_mm_and_si128(isX, axisX), _mm_andnot_si128(isX, axis));
+
+        __m128i maskI = _mm_castps_si128(mask);
+        bestDist = _mm_or_ps(_mm_and_ps(mask, tEnter), _mm_andnot_ps(mask, bestDist));
+        bestBox = _mm_or_si128(_mm_and_si128(maskI, boxId), _mm_andnot_si128(maskI, bestBox));
+        bestAxis = _mm_or_si128(_mm_and_si128(maskI, axis), _mm_andnot_si128(maskI, bestAxis));
+    }
+
+    alignas(16) float dist[4];
+    alignas(16) int box[4];
+    alignas(16) int axis[4];
+    _mm_store_ps(dist, bestDist);
+    _mm_store_si128(reinterpret_cast<__m128i *>(box), bestBox);
+    _mm_store_si128(reinterpret_cast<__m128i *>(axis), bestAxis);
+    reduceLanes(dist, box, axis, 4, hit);
+
+    // remaining boxes
+    nearestRayBoxHitScalar(boxes, i, last, ray, hit);
+}
+
+
+/*! AVX2 kernel, 8 boxes per iteration. */
+SIMD_TARGET_AVX2
+static void nearestRayBoxHitAVX2(const BoxSet & boxes, std::size_t first, std::size_t last,
+                                 const RayBoxRay & ray, RayBoxHit & hit)
+{
+    const float * cx = boxes.m_centerX.data();
+    const float * cy = boxes.m_centerY.data();
+    const float * cz = boxes.m_centerZ.data();
+    const float * hx = boxes.m_halfExtentX.data();
+    const float * hy = boxes.m_halfExtentY.data();
+    const float * hz = boxes.m_halfExtentZ.data();
+    const unsigned short * orientation = boxes.m_orientation.data();
+
+    const __m256 ox = _mm256_set1_ps(ray.m_origin[0]);
+    const __m256 oy = _mm256_set1_ps(ray.m_origin[1]);
+    const __m256 oz = _mm256_set1_ps(ray.m_origin[2]);
+    const __m256 invDx = _mm256_set1_ps(ray.m_invDir[0]);
+    const __m256 invDy = _mm256_set1_ps(ray.m_invDir[1]);
+    const __m256 invDz = _mm256_set1_ps(ray.m_invDir[2]);
+    const __m256 signMask = _mm256_set1_ps(-0.f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256i axisX = _mm256_setzero_si256();
+    const __m256i axisY = _mm256_set1_epi32(1);
+    const __m256i axisZ = _mm256_set1_epi32(2);
+    const __m256i eight = _mm256_set1_epi32(8);
+
+    __m256 bestDist = _mm256_set1_ps(hit.m_dist);
+    __m256i bestBox = _mm256_set1_epi32(-1);
+    __m256i bestAxis = _mm256_setzero_si256();
+    __m256i boxId = _mm256_add_epi32(_mm256_set1_epi32(int(first)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+
+    std::size_t i = first;
+    for (; i + 8 <= last; i += 8, boxId = _mm256_add_epi32(boxId, eight)) {
+        // only axis-aligned boxes (orientation index 0)
+        __m256i orient = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(orientation + i)));
+        __m256 aligned = _mm256_castsi256_ps(_mm256_cmpeq_epi32(orient, _mm256_setzero_si256()));
+
+        __m256 px = _mm256_sub_ps(ox, _mm256_loadu_ps(cx + i));
+        __m256 py = _mm256_sub_ps(oy, _mm256_loadu_ps(cy + i));
+        __m256 pz = _mm256_sub_ps(oz, _mm256_loadu_ps(cz + i));
+        __m256 ex = _mm256_loadu_ps(hx + i);
+        __m256 ey = _mm256_loadu_ps(hy + i);
+        __m256 ez = _mm256_loadu_ps(hz + i);
+        __m256 tx1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_xor_ps(ex, signMask), px), invDx);
+        __m256 tx2 = _mm256_mul_ps(_mm256_sub_ps(ex, px), invDx);
+        __m256 ty1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_xor_ps(ey, signMask), py), invDy);
+        __m256 ty2 = _mm256_mul_ps(_mm256_sub_ps(ey, py), invDy);
+        __m256 tz1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_xor_ps(ez, signMask), pz), invDz);
+        __m256 tz2 = _mm256_mul_ps(_mm256_sub_ps(ez, pz), invDz);
+        __m256 txMin = _mm256_min_ps(tx2, tx1), txMax = _mm256_max_ps(tx2, tx1);
+        __m256 tyMin = _mm256_min_ps(ty2, ty1), tyMax = _mm256_max_ps(ty2, ty1);
+        __m256 tzMin = _mm256_min_ps(tz2, tz1), tzMax = _mm256_max_ps(tz2, tz1);
+        __m256 tEnter = _mm256_max_ps(_mm256_max_ps(tzMin, tyMin), txMin);
+        __m256 tExit = _mm256_min_ps(_mm256_min_ps(tzMax, tyMax), txMax);
+
+        __m256 mask = _mm256_and_ps(aligned, _mm256_cmp_ps(tEnter, tExit, _CMP_LE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(tEnter, zero, _CMP_GE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(tEnter, one, _CMP_LE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(tEnter, bestDist, _CMP_LT_OQ));
+        if (_mm256_movemask_ps(mask) == 0)
+            continue;
+
+        // axis = tEnter == txMin ? 0 : (tEnter == tyMin ? 1 : 2)
+        __m256i isX = _mm256_castps_si256(_mm256_cmp_ps(tEnter, txMin, _CMP_EQ_OQ));
+        __m256i isY = _mm256_castps_si256(_mm256_cmp_ps(tEnter, tyMin, _CMP_EQ_OQ));
+        __m256i axis = _mm256_blendv_epi8(axisZ, axisY, isY);
+        axis = _mm256_blendv_epi8(axis, axisX, isX);
+
+        __m256i maskI = _mm256_castps_si256(mask);
+        bestDist = _mm256_blendv_ps(bestDist, tEnter, mask);
+        bestBox = _mm256_blendv_epi8(bestBox, boxId, maskI);
+        bestAxis = _mm256_blendv_epi8(bestAxis, axis, maskI);
+    }
+
+    alignas(32) float dist[8];
+    alignas(32) int box[8];
+    alignas(32) int axis[8];
+    _mm256_store_ps(dist, bestDist);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(box), bestBox);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(axis), bestAxis);
+    reduceLanes(dist, box, axis, 8, hit);
+
+    // remaining boxes
+    nearestRayBoxHitScalar(boxes, i, last, ray, hit);
+}
+
+#endif // SIMD_X86
+
+
+void nearestRayBoxHit(const BoxSet & boxes, std::size_t first, std::size_t last, const RayBoxRay & ray,
+                      RayBoxHit & hit, SimdLevel level)
+{
+    Q_ASSERT(last <= boxes.size());
+    // box indexes are handled as 32-bit ints in the SIMD kernels
+    Q_ASSERT(last <= 0x7fffffff);
+#if defined(SIMD_X86)
+    switch (level) {
+        case SIMD_AVX2	: nearestRayBoxHitAVX2(boxes, first, last, ray, hit); return;
+        case SIMD_SSE	: nearestRayBoxHitSSE(boxes, first, last, ray, hit); return;
+        default			: break;
+    }
+#else
+    (void)level;
+#endif
+    nearestRayBoxHitScalar(boxes, first, last, ray, hit);
+}
@@ -0,0 +1,41 @@
+#ifndef RAYBOXKERNELS_H
+#define RAYBOXKERNELS_H
+
+#include <cstddef>
+
+#include "SimdSupport.h"
+
+class BoxSet;
+
+/*! Line "p + t*d" in the form needed by the slab test. */
+struct RayBoxRay {
+    RayBoxRay(float px, float py, float pz, float dx, float dy, float dz);
+
+    float m_origin[3];
+    /*! 1/d per component, +-inf for components that are 0. */
+    float m_invDir[3];
+};
+
+/*! Closest hit found by nearestRayBoxHit(). */
+struct RayBoxHit {
+    RayBoxHit(float dist) : m_dist(dist), m_boxId(~0u), m_axis(0) {}
+
+    /*! Normalized distance of the hit, only hits closer than the initial value are accepted. */
+    float			m_dist;
+    /*! Index of box hit, ~0u if there was no hit. */
+    unsigned int	m_boxId;
+    /*! Axis (0 = x, 1 = y, 2 = z) of the slab that was entered, determines the face. */
+    unsigned int	m_axis;
+};
+
+/*! Tests the axis-aligned boxes with indexes [first, last) of the box set (boxes with an orientation are skipped)
+    against the ray with a slab test and updates hit, if a box is entered from outside at 0 <= t <= 1 and closer
+    than hit.m_dist. Of several boxes hit at the same distance, the one with the lowest index is taken.
+
+    The AVX2 (8 boxes per iteration) and SSE (4 boxes per iteration) kernels read the structure-of-arrays data of
+    the box set directly and return exactly the same results as the scalar kernel.
+*/
+void nearestRayBoxHit(const BoxSet & boxes, std::size_t first, std::size_t last, const RayBoxRay & ray,
+                      RayBoxHit & hit, SimdLevel level);
+
+#endif // RAYBOXKERNELS_H
@@ -0,0 +1,340 @@
+#include "RayPacketKernels.h"
+
+#include <algorithm>
+#include <cfloat>
+
+#if defined(SIMD_X86)
+    #include <immintrin.h>
+#endif
+
+// Mind: the kernels evaluate the same operations in the same order as the single ray code, i.e. the slab test
+// of MeshBVH and intersectTriangleEdges(), hence each ray gets the same result as when traced on its own.
+// std::min(a, b) returns (b < a) ? b : a, which is _mm_min_ps(b, a), and std::max(a, b) returns
+// (a < b) ? b : a, which is _mm_max_ps(b, a), so NaN values are passed on in the same way.
+
+static unsigned int packetIntersectBoxScalar(const RayPacket & packet, const float boxMin[3], const float boxMax[3],
+                                             unsigned int laneMask, float * tEnter)
+{
+    unsigned int hitMask = 0;
+    for (unsigned int l=0; l<RAY_PACKET_SIZE; ++l) {
+        float enter = FLT_MAX;
+        if (laneMask & (1u << l)) {
+            float t1 = (boxMin[0] - packet.m_ox[l])*packet.m_invDx[l], t2 = (boxMax[0] - packet.m_ox[l])*packet.m_invDx[l];
+            float tMin = std::min(t1, t2), tMax = std::max(t1, t2);
+            t1 = (boxMin[1] - packet.m_oy[l])*packet.m_invDy[l];
+            t2 = (boxMax[1] - packet.m_oy[l])*packet.m_invDy[l];
+            tMin = std::max(tMin, std::min(t1, t2));
+            tMax = std::min(tMax, std::max(t1, t2));
+            t1 = (boxMin[2] - packet.m_oz[l])*packet.m_invDz[l];
+            t2 = (boxMax[2] - packet.m_oz[l])*packet.m_invDz[l];
+            tMin = std::max(tMin, std::min(t1, t2));
+            tMax = std::min(tMax, std::max(t1, t2));
+            if (tMax >= tMin && tMax >= 0.f && tMin < packet.m_dist[l]) {
+                hitMask |= 1u << l;
+                enter = tMin;
+            }
+        }
+        if (tEnter != nullptr)
+            tEnter[l] = enter;
+    }
+    return hitMask;
+}
+
+
+static void packetRayTriangleHitsScalar(const TriangleSoA & triangles, std::size_t first, std::size_t last,
+                                        RayPacket & packet, unsigned int laneMask)
+{
+    for (unsigned int l=0; l<RAY_PACKET_SIZE; ++l) {
+        if ((laneMask & (1u << l)) == 0)
+            continue;
+        const glm::vec3 origin(packet.m_ox[l], packet.m_oy[l], packet.m_oz[l]);
+        const glm::vec3 dir(packet.m_dx[l], packet.m_dy[l], packet.m_dz[l]);
+        for (std::size_t i=first; i<last; ++i) {
+            const glm::vec3 v0(triangles.m_v0x[i], triangles.m_v0y[i], triangles.m_v0z[i]);
+            const glm::vec3 e1(triangles.m_e1x[i], triangles.m_e1y[i], triangles.m_e1z[i]);
+            const glm::vec3 e2(triangles.m_e2x[i], triangles.m_e2y[i], triangles.m_e2z[i]);
+            float t, u, v;
+            if (intersectTriangleEdges(origin, dir, v0, e1, e2, packet.m_dist[l], t, u, v)) {
+                packet.m_dist[l] = t;
+                packet.m_triangle[l] = int(i);
+                packet.m_u[l] = u;
+                packet.m_v[l] = v;
+            }
+        }
+    }
+}
+
+
+#if defined(SIMD_X86)
+
+/*! Lane masks of 4 lanes as SSE masks. */
+static inline __m128 laneMaskSSE(unsigned int laneMask) {
+    const __m128i bits = _mm_setr_epi32(1, 2, 4, 8);
+    return _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(int(laneMask)), bits), bits));
+}
+
+
+/*! SSE2 kernels, the packet is processed in two halves of 4 rays, halves without active ray are skipped. */
+static unsigned int packetIntersectBoxSSE(const RayPacket & packet, const float boxMin[3], const float boxMax[3],
+                                          unsigned int laneMask, float * tEnter)
+{
+    unsigned int hitMask = 0;
+    for (unsigned int h=0; h<RAY_PACKET_SIZE; h += 4) {
+        const unsigned int halfMask = (laneMask >> h) & 0xf;
+        if (halfMask == 0) {
+            if (tEnter != nullptr)
+                _mm_storeu_ps(tEnter + h, _mm_set1_ps(FLT_MAX));
+            continue;
+        }
+        const __m128 ox = _mm_load_ps(packet.m_ox + h);
+        const __m128 oy = _mm_load_ps(packet.m_oy + h);
+        const __m128 oz = _mm_load_ps(packet.m_oz + h);
+        const __m128 ix = _mm_load_ps(packet.m_invDx + h);
+        const __m128 iy = _mm_load_ps(packet.m_invDy + h);
+        const __m128 iz = _mm_load_ps(packet.m_invDz + h);
+
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boxMin[0]), ox), ix);
+        __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boxMax[0]), ox), ix);
+        __m128 tMin = _mm_min_ps(t2, t1);
+        __m128 tMax = _mm_max_ps(t2, t1);
+        t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boxMin[1]), oy), iy);
+        t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boxMax[1]), oy), iy);
+        tMin = _mm_max_ps(_mm_min_ps(t2, t1), tMin);
+        tMax = _mm_min_ps(_mm_max_ps(t2, t1), tMax);
+        t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boxMin[2]), oz), iz);
+        t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boxMax[2]), oz), iz);
+        tMin = _mm_max_ps(_mm_min_ps(t2, t1), tMin);
+        tMax = _mm_min_ps(_mm_max_ps(t2, t1), tMax);
+
+        __m128 mask = _mm_and_ps(_mm_cmpge_ps(tMax, tMin), _mm_cmpge_ps(tMax, _mm_setzero_ps()));
+        mask = _mm_and_ps(mask, _mm_cmplt_ps(tMin, _mm_load_ps(packet.m_dist + h)));
+        mask = _mm_and_ps(mask, laneMaskSSE(halfMask));
+        hitMask |= unsigned(_mm_movemask_ps(mask)) << h;
+        if (tEnter != nullptr)
+            _mm_storeu_ps(tEnter + h, _mm_or_ps(_mm_and_ps(mask, tMin), _mm_andnot_ps(mask, _mm_set1_ps(FLT_MAX))));
+    }
+    return hitMask;
+}
+
+
+static void packetRayTriangleHitsSSE(const TriangleSoA & triangles, std::size_t first, std::size_t last,
+                                     RayPacket & packet, unsigned int laneMask)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+    for (unsigned int h=0; h<RAY_PACKET_SIZE; h += 4) {
+        const unsigned int halfMask = (laneMask >> h) & 0xf;
+        if (halfMask == 0)
+            continue;
+        const __m128 active = laneMaskSSE(halfMask);
+        const __m128 ox = _mm_load_ps(packet.m_ox + h);
+        const __m128 oy = _mm_load_ps(packet.m_oy + h);
+        const __m128 oz = _mm_load_ps(packet.m_oz + h);
+        const __m128 dx = _mm_load_ps(packet.m_dx + h);
+        const __m128 dy = _mm_load_ps(packet.m_dy + h);
+        const __m128 dz = _mm_load_ps(packet.m_dz + h);
+        __m128 bestDist = _mm_load_ps(packet.m_dist + h);
+        __m128i bestTriangle = _mm_load_si128(reinterpret_cast<const __m128i *>(packet.m_triangle + h));
+        __m128 bestU = _mm_load_ps(packet.m_u + h);
+        __m128 bestV = _mm_load_ps(packet.m_v + h);
+
+        for (std::size_t i=first; i<last; ++i) {
+            const __m128 e1x = _mm_set1_ps(triangles.m_e1x[i]);
+            const __m128 e1y = _mm_set1_ps(triangles.m_e1y[i]);
+            const __m128 e1z = _mm_set1_ps(triangles.m_e1z[i]);
+            const __m128 e2x = _mm_set1_ps(triangles.m_e2x[i]);
+            const __m128 e2y = _mm_set1_ps(triangles.m_e2y[i]);
+            const __m128 e2z = _mm_set1_ps(triangles.m_e2z[i]);
+
+            // p = cross(dir, e2), det = dot(e1, p)
+            __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(e2y, dz));
+            __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(e2z, dx));
+            __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(e2x, dy));
+            __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+            __m128 mask = _mm_and_ps(_mm_cmpneq_ps(det, zero), active);
+            if (_mm_movemask_ps(mask) == 0)
+                continue;
+            __m128 invDet = _mm_div_ps(one, det);
+
+            // s = origin - v0, u = dot(s, p)/det
+            __m128 sx = _mm_sub_ps(ox, _mm_set1_ps(triangles.m_v0x[i]));
+            __m128 sy = _mm_sub_ps(oy, _mm_set1_ps(triangles.m_v0y[i]));
+            __m128 sz = _mm_sub_ps(oz, _mm_set1_ps(triangles.m_v0z[i]));
+            __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+            mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+            if (_mm_movemask_ps(mask) == 0)
+                continue;
+
+            // q = cross(s, e1), v = dot(dir, q)/det, t = dot(e2, q)/det
+            __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(e1y, sz));
+            __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(e1z, sx));
+            __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(e1x, sy));
+            __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+            mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+            __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+            mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(t, zero), _mm_cmplt_ps(t, bestDist)));
+            if (_mm_movemask_ps(mask) == 0)
+                continue;
+
+            __m128i maskI = _mm_castps_si128(mask);
+            bestDist = _mm_or_ps(_mm_and_ps(mask, t), _mm_andnot_ps(mask, bestDist));
+            bestTriangle = _mm_or_si128(_mm_and_si128(maskI, _mm_set1_epi32(int(i))), _mm_andnot_si128(maskI, bestTriangle));
+            bestU = _mm_or_ps(_mm_and_ps(mask, u), _mm_andnot_ps(mask, bestU));
+            bestV = _mm_or_ps(_mm_and_ps(mask, v), _mm_andnot_ps(mask, bestV));
+        }
+
+        _mm_store_ps(packet.m_dist + h, bestDist);
+        _mm_store_si128(reinterpret_cast<__m128i *>(packet.m_triangle + h), bestTriangle);
+        _mm_store_ps(packet.m_u + h, bestU);
+        _mm_store_ps(packet.m_v + h, bestV);
+    }
+}
+
+
+/*! Lane masks of 8 lanes as AVX mask. */
+SIMD_TARGET_AVX2
+static inline __m256 laneMaskAVX2(unsigned int laneMask) {
+    const __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    return _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(int(laneMask)), bits), bits));
+}
+
+
+/*! AVX2 kernels, the whole packet per instruction. */
+SIMD_TARGET_AVX2
+static unsigned int packetIntersectBoxAVX2(const RayPacket & packet, const float boxMin[3], const float boxMax[3],
+                                           unsigned int laneMask, float * tEnter)
+{
+    const __m256 ox = _mm256_load_ps(packet.m_ox);
+    const __m256 oy = _mm256_load_ps(packet.m_oy);
+    const __m256 oz = _mm256_load_ps(packet.m_oz);
+    const __m256 ix = _mm256_load_ps(packet.m_invDx);
+    const __m256 iy = _mm256_load_ps(packet.m_invDy);
+    const __m256 iz = _mm256_load_ps(packet.m_invDz);
+
+    __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(boxMin[0]), ox), ix);
+    __m256 t2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(boxMax[0]), ox), ix);
+    __m256 tMin = _mm256_min_ps(t2, t1);
+    __m256 tMax = _mm256_max_ps(t2, t1);
+    t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(boxMin[1]), oy), iy);
+    t2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(boxMax[1]), oy), iy);
+    tMin = _mm256_max_ps(_mm256_min_ps(t2, t1), tMin);
+    tMax = _mm256_min_ps(_mm256_max_ps(t2, t1), tMax);
+    t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(boxMin[2]), oz), iz);
+    t2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(boxMax[2]), oz), iz);
+    tMin = _mm256_max_ps(_mm256_min_ps(t2, t1), tMin);
+    tMax = _mm256_min_ps(_mm256_max_ps(t2, t1), tMax);
+
+    __m256 mask = _mm256_and_ps(_mm256_cmp_ps(tMax, tMin, _CMP_GE_OQ), _mm256_cmp_ps(tMax, _mm256_setzero_ps(), _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(tMin, _mm256_load_ps(packet.m_dist), _CMP_LT_OQ));
+    mask = _mm256_and_ps(mask, laneMaskAVX2(laneMask));
+    if (tEnter != nullptr)
+        _mm256_storeu_ps(tEnter, _mm256_blendv_ps(_mm256_set1_ps(FLT_MAX), tMin, mask));
+    return unsigned(_mm256_movemask_ps(mask));
+}
+
+
+SIMD_TARGET_AVX2
+static void packetRayTriangleHitsAVX2(const TriangleSoA & triangles, std::size_t first, std::size_t last,
+                                      RayPacket & packet, unsigned int laneMask)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 active = laneMaskAVX2(laneMask);
+    const __m256 ox = _mm256_load_ps(packet.m_ox);
+    const __m256 oy = _mm256_load_ps(packet.m_oy);
+    const __m256 oz = _mm256_load_ps(packet.m_oz);
+    const __m256 dx = _mm256_load_ps(packet.m_dx);
+    const __m256 dy = _mm256_load_ps(packet.m_dy);
+    const __m256 dz = _mm256_load_ps(packet.m_dz);
+    __m256 bestDist = _mm256_load_ps(packet.m_dist);
+    __m256i bestTriangle = _mm256_load_si256(reinterpret_cast<const __m256i *>(packet.m_triangle));
+    __m256 bestU = _mm256_load_ps(packet.m_u);
+    __m256 bestV = _mm256_load_ps(packet.m_v);
+
+    for (std::size_t i=first; i<last; ++i) {
+        const __m256 e1x = _mm256_set1_ps(triangles.m_e1x[i]);
+        const __m256 e1y = _mm256_set1_ps(triangles.m_e1y[i]);
+        const __m256 e1z = _mm256_set1_ps(triangles.m_e1z[i]);
+        const __m256 e2x = _mm256_set1_ps(triangles.m_e2x[i]);
+        const __m256 e2y = _mm256_set1_ps(triangles.m_e2y[i]);
+        const __m256 e2z = _mm256_set1_ps(triangles.m_e2z[i]);
+
+        // p = cross(dir, e2), det = dot(e1, p)
+        __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(e2y, dz));
+        __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(e2z, dx));
+        __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(e2x, dy));
+        __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+        __m256 mask = _mm256_and_ps(_mm256_cmp_ps(det, zero, _CMP_NEQ_UQ), active);
+        if (_mm256_movemask_ps(mask) == 0)
+            continue;
+        __m256 invDet = _mm256_div_ps(one, det);
+
+        // s = origin - v0, u = dot(s, p)/det
+        __m256 sx = _mm256_sub_ps(ox, _mm256_set1_ps(triangles.m_v0x[i]));
+        __m256 sy = _mm256_sub_ps(oy, _mm256_set1_ps(triangles.m_v0y[i]));
+        __m256 sz = _mm256_sub_ps(oz, _mm256_set1_ps(triangles.m_v0z[i]));
+        __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)),
+                                               _mm256_mul_ps(sz, pz)), invDet);
+        mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+        if (_mm256_movemask_ps(mask) == 0)
+            continue;
+
+        // q = cross(s, e1), v = dot(dir, q)/det, t = dot(e2, q)/det
+        __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(e1y, sz));
+        __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(e1z, sx));
+        __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(e1x, sy));
+        __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)),
+                                               _mm256_mul_ps(dz, qz)), invDet);
+        mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ),
+                                                 _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+        __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)),
+                                               _mm256_mul_ps(e2z, qz)), invDet);
+        mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(t, zero, _CMP_GE_OQ), _mm256_cmp_ps(t, bestDist, _CMP_LT_OQ)));
+        if (_mm256_movemask_ps(mask) == 0)
+            continue;
+
+        bestDist = _mm256_blendv_ps(bestDist, t, mask);
+        bestTriangle = _mm256_blendv_epi8(bestTriangle, _mm256_set1_epi32(int(i)), _mm256_castps_si256(mask));
+        bestU = _mm256_blendv_ps(bestU, u, mask);
+        bestV = _mm256_blendv_ps(bestV, v, mask);
+    }
+
+    _mm256_store_ps(packet.m_dist, bestDist);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(packet.m_triangle), bestTriangle);
+    _mm256_store_ps(packet.m_u, bestU);
+    _mm256_store_ps(packet.m_v, bestV);
+}
+
+#endif // SIMD_X86
+
+
+unsigned int packetIntersectBox(const RayPacket & packet, const float boxMin[3], const float boxMax[3],
+                                unsigned int laneMask, float * tEnter, SimdLevel level)
+{
+#if defined(SIMD_X86)
+    switch (level) {
+        case SIMD_AVX2	: return packetIntersectBoxAVX2(packet, boxMin, boxMax, laneMask, tEnter);
+        case SIMD_SSE	: return packetIntersectBoxSSE(packet, boxMin, boxMax, laneMask, tEnter);
+        default			: break;
+    }
+#else
+    (void)level;
+#endif
+    return packetIntersectBoxScalar(packet, boxMin, boxMax, laneMask, tEnter);
+}
+
+
+void packetRayTriangleHits(const TriangleSoA & triangles, std::size_t first, std::size_t last, RayPacket & packet,
+                           unsigned int laneMask, SimdLevel level)
+{
+#if defined(SIMD_X86)
+    switch (level) {
+        case SIMD_AVX2	: packetRayTriangleHitsAVX2(triangles, first, last, packet, laneMask); return;
+        case SIMD_SSE	: packetRayTriangleHitsSSE(triangles, first, last, packet, laneMask); return;
+        default			: break;
+    }
+#else
+    (void)level;
+#endif
+    packetRayTriangleHitsScalar(triangles, first, last, packet, laneMask);
+}
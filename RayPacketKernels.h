@@ -0,0 +1,68 @@
+#ifndef RAYPACKETKERNELS_H
+#define RAYPACKETKERNELS_H
+
+#include <cstddef>
+
+#include <glm.hpp>
+
+#include "RayTriangleKernels.h"
+#include "SimdSupport.h"
+
+/*! Number of rays in a RayPacket, one AVX2 vector (or two SSE vectors). */
+const unsigned int RAY_PACKET_SIZE = 8;
+
+/*! A packet of rays "origin + t*dir" together with their nearest hits so far, stored as structure of arrays
+    so that the packet kernels process one ray per SIMD lane.
+
+    Rays are selected with lane masks (bit i = ray i), lanes not in the mask are never changed.
+*/
+struct alignas(32) RayPacket {
+    /*! Stores ray i, hits must be closer than tMax. */
+    void setRay(unsigned int i, const glm::vec3 & origin, const glm::vec3 & dir, float tMax) {
+        m_ox[i] = origin.x;
+        m_oy[i] = origin.y;
+        m_oz[i] = origin.z;
+        m_dx[i] = dir.x;
+        m_dy[i] = dir.y;
+        m_dz[i] = dir.z;
+        // same reciprocal as in the single ray traversal of MeshBVH
+        m_invDx[i] = 1.f/dir.x;
+        m_invDy[i] = 1.f/dir.y;
+        m_invDz[i] = 1.f/dir.z;
+        m_dist[i] = tMax;
+        m_triangle[i] = -1;
+        m_u[i] = 0;
+        m_v[i] = 0;
+    }
+
+    float	m_ox[RAY_PACKET_SIZE], m_oy[RAY_PACKET_SIZE], m_oz[RAY_PACKET_SIZE];
+    float	m_dx[RAY_PACKET_SIZE], m_dy[RAY_PACKET_SIZE], m_dz[RAY_PACKET_SIZE];
+    float	m_invDx[RAY_PACKET_SIZE], m_invDy[RAY_PACKET_SIZE], m_invDz[RAY_PACKET_SIZE];
+    /*! Distance of the nearest hit so far (or the initial max. distance). */
+    float	m_dist[RAY_PACKET_SIZE];
+    /*! Index of the triangle hit (in the TriangleSoA), -1 if no triangle was hit yet. */
+    int		m_triangle[RAY_PACKET_SIZE];
+    /*! Barycentric coordinates of the hit point, weights of vertex 1 and 2. */
+    float	m_u[RAY_PACKET_SIZE];
+    float	m_v[RAY_PACKET_SIZE];
+};
+
+/*! Slab test of the rays in laneMask against the axis-aligned box. Returns the mask of rays that hit the box
+    at an entry distance below their m_dist, and stores the entry distances in tEnter (FLT_MAX for rays not hit),
+    if tEnter is not null.
+
+    Each ray gets exactly the result of the single ray test of MeshBVH (same operations, same NaN handling).
+*/
+unsigned int packetIntersectBox(const RayPacket & packet, const float boxMin[3], const float boxMax[3],
+                                unsigned int laneMask, float * tEnter, SimdLevel level);
+
+/*! Tests the triangles with indexes [first, last) against the rays in laneMask and updates their hits, if a
+    triangle is hit at 0 <= t < m_dist. Triangles are tested in ascending order, so of several triangles hit at
+    the same distance the one with the lowest index is taken.
+
+    Each ray gets exactly the result of nearestRayTriangleHit() for the same triangles.
+*/
+void packetRayTriangleHits(const TriangleSoA & triangles, std::size_t first, std::size_t last, RayPacket & packet,
+                           unsigned int laneMask, SimdLevel level);
+
+#endif // RAYPACKETKERNELS_H
@@ -0,0 +1,250 @@
+#include "RayTriangleKernels.h"
+
+#include <QtGlobal>
+
+#if defined(SIMD_X86)
+    #include <immintrin.h>
+#endif
+
+// Mind: all kernels evaluate the same products, sums and differences in the same order as glm::cross() and
+// glm::dot() in intersectTriangleEdges() (no fused multiply-add, exact division), hence results are identical.
+
+void TriangleSoA::resize(std::size_t count) {
+    std::vector<float> * arrays[9] = { &m_v0x, &m_v0y, &m_v0z, &m_e1x, &m_e1y, &m_e1z, &m_e2x, &m_e2y, &m_e2z };
+    for (std::vector<float> * a : arrays) {
+        a->resize(count);
+        a->resize(count + TRIANGLE_SOA_PADDING, 0.f);
+    }
+    m_size = count;
+}
+
+
+void TriangleSoA::clear() {
+    std::vector<float> * arrays[9] = { &m_v0x, &m_v0y, &m_v0z, &m_e1x, &m_e1y, &m_e1z, &m_e2x, &m_e2y, &m_e2z };
+    for (std::vector<float> * a : arrays) {
+        a->clear();
+        a->shrink_to_fit();
+    }
+    m_size = 0;
+}
+
+
+static void nearestRayTriangleHitScalar(const TriangleSoA & triangles, std::size_t first, std::size_t last,
+                                        const glm::vec3 & origin, const glm::vec3 & dir, RayTriangleHit & hit)
+{
+    for (std::size_t i=first; i<last; ++i) {
+        const glm::vec3 v0(triangles.m_v0x[i], triangles.m_v0y[i], triangles.m_v0z[i]);
+        const glm::vec3 e1(triangles.m_e1x[i], triangles.m_e1y[i], triangles.m_e1z[i]);
+        const glm::vec3 e2(triangles.m_e2x[i], triangles.m_e2y[i], triangles.m_e2z[i]);
+        float t, u, v;
+        if (intersectTriangleEdges(origin, dir, v0, e1, e2, hit.m_dist, t, u, v)) {
+            hit.m_dist = t;
+            hit.m_triangle = (unsigned int)i;
+            hit.m_u = u;
+            hit.m_v = v;
+        }
+    }
+}
+
+
+/*! Merges the per-lane hits of a SIMD kernel into hit (lowest triangle index wins for equal distances). */
+static void reduceLanes(const float * dist, const int * triangle, const float * u, const float * v,
+                        unsigned int laneCount, RayTriangleHit & hit)
+{
+    for (unsigned int l=0; l<laneCount; ++l) {
+        if (triangle[l] == -1)
+            continue;
+        if (dist[l] < hit.m_dist || (dist[l] == hit.m_dist && (unsigned int)triangle[l] < hit.m_triangle)) {
+            hit.m_dist = dist[l];
+            hit.m_triangle = (unsigned int)triangle[l];
+            hit.m_u = u[l];
+            hit.m_v = v[l];
+        }
+    }
+}
+
+
+#if defined(SIMD_X86)
+
+/*! SSE2 kernel, 4 triangles per iteration. The last iteration reads into the padding of the arrays and masks
+    out the lanes beyond last, so that short ranges (BVH leaves) are vectorized as well.
+*/
+static void nearestRayTriangleHitSSE(const TriangleSoA & triangles, std::size_t first, std::size_t last,
+                                     const glm::vec3 & origin, const glm::vec3 & dir, RayTriangleHit & hit)
+{
+    const __m128 ox = _mm_set1_ps(origin.x);
+    const __m128 oy = _mm_set1_ps(origin.y);
+    const __m128 oz = _mm_set1_ps(origin.z);
+    const __m128 dx = _mm_set1_ps(dir.x);
+    const __m128 dy = _mm_set1_ps(dir.y);
+    const __m128 dz = _mm_set1_ps(dir.z);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128i laneOffset = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128i four = _mm_set1_epi32(4);
+
+    __m128 bestDist = _mm_set1_ps(hit.m_dist);
+    __m128i bestTriangle = _mm_set1_epi32(-1);
+    __m128 bestU = _mm_setzero_ps();
+    __m128 bestV = _mm_setzero_ps();
+    __m128i triangleId = _mm_add_epi32(_mm_set1_epi32(int(first)), laneOffset);
+    const __m128i lastId = _mm_set1_epi32(int(last));
+
+    for (std::size_t i = first; i < last; i += 4, triangleId = _mm_add_epi32(triangleId, four)) {
+        __m128 e1x = _mm_loadu_ps(triangles.m_e1x.data() + i);
+        __m128 e1y = _mm_loadu_ps(triangles.m_e1y.data() + i);
+        __m128 e1z = _mm_loadu_ps(triangles.m_e1z.data() + i);
+        __m128 e2x = _mm_loadu_ps(triangles.m_e2x.data() + i);
+        __m128 e2y = _mm_loadu_ps(triangles.m_e2y.data() + i);
+        __m128 e2z = _mm_loadu_ps(triangles.m_e2z.data() + i);
+
+        // p = cross(dir, e2), det = dot(e1, p)
+        __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(e2y, dz));
+        __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(e2z, dx));
+        __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(e2x, dy));
+        __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+        // lanes beyond last hold padding (or other triangles' data) and are excluded
+        __m128 mask = _mm_and_ps(_mm_cmpneq_ps(det, zero), _mm_castsi128_ps(_mm_cmplt_epi32(triangleId, lastId)));
+        if (_mm_movemask_ps(mask) == 0)
+            continue;
+        __m128 invDet = _mm_div_ps(one, det);
+
+        // s = origin - v0, u = dot(s, p)/det
+        __m128 sx = _mm_sub_ps(ox, _mm_loadu_ps(triangles.m_v0x.data() + i));
+        __m128 sy = _mm_sub_ps(oy, _mm_loadu_ps(triangles.m_v0y.data() + i));
+        __m128 sz = _mm_sub_ps(oz, _mm_loadu_ps(triangles.m_v0z.data() + i));
+        __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+        mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+
+        // q = cross(s, e1), v = dot(dir, q)/det, t = dot(e2, q)/det
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(e1y, sz));
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(e1z, sx));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(e1x, sy));
+        __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+        mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+        __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+        mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(t, zero), _mm_cmplt_ps(t, bestDist)));
+        if (_mm_movemask_ps(mask) == 0)
+            continue;
+
+        __m128i maskI = _mm_castps_si128(mask);
+        bestDist = _mm_or_ps(_mm_and_ps(mask, t), _mm_andnot_ps(mask, bestDist));
+        bestTriangle = _mm_or_si128(_mm_and_si128(maskI, triangleId), _mm_andnot_si128(maskI, bestTriangle));
+        bestU = _mm_or_ps(_mm_and_ps(mask, u), _mm_andnot_ps(mask, bestU));
+        bestV = _mm_or_ps(_mm_and_ps(mask, v), _mm_andnot_ps(mask, bestV));
+    }
+
+    alignas(16) float dist[4];
+    alignas(16) int triangle[4];
+    alignas(16) float u[4];
+    alignas(16) float v[4];
+    _mm_store_ps(dist, bestDist);
+    _mm_store_si128(reinterpret_cast<__m128i *>(triangle), bestTriangle);
+    _mm_store_ps(u, bestU);
+    _mm_store_ps(v, bestV);
+    reduceLanes(dist, triangle, u, v, 4, hit);
+}
+
+
+/*! AVX2 kernel, 8 triangles per iteration, last iteration masked as in the SSE kernel. */
+SIMD_TARGET_AVX2
+static void nearestRayTriangleHitAVX2(const TriangleSoA & triangles, std::size_t first, std::size_t last,
+                                      const glm::vec3 & origin, const glm::vec3 & dir, RayTriangleHit & hit)
+{
+    const __m256 ox = _mm256_set1_ps(origin.x);
+    const __m256 oy = _mm256_set1_ps(origin.y);
+    const __m256 oz = _mm256_set1_ps(origin.z);
+    const __m256 dx = _mm256_set1_ps(dir.x);
+    const __m256 dy = _mm256_set1_ps(dir.y);
+    const __m256 dz = _mm256_set1_ps(dir.z);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256i laneOffset = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i eight = _mm256_set1_epi32(8);
+
+    __m256 bestDist = _mm256_set1_ps(hit.m_dist);
+    __m256i bestTriangle = _mm256_set1_epi32(-1);
+    __m256 bestU = _mm256_setzero_ps();
+    __m256 bestV = _mm256_setzero_ps();
+    __m256i triangleId = _mm256_add_epi32(_mm256_set1_epi32(int(first)), laneOffset);
+    const __m256i lastId = _mm256_set1_epi32(int(last));
+
+    for (std::size_t i = first; i < last; i += 8, triangleId = _mm256_add_epi32(triangleId, eight)) {
+        __m256 e1x = _mm256_loadu_ps(triangles.m_e1x.data() + i);
+        __m256 e1y = _mm256_loadu_ps(triangles.m_e1y.data() + i);
+        __m256 e1z = _mm256_loadu_ps(triangles.m_e1z.data() + i);
+        __m256 e2x = _mm256_loadu_ps(triangles.m_e2x.data() + i);
+        __m256 e2y = _mm256_loadu_ps(triangles.m_e2y.data() + i);
+        __m256 e2z = _mm256_loadu_ps(triangles.m_e2z.data() + i);
+
+        // p = cross(dir, e2), det = dot(e1, p)
+        __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(e2y, dz));
+        __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(e2z, dx));
+        __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(e2x, dy));
+        __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+        // lanes beyond last hold padding (or other triangles' data) and are excluded
+        __m256 mask = _mm256_and_ps(_mm256_cmp_ps(det, zero, _CMP_NEQ_UQ),
+                                    _mm256_castsi256_ps(_mm256_cmpgt_epi32(lastId, triangleId)));
+        if (_mm256_movemask_ps(mask) == 0)
+            continue;
+        __m256 invDet = _mm256_div_ps(one, det);
+
+        // s = origin - v0, u = dot(s, p)/det
+        __m256 sx = _mm256_sub_ps(ox, _mm256_loadu_ps(triangles.m_v0x.data() + i));
+        __m256 sy = _mm256_sub_ps(oy, _mm256_loadu_ps(triangles.m_v0y.data() + i));
+        __m256 sz = _mm256_sub_ps(oz, _mm256_loadu_ps(triangles.m_v0z.data() + i));
+        __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)),
+                                               _mm256_mul_ps(sz, pz)), invDet);
+        mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+
+        // q = cross(s, e1), v = dot(dir, q)/det, t = dot(e2, q)/det
+        __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(e1y, sz));
+        __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(e1z, sx));
+        __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(e1x, sy));
+        __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)),
+                                               _mm256_mul_ps(dz, qz)), invDet);
+        mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ),
+                                                 _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+        __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)),
+                                               _mm256_mul_ps(e2z, qz)), invDet);
+        mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(t, zero, _CMP_GE_OQ), _mm256_cmp_ps(t, bestDist, _CMP_LT_OQ)));
+        if (_mm256_movemask_ps(mask) == 0)
+            continue;
+
+        bestDist = _mm256_blendv_ps(bestDist, t, mask);
+        bestTriangle = _mm256_blendv_epi8(bestTriangle, triangleId, _mm256_castps_si256(mask));
+        bestU = _mm256_blendv_ps(bestU, u, mask);
+        bestV = _mm256_blendv_ps(bestV, v, mask);
+    }
+
+    alignas(32) float dist[8];
+    alignas(32) int triangle[8];
+    alignas(32) float u[8];
+    alignas(32) float v[8];
+    _mm256_store_ps(dist, bestDist);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(triangle), bestTriangle);
+    _mm256_store_ps(u, bestU);
+    _mm256_store_ps(v, bestV);
+    reduceLanes(dist, triangle, u, v, 8, hit);
+}
+
+#endif // SIMD_X86
+
+
+void nearestRayTriangleHit(const TriangleSoA & triangles, std::size_t first, std::size_t last,
+                           const glm::vec3 & origin, const glm::vec3 & dir, RayTriangleHit & hit, SimdLevel level)
+{
+    Q_ASSERT(last <= triangles.size());
+    // triangle indexes are handled as 32-bit ints in the SIMD kernels, the padding must fit as well
+    Q_ASSERT(last + TRIANGLE_SOA_PADDING <= 0x7fffffff);
+#if defined(SIMD_X86)
+    switch (level) {
+        case SIMD_AVX2	: nearestRayTriangleHitAVX2(triangles, first, last, origin, dir, hit); return;
+        case SIMD_SSE	: nearestRayTriangleHitSSE(triangles, first, last, origin, dir, hit); return;
+        default			: break;
+    }
+#else
+    (void)level;
+#endif
+    nearestRayTriangleHitScalar(triangles, first, last, origin, dir, hit);
+}
@@ -0,0 +1,117 @@
+#ifndef RAYTRIANGLEKERNELS_H
+#define RAYTRIANGLEKERNELS_H
+
+#include <cstddef>
+#include <vector>
+
+#include <glm.hpp>
+
+#include "SimdSupport.h"
+
+/*! Number of zero triangles appended to the arrays of TriangleSoA, so that the SIMD kernels can always load
+    full vectors (lanes beyond the range tested are masked out).
+*/
+const std::size_t TRIANGLE_SOA_PADDING = 7;
+
+/*! Triangles stored as structure of arrays, as needed by nearestRayTriangleHit(): first vertex v0 and the
+    edges e1 = v1 - v0 and e2 = v2 - v0, one array per coordinate.
+*/
+struct TriangleSoA {
+    /*! Number of triangles. */
+    std::size_t size() const { return m_size; }
+
+    /*! Resizes all arrays to count triangles (plus padding), new triangles are zero (degenerated). */
+    void resize(std::size_t count);
+    void clear();
+
+    /*! Stores triangle i with vertexes v0, v1, v2. */
+    void set(std::size_t i, const glm::vec3 & v0, const glm::vec3 & v1, const glm::vec3 & v2) {
+        m_v0x[i] = v0.x;
+        m_v0y[i] = v0.y;
+        m_v0z[i] = v0.z;
+        const glm::vec3 e1 = v1 - v0;
+        const glm::vec3 e2 = v2 - v0;
+        m_e1x[i] = e1.x;
+        m_e1y[i] = e1.y;
+        m_e1z[i] = e1.z;
+        m_e2x[i] = e2.x;
+        m_e2y[i] = e2.y;
+        m_e2z[i] = e2.z;
+    }
+
+    std::vector<float>	m_v0x, m_v0y, m_v0z;
+    std::vector<float>	m_e1x, m_e1y, m_e1z;
+    std::vector<float>	m_e2x, m_e2y, m_e2z;
+
+private:
+    std::size_t			m_size = 0;
+};
+
+/*! Closest hit found by nearestRayTriangleHit(). */
+struct RayTriangleHit {
+    RayTriangleHit(float dist) : m_dist(dist), m_triangle(~0u), m_u(0), m_v(0) {}
+
+    /*! Distance in units of the ray direction, only hits closer than the initial value are accepted. */
+    float			m_dist;
+    /*! Index of the triangle hit (in the TriangleSoA), ~0u if there was no hit. */
+    unsigned int	m_triangle;
+    /*! Barycentric coordinates of the hit point, weights of vertex 1 and 2 (vertex 0 has 1 - u - v). */
+    float			m_u;
+    float			m_v;
+};
+
+/*! Tests the triangles with indexes [first, last) against the ray "origin + t*dir" (Möller-Trumbore, both sides
+    of a triangle count) and updates hit, if a triangle is hit at 0 <= t < hit.m_dist. Of several triangles hit
+    at the same distance, the one with the lowest index is taken.
+
+    The AVX2 (8 triangles per iteration) and SSE (4 triangles per iteration) kernels return exactly the same
+    results as the scalar kernel, i.e. as intersectTriangle().
+*/
+void nearestRayTriangleHit(const TriangleSoA & triangles, std::size_t first, std::size_t last,
+                           const glm::vec3 & origin, const glm::vec3 & dir, RayTriangleHit & hit, SimdLevel level);
+
+
+/*! Möller-Trumbore ray/triangle intersection (both sides count) for a triangle given by vertex v0 and the
+    edges e1 = v1 - v0, e2 = v2 - v0.
+    Returns true if the ray "orig + t*dir" hits the triangle at 0 <= t < tMax, and returns t and the
+    barycentric coordinates u, v (weights of v1 and v2).
+
+    Mind: the conditions are written such that NaN values (nearly degenerated triangles) are rejected, the
+    SIMD kernels use the same (ordered) comparisons.
+*/
+inline bool intersectTriangleEdges(const glm::vec3 & orig, const glm::vec3 & dir,
+                                   const glm::vec3 & v0, const glm::vec3 & e1, const glm::vec3 & e2,
+                                   float tMax, float & t, float & u, float & v)
+{
+    const glm::vec3 p = glm::cross(dir, e2);
+    const float det = glm::dot(e1, p);
+    if (det == 0.f)
+        return false; // ray parallel to triangle (or degenerated triangle)
+    const float invDet = 1.f/det;
+    const glm::vec3 s = orig - v0;
+    const float uu = glm::dot(s, p)*invDet;
+    if (!(uu >= 0.f && uu <= 1.f))
+        return false;
+    const glm::vec3 q = glm::cross(s, e1);
+    const float vv = glm::dot(dir, q)*invDet;
+    if (!(vv >= 0.f && uu + vv <= 1.f))
+        return false;
+    const float tt = glm::dot(e2, q)*invDet;
+    if (!(tt >= 0.f && tt < tMax))
+        return false;
+    t = tt;
+    u = uu;
+    v = vv;
+    return true;
+}
+
+
+/*! Möller-Trumbore ray/triangle intersection for a triangle given by its vertexes, see intersectTriangleEdges(). */
+inline bool intersectTriangle(const glm::vec3 & orig, const glm::vec3 & dir,
+                              const glm::vec3 & v0, const glm::vec3 & v1, const glm::vec3 & v2,
+                              float tMax, float & t, float & u, float & v)
+{
+    return intersectTriangleEdges(orig, dir, v0, v1 - v0, v2 - v0, tMax, t, u, v);
+}
+
+#endif // RAYTRIANGLEKERNELS_H
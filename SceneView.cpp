@@ -1,16 +1,38 @@
 #include "SceneView.h"
 
 #include <QExposeEvent>
+#include <QMouseEvent>
 #include <QOpenGLShaderProgram>
 #include <QDateTime>
 
 #include "DebugApplication.h"
+#include "ScreenSelection.h"
+#include "ThreadPool.h"
 
 #define SHADER(x) m_shaderPrograms[x].shaderProgram()
 
+/*! Object ID of m_objModel in the ID buffer. */
+static const unsigned int OBJMODEL_PICK_ID = 1;
+/*! Radius of the ID buffer pick window in (device) pixels. */
+static const int ID_PICK_RADIUS = 5;
+/*! Color of the vertex boxes, and of the box of the vertex under the mouse cursor. */
+static const Qt::GlobalColor BOX_COLOR = Qt::blue;
+static const Qt::GlobalColor HOVER_BOX_COLOR = Qt::yellow;
+/*! Color of the boxes of selected vertexes. */
+static const Qt::GlobalColor SELECTED_BOX_COLOR = Qt::red;
+/*! Min. distance (manhattan, in pixels) the mouse must be dragged with the left button held, to select all vertexes
+    inside a rectangle (or lasso) instead of picking a single one.
+*/
+static const int SELECTION_MIN_DRAG = 4;
+/*! Min. distance (manhattan, in pixels) between recorded points of the lasso outline. */
+static const int LASSO_POINT_DISTANCE = 3;
+
 
 SceneView::SceneView() :
-    m_inputEventReceived(false)
+    m_inputEventReceived(false),
+    m_hoverPicker([this](const glm::vec3 & nearPoint, const glm::vec3 & farPoint, PickObject & po) {
+        return m_objModel.pickPoint(nearPoint, farPoint, po);
+    })
 {    
     // tell keyboard handler to monitor certain keys
     m_keyboardMouseHandler.addRecognizedKey(Qt::Key_W);
@@ -20,6 +42,7 @@ SceneView::SceneView() :
     m_keyboardMouseHandler.addRecognizedKey(Qt::Key_Q);
     m_keyboardMouseHandler.addRecognizedKey(Qt::Key_E);
     m_keyboardMouseHandler.addRecognizedKey(Qt::Key_Shift);
+    m_keyboardMouseHandler.addRecognizedKey(Qt::Key_Control);
 
     // *** create scene (no OpenGL calls are being issued below, just the data structures are created.
 
@@ -35,6 +58,21 @@ SceneView::SceneView() :
     grid.m_uniformNames.append("backColor"); // vec3
     m_shaderPrograms.append( grid );
 
+    // Shaderprogram #2 : boxes (painting one instance of the unit cube per box)
+    ShaderProgram boxes("E:/Applications/qt_vertex-picking/shaders/boxInstances.vert","E:/Applications/qt_vertex-picking/shaders/simple.frag");
+    boxes.m_uniformNames.append("worldToView");
+    m_shaderPrograms.append( boxes );
+
+    // Shaderprogram #3 : ID buffer picking (painting object, triangle and vertex IDs)
+    ShaderProgram ids("E:/Applications/qt_vertex-picking/shaders/idTriangles.vert","E:/Applications/qt_vertex-picking/shaders/id.frag",
+                      "E:/Applications/qt_vertex-picking/shaders/idTriangles.geom");
+    ids.m_uniformNames.append("worldToView"); // mat4
+    ids.m_uniformNames.append("objectId"); // uint
+    m_shaderPrograms.append( ids );
+
+    // compute shader for brute-force picking (see GpuPicker)
+    m_gpuPicker.m_computeShaderFilePath = "E:/Applications/qt_vertex-picking/shaders/pick.comp";
+
     // *** initialize camera placement and model placement in the world
 
     // move camera a little back (mind: positive z) and look straight ahead
@@ -44,13 +82,23 @@ SceneView::SceneView() :
     // look slightly left
     m_camera.rotate(-5, QVector3D(0.0f, 1.0f, 0.0f));
 
-    m_objModel.loadObj("C:/Users/firo1/Downloads/starRandMesh.obj");
-    m_objModel.boxobj();
+    // the mesh is loaded in the background, each event of the loader schedules a repaint, which processes it
+    m_objModel.m_loader.m_notify = [this]() {
+        QMetaObject::invokeMethod(this, &OpenGLWindow::renderLater, Qt::QueuedConnection);
+    };
+    m_objModel.loadObjInBackground("C:/Users/firo1/Downloads/starRandMesh.obj");
     //m_objModel.pickPoint();
+
+    // hover pick results are emitted from the picker thread and queued into the GUI thread
+    connect(&m_hoverPicker, &HoverPicker::picked, this, [this](const HoverPickResult & result) {
+        onHoverPicked(result);
+    }, Qt::QueuedConnection);
 }
 
 
 SceneView::~SceneView() {
+    // the loader thread must not schedule repaints anymore
+    m_objModel.m_loader.cancel();
     if (m_context) {
         m_context->makeCurrent(this);
 
@@ -59,8 +107,11 @@ SceneView::~SceneView() {
 
         
         m_objModel.destroy();
+        m_boxInstances.destroy();
         m_gridObject.destroy();
         m_pickLineObject.destroy();
+        m_idPickBuffer.destroy();
+        m_gpuPicker.destroy();
 
         m_gpuTimers.destroy();
     }
@@ -81,8 +132,11 @@ void SceneView::initializeGL() {
 
         // initialize drawable objects
         m_objModel.create(SHADER(0));
+        m_boxInstances.create(SHADER(2));
         m_gridObject.create(SHADER(1));
         m_pickLineObject.create(SHADER(0));
+        m_idPickBuffer.create();
+        m_gpuPicker.create();
 
         // Timer
         m_gpuTimers.setSampleCount(6);
@@ -119,6 +173,9 @@ void SceneView::paintGL() {
     // process input, i.e. check if any keys have been pressed
     if (m_inputEventReceived)
         processInput();
+    if (m_hoverResultPending)
+        applyHoverPick();
+    processLoadEvents();
 
     const qreal retinaScale = devicePixelRatio(); // needed for Macs with retina display
     glViewport(0, 0, width() * retinaScale, height() * retinaScale);
@@ -152,6 +209,12 @@ void SceneView::paintGL() {
 
     SHADER(0)->release();
 
+    // *** render box instances
+    SHADER(2)->bind();
+    SHADER(2)->setUniformValue(m_shaderPrograms[2].m_uniformIDs[0], m_worldToView);
+    m_boxInstances.render();
+    SHADER(2)->release();
+
     // *** render grid ***
 
     m_gpuTimers.recordSample(); // setup grid
@@ -166,6 +229,11 @@ void SceneView::paintGL() {
 
     m_gpuTimers.recordSample(); // done painting
 
+    // *** ID buffer picking
+    if (m_idPickRequested)
+        renderIdPick();
+    pollIdPick();
+    pollGpuPick();
 
 #if 0
     // do some animation stuff
@@ -187,6 +255,22 @@ void SceneView::paintGL() {
 }
 
 
+static const glm::vec3 qvec3toVec3(const QVector3D& q)
+{
+    glm::vec3 v;
+    v.x = q.x();
+    v.y = q.y();
+    v.z = q.z();
+    return v;
+}
+
+
+/*! Converts local mouse coordinates into normalized device coordinates. */
+static glm::vec2 mouseToNdc(const QPoint & localMousePos, int width, int height) {
+    return glm::vec2(2.f*localMousePos.x()/width - 1, 1 - 2.f*localMousePos.y()/height);
+}
+
+
 void SceneView::keyPressEvent(QKeyEvent *event) {
     m_keyboardMouseHandler.keyPressEvent(event);
     checkInput();
@@ -199,6 +283,10 @@ void SceneView::keyReleaseEvent(QKeyEvent *event) {
 
 void SceneView::mousePressEvent(QMouseEvent *event) {
     m_keyboardMouseHandler.mousePressEvent(event);
+    if (event->button() == Qt::LeftButton) {
+        m_selectionPath.clear();
+        m_selectionPath.append(event->globalPosition().toPoint());
+    }
     checkInput();
 }
 
@@ -207,7 +295,19 @@ void SceneView::mouseReleaseEvent(QMouseEvent *event) {
     checkInput();
 }
 
-void SceneView::mouseMoveEvent(QMouseEvent * /*event*/) {
+void SceneView::mouseMoveEvent(QMouseEvent * event) {
+    // hover picking, only while no button is held (right button = camera navigation)
+    if (event->buttons() == Qt::NoButton) {
+        QVector3D nearPoint, farPoint;
+        if (pickRay(event->position().toPoint(), nearPoint, farPoint))
+            m_hoverSerial = m_hoverPicker.postRay(qvec3toVec3(nearPoint), qvec3toVec3(farPoint));
+    }
+    // record the outline of a lasso selection
+    if ((event->buttons() & Qt::LeftButton) && !m_selectionPath.isEmpty()) {
+        QPoint globalPos = event->globalPosition().toPoint();
+        if ((globalPos - m_selectionPath.last()).manhattanLength() >= LASSO_POINT_DISTANCE)
+            m_selectionPath.append(globalPos);
+    }
     checkInput();
 }
 
@@ -217,20 +317,83 @@ void SceneView::wheelEvent(QWheelEvent *event) {
 }
 
 
-static const glm::vec3 qvec3toVec3(const QVector3D& q)
-{
-    glm::vec3 v;
-    v.x = q.x();
-    v.y = q.y();
-    v.z = q.z();
-    return v;
-}
-
 void SceneView::pick(const QPoint & globalMousePos) {
     // local mouse coordinates
     QPoint localMousePos = mapFromGlobal(globalMousePos);
     int my = localMousePos.y();
     int mx = localMousePos.x();
+    const qreal retinaScale = devicePixelRatio(); // needed for Macs with retina display
+
+    // Ctrl + click: pick with the ID buffer instead of the pick ray, the pick is rendered in paintGL()
+    if (m_keyboardMouseHandler.keyDown(Qt::Key_Control)) {
+        m_idPickRequested = true;
+        m_idPickPos = QPoint(int(mx*retinaScale), int(height()*retinaScale) - 1 - int(my*retinaScale));
+        return;
+    }
+
+    QVector3D nearPoint, farPoint;
+    if (!pickRay(localMousePos, nearPoint, farPoint))
+        return;
+
+    // update pick line vertices (visualize pick line)
+    m_context->makeCurrent(this);
+    m_pickLineObject.setPoints(nearPoint, farPoint);
+
+    // now do the actual picking - for now we implement a selection
+    selectNearestObject(nearPoint, farPoint);
+}
+
+
+void SceneView::select(const QPoint & globalDownPos, const QPoint & globalReleasePos) {
+    // the vertexes (and their boxes) are complete only after loading
+    if (m_objModel.loading())
+        return;
+
+    QElapsedTimer selectTimer;
+    selectTimer.start();
+
+    ScreenSelection selection;
+    float worldToView[16];
+    m_worldToView.copyDataTo(worldToView);
+    bool lasso = m_keyboardMouseHandler.keyDown(Qt::Key_Shift) && m_selectionPath.size() >= 3;
+    if (lasso) {
+        std::vector<glm::vec2> polygon;
+        for (const QPoint & p : m_selectionPath)
+            polygon.push_back(mouseToNdc(mapFromGlobal(p), width(), height()));
+        polygon.push_back(mouseToNdc(mapFromGlobal(globalReleasePos), width(), height()));
+        selection.setLasso(worldToView, polygon);
+    }
+    else {
+        glm::vec2 a = mouseToNdc(mapFromGlobal(globalDownPos), width(), height());
+        glm::vec2 b = mouseToNdc(mapFromGlobal(globalReleasePos), width(), height());
+        selection.setRectangle(worldToView, a.x, a.y, b.x, b.y);
+    }
+
+    // boxes are selected by their center (the vertex), there is no spatial index over the vertexes,
+    // so all of them are tested, in parallel
+    std::vector<unsigned int> ids;
+    selection.selectPoints(m_objModel.positionData(), m_objModel.positionCount(), ThreadPool::globalInstance(), ids);
+    double selectMs = selectTimer.nsecsElapsed()*1e-6;
+
+    // Mind: OpenGL-context must be current when we call this function!
+    m_context->makeCurrent(this);
+    m_boxInstances.setBoxColors(m_selectedVertexes, BOX_COLOR);
+    m_boxInstances.setBoxColors(ids, SELECTED_BOX_COLOR);
+    m_vertexSelected.assign(m_objModel.positionCount(), false);
+    for (unsigned int id : ids)
+        m_vertexSelected[id] = true;
+    m_selectedVertexes.swap(ids);
+    if (m_hoveredVertex != ~0u)
+        m_boxInstances.setBoxColor(m_hoveredVertex, HOVER_BOX_COLOR);
+
+    qDebug().nospace() << (lasso ? "Lasso" : "Rectangle") << " selection: " << m_selectedVertexes.size()
+                       << " vertexes in " << selectMs << " ms";
+}
+
+
+bool SceneView::pickRay(const QPoint & localMousePos, QVector3D & nearPoint, QVector3D & farPoint) const {
+    int my = localMousePos.y();
+    int mx = localMousePos.x();
 
     // viewport dimensions
     const qreal retinaScale = devicePixelRatio(); // needed for Macs with retina display
@@ -242,7 +405,7 @@ void SceneView::pick(const QPoint & globalMousePos) {
     QMatrix4x4 projectionMatrixInverted = m_worldToView.inverted(&invertible);
     if (!invertible) {
         qWarning()<< "Cannot invert projection matrix.";
-        return;
+        return false;
     }
 
     // mouse position in NDC space, one point on near plane and one point on far plane
@@ -264,13 +427,9 @@ void SceneView::pick(const QPoint & globalMousePos) {
     // don't forget normalization!
     nearResult /= nearResult.w();
     farResult /= farResult.w();
-
-    // update pick line vertices (visualize pick line)
-    m_context->makeCurrent(this);
-    m_pickLineObject.setPoints(nearResult.toVector3D(), farResult.toVector3D());
-
-    // now do the actual picking - for now we implement a selection
-    selectNearestObject(nearResult.toVector3D(), farResult.toVector3D());
+    nearPoint = nearResult.toVector3D();
+    farPoint = farResult.toVector3D();
+    return true;
 }
 
 
@@ -361,9 +520,15 @@ void SceneView::processInput() {
         m_camera.translate(wheelDelta * m_camera.forward() * transSpeed);
     }
 
-    // check for picking operation
+    // check for picking operation, or a selection if the mouse was dragged
     if (m_keyboardMouseHandler.buttonReleased(Qt::LeftButton)) {
-        pick(m_keyboardMouseHandler.mouseReleasePos());
+        QPoint downPos = m_selectionPath.isEmpty() ? m_keyboardMouseHandler.mouseDownPos() : m_selectionPath.first();
+        QPoint releasePos = m_keyboardMouseHandler.mouseReleasePos();
+        if ((releasePos - downPos).manhattanLength() >= SELECTION_MIN_DRAG)
+            select(downPos, releasePos);
+        else
+            pick(releasePos);
+        m_selectionPath.clear();
     }
 
     // finally, reset "WasPressed" key states
@@ -391,21 +556,139 @@ void SceneView::selectNearestObject(const QVector3D& nearPoint, const QVector3D&
     // create pick object, distance is a value between 0 and 1, so initialize with 2 (very far back) to be on the safe side.
     PickObject p(2.f, std::numeric_limits<unsigned int>::max());
 
+    // BVH not built yet: test all triangles with the compute shader, the result is reported in pollGpuPick()
+    if (!m_objModel.hasSearchTrees()) {
+        m_objModel.gpuPick(m_gpuPicker, qvec3toVec3(nearPoint), qvec3toVec3(farPoint));
+        renderLater();
+        return;
+    }
+
     // now process all objects and update p to hold the closest hit
     //m_objModel.pick(nearPoint, d, p);
-    m_objModel.pickPoint(qvec3toVec3(nearPoint), qvec3toVec3(farPoint));
+    m_objModel.pickPoint(qvec3toVec3(nearPoint), qvec3toVec3(farPoint), p);
     // ... other objects
 
     // any object accepted a pick?
-   //if (p.m_objectId == std::numeric_limits<unsigned int>::max())
-   //    return; // nothing selected
+    if (p.m_objectId == std::numeric_limits<unsigned int>::max())
+        return; // nothing selected
 
-   // qDebug().nospace() << "Pick successful (Box #"
-   //                    << p.m_objectId <<  ", Face #" << p.m_faceId << ", t = " << p.m_dist << ") after "
-   //                    << pickTimer.elapsed() << " ms";
-
-    //std::cout << "Vertex index: " << p.m_objectId;
+    qDebug().nospace() << "Pick successful (Vertex #"
+                       << p.m_objectId <<  ", Triangle #" << p.m_faceId << ", t = " << p.m_dist
+                       << ", nearest mesh vertex #" << p.m_nearestVertex << ") after " << pickTimer.elapsed() << " ms";
 
     // Mind: OpenGL-context must be current when we call this function!
     //m_objModel.highlight(p.m_objectId, p.m_faceId);
 }
+
+
+void SceneView::processLoadEvents() {
+    const bool wasFinished = m_objModel.m_loader.state() == BackgroundLoader::Finished;
+    // Mind: OpenGL-context must be current when we call this function!
+    if (m_objModel.processLoadEvents())
+        renderLater(); // upload the rest with the next frame
+    // hover picks may hit the mesh from now on
+    if (!wasFinished && m_objModel.m_loader.state() == BackgroundLoader::Finished) {
+        // one box per vertex, drawn as instances of a single cube (no per-box geometry is generated)
+        m_boxInstances.setBoxes(m_objModel.positionData(), m_objModel.positionCount(), 500, BOX_COLOR);
+        m_selectedVertexes.clear();
+        m_vertexSelected.clear();
+        m_hoveredVertex = ~0u;
+    }
+
+    QString status = m_objModel.m_loader.statusText();
+    if (m_objModel.m_loader.state() == BackgroundLoader::Finished)
+        status = QString("%1: %2 vertexes, %3 triangles").arg(status).arg(m_objModel.positionCount())
+                     .arg(m_objModel.elementCount()/3);
+    if (status != m_loadStatus) {
+        m_loadStatus = status;
+        emit loadProgress(status);
+    }
+}
+
+
+void SceneView::onHoverPicked(const HoverPickResult & result) {
+    // results of rays superseded meanwhile (the picker may already have emitted them) are ignored
+    if (result.m_serial != m_hoverSerial)
+        return;
+    m_hoverResult = result;
+    m_hoverResultPending = true;
+    renderLater();
+}
+
+
+void SceneView::applyHoverPick() {
+    m_hoverResultPending = false;
+    unsigned int vertex = m_hoverResult.m_hit ? m_hoverResult.m_objectId : ~0u;
+    if (vertex == m_hoveredVertex)
+        return;
+
+    // Mind: OpenGL-context must be current when we call this function!
+    if (m_hoveredVertex != ~0u)
+        m_boxInstances.setBoxColor(m_hoveredVertex, m_vertexSelected.empty() || !m_vertexSelected[m_hoveredVertex] ?
+                                                        BOX_COLOR : SELECTED_BOX_COLOR);
+    if (vertex != ~0u)
+        m_boxInstances.setBoxColor(vertex, HOVER_BOX_COLOR);
+    m_hoveredVertex = vertex;
+
+    // latency from the mouse move to the highlight being submitted with this frame
+    double latencyMs = (m_hoverPicker.elapsedNs() - m_hoverResult.m_postTime)*1e-6;
+    if (vertex != ~0u)
+        qDebug().nospace() << "Hover pick (Vertex #" << vertex << ", Triangle #" << m_hoverResult.m_faceId << "): pick "
+                           << m_hoverResult.m_pickMs << " ms, latency until highlight " << latencyMs << " ms";
+    else
+        qDebug().nospace() << "Hover pick (nothing): pick " << m_hoverResult.m_pickMs << " ms, latency until highlight "
+                           << latencyMs << " ms";
+}
+
+
+void SceneView::renderIdPick() {
+    m_idPickRequested = false;
+    const qreal retinaScale = devicePixelRatio();
+    if (m_idPickBuffer.beginPick(int(width()*retinaScale), int(height()*retinaScale),
+                                 m_idPickPos.x(), m_idPickPos.y(), ID_PICK_RADIUS))
+    {
+        SHADER(3)->bind();
+        SHADER(3)->setUniformValue(m_shaderPrograms[3].m_uniformIDs[0], m_worldToView);
+        SHADER(3)->setUniformValue(m_shaderPrograms[3].m_uniformIDs[1], GLuint(OBJMODEL_PICK_ID));
+        m_objModel.render();
+        SHADER(3)->release();
+    }
+    m_idPickBuffer.endPick(m_context->defaultFramebufferObject());
+}
+
+
+void SceneView::pollIdPick() {
+    if (!m_idPickBuffer.pickPending())
+        return;
+    IdPickResult res;
+    if (!m_idPickBuffer.pollResult(res)) {
+        renderLater(); // GPU not done yet, check again with the next frame
+        return;
+    }
+    if (res.m_objectId != OBJMODEL_PICK_ID) {
+        qDebug().nospace() << "ID pick: nothing selected after " << m_idPickBuffer.m_lastPickMs << " ms";
+        return;
+    }
+    qDebug().nospace() << "ID pick successful (Vertex #"
+                       << res.m_vertexId <<  ", Triangle #" << res.m_primitiveId << ") after "
+                       << m_idPickBuffer.m_lastPickMs << " ms";
+}
+
+
+void SceneView::pollGpuPick() {
+    if (!m_gpuPicker.pickPending())
+        return;
+    GpuPickResult res;
+    if (!m_gpuPicker.pollResult(res)) {
+        renderLater(); // GPU not done yet, check again with the next frame
+        return;
+    }
+    PickObject p(2.f, std::numeric_limits<unsigned int>::max());
+    if (!m_objModel.storeGpuHit(res, p)) {
+        qDebug().nospace() << "GPU pick: nothing selected after " << m_gpuPicker.m_lastPickMs << " ms";
+        return;
+    }
+    qDebug().nospace() << "GPU pick successful (Vertex #"
+                       << p.m_objectId <<  ", Triangle #" << p.m_faceId << ", t = " << p.m_dist << ") after "
+                       << m_gpuPicker.m_lastPickMs << " ms";
+}
@@ -5,6 +5,7 @@
 #include <QMatrix4x4>
 #include <QOpenGLTimeMonitor>
 #include <QElapsedTimer>
+#include <QPolygon>
 
 #include "OpenGLWindow.h"
 #include "ShaderProgram.h"
@@ -12,7 +13,11 @@
 #include "GridObject.h"
 #include "PickLineObject.h"
 #include "Camera.h"
+#include "IdPickBuffer.h"
+#include "GpuPicker.h"
 #include "ObjModel.h"
+#include "InstancedBoxObject.h"
+#include "HoverPicker.h"
 
 
 /*! The class SceneView extends the primitive OpenGLWindow
@@ -21,12 +26,17 @@
 */
 
 class SceneView : public OpenGLWindow {
+    Q_OBJECT
 public:
     SceneView();
     virtual ~SceneView() override;
 
     std::string filename;
 
+signals:
+    /*! Emitted when the state of the background load of the mesh changes (see BackgroundLoader::statusText()). */
+    void loadProgress(const QString & status);
+
 protected:
     void initializeGL() override;
     void resizeGL(int width, int height) override;
@@ -42,6 +52,11 @@ protected:
 
     void pick(const QPoint & globalMousePos);
 
+    /*! Selects all vertexes (boxes) inside the rectangle between the press and release position of the left mouse button
+        (both global), or inside the lasso m_selectionPath if Shift is held.
+    */
+    void select(const QPoint & globalDownPos, const QPoint & globalReleasePos);
+
 private:
     /*! Tests, if any relevant input was received and registers a state change. */
     void checkInput();
@@ -51,6 +66,11 @@ private:
     */
     void processInput();
 
+    /*! Computes the pick ray through the given mouse position (local coordinates), nearPoint and farPoint are
+        on the near and far plane, in model coordinates. Returns false if the world2view matrix is not invertible.
+    */
+    bool pickRay(const QPoint & localMousePos, QVector3D & nearPoint, QVector3D & farPoint) const;
+
     /*! Compines camera matrix and project matrix to form the world2view matrix. */
     void updateWorld2ViewMatrix();
 
@@ -59,6 +79,30 @@ private:
     */
     void selectNearestObject(const QVector3D& nearPoint, const QVector3D& farPoint);
 
+    /*! Renders the ID buffer pick requested in pick() and starts its readback. */
+    void renderIdPick();
+
+    /*! Checks if the result of an ID buffer pick is available and reports it, otherwise schedules
+        another repaint to check again.
+    */
+    void pollIdPick();
+
+    /*! Checks if the result of a compute shader pick (started in selectNearestObject()) is available and reports
+        it, otherwise schedules another repaint to check again.
+    */
+    void pollGpuPick();
+
+    /*! Uploads the data of the background load of m_objModel (schedules another repaint while data is left),
+        creates the vertex boxes when it has finished and emits loadProgress() when its status changes.
+    */
+    void processLoadEvents();
+
+    /*! Receives a hover pick result (queued from the HoverPicker thread), it is applied in the next paintGL(). */
+    void onHoverPicked(const HoverPickResult & result);
+
+    /*! Highlights the box of the hovered vertex and reports the latency from mouse move to highlight. */
+    void applyHoverPick();
+
     /*! If set to true, an input event was received, which will be evaluated at next repaint. */
     bool						m_inputEventReceived;
 
@@ -77,9 +121,44 @@ private:
 
     //BoxObject					m_boxObject;
     ObjModel                    m_objModel;
+    InstancedBoxObject			m_boxInstances;
     GridObject					m_gridObject;
     PickLineObject				m_pickLineObject;
 
+    /*! Offscreen ID buffer for GPU picking (Ctrl + left click). */
+    IdPickBuffer				m_idPickBuffer;
+    /*! If true, an ID buffer pick at m_idPickPos (OpenGL window coordinates) is rendered in the next paintGL(). */
+    bool						m_idPickRequested = false;
+    QPoint						m_idPickPos;
+
+    /*! Brute-force picking with a compute shader, used while the BVH of the mesh is not built yet. */
+    GpuPicker					m_gpuPicker;
+
+    /*! Picks the vertex under the mouse cursor on mouse moves, in a background thread.
+        Mind: declared after m_objModel, so that its thread is stopped before the model is destroyed.
+    */
+    HoverPicker					m_hoverPicker;
+    /*! Serial number of the latest ray posted to m_hoverPicker, older results are ignored. */
+    quint64						m_hoverSerial = 0;
+    /*! Latest hover pick result, not yet applied if m_hoverResultPending is true. */
+    HoverPickResult				m_hoverResult;
+    bool						m_hoverResultPending = false;
+    /*! Vertex (box) currently highlighted as hovered, ~0u if none. */
+    unsigned int				m_hoveredVertex = ~0u;
+
+    /*! Vertexes (boxes) selected with a rectangle or lasso, ascending. */
+    std::vector<unsigned int>	m_selectedVertexes;
+    /*! Per vertex: true if selected, used to restore the box color after hovering. */
+    std::vector<bool>			m_vertexSelected;
+
+    /*! Mouse positions (global) recorded while the left button is held, starting with the press position.
+        Used as lasso outline when selecting with Shift held.
+    */
+    QPolygon					m_selectionPath;
+
+    /*! Status of the background load last emitted with loadProgress(). */
+    QString						m_loadStatus;
+
     QOpenGLTimeMonitor			m_gpuTimers;
     QElapsedTimer				m_cpuTimer;
 };
@@ -1,17 +1,38 @@
 #include "SceneViewLeft.h"
 
 #include <QExposeEvent>
+#include <QFileInfo>
+#include <QKeyEvent>
+#include <QMouseEvent>
 #include <QOpenGLShaderProgram>
 #include <QDateTime>
 
 #include "DebugApplication.h"
 #include "PickObject.h"
+#include "ScreenSelection.h"
+#include "ThreadPool.h"
 
 #define SHADER(x) m_shaderPrograms[x].shaderProgram()
 
+/*! Object ID of m_boxObject (the point cloud) in the ID buffer. */
+static const unsigned int POINTCLOUD_PICK_ID = 1;
+/*! Min. distance (manhattan, in pixels) the mouse must be dragged with the left button held, to select all points
+    inside a rectangle (or lasso) instead of picking a single one.
+*/
+static const int SELECTION_MIN_DRAG = 4;
+/*! Min. distance (manhattan, in pixels) between recorded points of the lasso outline. */
+static const int LASSO_POINT_DISTANCE = 3;
+/*! PLY files of this size (bytes) or larger are not loaded into memory, but streamed from a tile file
+    (see PointCloudStreamer).
+*/
+static const qint64 OUT_OF_CORE_MIN_FILE_SIZE = qint64(2) << 30;
+/*! Number of frames a sequence is moved with Page Up/Page Down. */
+static const int SEQUENCE_SCRUB_FRAMES = 10;
+
 
 SceneViewLeft::SceneViewLeft() :
-    m_inputEventReceived(false)
+    m_inputEventReceived(false),
+    m_pickTolerance(5)
 {
     // tell keyboard handler to monitor certain keys
     m_keyboardMouseHandler.addRecognizedKey(Qt::Key_W);
@@ -21,6 +42,7 @@ SceneViewLeft::SceneViewLeft() :
     m_keyboardMouseHandler.addRecognizedKey(Qt::Key_Q);
     m_keyboardMouseHandler.addRecognizedKey(Qt::Key_E);
     m_keyboardMouseHandler.addRecognizedKey(Qt::Key_Shift);
+    m_keyboardMouseHandler.addRecognizedKey(Qt::Key_Control);
 
     // *** create scene (no OpenGL calls are being issued below, just the data structures are created.
 
@@ -36,6 +58,15 @@ SceneViewLeft::SceneViewLeft() :
     grid.m_uniformNames.append("backColor"); // vec3
     m_shaderPrograms.append( grid );
 
+    // Shaderprogram #2 : ID buffer picking (painting object and point IDs)
+    ShaderProgram ids("E:/Applications/qt_vertex-picking/shaders/idPoints.vert","E:/Applications/qt_vertex-picking/shaders/id.frag");
+    ids.m_uniformNames.append("worldToView"); // mat4
+    ids.m_uniformNames.append("objectId"); // uint
+    m_shaderPrograms.append( ids );
+
+    // compute shader for brute-force picking (see GpuPicker)
+    m_gpuPicker.m_computeShaderFilePath = "E:/Applications/qt_vertex-picking/shaders/pick.comp";
+
     // *** initialize camera placement and model placement in the world
 
     // move camera a little back (mind: positive z) and look straight ahead
@@ -45,11 +76,42 @@ SceneViewLeft::SceneViewLeft() :
     // look slightly left
     m_camera.rotate(-170, QVector3D(0.0f, 1.0f, 0.0f));
 
-    m_boxObject.loadObj("C:/Users/firo1/Downloads/frame1.ply");
+    // the points are loaded in the background, each event of the loader schedules a repaint, which processes it
+    auto scheduleRepaint = [this]() {
+        QMetaObject::invokeMethod(this, &OpenGLWindow::renderLater, Qt::QueuedConnection);
+    };
+    QStringList args = qApp->arguments();
+    // streamed point clouds and sequences store 16 bit positions on the GPU with --quantize-positions
+    m_pointStreamer.m_quantizePositions = m_sequence.m_quantizePositions = args.contains("--quantize-positions");
+    // a sequence of PLY files given on the command line is played instead of a single file, e.g.
+    //   --sequence C:/Users/firo1/Downloads  or  --sequence C:/Users/firo1/Downloads/frame*.ply
+    int argIdx = args.indexOf("--sequence");
+    if (argIdx != -1 && argIdx + 1 < args.size()) {
+        m_sequence.m_notify = scheduleRepaint;
+        m_sequencePlayback = m_sequence.open(args[argIdx + 1]);
+        if (m_sequencePlayback)
+            m_sequence.play();
+    }
+    const std::string filename = "C:/Users/firo1/Downloads/frame1.ply";
+    m_outOfCore = !m_sequencePlayback && QFileInfo(QString::fromStdString(filename)).size() >= OUT_OF_CORE_MIN_FILE_SIZE;
+    if (m_outOfCore) {
+        // large clouds are split into tiles on disk first, then the tiles needed for the view are streamed in
+        m_pointStreamer.m_loader.m_notify = scheduleRepaint;
+        m_pointStreamer.m_notify = scheduleRepaint;
+        m_pointStreamer.openInBackground(filename);
+    }
+    else if (!m_sequencePlayback) {
+        m_boxObject.m_loader.m_notify = scheduleRepaint;
+        m_boxObject.loadObjInBackground(filename);
+    }
 }
 
 
 SceneViewLeft::~SceneViewLeft() {
+    // the loader threads must not schedule repaints anymore
+    m_boxObject.m_loader.cancel();
+    m_pointStreamer.m_loader.cancel();
+    m_sequence.close();
     if (m_context) {
         m_context->makeCurrent(this);
 
@@ -57,8 +119,12 @@ SceneViewLeft::~SceneViewLeft() {
             p.destroy();
 
         m_boxObject.destroy();
+        m_pointStreamer.destroy();
+        m_sequence.destroy();
         m_gridObject.destroy();
         m_pickLineObject.destroy();
+        m_idPickBuffer.destroy();
+        m_gpuPicker.destroy();
 
         m_gpuTimers.destroy();
     }
@@ -79,8 +145,12 @@ void SceneViewLeft::initializeGL() {
 
         // initialize drawable objects
         m_boxObject.create(SHADER(0));
+        m_pointStreamer.create(SHADER(0));
+        m_sequence.create(SHADER(0));
         m_gridObject.create(SHADER(1));
         m_pickLineObject.create(SHADER(0));
+        m_idPickBuffer.create();
+        m_gpuPicker.create();
 
         // Timer
         m_gpuTimers.setSampleCount(6);
@@ -117,6 +187,7 @@ void SceneViewLeft::paintGL() {
     // process input, i.e. check if any keys have been pressed
     if (m_inputEventReceived)
         processInput();
+    processLoadEvents();
 
     const qreal retinaScale = devicePixelRatio(); // needed for Macs with retina display
     glViewport(0, 0, width() * retinaScale, height() * retinaScale);
@@ -142,7 +213,28 @@ void SceneViewLeft::paintGL() {
 
     m_gpuTimers.recordSample(); // render boxes
 
-    m_boxObject.render();
+    float worldToView[16];
+    m_worldToView.copyDataTo(worldToView);
+    // m_projection(1, 1) = 1/tan(half vertical field of view)
+    const float focalLength = m_projection(1, 1)*height()*float(retinaScale)/2;
+    if (m_sequencePlayback) {
+        // advance the playback, draw the frame in the front buffer while the next one is uploaded
+        if (m_sequence.update())
+            renderLater(); // playing, or upload the rest with the next frame
+        m_sequence.render();
+    }
+    else if (m_outOfCore) {
+        // page tiles in and out for the current view, then draw the tiles on the GPU
+        const QVector3D & cameraPos = m_camera.translation();
+        if (m_pointStreamer.update(worldToView, glm::vec3(cameraPos.x(), cameraPos.y(), cameraPos.z()), focalLength))
+            renderLater(); // upload the rest with the next frame
+        m_pointStreamer.render();
+    }
+    else {
+        // select the octree nodes for the current view (all points without octree)
+        m_boxObject.updateLod(worldToView, focalLength);
+        m_boxObject.render();
+    }
 
     m_gpuTimers.recordSample(); // render pickline
     if (m_pickLineObject.m_visible)
@@ -164,6 +256,11 @@ void SceneViewLeft::paintGL() {
 
     m_gpuTimers.recordSample(); // done painting
 
+    // *** ID buffer picking
+    if (m_idPickRequested)
+        renderIdPick();
+    pollIdPick();
+    pollGpuPick();
 
 #if 0
     // do some animation stuff
@@ -186,6 +283,28 @@ void SceneViewLeft::paintGL() {
 
 
 void SceneViewLeft::keyPressEvent(QKeyEvent *event) {
+    // sequence playback: Space plays/pauses, Left/Right and Page Up/Page Down scrub, Home returns to the first frame
+    if (m_sequencePlayback) {
+        bool handled = true;
+        switch (event->key()) {
+            case Qt::Key_Space :
+                if (m_sequence.playing())
+                    m_sequence.pause();
+                else
+                    m_sequence.play();
+                break;
+            case Qt::Key_Left		: m_sequence.step(-1); break;
+            case Qt::Key_Right		: m_sequence.step(1); break;
+            case Qt::Key_PageUp		: m_sequence.step(-SEQUENCE_SCRUB_FRAMES); break;
+            case Qt::Key_PageDown	: m_sequence.step(SEQUENCE_SCRUB_FRAMES); break;
+            case Qt::Key_Home		: m_sequence.seek(0); break;
+            default : handled = false;
+        }
+        if (handled) {
+            renderLater();
+            return;
+        }
+    }
     m_keyboardMouseHandler.keyPressEvent(event);
     checkInput();
 }
@@ -197,6 +316,10 @@ void SceneViewLeft::keyReleaseEvent(QKeyEvent *event) {
 
 void SceneViewLeft::mousePressEvent(QMouseEvent *event) {
     m_keyboardMouseHandler.mousePressEvent(event);
+    if (event->button() == Qt::LeftButton) {
+        m_selectionPath.clear();
+        m_selectionPath.append(event->globalPosition().toPoint());
+    }
     checkInput();
 }
 
@@ -205,7 +328,13 @@ void SceneViewLeft::mouseReleaseEvent(QMouseEvent *event) {
     checkInput();
 }
 
-void SceneViewLeft::mouseMoveEvent(QMouseEvent * /*event*/) {
+void SceneViewLeft::mouseMoveEvent(QMouseEvent * event) {
+    // record the outline of a lasso selection
+    if ((event->buttons() & Qt::LeftButton) && !m_selectionPath.isEmpty()) {
+        QPoint globalPos = event->globalPosition().toPoint();
+        if ((globalPos - m_selectionPath.last()).manhattanLength() >= LASSO_POINT_DISTANCE)
+            m_selectionPath.append(globalPos);
+    }
     checkInput();
 }
 
@@ -223,6 +352,12 @@ static const glm::vec3 qvec3toVec3(const QVector3D& q)
     return v;
 }
 
+
+/*! Converts local mouse coordinates into normalized device coordinates. */
+static glm::vec2 mouseToNdc(const QPoint & localMousePos, int width, int height) {
+    return glm::vec2(2.f*localMousePos.x()/width - 1, 1 - 2.f*localMousePos.y()/height);
+}
+
 void SceneViewLeft::pick(const QPoint & globalMousePos) {
     // local mouse coordinates
     QPoint localMousePos = mapFromGlobal(globalMousePos);
@@ -234,6 +369,14 @@ void SceneViewLeft::pick(const QPoint & globalMousePos) {
     qreal halfVpw = width()*retinaScale/2;
     qreal halfVph = height()*retinaScale/2;
 
+    // Ctrl + click: pick with the ID buffer instead of the pick ray, the pick is rendered in paintGL()
+    // (not for streamed point clouds, the vertex ids in the ID buffer restart with each tile, nor for sequences)
+    if (m_keyboardMouseHandler.keyDown(Qt::Key_Control) && !m_outOfCore && !m_sequencePlayback) {
+        m_idPickRequested = true;
+        m_idPickPos = QPoint(int(mx*retinaScale), int(height()*retinaScale) - 1 - int(my*retinaScale));
+        return;
+    }
+
     // invert world2view matrix, with m_worldToView = m_projection * m_camera.toMatrix() * m_transform.toMatrix();
     bool invertible;
     QMatrix4x4 projectionMatrixInverted = m_worldToView.inverted(&invertible);
@@ -262,12 +405,55 @@ void SceneViewLeft::pick(const QPoint & globalMousePos) {
     nearResult /= nearResult.w();
     farResult /= farResult.w();
 
+    // pick tolerance in model coordinates, at near and far plane (same points, moved by the tolerance in x direction)
+    QVector4D neaOffset = projectionMatrixInverted*QVector4D(nea.x() + m_pickTolerance/halfVpw, nea.y(), -1, 1.0);
+    QVector4D faOffset = projectionMatrixInverted*QVector4D(nea.x() + m_pickTolerance/halfVpw, nea.y(), 1, 1.0);
+    float nearTolerance = (neaOffset.toVector3D()/neaOffset.w() - nearResult.toVector3D()).length();
+    float farTolerance = (faOffset.toVector3D()/faOffset.w() - farResult.toVector3D()).length();
+
     // update pick line vertices (visualize pick line)
     m_context->makeCurrent(this);
     m_pickLineObject.setPoints(nearResult.toVector3D(), farResult.toVector3D());
 
     // now do the actual picking - for now we implement a selection
-    selectNearestObject(nearResult.toVector3D(), farResult.toVector3D());
+    selectNearestObject(nearResult.toVector3D(), farResult.toVector3D(), nearTolerance, farTolerance);
+}
+
+
+void SceneViewLeft::select(const QPoint & globalDownPos, const QPoint & globalReleasePos) {
+    // the point grid is built only after loading, streamed point clouds and sequences have no point grid
+    if (m_boxObject.loading() || m_outOfCore || m_sequencePlayback)
+        return;
+
+    QElapsedTimer selectTimer;
+    selectTimer.start();
+
+    ScreenSelection selection;
+    float worldToView[16];
+    m_worldToView.copyDataTo(worldToView);
+    bool lasso = m_keyboardMouseHandler.keyDown(Qt::Key_Shift) && m_selectionPath.size() >= 3;
+    if (lasso) {
+        std::vector<glm::vec2> polygon;
+        for (const QPoint & p : m_selectionPath)
+            polygon.push_back(mouseToNdc(mapFromGlobal(p), width(), height()));
+        polygon.push_back(mouseToNdc(mapFromGlobal(globalReleasePos), width(), height()));
+        selection.setLasso(worldToView, polygon);
+    }
+    else {
+        glm::vec2 a = mouseToNdc(mapFromGlobal(globalDownPos), width(), height());
+        glm::vec2 b = mouseToNdc(mapFromGlobal(globalReleasePos), width(), height());
+        selection.setRectangle(worldToView, a.x, a.y, b.x, b.y);
+    }
+
+    std::vector<unsigned int> ids;
+    m_boxObject.m_pointGrid.selectPoints(selection, ThreadPool::globalInstance(), ids);
+    double selectMs = selectTimer.nsecsElapsed()*1e-6;
+
+    // Mind: OpenGL-context must be current when we call this function!
+    m_context->makeCurrent(this);
+    m_boxObject.setSelection(ids);
+    qDebug().nospace() << (lasso ? "Lasso" : "Rectangle") << " selection: " << ids.size() << " points in "
+                       << selectMs << " ms";
 }
 
 
@@ -358,9 +544,15 @@ void SceneViewLeft::processInput() {
         m_camera.translate(wheelDelta * m_camera.forward() * transSpeed);
     }
 
-    // check for picking operation
+    // check for picking operation, or a selection if the mouse was dragged
     if (m_keyboardMouseHandler.buttonReleased(Qt::LeftButton)) {
-        pick(m_keyboardMouseHandler.mouseReleasePos());
+        QPoint downPos = m_selectionPath.isEmpty() ? m_keyboardMouseHandler.mouseDownPos() : m_selectionPath.first();
+        QPoint releasePos = m_keyboardMouseHandler.mouseReleasePos();
+        if ((releasePos - downPos).manhattanLength() >= SELECTION_MIN_DRAG)
+            select(downPos, releasePos);
+        else
+            pick(releasePos);
+        m_selectionPath.clear();
     }
 
     // finally, reset "WasPressed" key states
@@ -379,7 +571,9 @@ void SceneViewLeft::updateWorld2ViewMatrix() {
     m_worldToView = m_projection * m_camera.toMatrix() * m_transform.toMatrix();
 }
 
-void SceneViewLeft::selectNearestObject(const QVector3D & nearPoint, const QVector3D & farPoint) {
+void SceneViewLeft::selectNearestObject(const QVector3D & nearPoint, const QVector3D & farPoint,
+                                        float nearTolerance, float farTolerance)
+{
     QElapsedTimer pickTimer;
     pickTimer.start();
 
@@ -389,20 +583,121 @@ void SceneViewLeft::selectNearestObject(const QVector3D & nearPoint, const QVect
     // create pick object, distance is a value between 0 and 1, so initialize with 2 (very far back) to be on the safe side.
     PickObject p(2.f, std::numeric_limits<unsigned int>::max());
 
+    // sequence: the points of the displayed frame are tested
+    if (m_sequencePlayback) {
+        if (!m_sequence.pickPoint(qvec3toVec3(nearPoint), qvec3toVec3(farPoint), nearTolerance, farTolerance, p))
+            return; // nothing selected
+        qDebug().nospace() << "Pick successful (Point #" << p.m_objectId << " of frame " << m_sequence.displayedFrame() + 1
+                           << ", t = " << p.m_dist << ") after " << pickTimer.nsecsElapsed()*1e-6 << " ms";
+        return;
+    }
+
+    // streamed point cloud: only the tiles in host memory are tested
+    if (m_outOfCore) {
+        if (!m_pointStreamer.pickPoint(qvec3toVec3(nearPoint), qvec3toVec3(farPoint), nearTolerance, farTolerance, p))
+            return; // nothing selected
+        qDebug().nospace() << "Pick successful (Point #" << p.m_objectId << " of tile file, t = " << p.m_dist
+                           << ") after " << pickTimer.nsecsElapsed()*1e-6 << " ms";
+        return;
+    }
+
+    // point grid not built yet: test all points with the compute shader, the result is reported in pollGpuPick()
+    if (m_boxObject.m_pointGrid.empty()) {
+        m_boxObject.gpuPickPoint(m_gpuPicker, qvec3toVec3(nearPoint), qvec3toVec3(farPoint), nearTolerance, farTolerance);
+        renderLater();
+        return;
+    }
+
     // now process all objects and update p to hold the closest hit
     //m_boxObject.pick(nearPoint, d, p);
+    m_boxObject.pickPoint(qvec3toVec3(nearPoint), qvec3toVec3(farPoint), nearTolerance, farTolerance, p);
     // ... other objects
 
-    m_boxObject.pickPoint(qvec3toVec3(nearPoint), qvec3toVec3(farPoint));
-
     // any object accepted a pick?
-    //if (p.m_objectId == std::numeric_limits<unsigned int>::max())
-    //    return; // nothing selected
+    if (p.m_objectId == std::numeric_limits<unsigned int>::max())
+        return; // nothing selected
 
-    //qDebug().nospace() << "Pick successful (Box #"
-    //                   << p.m_objectId <<  ", Face #" << p.m_faceId << ", t = " << p.m_dist << ") after "
-    //                   << pickTimer.elapsed() << " ms";
+    qDebug().nospace() << "Pick successful (Point #"
+                       << p.m_objectId << ", t = " << p.m_dist << ") after "
+                       << pickTimer.nsecsElapsed()*1e-6 << " ms";
 
     // Mind: OpenGL-context must be current when we call this function!
     //m_boxObject.highlight(p.m_objectId, p.m_faceId);
 }
+
+
+void SceneViewLeft::renderIdPick() {
+    m_idPickRequested = false;
+    const qreal retinaScale = devicePixelRatio();
+    // points are drawn with 1 pixel, the pick window provides the tolerance
+    if (m_idPickBuffer.beginPick(int(width()*retinaScale), int(height()*retinaScale),
+                                 m_idPickPos.x(), m_idPickPos.y(), int(m_pickTolerance)))
+    {
+        SHADER(2)->bind();
+        SHADER(2)->setUniformValue(m_shaderPrograms[2].m_uniformIDs[0], m_worldToView);
+        SHADER(2)->setUniformValue(m_shaderPrograms[2].m_uniformIDs[1], GLuint(POINTCLOUD_PICK_ID));
+        m_boxObject.render();
+        SHADER(2)->release();
+    }
+    m_idPickBuffer.endPick(m_context->defaultFramebufferObject());
+}
+
+
+void SceneViewLeft::pollIdPick() {
+    if (!m_idPickBuffer.pickPending())
+        return;
+    IdPickResult res;
+    if (!m_idPickBuffer.pollResult(res)) {
+        renderLater(); // GPU not done yet, check again with the next frame
+        return;
+    }
+    if (res.m_objectId != POINTCLOUD_PICK_ID) {
+        qDebug().nospace() << "ID pick: nothing selected after " << m_idPickBuffer.m_lastPickMs << " ms";
+        return;
+    }
+    qDebug().nospace() << "ID pick successful (Point #" << res.m_vertexId << ") after "
+                       << m_idPickBuffer.m_lastPickMs << " ms";
+}
+
+
+void SceneViewLeft::pollGpuPick() {
+    if (!m_gpuPicker.pickPending())
+        return;
+    GpuPickResult res;
+    if (!m_gpuPicker.pollResult(res)) {
+        renderLater(); // GPU not done yet, check again with the next frame
+        return;
+    }
+    if (res.m_primitiveId == ~0u) {
+        qDebug().nospace() << "GPU pick: nothing selected after " << m_gpuPicker.m_lastPickMs << " ms";
+        return;
+    }
+    qDebug().nospace() << "GPU pick successful (Point #" << res.m_primitiveId << ", t = " << res.m_dist << ") after "
+                       << m_gpuPicker.m_lastPickMs << " ms";
+}
+
+
+void SceneViewLeft::processLoadEvents() {
+    // Mind: OpenGL-context must be current when we call this function!
+    QString status;
+    if (m_sequencePlayback)
+        status = m_sequence.statusText();
+    else if (m_outOfCore) {
+        m_pointStreamer.processLoadEvents();
+        status = m_pointStreamer.m_loader.statusText();
+        if (m_pointStreamer.m_loader.state() == BackgroundLoader::Finished)
+            status = QString("%1: %2 points in %3 tiles (streamed)").arg(status).arg(m_pointStreamer.pointCount())
+                    .arg(m_pointStreamer.tileCount());
+    }
+    else {
+        if (m_boxObject.processLoadEvents())
+            renderLater(); // upload the rest with the next frame
+        status = m_boxObject.m_loader.statusText();
+        if (m_boxObject.m_loader.state() == BackgroundLoader::Finished)
+            status = QString("%1: %2 points").arg(status).arg(m_boxObject.vertex_positions.size());
+    }
+    if (status != m_loadStatus) {
+        m_loadStatus = status;
+        emit loadProgress(status);
+    }
+}
@@ -6,14 +6,19 @@
 #include <QMatrix4x4>
 #include <QOpenGLTimeMonitor>
 #include <QElapsedTimer>
+#include <QPolygon>
 
 #include "OpenGLWindow.h"
 #include "ShaderProgram.h"
 #include "KeyboardMouseHandler.h"
 #include "GridObject.h"
 #include "BoxObject.h"
+#include "PointCloudStreamer.h"
+#include "PointCloudSequence.h"
 #include "PickLineObject.h"
 #include "Camera.h"
+#include "IdPickBuffer.h"
+#include "GpuPicker.h"
 
 
 /*! The class SceneView extends the primitive OpenGLWindow
@@ -22,10 +27,17 @@
 */
 
 class SceneViewLeft : public OpenGLWindow {
+    Q_OBJECT
 public:
     SceneViewLeft();
     virtual ~SceneViewLeft() override;
 
+signals:
+    /*! Emitted when the state of the background load of the point cloud changes
+        (see BackgroundLoader::statusText()).
+    */
+    void loadProgress(const QString & status);
+
 protected:
     void initializeGL() override;
     void resizeGL(int width, int height) override;
@@ -41,6 +53,11 @@ protected:
 
     void pick(const QPoint & globalMousePos);
 
+    /*! Selects all points inside the rectangle between the press and release position of the left mouse button
+        (both global), or inside the lasso m_selectionPath if Shift is held.
+    */
+    void select(const QPoint & globalDownPos, const QPoint & globalReleasePos);
+
 private:
     /*! Tests, if any relevant input was received and registers a state change. */
     void checkInput();
@@ -53,14 +70,37 @@ private:
     /*! Compines camera matrix and project matrix to form the world2view matrix. */
     void updateWorld2ViewMatrix();
 
-    /*! Determine which objects/planes are selected and color them accordingly.
-        nearPoint and farPoint define the current ray and are given in model coordinates.
+    /*! Determine which points are selected.
+        nearPoint and farPoint define the current ray and are given in model coordinates, nearTolerance and
+        farTolerance are the pick tolerance (m_pickTolerance) at nearPoint and farPoint in model coordinates.
+    */
+    void selectNearestObject(const QVector3D& nearPoint, const QVector3D& farPoint, float nearTolerance, float farTolerance);
+
+    /*! Renders the ID buffer pick requested in pick() and starts its readback. */
+    void renderIdPick();
+
+    /*! Checks if the result of an ID buffer pick is available and reports it, otherwise schedules
+        another repaint to check again.
     */
-    void selectNearestObject(const QVector3D& nearPoint, const QVector3D& farPoint);
+    void pollIdPick();
+
+    /*! Checks if the result of a compute shader pick (started in selectNearestObject()) is available and reports
+        it, otherwise schedules another repaint to check again.
+    */
+    void pollGpuPick();
+
+    /*! Uploads the points of the background load of m_boxObject (schedules another repaint while points are
+        left), or starts streaming when the tile file of m_pointStreamer is open, and emits loadProgress() when
+        the status of the load (or of the sequence playback) changes.
+    */
+    void processLoadEvents();
 
     /*! If set to true, an input event was received, which will be evaluated at next repaint. */
     bool						m_inputEventReceived;
 
+    /*! Max. distance in (device) pixels between mouse position and a picked point on screen. */
+    float						m_pickTolerance;
+
     /*! The input handler, that encapsulates the event handling code. */
     KeyboardMouseHandler		m_keyboardMouseHandler;
 
@@ -75,9 +115,36 @@ private:
     QList<ShaderProgram>		m_shaderPrograms;
 
     BoxObject					m_boxObject;
+    /*! Streams the point cloud from a tile file, used instead of m_boxObject if m_outOfCore is true
+        (PLY files that may not fit into memory).
+    */
+    PointCloudStreamer			m_pointStreamer;
+    bool						m_outOfCore = false;
+    /*! Plays a sequence of PLY files, used instead of m_boxObject if m_sequencePlayback is true
+        (command line option "--sequence <directory or file pattern>").
+    */
+    PointCloudSequence			m_sequence;
+    bool						m_sequencePlayback = false;
     GridObject					m_gridObject;
     PickLineObject				m_pickLineObject;
 
+    /*! Offscreen ID buffer for GPU picking (Ctrl + left click). */
+    IdPickBuffer				m_idPickBuffer;
+    /*! If true, an ID buffer pick at m_idPickPos (OpenGL window coordinates) is rendered in the next paintGL(). */
+    bool						m_idPickRequested = false;
+    QPoint						m_idPickPos;
+
+    /*! Brute-force picking with a compute shader, used while the point grid is not built yet. */
+    GpuPicker					m_gpuPicker;
+
+    /*! Mouse positions (global) recorded while the left button is held, starting with the press position.
+        Used as lasso outline when selecting with Shift held.
+    */
+    QPolygon					m_selectionPath;
+
+    /*! Status of the background load last emitted with loadProgress(). */
+    QString						m_loadStatus;
+
     QOpenGLTimeMonitor			m_gpuTimers;
     QElapsedTimer				m_cpuTimer;
 };
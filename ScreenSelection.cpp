@@ -0,0 +1,170 @@
+#include "ScreenSelection.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+
+#include <QtGlobal>
+
+#include "ThreadPool.h"
+
+/*! Number of blocks per thread in parallel selections, for load balancing (parts of the screen differ in cost). */
+static const unsigned int SELECTION_BLOCKS_PER_THREAD = 4;
+
+
+static inline float planeDistance(const float plane[4], const glm::vec3 & p) {
+    return plane[0]*p.x + plane[1]*p.y + plane[2]*p.z + plane[3];
+}
+
+
+void ScreenSelection::setRectangle(const float worldToView[16], float x1, float y1, float x2, float y2) {
+    m_polygon.clear();
+    setFrustum(worldToView, std::min(x1, x2), std::min(y1, y2), std::max(x1, x2), std::max(y1, y2));
+}
+
+
+void ScreenSelection::setLasso(const float worldToView[16], const std::vector<glm::vec2> & polygon) {
+    Q_ASSERT(polygon.size() >= 3);
+    glm::vec2 pMin = polygon[0], pMax = polygon[0];
+    for (const glm::vec2 & p : polygon) {
+        pMin = glm::vec2(std::min(pMin.x, p.x), std::min(pMin.y, p.y));
+        pMax = glm::vec2(std::max(pMax.x, p.x), std::max(pMax.y, p.y));
+    }
+    setFrustum(worldToView, pMin.x, pMin.y, pMax.x, pMax.y);
+    m_polygon = polygon;
+}
+
+
+void ScreenSelection::setFrustum(const float worldToView[16], float xMin, float yMin, float xMax, float yMax) {
+    std::memcpy(m_rows, worldToView, sizeof(m_rows));
+    // clip coordinates (x, y, z, w) = rows * p, a point is inside if xMin*w <= x <= xMax*w (same for y)
+    // and -w <= z <= w, i.e. each condition is a plane built from two rows
+    const float * rx = m_rows[0];
+    const float * ry = m_rows[1];
+    const float * rz = m_rows[2];
+    const float * rw = m_rows[3];
+    for (int i=0; i<4; ++i) {
+        m_planes[0][i] = rx[i] - xMin*rw[i];
+        m_planes[1][i] = xMax*rw[i] - rx[i];
+        m_planes[2][i] = ry[i] - yMin*rw[i];
+        m_planes[3][i] = yMax*rw[i] - ry[i];
+        m_planes[4][i] = rz[i] + rw[i];
+        m_planes[5][i] = rw[i] - rz[i];
+    }
+}
+
+
+bool ScreenSelection::contains(const glm::vec3 & p) const {
+    for (int i=0; i<6; ++i)
+        if (planeDistance(m_planes[i], p) < 0)
+            return false;
+    if (m_polygon.empty())
+        return true;
+    // project into NDC, w > 0 is guaranteed by the frustum planes
+    const float w = planeDistance(m_rows[3], p);
+    return insidePolygon(planeDistance(m_rows[0], p)/w, planeDistance(m_rows[1], p)/w);
+}
+
+
+ScreenSelection::Overlap ScreenSelection::classifyBox(const glm::vec3 & boxMin, const glm::vec3 & boxMax) const {
+    bool inside = true;
+    for (int i=0; i<6; ++i) {
+        const float * plane = m_planes[i];
+        // corner farthest in direction of the plane normal (positive vertex) and the opposite corner
+        glm::vec3 pos(plane[0] >= 0 ? boxMax.x : boxMin.x, plane[1] >= 0 ? boxMax.y : boxMin.y,
+                      plane[2] >= 0 ? boxMax.z : boxMin.z);
+        glm::vec3 neg(plane[0] >= 0 ? boxMin.x : boxMax.x, plane[1] >= 0 ? boxMin.y : boxMax.y,
+                      plane[2] >= 0 ? boxMin.z : boxMax.z);
+        if (planeDistance(plane, pos) < 0)
+            return OUTSIDE;
+        if (planeDistance(plane, neg) < 0)
+            inside = false;
+    }
+    if (m_polygon.empty())
+        return inside ? INSIDE : PARTIAL;
+
+    // lasso: bounding rectangle of the projected corners, only possible if all corners are in front of the camera
+    glm::vec2 rectMin(FLT_MAX, FLT_MAX), rectMax(-FLT_MAX, -FLT_MAX);
+    for (int c=0; c<8; ++c) {
+        const glm::vec3 corner(c & 1 ? boxMax.x : boxMin.x, c & 2 ? boxMax.y : boxMin.y, c & 4 ? boxMax.z : boxMin.z);
+        const float w = planeDistance(m_rows[3], corner);
+        if (!(w > 0))
+            return PARTIAL;
+        const float x = planeDistance(m_rows[0], corner)/w;
+        const float y = planeDistance(m_rows[1], corner)/w;
+        rectMin = glm::vec2(std::min(rectMin.x, x), std::min(rectMin.y, y));
+        rectMax = glm::vec2(std::max(rectMax.x, x), std::max(rectMax.y, y));
+    }
+    // if no edge of the polygon crosses the rectangle, the rectangle is either entirely inside or outside
+    const std::size_t n = m_polygon.size();
+    for (std::size_t i=0, j=n - 1; i<n; j = i++)
+        if (edgeIntersectsRect(m_polygon[j], m_polygon[i], rectMin, rectMax))
+            return PARTIAL;
+    if (!insidePolygon(rectMin.x, rectMin.y))
+        return OUTSIDE;
+    return inside ? INSIDE : PARTIAL;
+}
+
+
+void ScreenSelection::selectPoints(const glm::vec3 * points, std::size_t count, ThreadPool & pool,
+                                   std::vector<unsigned int> & ids) const
+{
+    std::vector<std::vector<unsigned int> > blockIds(SELECTION_BLOCKS_PER_THREAD*pool.threadCount());
+    pool.parallelFor(count, (unsigned int)blockIds.size(), [&](std::size_t first, std::size_t last, unsigned int block) {
+        std::vector<unsigned int> & out = blockIds[block];
+        for (std::size_t i=first; i<last; ++i)
+            if (contains(points[i]))
+                out.push_back((unsigned int)i);
+    });
+    concatenateSelections(blockIds, ids);
+}
+
+
+bool ScreenSelection::edgeIntersectsRect(const glm::vec2 & a, const glm::vec2 & b, const glm::vec2 & rectMin,
+                                         const glm::vec2 & rectMax)
+{
+    if (std::max(a.x, b.x) < rectMin.x || std::min(a.x, b.x) > rectMax.x ||
+        std::max(a.y, b.y) < rectMin.y || std::min(a.y, b.y) > rectMax.y)
+    {
+        return false;
+    }
+    // the segment's line crosses the rectangle if not all corners are strictly on the same side of it
+    int positive = 0, negative = 0;
+    for (int c=0; c<4; ++c) {
+        const float x = c & 1 ? rectMax.x : rectMin.x;
+        const float y = c & 2 ? rectMax.y : rectMin.y;
+        const float side = (b.x - a.x)*(y - a.y) - (b.y - a.y)*(x - a.x);
+        if (side >= 0)
+            ++positive;
+        if (side <= 0)
+            ++negative;
+    }
+    return positive != 0 && negative != 0;
+}
+
+
+bool ScreenSelection::insidePolygon(float x, float y) const {
+    // count crossings of the horizontal ray from (x, y) to the right with the polygon edges
+    bool inside = false;
+    const std::size_t n = m_polygon.size();
+    for (std::size_t i=0, j=n - 1; i<n; j = i++) {
+        const glm::vec2 & a = m_polygon[i];
+        const glm::vec2 & b = m_polygon[j];
+        if ((a.y > y) != (b.y > y) && x < a.x + (y - a.y)*(b.x - a.x)/(b.y - a.y))
+            inside = !inside;
+    }
+    return inside;
+}
+
+
+void concatenateSelections(std::vector<std::vector<unsigned int> > & blockIds, std::vector<unsigned int> & ids) {
+    std::size_t count = 0;
+    for (const std::vector<unsigned int> & b : blockIds)
+        count += b.size();
+    ids.clear();
+    ids.reserve(count);
+    for (std::vector<unsigned int> & b : blockIds) {
+        ids.insert(ids.end(), b.begin(), b.end());
+        std::vector<unsigned int>().swap(b);
+    }
+}
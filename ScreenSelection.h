@@ -0,0 +1,80 @@
+#ifndef SCREENSELECTION_H
+#define SCREENSELECTION_H
+
+#include <cstddef>
+#include <vector>
+
+#include <glm.hpp>
+
+class ThreadPool;
+
+/*! A selection region on screen, either a rectangle (marquee) or a lasso polygon, and the part of model space
+    that is seen through it.
+
+    The region is given in normalized device coordinates (NDC, -1..1) together with the world-to-view matrix.
+    A rectangle selects the frustum between its corners, clipped by near and far plane. Its six planes are
+    derived directly from the rows of the matrix, so that points (and boxes) are classified in model
+    coordinates without transforming them. A lasso selects the frustum of its bounding rectangle, intersected
+    with the polygon (tested on the projected points).
+
+    All functions are const and can be called from several threads at once.
+*/
+class ScreenSelection {
+public:
+    /*! Result of classifyBox(). */
+    enum Overlap {
+        OUTSIDE,	// box is entirely outside, none of its points can be selected
+        PARTIAL,	// box may be partially inside, points must be tested individually
+        INSIDE		// box is entirely inside, all of its points are selected
+    };
+
+    /*! Selects the rectangle between the corners (x1, y1) and (x2, y2) in NDC.
+        worldToView is the world-to-view (model-view-projection) matrix in row-major order,
+        as returned by QMatrix4x4::copyDataTo().
+    */
+    void setRectangle(const float worldToView[16], float x1, float y1, float x2, float y2);
+
+    /*! Selects the area enclosed by the polygon (NDC, at least 3 points, closed implicitly, may be self-intersecting,
+        the even-odd rule applies).
+    */
+    void setLasso(const float worldToView[16], const std::vector<glm::vec2> & polygon);
+
+    /*! Returns true if the point is selected. */
+    bool contains(const glm::vec3 & p) const;
+
+    /*! Classifies the axis-aligned box against the selection. For lassos, the bounding rectangle of the projected
+        box is tested against the polygon: it is entirely inside or outside if no polygon edge crosses it.
+    */
+    Overlap classifyBox(const glm::vec3 & boxMin, const glm::vec3 & boxMax) const;
+
+    /*! Selects the points that are inside the selection, in parallel on the thread pool, and stores their indexes
+        in ids (ascending).
+    */
+    void selectPoints(const glm::vec3 * points, std::size_t count, ThreadPool & pool, std::vector<unsigned int> & ids) const;
+
+private:
+    /*! Computes matrix rows and the frustum planes of the rectangle [xMin, xMax] x [yMin, yMax]. */
+    void setFrustum(const float worldToView[16], float xMin, float yMin, float xMax, float yMax);
+
+    /*! Returns true if the segment a-b may intersect the rectangle (conservative at the corners). */
+    static bool edgeIntersectsRect(const glm::vec2 & a, const glm::vec2 & b, const glm::vec2 & rectMin,
+                                   const glm::vec2 & rectMax);
+
+    /*! Even-odd test of the projected point against m_polygon. */
+    bool insidePolygon(float x, float y) const;
+
+    /*! Rows of the world-to-view matrix. */
+    float					m_rows[4][4];
+    /*! Planes (a, b, c, d) of the selection frustum: left, right, bottom, top, near, far.
+        A point p is inside if a*p.x + b*p.y + c*p.z + d >= 0 for all planes.
+    */
+    float					m_planes[6][4];
+    /*! Lasso polygon in NDC, empty for rectangles. */
+    std::vector<glm::vec2>	m_polygon;
+};
+
+
+/*! Concatenates the ID lists of all blocks (in block order) into ids and releases their memory. */
+void concatenateSelections(std::vector<std::vector<unsigned int> > & blockIds, std::vector<unsigned int> & ids);
+
+#endif // SCREENSELECTION_H
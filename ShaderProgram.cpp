@@ -5,9 +5,11 @@
 
 #include "OpenGLException.h"
 
-ShaderProgram::ShaderProgram(const QString & vertexShaderFilePath, const QString & fragmentShaderFilePath) :
+ShaderProgram::ShaderProgram(const QString & vertexShaderFilePath, const QString & fragmentShaderFilePath,
+                             const QString & geometryShaderFilePath) :
     m_vertexShaderFilePath(vertexShaderFilePath),
     m_fragmentShaderFilePath(fragmentShaderFilePath),
+    m_geometryShaderFilePath(geometryShaderFilePath),
     m_program(nullptr)
 {
 }
@@ -29,6 +31,12 @@ void ShaderProgram::create() {
     if (!m_program->addShaderFromSourceFile(QOpenGLShader::Fragment, m_fragmentShaderFilePath))
         throw OpenGLException(QString("Error compiling fragment shader %1:\n%2").arg(m_fragmentShaderFilePath).arg(m_program->log()), FUNC_ID);
 
+    if (!m_geometryShaderFilePath.isEmpty() &&
+        !m_program->addShaderFromSourceFile(QOpenGLShader::Geometry, m_geometryShaderFilePath))
+    {
+        throw OpenGLException(QString("Error compiling geometry shader %1:\n%2").arg(m_geometryShaderFilePath).arg(m_program->log()), FUNC_ID);
+    }
+
     if (!m_program->link())
         throw OpenGLException(QString("Shader linker error:\n%2").arg(m_program->log()), FUNC_ID);
 
@@ -20,7 +20,8 @@ QT_END_NAMESPACE
 class ShaderProgram {
 public:
     ShaderProgram();
-    ShaderProgram(const QString & vertexShaderFilePath, const QString & fragmentShaderFilePath);
+    ShaderProgram(const QString & vertexShaderFilePath, const QString & fragmentShaderFilePath,
+                  const QString & geometryShaderFilePath = QString());
 
     /*! Creates shader program, compiles and links the programs. */
     void create();
@@ -34,6 +35,8 @@ public:
     QString		m_vertexShaderFilePath;
     /*! Path to fragment shader program, used in create(). */
     QString		m_fragmentShaderFilePath;
+    /*! Path to (optional) geometry shader program, used in create(). */
+    QString		m_geometryShaderFilePath;
 
 
     // Note: Uniform-Handling is pretty simple, probably better to wrap that somehow.
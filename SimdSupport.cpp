@@ -0,0 +1,69 @@
+#include "SimdSupport.h"
+
+#include <atomic>
+
+#if defined(SIMD_X86) && defined(_MSC_VER)
+    #include <intrin.h>
+    #include <immintrin.h>
+#endif
+
+static SimdLevel detectSimdLevel() {
+#if defined(SIMD_X86)
+    #if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+    __cpuid(info, 1);
+    const bool sse2 = (info[3] & (1 << 26)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    bool avx2 = false;
+    // AVX registers must also be saved by the operating system
+    if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+    #else
+    __builtin_cpu_init();
+    const bool sse2 = __builtin_cpu_supports("sse2");
+    const bool avx2 = __builtin_cpu_supports("avx2");
+    #endif
+    if (avx2)
+        return SIMD_AVX2;
+    if (sse2)
+        return SIMD_SSE;
+#endif
+    return SIMD_SCALAR;
+}
+
+
+SimdLevel cpuSimdLevel() {
+    static const SimdLevel level = detectSimdLevel();
+    return level;
+}
+
+
+/*! Selected level, -1 = not selected, use cpuSimdLevel(). */
+static std::atomic<int> selectedSimdLevel(-1);
+
+SimdLevel simdLevel() {
+    int level = selectedSimdLevel.load(std::memory_order_relaxed);
+    return level == -1 ? cpuSimdLevel() : SimdLevel(level);
+}
+
+
+void setSimdLevel(SimdLevel level) {
+    if (level > cpuSimdLevel())
+        level = cpuSimdLevel();
+    selectedSimdLevel = level;
+}
+
+
+const char * simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SIMD_SCALAR	: return "scalar";
+        case SIMD_SSE		: return "SSE2";
+        case SIMD_AVX2		: return "AVX2";
+        default				: return "unknown";
+    }
+}
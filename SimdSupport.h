@@ -0,0 +1,38 @@
+#ifndef SIMDSUPPORT_H
+#define SIMDSUPPORT_H
+
+/*! Instruction set levels of the SIMD kernels, each level includes the ones below. */
+enum SimdLevel {
+    SIMD_SCALAR,	// plain C++
+    SIMD_SSE,		// SSE2, 4 floats per instruction (always available on x86-64)
+    SIMD_AVX2,		// AVX2, 8 floats/ints per instruction
+    NUM_SIMD_LEVELS
+};
+
+// Kernels for x86 instruction sets are compiled into the regular translation units, functions using
+// AVX2 intrinsics are marked with SIMD_TARGET_AVX2 so that no global compiler flags are needed.
+// They must only be called if cpuSimdLevel() reports support.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define SIMD_X86
+    #if defined(_MSC_VER) && !defined(__clang__)
+        #define SIMD_TARGET_AVX2
+    #else
+        #define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+    #endif
+#endif
+
+/*! Highest level supported by CPU and operating system, detected once. */
+SimdLevel cpuSimdLevel();
+
+/*! Level to be used by the kernels, by default cpuSimdLevel(). */
+SimdLevel simdLevel();
+
+/*! Restricts the kernels to the given level (e.g. for benchmarks), levels above cpuSimdLevel() are
+    reduced to cpuSimdLevel().
+*/
+void setSimdLevel(SimdLevel level);
+
+/*! Name of the level for output. */
+const char * simdLevelName(SimdLevel level);
+
+#endif // SIMDSUPPORT_H
@@ -0,0 +1,50 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+/*! Bounded lock-free queue for exactly one producer thread and one consumer thread.
+
+    The items are stored in a ring buffer of Capacity entries. The producer only writes m_tail, the consumer only
+    writes m_head, each publishes its index with release semantics after accessing the item, so an item is
+    completely written before the consumer sees it (and everything the producer wrote before push() is visible to
+    the consumer after pop()). push() and pop() never block, push() returns false if the queue is full.
+*/
+template <typename T, std::size_t Capacity>
+class SpscQueue {
+public:
+    /*! Producer thread: appends value, returns false if the queue is full. */
+    bool push(const T & value) {
+        const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == Capacity)
+            return false;
+        m_items[tail % Capacity] = value;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /*! Consumer thread: removes the oldest item and stores it in value, returns false if the queue is empty. */
+    bool pop(T & value) {
+        const std::size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+            return false;
+        value = m_items[head % Capacity];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /*! Consumer thread: removes all items. */
+    void clear() {
+        m_head.store(m_tail.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+private:
+    T							m_items[Capacity];
+    /*! Number of items popped so far, own cache line to avoid false sharing with m_tail. */
+    alignas(64) std::atomic<std::size_t>	m_head{0};
+    /*! Number of items pushed so far. */
+    alignas(64) std::atomic<std::size_t>	m_tail{0};
+};
+
+#endif // SPSCQUEUE_H
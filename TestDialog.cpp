@@ -62,6 +62,10 @@ TestDialog::TestDialog() :
     objInfo->setWordWrap(true);
     objInfo->setText("-Vieport Right-");
 
+    // show the progress of the background loads in the info labels
+    connect(m_sceneViewLeft, &SceneViewLeft::loadProgress, plyInfo, &QLabel::setText);
+    connect(m_sceneViewRight, &SceneView::loadProgress, objInfo, &QLabel::setText);
+
     // now create some buttons at the bottom
     connect(addPlyFile, &QPushButton::clicked, this, &TestDialog::handleButton);
 
@@ -79,7 +83,9 @@ TestDialog::TestDialog() :
     navigationInfo->setWordWrap(true);
     navigationInfo->setText("Hold right mouse button for free mouse look and to navigate "
         "with keys WASDQE. Hold shift to slow down. Use scroll-wheel to move quickly forward and backward. "
-        "Use left-click to select objects.");
+        "Use left-click to select objects, Ctrl + left-click to select objects with the GPU ID buffer. "
+        "Drag with the left mouse button to select all points/vertexes inside a rectangle, hold shift while "
+        "dragging to select with a lasso. In the mesh view, the vertex under the mouse cursor is highlighted.");
     hlay->addWidget(navigationInfo);
 
     QPushButton* closeBtn = new QPushButton(tr("Close"), this);
@@ -0,0 +1,85 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned int threadCount) :
+    m_nextTask(0)
+{
+    if (threadCount == 0)
+        threadCount = std::thread::hardware_concurrency();
+    // the calling thread always participates, so we need one worker less
+    for (unsigned int i=1; i<threadCount; ++i)
+        m_workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wakeCondition.notify_all();
+    for (std::thread & t : m_workers)
+        t.join();
+}
+
+
+ThreadPool & ThreadPool::globalInstance() {
+    static ThreadPool pool;
+    return pool;
+}
+
+
+void ThreadPool::run(unsigned int taskCount, const std::function<void(unsigned int)> & func) {
+    if (taskCount == 0)
+        return;
+    // nothing to distribute? run directly in calling thread
+    if (taskCount == 1 || m_workers.empty()) {
+        for (unsigned int i=0; i<taskCount; ++i)
+            func(i);
+        return;
+    }
+
+    std::lock_guard<std::mutex> runLock(m_runMutex);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_func = &func;
+        m_taskCount = taskCount;
+        m_nextTask = 0;
+        m_activeWorkers = m_workers.size();
+        ++m_generation;
+    }
+    m_wakeCondition.notify_all();
+
+    // calling thread helps out
+    processTasks();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_doneCondition.wait(lock, [this]() { return m_activeWorkers == 0; });
+    m_func = nullptr;
+}
+
+
+void ThreadPool::workerLoop() {
+    unsigned long long lastGeneration = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeCondition.wait(lock, [&]() { return m_stop || m_generation != lastGeneration; });
+            if (m_stop)
+                return;
+            lastGeneration = m_generation;
+        }
+
+        processTasks();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_activeWorkers == 0)
+            m_doneCondition.notify_one();
+    }
+}
+
+
+void ThreadPool::processTasks() {
+    unsigned int taskIndex;
+    while ((taskIndex = m_nextTask.fetch_add(1)) < m_taskCount)
+        (*m_func)(taskIndex);
+}
@@ -0,0 +1,83 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*! A minimal fork-join thread pool for data-parallel loops (parsing, buffer generation, picking, ...).
+
+    The worker threads are created once and sleep until run() is called. run() distributes task indexes
+    across the workers and the calling thread, and returns once all tasks have been processed.
+
+    Tasks must not throw and must not call run() of the same pool (no nesting). Concurrent calls to run()
+    from different threads are serialized.
+
+    Use globalInstance() to share one pool (sized to the number of hardware threads) in the application.
+*/
+class ThreadPool {
+public:
+    /*! Creates a pool that runs tasks on threadCount threads in total (including the calling thread).
+        threadCount = 0 selects the number of hardware threads.
+    */
+    explicit ThreadPool(unsigned int threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool & operator=(const ThreadPool &) = delete;
+
+    /*! The application-wide pool. */
+    static ThreadPool & globalInstance();
+
+    /*! Number of threads that process tasks, including the thread calling run(). */
+    unsigned int threadCount() const { return (unsigned int)m_workers.size() + 1; }
+
+    /*! Calls func(taskIndex) for all taskIndex in [0, taskCount) and blocks until all calls have returned. */
+    void run(unsigned int taskCount, const std::function<void(unsigned int)> & func);
+
+    /*! Splits the range [0, count) into (at most) blockCount contiguous blocks of similar size and calls
+        func(begin, end, blockIndex) for each block in parallel.
+        blockCount = 0 selects threadCount() blocks.
+    */
+    template <typename Func>
+    void parallelFor(std::size_t count, unsigned int blockCount, Func func) {
+        if (count == 0)
+            return;
+        if (blockCount == 0)
+            blockCount = threadCount();
+        if (blockCount > count)
+            blockCount = (unsigned int)count;
+        run(blockCount, [&](unsigned int blockIndex) {
+            std::size_t begin = count*blockIndex/blockCount;
+            std::size_t end = count*(blockIndex + 1)/blockCount;
+            func(begin, end, blockIndex);
+        });
+    }
+
+private:
+    void workerLoop();
+    void processTasks();
+
+    std::vector<std::thread>	m_workers;
+
+    /*! Serializes calls to run(). */
+    std::mutex					m_runMutex;
+
+    /*! Protects job state below and is used with both condition variables. */
+    std::mutex					m_mutex;
+    std::condition_variable		m_wakeCondition;	// signals workers that a new job is available
+    std::condition_variable		m_doneCondition;	// signals run() that all workers are done
+
+    const std::function<void(unsigned int)> *m_func = nullptr;
+    unsigned int				m_taskCount = 0;
+    std::atomic<unsigned int>	m_nextTask;
+    std::size_t					m_activeWorkers = 0;
+    unsigned long long			m_generation = 0;	// incremented for each job
+    bool						m_stop = false;
+};
+
+#endif // THREADPOOL_H
@@ -0,0 +1,160 @@
+#include "VertexWelder.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "ThreadPool.h"
+
+/*! Integer key of a position, either its bit pattern or its grid cell. */
+struct WeldKey {
+    std::int64_t m_x, m_y, m_z;
+
+    bool operator==(const WeldKey & other) const {
+        return m_x == other.m_x && m_y == other.m_y && m_z == other.m_z;
+    }
+};
+
+
+static inline std::int64_t floatBits(float f) {
+    f += 0.0f; // turns -0 into +0
+    std::uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+
+static inline WeldKey weldKey(const glm::vec3 & p, double invTolerance) {
+    if (invTolerance == 0)
+        return WeldKey{ floatBits(p.x), floatBits(p.y), floatBits(p.z) };
+    return WeldKey{ std::int64_t(std::floor(p.x*invTolerance)),
+                    std::int64_t(std::floor(p.y*invTolerance)),
+                    std::int64_t(std::floor(p.z*invTolerance)) };
+}
+
+
+static inline std::uint64_t mixHash(std::uint64_t h) {
+    // finalizer of MurmurHash3
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+static inline std::uint64_t hashKey(const WeldKey & k) {
+    return mixHash(std::uint64_t(k.m_x) ^ mixHash(std::uint64_t(k.m_y) ^ mixHash(std::uint64_t(k.m_z))));
+}
+
+
+void weldVertices(const glm::vec3 * positions, std::size_t count, float tolerance, ThreadPool & pool,
+                  std::vector<glm::vec3> & uniquePositions, std::vector<unsigned int> & remap)
+{
+    const double invTolerance = tolerance > 0 ? 1.0/tolerance : 0.0;
+    const unsigned int blockCount = pool.threadCount();
+    // number of hash shards, power of 2 and a few per thread for load balancing
+    unsigned int shardBits = 0;
+    while ((1u << shardBits) < 4*blockCount)
+        ++shardBits;
+    const unsigned int shardCount = 1u << shardBits;
+    // shard is selected by the upper hash bits, hash table slots by the lower bits
+    auto shardOf = [shardBits](std::uint64_t hash) -> unsigned int {
+        return shardBits == 0 ? 0 : (unsigned int)(hash >> (64 - shardBits));
+    };
+
+    // *** hash all keys and count shard sizes per block
+    std::vector<std::uint64_t> hashes(count);
+    std::vector<std::size_t> shardOffsets(std::size_t(blockCount)*shardCount, 0);
+    pool.parallelFor(count, blockCount, [&](std::size_t first, std::size_t last, unsigned int block) {
+        std::size_t * counts = shardOffsets.data() + std::size_t(block)*shardCount;
+        for (std::size_t i=first; i<last; ++i) {
+            hashes[i] = hashKey(weldKey(positions[i], invTolerance));
+            ++counts[shardOf(hashes[i])];
+        }
+    });
+
+    // exclusive prefix sums, shard-major, so that each shard is a contiguous range ordered by block
+    std::vector<std::size_t> shardBegin(shardCount + 1);
+    std::size_t offset = 0;
+    for (unsigned int s=0; s<shardCount; ++s) {
+        shardBegin[s] = offset;
+        for (unsigned int b=0; b<blockCount; ++b) {
+            std::size_t & c = shardOffsets[std::size_t(b)*shardCount + s];
+            std::size_t n = c;
+            c = offset;
+            offset += n;
+        }
+    }
+    shardBegin[shardCount] = offset;
+
+    // *** scatter vertex indexes into shards, within a shard indexes remain in ascending order
+    std::vector<unsigned int> order(count);
+    pool.parallelFor(count, blockCount, [&](std::size_t first, std::size_t last, unsigned int block) {
+        std::size_t * offsets = shardOffsets.data() + std::size_t(block)*shardCount;
+        for (std::size_t i=first; i<last; ++i)
+            order[offsets[shardOf(hashes[i])]++] = (unsigned int)i;
+    });
+
+    // *** find representative (first occurrence) for each vertex, one hash table per shard
+    std::vector<unsigned int> representative(count);
+    const unsigned int EMPTY = ~0u;
+    pool.run(shardCount, [&](unsigned int s) {
+        const std::size_t n = shardBegin[s+1] - shardBegin[s];
+        if (n == 0)
+            return;
+        std::size_t tableSize = 1;
+        while (tableSize < 2*n)
+            tableSize *= 2;
+        std::vector<unsigned int> table(tableSize, EMPTY);
+        for (std::size_t j=shardBegin[s]; j<shardBegin[s+1]; ++j) {
+            const unsigned int i = order[j];
+            const WeldKey key = weldKey(positions[i], invTolerance);
+            std::size_t slot = hashes[i] & (tableSize - 1);
+            for (;;) {
+                unsigned int other = table[slot];
+                if (other == EMPTY) {
+                    table[slot] = i;
+                    representative[i] = i;
+                    break;
+                }
+                if (hashes[other] == hashes[i] && weldKey(positions[other], invTolerance) == key) {
+                    representative[i] = other;
+                    break;
+                }
+                slot = (slot + 1) & (tableSize - 1);
+            }
+        }
+    });
+
+    // *** number unique vertexes in order of first occurrence
+    std::vector<std::size_t> uniqueOffsets(blockCount + 1, 0);
+    pool.parallelFor(count, blockCount, [&](std::size_t first, std::size_t last, unsigned int block) {
+        std::size_t n = 0;
+        for (std::size_t i=first; i<last; ++i)
+            if (representative[i] == i)
+                ++n;
+        uniqueOffsets[block + 1] = n;
+    });
+    for (unsigned int b=0; b<blockCount; ++b)
+        uniqueOffsets[b + 1] += uniqueOffsets[b];
+
+    uniquePositions.resize(uniqueOffsets[blockCount]);
+    remap.resize(count);
+    pool.parallelFor(count, blockCount, [&](std::size_t first, std::size_t last, unsigned int block) {
+        std::size_t id = uniqueOffsets[block];
+        for (std::size_t i=first; i<last; ++i) {
+            if (representative[i] == i) {
+                uniquePositions[id] = positions[i];
+                remap[i] = (unsigned int)id++;
+            }
+        }
+    });
+    // duplicates get the id of their representative (which has been assigned above)
+    pool.parallelFor(count, blockCount, [&](std::size_t first, std::size_t last, unsigned int) {
+        for (std::size_t i=first; i<last; ++i)
+            if (representative[i] != i)
+                remap[i] = remap[representative[i]];
+    });
+}
@@ -0,0 +1,31 @@
+#ifndef VERTEXWELDER_H
+#define VERTEXWELDER_H
+
+#include <cstddef>
+#include <vector>
+
+#include <glm.hpp>
+
+class ThreadPool;
+
+/*! Merges duplicate vertex positions.
+
+    With tolerance = 0, only bit-identical positions are merged (+0 and -0 are treated as equal).
+    With tolerance > 0, positions are snapped to a grid with the given cell size and positions falling
+    into the same cell are merged (mind: two positions closer than tolerance may still end up in neighboring
+    cells and are then kept).
+
+    The work is done in parallel on the thread pool: position keys are hashed and scattered into hash
+    shards (keeping the original order), each shard is deduplicated with its own open-addressing table,
+    and finally the unique vertexes are numbered in order of their first occurrence. The result is therefore
+    deterministic and independent of the number of threads.
+
+    \param positions Input positions.
+    \param count Number of input positions.
+    \param uniquePositions Receives the unique positions (first occurrence of each group).
+    \param remap Receives for each input position the index of its unique position.
+*/
+void weldVertices(const glm::vec3 * positions, std::size_t count, float tolerance, ThreadPool & pool,
+                  std::vector<glm::vec3> & uniquePositions, std::vector<unsigned int> & remap);
+
+#endif // VERTEXWELDER_H
@@ -8,6 +8,7 @@
 
 #include "OpenGLException.h"
 #include "DebugApplication.h"
+#include "Benchmarks.h"
 
 void qDebugMsgHandler(QtMsgType type, const QMessageLogContext &context, const QString &msg) {
     (void) context;
@@ -32,6 +33,57 @@ int main(int argc, char **argv) {
 
     srand(time(nullptr));
 
+    // command line benchmarks, run without opening the dialog:
+    //   --benchmark-obj <file.obj>
+    //   --benchmark-boxes <box count>
+    //   --benchmark-pick <box count>
+    //   --benchmark-bvh <file.obj>
+    //   --benchmark-points <point count>
+    //   --benchmark-rays <file.obj>
+    //   --benchmark-refit <file.obj>
+    //   --benchmark-knn <point count>
+    QStringList args = app.arguments();
+    int argIdx = args.indexOf("--benchmark-obj");
+    if (argIdx != -1 && argIdx + 1 < args.size()) {
+        benchmarkObjParsing(args[argIdx + 1].toLocal8Bit().constData());
+        return 0;
+    }
+    argIdx = args.indexOf("--benchmark-boxes");
+    if (argIdx != -1 && argIdx + 1 < args.size()) {
+        benchmarkBoxBufferGeneration(args[argIdx + 1].toULongLong());
+        return 0;
+    }
+    argIdx = args.indexOf("--benchmark-pick");
+    if (argIdx != -1 && argIdx + 1 < args.size()) {
+        benchmarkBoxPicking(args[argIdx + 1].toULongLong());
+        return 0;
+    }
+    argIdx = args.indexOf("--benchmark-bvh");
+    if (argIdx != -1 && argIdx + 1 < args.size()) {
+        benchmarkBvhPicking(args[argIdx + 1].toLocal8Bit().constData());
+        return 0;
+    }
+    argIdx = args.indexOf("--benchmark-points");
+    if (argIdx != -1 && argIdx + 1 < args.size()) {
+        benchmarkPointPicking(args[argIdx + 1].toULongLong());
+        return 0;
+    }
+    argIdx = args.indexOf("--benchmark-rays");
+    if (argIdx != -1 && argIdx + 1 < args.size()) {
+        benchmarkBatchPicking(args[argIdx + 1].toLocal8Bit().constData());
+        return 0;
+    }
+    argIdx = args.indexOf("--benchmark-refit");
+    if (argIdx != -1 && argIdx + 1 < args.size()) {
+        benchmarkBvhRefit(args[argIdx + 1].toLocal8Bit().constData());
+        return 0;
+    }
+    argIdx = args.indexOf("--benchmark-knn");
+    if (argIdx != -1 && argIdx + 1 < args.size()) {
+        benchmarkNearestNeighbors(args[argIdx + 1].toULongLong());
+        return 0;
+    }
+
     TestDialog dlg;
     dlg.show();
     return app.exec();
@@ -0,0 +1,19 @@
+#version 440
+
+// GLSL version 4.4
+// vertex shader for instanced boxes, one instance per box
+
+layout(location = 0) in vec3 position;    // input:  corner of unit cube (-1..1)
+layout(location = 1) in float shade;      // input:  brightness factor of corner
+layout(location = 2) in vec3 center;      // input:  box center, per instance
+layout(location = 3) in float halfExtent; // input:  half edge length of box, per instance
+layout(location = 4) in vec4 color;       // input:  box color (rgba), per instance
+out vec4 fragColor;                       // output: computed fragmentation color
+
+uniform mat4 worldToView;            // parameter: the camera matrix
+
+void main() {
+  // Mind multiplication order for matrixes
+  gl_Position = worldToView * vec4(center + halfExtent*position, 1.0);
+  fragColor = vec4(shade*color.rgb, 1.0);
+}
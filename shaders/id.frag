@@ -0,0 +1,20 @@
+#version 440 core
+
+// fragment shader for ID picking, writes into a GL_RGBA32UI color buffer
+
+flat in uint primitiveId;   // input: primitive (triangle/point) index
+flat in uvec3 vertexIds;    // input: vertex indexes of the primitive
+in vec3 barycentric;        // input: interpolated weights of the vertexes
+out uvec4 pickId;           // output: object ID, primitive index, index of nearest vertex
+
+uniform uint objectId;      // parameter: ID of the object, must not be 0 (0 = background)
+
+void main() {
+  // the vertex with the largest weight is nearest to the fragment
+  uint v = vertexIds.x;
+  if (barycentric.y > barycentric.x && barycentric.y >= barycentric.z)
+    v = vertexIds.y;
+  else if (barycentric.z > barycentric.x && barycentric.z > barycentric.y)
+    v = vertexIds.z;
+  pickId = uvec4(objectId, primitiveId, v, 0u);
+}
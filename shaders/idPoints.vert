@@ -0,0 +1,19 @@
+#version 440
+
+// GLSL version 4.4
+// vertex shader for ID picking of points, the point index is both primitive and vertex index
+
+layout(location = 0) in vec3 position; // input:  attribute with index '0' with 3 elements per vertex
+flat out uint primitiveId;             // output: point index
+flat out uvec3 vertexIds;              // output: point index (same interface as idTriangles.geom)
+out vec3 barycentric;                  // output: weights, only the first vertex is used
+
+uniform mat4 worldToView;            // parameter: the camera matrix
+
+void main() {
+  // Mind multiplication order for matrixes
+  gl_Position = worldToView * vec4(position, 1.0);
+  primitiveId = uint(gl_VertexID);
+  vertexIds = uvec3(primitiveId);
+  barycentric = vec3(1.0, 0.0, 0.0);
+}
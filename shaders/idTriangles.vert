@@ -0,0 +1,15 @@
+#version 440
+
+// GLSL version 4.4
+// vertex shader for ID picking of triangles, see idTriangles.geom
+
+layout(location = 0) in vec3 position; // input:  attribute with index '0' with 3 elements per vertex
+flat out uint vertexId;                // output: vertex index (as in the element buffer)
+
+uniform mat4 worldToView;            // parameter: the camera matrix
+
+void main() {
+  // Mind multiplication order for matrixes
+  gl_Position = worldToView * vec4(position, 1.0);
+  vertexId = uint(gl_VertexID);
+}
@@ -8,10 +8,14 @@ layout(location = 1) in vec3 color;    // input:  attribute with index '1' with
 out vec4 fragColor;                    // output: computed fragmentation color
 
 uniform mat4 worldToView;            // parameter: the camera matrix
+// quantized positions (16 bit integers per axis, see PointQuantization) are decoded as origin + scale*position,
+// the defaults keep float positions unchanged
+uniform vec3 positionOrigin = vec3(0.0);
+uniform vec3 positionScale = vec3(1.0);
 
 void main() {
   // Mind multiplication order for matrixes
-  gl_Position = worldToView * vec4(position, 1.0);
+  gl_Position = worldToView * vec4(positionOrigin + positionScale * position, 1.0);
   fragColor = vec4(color, 1.0);
 }
 
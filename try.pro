@@ -1,53 +1,104 @@
 QT       += core gui opengl openglwidgets widgets
-LIBS += -lopengl32 -lUser32 -lGdi32
-LIBS += "E:\CodeProjects\vcpkg\installed\x64-windows\lib\pcl_io.lib" "E:\CodeProjects\vcpkg\installed\x64-windows\lib\pcl_common.lib"
+win32: LIBS += -lopengl32 -lUser32 -lGdi32
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
 CONFIG += c++17
-INCLUDEPATH += "E:\CodeProjects\Repos\hazel\Hazel\vendor\glm\glm" "E:\CodeProjects\vcpkg\installed\x64-windows\include"
+INCLUDEPATH += "E:\CodeProjects\Repos\hazel\Hazel\vendor\glm\glm"
+unix: INCLUDEPATH += /usr/include/glm
 
 # You can make your code fail to compile if it uses deprecated APIs.
 # In order to do so, uncomment the following line.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    BackgroundLoader.cpp \
+    Benchmarks.cpp \
     BoxMesh.cpp \
     BoxObject.cpp \
+    BoxSet.cpp \
+    GpuPicker.cpp \
     GridObject.cpp \
+    HoverPicker.cpp \
+    IdPickBuffer.cpp \
+    InstancedBoxObject.cpp \
     KeyboardMouseHandler.cpp \
+    MeshBVH.cpp \
+    MeshCache.cpp \
     ObjModel.cpp \
+    ObjParser.cpp \
     OpenGLException.cpp \
     OpenGLWindow.cpp \
     PickLineObject.cpp \
     PickObject.cpp \
+    PlyReader.cpp \
+    PointCloudSequence.cpp \
+    PointCloudStreamer.cpp \
+    PointGrid.cpp \
+    PointKDTree.cpp \
+    PointOctree.cpp \
+    PointQuantization.cpp \
+    PointTileFile.cpp \
+    RayBoxKernels.cpp \
+    RayPacketKernels.cpp \
+    RayTriangleKernels.cpp \
     SceneView.cpp \
     SceneViewLeft.cpp \
+    ScreenSelection.cpp \
     ShaderProgram.cpp \
+    SimdSupport.cpp \
     TestDialog.cpp \
+    ThreadPool.cpp \
     Transform3d.cpp \
+    VertexWelder.cpp \
     main.cpp
 
 HEADERS += \
+    BackgroundLoader.h \
+    Benchmarks.h \
     BoxMesh.h \
     BoxObject.h \
+    BoxSet.h \
     Camera.h \
     DebugApplication.h \
+    GpuPicker.h \
     GridObject.h \
+    HoverPicker.h \
+    IdPickBuffer.h \
+    InstancedBoxObject.h \
     KeyboardMouseHandler.h \
+    MeshBVH.h \
+    MeshCache.h \
     Model_Camera.h \
     Model_Math.h \
     ObjModel.h \
+    ObjParser.h \
     OpenGLException.h \
     OpenGLWindow.h \
     PickLineObject.h \
     PickObject.h \
+    PlyReader.h \
+    PointCloudSequence.h \
+    PointCloudStreamer.h \
+    PointGrid.h \
+    PointKDTree.h \
+    PointOctree.h \
+    PointQuantization.h \
+    PointTileFile.h \
+    RayBoxKernels.h \
+    RayPacketKernels.h \
+    RayTriangleKernels.h \
     SceneView.h \
     SceneViewLeft.h \
+    ScreenSelection.h \
     ShaderProgram.h \
+    SimdSupport.h \
+    SpscQueue.h \
     TestDialog.h \
+    ThreadPool.h \
     Transform3d.h \
-    Vertex.h
+    Vertex.h \
+    VertexWelder.h
 
 FORMS += \
     OpenGLWindow.ui